@@ -0,0 +1,10 @@
+
+#include <immintrin.h>
+
+int main(int argc, const char* argv[])
+{
+    __m256d arst = _mm256_fmadd_pd(_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd());
+    __m256i oien = _mm256_slli_epi64(_mm256_castpd_si256(arst), 52);
+    return 0;
+}
+
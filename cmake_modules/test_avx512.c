@@ -0,0 +1,10 @@
+
+#include <immintrin.h>
+
+int main(int argc, const char* argv[])
+{
+    __m512d arst = _mm512_fmadd_pd(_mm512_setzero_pd(), _mm512_setzero_pd(), _mm512_setzero_pd());
+    __mmask8 oien = _mm512_cmp_pd_mask(arst, arst, _CMP_GT_OQ);
+    return 0;
+}
+
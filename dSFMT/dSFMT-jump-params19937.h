@@ -0,0 +1,92 @@
+/**
+ * @file dSFMT-jump-params19937.h
+ *
+ * @brief Jump polynomials for dSFMT-19937.
+ *
+ * x^(2^64) modulo the characteristic polynomial of dSFMT-19937, for
+ * dSFMT_jump(). Jumping by 2^64 steps (2^65 doubles) splits the
+ * sequence into substreams which will never overlap in practice.
+ *
+ * The characteristic polynomial used is the least common multiple of
+ * the minimal polynomials of several output bit sequences, found with
+ * the Berlekamp-Massey algorithm. It is in dSFMT-poly19937.h, and
+ * jump_test recomputes this jump from it.
+ *
+ * The new BSD License is applied to this software, see LICENSE.txt
+ */
+#ifndef DSFMT_JUMP_PARAMS19937_H
+#define DSFMT_JUMP_PARAMS19937_H
+
+#define DSFMT_JUMP_2_64 \
+    "ea0d9d40b4853cc5fa61b988bb7261fe2b7ea752e3192d09baca91574f82c6a9097acabc" \
+    "7e0aa6bf03e1b5378a463d861e2b6667556a8f851499208c5363de936106632580efd5fb" \
+    "710d01fe9094c1e79f59f73615859df276dae0ac63e4635dedf5f62e847162f5be6b7e3c" \
+    "d99825ac063781402a74d28009d8a86c75c5f6e6a9dea36ee14ede368fc865f3594f4aa4" \
+    "f59db6c8ff677b8e0c27435ba7404f8193aa76e48b8d4f1ab5a088dd30506b26d5f4233b" \
+    "2a0f78ae93f5332ca55793a6cec0c6d01f0657a692ffe417ca49dbdc83926a83eedc2c92" \
+    "70376d2d53828f454ca6a34ba6d5f84c7d7cb77e5a6e42204b13f609fec1ee55a0e9c5d3" \
+    "4091713bd671f701fb19903be0a7ef2d002474edd3a3ee5694950a97dd12ec0ed36391ef" \
+    "8cef755da3ca332144c4cc5b58c1c988eb80e44deaea67ce7a3e7489f26ea27af271e7af" \
+    "1aaa811c26a761f0c9f94a564f4359d81b49b4139127e97f290a58bdd33b95c28499b2d3" \
+    "b66b8a5e70ac6522b0fb59221b490d571789e3fb741cfb8689e4b53aac3ac7a8cd2b235e" \
+    "2730af257fd6093047ef9b836a7da75634d88d60bdab547ce20dd310380a3d89bd500113" \
+    "5fc58008e1b44bb058690ee242e6dc24ede66a31751706c3136eed48388c750233c7ff69" \
+    "4a5ac2be0f307c9dadbb7b76d7c07841bcb9ce9d9443066e1ea5e18f097bd088cd537e35" \
+    "939c10b2a9aced5d018fe1baeb02cff27f5d04450f15c02ab036ba8a42e2c86501e5db0a" \
+    "2808745e9eecb0276634302d710a862f69553006c114f8ab09fc6fda62ead86620c1c7e3" \
+    "1c053d617c5b28904428d8262e6ab659b79401149d3bd7cfe15b4c6f309ba5a0b1bd1f41" \
+    "b26fd7c82f8713ff980e159d82dcd21758395f79db6fc9c7b9cf2fc77e0deb3997560e48" \
+    "ad5ddb36b1b4ff950bfb09ee72fa4cf688891618fd8238789410ccfd412005b9e166ec4b" \
+    "e660beeb072d6cd056d7cf6f3bf02d0c2c495fc10f35f6c55108e96967ecf6a5c06f2136" \
+    "e98eb7cce1ec9897cc8616d99e97f356103841ad3cc469985a56f4554566f7fbce0ddcc3" \
+    "ad8098dc1d33ccc2c057a7847b7bb34386feb07cbda5b6e825928f2e24391caeb3e346de" \
+    "b7395ab5755cea42227c30382c7da9229989535c79875951f413b5dcdb258d6ff678ceb1" \
+    "f3abc97a801ebeafd4ba75de5d093944620679addf082f49c77eb5b307d7b2f7a05830e4" \
+    "7201c3f0125179891929ca935e3cac538976266271e042a1e20b4fab34c090019365fa96" \
+    "4887bf62309c9f1f3a419ed15ea3cf9fb7e4fd8618a330396f5f42767445fb26099feb29" \
+    "41e31f6213161dcf69c63d807e2d57ab53710b8420e2c8c061c56dd91dd166d85aae4f1e" \
+    "df183260e303126cd6074617a04d5bc91138cbb5f0bbbb15f0e08c857aaaae102b5d5337" \
+    "57b3b0df488ebcc7d20eb3654890d0dd6cd3cc2ac490dd32656e8a7cb7f2856f717da3d8" \
+    "7a9b3f2aeb309ad715d8a22c25437126d06bba9ac388683d75b1fb11fdf9971b3fb723e4" \
+    "13327c84e7bb4ad38414a3009e6ac480d29bfed73775f2fcf02761be8941bb97398f38a0" \
+    "edc0d6aa6422432b874cef97c960f32dedfc074a137b1b40e10f914158c8a2d68f1524fb" \
+    "05148900620d8a8408589edbfe20c13b8bd23d6bb40d7e2cb45af167d959c83695e9e36c" \
+    "d891cf0c4656b26315ec0b5d271890db21542809fecfc73b18db8fd41c1709b6ef765485" \
+    "c314cd49181ff3c70302f52914643d6881ca88ff15d777fd9ac65f4322e02b53a0fe06f9" \
+    "1a701065e170041d188d333542f1a7841468a781b8491d1f1c49bbd97ee894d1c202d926" \
+    "20269560a77dcad95c614b23fd02bcee273797c541aedb8644f1c77cd13d1324c09272b6" \
+    "c756a94cc75f94710ec466d3fdef0eb84ce5b8ae9072cd76303f677dff0628619ef7ea0d" \
+    "67d4a709a1b1bcef6b1b389222a824ce937d423b073735284561e6fde420bf0c81e5fea0" \
+    "95e0df42bb5213a008cdc3813b498de8039250ef37fccea6b89f4b8b5d0627ee211b9ef2" \
+    "a7589f905b845e8b092408809b773cf99bc8475d1f9b4ef81a9d67c941d6d814325f069d" \
+    "4fcebed843c99801ee795db846b2abb891d39326ccf50fbac58664f1a72b77577239e4a5" \
+    "954a95cf3a905210d417f17fb98c71d8ad10a76b8920056ec0612898a353bfdac4df2787" \
+    "cda540736ffc34ba0fc2d6d0c742e82c705074e607379d143a8c48f0bad9f3e804e9ffe3" \
+    "d6c35ac31cd004d7b63fed7b20011c5b042c85f55445896fabedc38813734483bad7e915" \
+    "736f860ca7a7895c37d9c3103a3f2d572712716917365c038a9bf5d9fa6e4ac6124159d0" \
+    "62cdc9309cb54fa2cc648eecdb24f14f05391ff97d27f13a2a63328037d100618829ba9b" \
+    "541903d914e2f430b74a8907903a8e11ca7d3786fd043fefb5e099346adc2ae9fa0fe69c" \
+    "ad956e319f0cd11be7ba97ea06b6546d077cbf484396d33a7e5f99631d92f225366b33ec" \
+    "581649b1056571446597b709d99d07c1f1c32885d7aeed7613dacb3c072358dd1f5048ee" \
+    "f29f46af4341a38aff637e61da4504f681eb6831fa4689646a5399d9212949dbafb27989" \
+    "6bb7d0f04fbb22a62850f8d0fb4cfbe1f2fda0a74eeca2729ae0508946a4d22a151ecef5" \
+    "d15579cbdce74dbd0ab6efd0873b159a7536198a1a619eecc3090d64be98dd51dcb3cb6a" \
+    "c1b97fe326bdea21a2eab3de00ca810b3fcf6225b1a84a3e99e1838f42a21b2ed27ac141" \
+    "91d1845fa327efd00bec9b94a2110fd4d1e73e4e4465e91ef572b7c4402db4cb9e217d95" \
+    "14abd0fbc938176b9ddd59d1bbbf5586f0d8f7fc325be23c718838a3320aa88c09af50d8" \
+    "14a8c14bad023ecd7d5c1e562b855f08bf332d46deac5939358336e8a2b1fd27ede0bb0b" \
+    "0f28f150314cfa7a7fb2f0c780b96e0827160c9a2dee7b6b49d56e6fa61e63dfd3fd5884" \
+    "7f45ae609ac0ea106c02e653ccf59d6f75d8b9661d95fffef857ee0be98dd0fdebb77bd8" \
+    "37a7d4c2fe0fdde9f47db17ba3b087f1d417ffd0b22cd637590290481c3b6c8e4380cefa" \
+    "9a92c9d5b057f8217ad0a94e715519cef58c16590b2667b7d5420834051061ec17180743" \
+    "c8365d597b5603da8c2868f0b2865582c4eefd2598082e26b519554fd51c8421598dd79d" \
+    "3fc709c86ad9a03b11903749c242b572e19c802793ff382a47398619b46c9f927f4c1b18" \
+    "cc4298fbca081cbdccfe277b8c3ef48f13257aa35cdb93f727fecb3e7c3d6096bf4f129e" \
+    "a32c94d66f0828d041046b6c4c7ab76a6378272d277de71b536e172e9b70b9866ea1cf68" \
+    "8a8840d7d777ff46e48b0b6ef3e652227c88b6972c28028a08419176feebeb6bf7073a56" \
+    "a17a984bd7d453fa0823775b6be6483756740ef847318b53eb10133f8a6d747f24f1f0a6" \
+    "7d394b2ae02c0d69de855092fb7fc3fae917102c4b48793d9759206fc5bc2cbf7fc72815" \
+    "85970a27e3e7011f1c2c3c6450822f63b90040575f0c47672bf1c4ed0139958b42b24a3b" \
+    "0507def712e94f24dc3c5c67fe9ad"
+
+#endif /* DSFMT_JUMP_PARAMS19937_H */
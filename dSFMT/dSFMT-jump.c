@@ -0,0 +1,109 @@
+/**
+ * @file dSFMT-jump.c
+ *
+ * @brief Jump ahead function for dSFMT.
+ *
+ * The state is advanced one 128-bit word at a time, and the states
+ * for the nonzero coefficients of the jump polynomial are added
+ * together, which is the state after the jump.
+ *
+ * The new BSD License is applied to this software, see LICENSE.txt
+ */
+#include <string.h>
+#include "dSFMT-params.h"
+#include "dSFMT-jump.h"
+
+/* The plain C recursion; the SIMD versions in dSFMT.c compute the
+ * same thing */
+static void jump_recursion(w128_t *r, w128_t *a, w128_t *b, w128_t *lung)
+{
+    uint64_t t0, t1, L0, L1;
+
+    t0 = a->u[0];
+    t1 = a->u[1];
+    L0 = lung->u[0];
+    L1 = lung->u[1];
+    lung->u[0] = (t0 << DSFMT_SL1) ^ (L1 >> 32) ^ (L1 << 32) ^ b->u[0];
+    lung->u[1] = (t1 << DSFMT_SL1) ^ (L0 >> 32) ^ (L0 << 32) ^ b->u[1];
+    r->u[0] = (lung->u[0] >> DSFMT_SR) ^ (lung->u[0] & DSFMT_MSK1) ^ t0;
+    r->u[1] = (lung->u[1] >> DSFMT_SR) ^ (lung->u[1] & DSFMT_MSK2) ^ t1;
+}
+
+/* Advance the state by one word. idx is the index of the next word
+ * to replace, in doubles */
+static void next_state(dsfmt_t *dsfmt)
+{
+    int idx = (dsfmt->idx / 2) % DSFMT_N;
+
+    jump_recursion(&dsfmt->status[idx],
+                   &dsfmt->status[idx],
+                   &dsfmt->status[(idx + DSFMT_POS1) % DSFMT_N],
+                   &dsfmt->status[DSFMT_N]);
+    dsfmt->idx = (dsfmt->idx + 2) % DSFMT_N64;
+}
+
+/* dest += src, lining up the words by their positions */
+static void add_state(dsfmt_t *dest, const dsfmt_t *src)
+{
+    int dp = dest->idx / 2;
+    int sp = src->idx / 2;
+    int diff = (sp - dp + DSFMT_N) % DSFMT_N;
+    int i, p;
+
+    for (i = 0; i < DSFMT_N; i++) {
+        p = i + diff;
+        if (p >= DSFMT_N) {
+            p -= DSFMT_N;
+        }
+        dest->status[i].u[0] ^= src->status[p].u[0];
+        dest->status[i].u[1] ^= src->status[p].u[1];
+    }
+    dest->status[DSFMT_N].u[0] ^= src->status[DSFMT_N].u[0];
+    dest->status[DSFMT_N].u[1] ^= src->status[DSFMT_N].u[1];
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return 0;
+}
+
+/**
+ * This function jumps the state ahead by the number of steps the
+ * jump polynomial was calculated for. Numbers already generated but
+ * not yet used are skipped the same way, so the outputs continue as
+ * if that many words had been generated.
+ * @param dsfmt dsfmt state (I/O)
+ * @param jump_string jump polynomial
+ */
+void dSFMT_jump(dsfmt_t *dsfmt, const char *jump_string)
+{
+    dsfmt_t work;
+    int index = dsfmt->idx;
+    int bits, i, j;
+
+    memset(&work, 0, sizeof(dsfmt_t));
+    dsfmt->idx = DSFMT_N64;
+
+    for (i = 0; jump_string[i] != '\0'; i++) {
+        bits = hex_value(jump_string[i]);
+        for (j = 0; j < 4; j++) {
+            if ((bits & 1) != 0) {
+                add_state(&work, dsfmt);
+            }
+            next_state(dsfmt);
+            bits >>= 1;
+        }
+    }
+
+    *dsfmt = work;
+    dsfmt->idx = index;
+}
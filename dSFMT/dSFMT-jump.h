@@ -0,0 +1,33 @@
+/**
+ * @file dSFMT-jump.h
+ *
+ * @brief Jump ahead function for dSFMT.
+ *
+ * The jump polynomial for a number of steps is x^steps modulo the
+ * characteristic polynomial of the generator, as a string of hex
+ * digits with the lowest order coefficients first and the lowest bit
+ * of each digit the lowest coefficient. One step is one 128-bit word,
+ * or 2 doubles.
+ *
+ * The new BSD License is applied to this software, see LICENSE.txt
+ */
+#ifndef DSFMT_JUMP_H
+#define DSFMT_JUMP_H
+
+#include "dSFMT.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+void dSFMT_jump(dsfmt_t *dsfmt, const char *jump_string);
+
+#if DSFMT_MEXP == 19937
+  #include "dSFMT-jump-params19937.h"
+#endif
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* DSFMT_JUMP_H */
@@ -0,0 +1,93 @@
+/**
+ * @file dSFMT-poly19937.h
+ *
+ * @brief Characteristic polynomial of dSFMT-19937.
+ *
+ * The polynomial the jump polynomials in dSFMT-jump-params19937.h
+ * were reduced by. It is the least common multiple of the minimal
+ * polynomials of several output bit sequences, each found with the
+ * Berlekamp-Massey algorithm, and has degree 19993.
+ *
+ * The string has the same layout as a jump string: the lowest bit of
+ * the first hex digit is the constant coefficient.
+ *
+ * The new BSD License is applied to this software, see LICENSE.txt
+ */
+#ifndef DSFMT_POLY19937_H
+#define DSFMT_POLY19937_H
+
+#define DSFMT_CHARPOLY_DEGREE 19993
+
+#define DSFMT_CHARPOLY \
+    "30cff330fccf33ccc0fcffcf3cfc37ccc1e70870e789f10681068f100ef21403ff0ff003" \
+    "fc0fcc3ccc000f3383e4616d3ff240166709e3e708ff1eb000c3c2cc47c10128c2ae8081" \
+    "5fb2396b442e0941e7af2913434c2f8c433fcccf0033c033f3c3f3cc0f00fc3c051be39e" \
+    "73c340c7460e9189f1efab18a0450ce109d28e54f9d8793cd72367f19113816ab79e8f05" \
+    "29e83acfc40d3373f4de8470fcccd0fc3fdc6026dbd52bc62fd86d76e15a3db12fbd6d19" \
+    "549bbed9f903abac3ee175f80d4e959fca95ddf13d1ad95fda2b8831641ba95af3dc1ec3" \
+    "aa5d7c078a1793244379031d47674a69bc0f2d35cb221e2a2baea95ab2b2e5a0030ff76c" \
+    "774443685caabecef74292bca22a39bb9a304e08d3ece8a08f62e03a2ba99b84b6db0b0b" \
+    "30fc2237dbf57a43778962b7375488f08952dc8efa9cfd6f650bcefab55a07df5edc7204" \
+    "7eba31353460817167cd66e7f3e6a305412672bf1055673579d1ba97cb5e1d53d7ddc2ff" \
+    "a7ca8546fa88cb20882f0c4d7255401611c7e4a13ee82c1ce49eb18c47156ceaf852358a" \
+    "a664c778290ef1b32c476cfc3bca20b7cd64b80b76cd5cf67d7fa1161bc41be716f16f2a" \
+    "bd1b0b2c9c4c610a423a2fa45fb06c20096b26a8c72c3125588090d854e51a1be7135ddd" \
+    "bfb5185b914a502a197dbdde86fede0eabffa076b82c35f135d47b57a5d2983f8acdcd8a" \
+    "fb807e3323630ad258aa3c37ebc8f52ed0c7ea6495f899279d8bb1d55097f1b7db5fddb8" \
+    "8d8655aa31bd7ab085a994a1bf5cabe0158bd8c3846d06ab890f348540c24e51f3a96c65" \
+    "42e9fde14ca664dced441434fa0400fbfb59ca3af3ca8a10a4a27593f0d5a4ca1d681eba" \
+    "900878f3cd5a63a663217e9258ebbab152ccf7172480456cd5e7129874d0b9cb0dee7053" \
+    "4e5557268d114ebf67b641fe13d10bdbc180a9619c3b0de8f2b4ffee05687e2190804471" \
+    "0369ba25852de7689434f3a44a4389d71a88c35ac742f6d6fce31d66c67a7062d8b840ff" \
+    "b898dcfcfec223771f508dffa7573764bc1ff4c7706cfe1f0437b524b57ab05788861b23" \
+    "2a533d8d68f635f9a08092935a3d76f84114583ab7aea46fc86c6c27f25cf5c90dfa3700" \
+    "b90d8fd4b43f147063e6be9ea7f2ce9bdbf590600c21f541cc80f1341a868c5f7cb5a3e8" \
+    "8541f4431c54aa7a3f1fc2a751889a1c89f617ff804641de80e576baae0f6244bc34843a" \
+    "19c55f3cce72415b386892ae1146198f652691e902d6da4aa4f43c79731593c2c71d4274" \
+    "8d704391b70474840876b194a2683ad26dc8676dc3112b34f7ab8862b0d13727ae9b00f6" \
+    "479500613855ffd879466fd7a89a26d90ec9ca2b95f092adb765ef97b2c13423f15381c9" \
+    "3d650a29b093157c0986737fa8115604a854b882e698d11d43b4f9158619bad3aff47966" \
+    "f04a677b994f29501be569f22bc5eeaf7ad0e23797f785ae9c160867627287f2a5595992" \
+    "44596df4d879babc65f233a56107d5fb26c971fe2105814d0e3c63eeda096f195a6a61be" \
+    "cc8eada6c96241b3f2ac436e6b96b24fd4635606fec7f41bd2406e2420fa9c8c8fbc2196" \
+    "f1a870153e428a029798a85509b457a008615130ff733885a16a2e629539355f004f96a8" \
+    "63aa628f066525aeab780a1df2c4a19e8c0ab6bf29d69eaca9ba252f76c07c885fa307b9" \
+    "df0e330b5d0bfa5b68aa5ca45f1b23499daf1889efabd264dcc7da9047c1468942b73380" \
+    "33b519410c6d07b5ad66f8bc0249796e15984ab8ed479da3aaa08cd791f9e19bf5bb6ece" \
+    "cc6c33cadf4c7228e1f1bf1b71a8ae068f6f0c6c81e90745760a2d562270173483befd8e" \
+    "6d881bd0c83d9ab5d558691b292d2a42c5530a7cd0b6599c10086b52da31eb77712fcff5" \
+    "4f4ee0559f6e6d8b4c9755c2a9f423f420dba081d26b6433406b49d9c678b32e2cc8f6e2" \
+    "e2c332a9bef59b3b014630ebee319687b132c239d3fa8f64c989e213a1dbe527d8330a20" \
+    "5327750eff985565707e8edc9fce6c6fe08d58d2e8ba48ea80799fa248a8c31c35995c68" \
+    "ced0d2362ecfe42898e4d6f1135f7f0f121801038590f9a8f5fed5e639bedd92020fd311" \
+    "af690de3253483eba7612a2d2d494a803735b1ae5b5b11e7c201aa1128b6a0ac07cf66ee" \
+    "2e3b7a8986a4ea1c4cb97d56b23e95c7bd32fe77f7cffc569fd8f1ca4935870a4c5c7288" \
+    "5ad85d05d086a601b8103c62671f1135bde500e863351527b2b94e9d5ae49e0ce1acf2ca" \
+    "de87052c20d59d6f286d257215328d038b855d5253aead441fea63ab36ca1b89f0fc782f" \
+    "9b7489439fe3cefe6e863a7cbca131bb56701623c58c4852dfaa90e2bedd61562e4b3ca8" \
+    "87c267de0d30ffcb3079a3247a758d82c7cb6077aecb102c154f77f9ad82653cc22c6d37" \
+    "f127411852d592034e650545dd795e8fc6e467149de4c160a498ee8c670141c01fb936fd" \
+    "b77f76c78d11e7ce30f780ef7c7310776ae5d4e71992d2accaa47d08746d78d1104e491c" \
+    "103d33cbbf8ccb6c26e817288dca294957c72e47bbf43de864646fe2679d2f3a3b2f257f" \
+    "25a2c82a243e3cf374547f87400ec85fe106dc0cb28794d4c321040f1d0b20695b618bea" \
+    "342973002d25627d36d0f19b617ac41430cafca1423f25130cc20035553cff2ce8993a7b" \
+    "1c69b1de0f4dc59fe41a065ad4c1bdc44e96c9f54fd5dda38c684066ac6c424f01310ac4" \
+    "c4d771998b6ec87c6af82f03f733fa3d81516d5b865a82de387ddfe03485cfe76a309016" \
+    "f20509690076597bff2ff0462c354cec3cfb0afb4028a0bbabd296e56d84a5c9ac3eccb1" \
+    "f924bbe22df054c0103a85f246e6cea1c6f44d118590cf85be8934ba614d1db9de87f7fc" \
+    "323cf4691875c4259cd028b14bffde17ade24c13b24f963af98cee01e400bc5e3bee6e88" \
+    "9fd06b6f342371fc91f9cd00b695c847ad933c15d4206c40151aac1993669a719b7767f6" \
+    "3a6df0d01fed529c297daf011a67a89a250455163fc232cb505844813e7faa03858748e4" \
+    "3e594e8d9b80bede2d93b8788b2087235069aed0271a5da7a2a804af2ed5325918c76ccb" \
+    "85b242f3e15147fb7cd9021a6991bdc3e4ded73a71ef3e7b00dff744b6007c78d98fc5df" \
+    "4b1f22db8663a0850475890f0678fcb4ba4489203574b25b6ecd619387d8cf43d7f8d348" \
+    "d3d303befdfc0bfd4df3a99fc50f3ab815f34aee377c8d9e70e8afb087573c776663bc4c" \
+    "a5677bd6e22100d2d51608a2f75ffa247e584972354e3e0a421aa57ec5531843bcdf600f" \
+    "a71f7bcf9b335fcc57c3900314fc2b93cb9fc8ec0753cf1038106fac9423a7ccd31220d1" \
+    "14d5e3e1d8a67c5e47598f9e38fb31fc3ff3c44b403007bb4cc3e86b53102664a3e3d31c" \
+    "1cc4fc3bfffbef24202710e8df2be3e4ec0c030b73c88f04433bfff7bcc470fb8f044cc3" \
+    "c334cbcb34f48807c807c807c8073bc80700f008884bbb478b4b784b784bb7b48b748770" \
+    "ff0010ff00f3f3ffcfcfcfcfcfcfc3c3cf0fe0f0f0f0f0fccccc3333333333333fffffcf" \
+    "ffffffffffff0000000000000000003"
+
+#endif /* DSFMT_POLY19937_H */
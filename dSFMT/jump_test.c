@@ -0,0 +1,295 @@
+/**
+ * @file jump_test.c
+ *
+ * @brief Check dSFMT_jump() against stepping the generator.
+ *
+ * Jumps shorter than the degree of the characteristic polynomial are
+ * x^steps itself, so they check the jump arithmetic without depending
+ * on the polynomial. Longer jumps are recomputed here from the
+ * polynomial in dSFMT-poly19937.h by repeated squaring: x^(2^20) is
+ * checked against stepping, which checks the polynomial, and both it
+ * and x^(2^64) are compared with the strings shipped for them.
+ *
+ * The new BSD License is applied to this software, see LICENSE.txt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dSFMT-jump.h"
+#include "dSFMT-jump-params19937.h"
+#include "dSFMT-poly19937.h"
+
+#define NUM_COMPARE 1000
+
+/* x^(2^20) modulo the characteristic polynomial of dSFMT-19937 */
+#define DSFMT_JUMP_2_20 \
+    "78550e903b97f6e80db6e741013c48d09c7937b44da4f74a423def0aca92cfcfdd664c60" \
+    "07a9a636472295671b0a969c59189ef15bdb15818cc53d5288b691b127212720d101763d" \
+    "ccd6e36c2fe6fc8402882bbe683333a97746b4f5965282ace3a9f83559b3735b6c4f7c70" \
+    "aeb240234e7caa5f215b7cfa617245b67ed74c486c04d01d61069a537838feaacd781cfb" \
+    "0b91c050ebc2a8199d8b856303db3b7d7d92965a4e4f2b06c68813182336af7cb93f3449" \
+    "94f7b166b77c1144a0ad41e85cb88177af9e6db5176057994a0603fbd4085363629ece12" \
+    "25ebf4c368fbb96679536e973b1c4ca0a0014034a306cd25282879ca5a0645de0108f225" \
+    "090b8769c4a83663d066584e12876e3fae73b205fc74380c04acdfb65cff84b3fc65942b" \
+    "6cf4d9dcf5216d6208db1994990f299c5e6dc77adb081b3ad4f34e4198873a42defd91c7" \
+    "a073dc39fa4af9b2d68296bf76704214a3e63b65ea67e70a170d3e187144fa0a43c0275c" \
+    "d4d897c92e6d0cf9476c71a236185d578dfc0de8be334f424e31882a948dbc11a53fa3d5" \
+    "89cc3d024e4605c8de6f961bf426daefee4ef84eb9cee6c2c2b1df3031c7fad1e120702d" \
+    "12a39c907b2810471b29639b53653b193a01c2987c25ea672716656aa8fdcf9165b2ebce" \
+    "15844dadc116778755f2a2b1c44af146ec7bf261f47f2b037b99309245f22042b822c6e5" \
+    "005f838dca614da428b6cfd56519d738d19e4118da8ddbf28cff3493f52cbd093414718c" \
+    "7190a8ca23dea00622d1af48a9528926b7c1295c9f21e6cc77a0c93397a135143d8bbcd9" \
+    "44cf16c6ef4940f977bfdf26287a64cb2fa5042fc9b6ff0b73543c8a40576cfa702a836e" \
+    "ad7b1560e126bdac5ddce40624975d10b6c7d4dce0358705a799e5c61e1442f36eca4389" \
+    "935e3c9fa3cfb5061970622db6bf350c1066b6650e9c748589a8e835b800e23f69ca913c" \
+    "29c2710f93391996f5f97b7bc1e33d331df88698baf1ae579e14c08010902ab7e58a2ff0" \
+    "3bc8b1e8d721e8f2aa6adee631f7fe73649151b56d5d3482f8ac6b22d6ea1244ee7dc4ad" \
+    "232b1e8ebfb194e0ee296c0c28c49a80937544c2cd4f53311b71de419d7b7b50e80ab885" \
+    "d6a8d53168339f38f68537a39fdc8435594e768c82953777913a8731eee964c3778aab06" \
+    "90668250027b6ee5124c704bdb386d081defc244128791e089cf67b18a32263cb7d3b29c" \
+    "4c71e4c74205255e61e03294c1eb4527792eec9bc688be5e1a9eee4cf2fbf7c089e2a173" \
+    "d9d7a6fa5337d93a26262343be0a531b028b203c081efe6cbb79f2bde3dfbf64bd63a1da" \
+    "973559225ae09d0f9ad624b7cb098a05aa77e86320ad3eb8dff8378a0fd998046cbd9c5d" \
+    "8b88354948f46b0e27aa4f42f743bed6b0184f453494b8e5b1a5d233acb37b8a6207d1b4" \
+    "673142bf94881daaf70cdd8d5c95628dd508009e0fcb5fad43aa368e6fba87b0e4453a0f" \
+    "49de1a32d06d95cb499a3da2a0df2296799171c8411038933ccc341cd2f88c0541dcb645" \
+    "704b60a5c4ccb0eeb49953a66f1d38eba2ad930d15520b61fc78cf38b09dbae79fe65e43" \
+    "6375048373e4c49837d0e18a24f7831e9e887cbca138f8e44d6d2ebc5eeea15b255950a5" \
+    "86340538a822c453e18023109ae3ca892280d032df24177433656244160be0bf5a329508" \
+    "3d90b3d2b11445bafc1cea276569ad6493326d71960167b7683dd6c05738780a6030a981" \
+    "129b9037eaee0b9f3e8a9d8f69cad5574053f77bb870ab424c817425921fe43a5226bd01" \
+    "9ae41a4168917aab279a801ff3e205e59bfce076e92eb74bbfd348c8967f6d99f8d05140" \
+    "2fcfb0ad18517337d51b73e3b46ee6a386b6ccae0924f5553ae13bca27bcaf9ef72b8151" \
+    "6257473617c740b5d5fc6ea67b1f746bea3525ecdd900fd315414257882abb23fb57fba2" \
+    "a29328e5dcbe5ef21e534efc2bbe5881efdaa860b253a987842f0b3181249d43971f1260" \
+    "353bdccd2a5d9277f0db0002a4a3481a19831d164bf06694a7ad7ca3322ea09f3bca5a48" \
+    "ecf7e65a647257e6ccbfec525bed6d923b89a6bbbf50afe64d63693f19347e3c8a00b0f6" \
+    "af29a70ccddc776f985fac87010428050b0c378cbea5d01b98e5487f95463d66aef68375" \
+    "96f1fb8ce23bb87ad56502eb91a4b8177dc78e21c80f9c8a2235db658b0961c98c69f3f9" \
+    "8f0afa3098334757fd4d5753e23f045d55b2ecc86ceaf396f43bff71497438703a0bb12c" \
+    "cce3b9131d5f508dbd4f079d08429407322ecd9ffcff27aa7961ddc79629c0469f544e8c" \
+    "eae0df8bd0f72f0a9fd896b0587beb6aae9a0c46c53fd3002d6a22070da2bfefabef839e" \
+    "1c4d875610ed471b555513050459aa4145e8200a01e890bb813d0619a927586d274e440c" \
+    "074db37d5ffaaa35dadf9039bee831d8b33b5552b5622b1b227ca5b4ad456773adc462bf" \
+    "5bd667d81234d585cc62c5400060d5e1c94c43ac47e7e2b908623841690bb2287acb6d11" \
+    "b9fb2a457766319ac4e18136777dafdd3a68dd306763d3ea9571f6dc9a86adca5403d49d" \
+    "482181dd554c8677e4ef59a99b3f54a9d92a660383e598325984fe8925de7701ece1696b" \
+    "8b98398e09d95720c3ba64fd5842ac3e0fc9c409bff13cde8bc82dc8d3c7c1169f855208" \
+    "1c985cacd6ddb3ca4037c4d46fe5990999f96cd5248c8950aeb4cb802ccca3ccbcf9dff7" \
+    "71d4b82df2afc3467ff4c5186afaade996862e8852d7beda6ee20a782f7b709dca825c7d" \
+    "d9bd92efbc585dd8990160a88ca4c9fe72f6a1bd8b7d2671f5648dbe540e94a01883595b" \
+    "1c2efe7f9ae38c75f19b0ec53761135c6a0f39718db45c13dd57340d417a99e047b8fe48" \
+    "189cef7ce66b87bbabf882b5587094b4f04db91e95d4c7d3c8993d38452b04468bea2e82" \
+    "bb2e5186f60a68b10bdb5ad6fd6e4b627370c0f364124f031eb328fdb16c62f8ec6b9ca3" \
+    "3672d0b96ccfa6bf97be31b1c28e2d37e38321fde7bd0d9505d7bf14ad54707aff5b034f" \
+    "aefbe339ee3562aa2ff95b0284d474c114f6fd66278b9e6e4bce2de4823791b5634561f6" \
+    "239952b23625d9c61165a366c6176dbe80c875833030208844c2671141512cf0f9265a17" \
+    "34f2cb5227691676f4c451cc32fc8c183c96fc690aa4538041bb409c3ae187ea36566808" \
+    "de9320cd89715b68e18fefbc088a516a1d89e3ba62a8aaced8e0ceebfad7cf2edeb8004b" \
+    "64b75ced7f62070aaa9b12e5def559fcbdb367febb470cf419a7b7cf3504ed975d6e72a3" \
+    "71b8af1db13e583c4c5ba66c814c399a77bcdcc0e350d92c23e05dfaf1cf6c6ab6cb4ddb" \
+    "4ce591511b9bc12d02b176c2bfcb4e42ae47ef11c35b112a3b7a37c73ab60174a58acb55" \
+    "f9c691832f7a52d0c104e34d3d5e1fc40981a780e5d4ad23cdd1002f4107f99ff2a61555" \
+    "9b1338b01a916484b67b47d4d1cc9b066849b84c5fca82920b85f12d065d39cfc6625ff0" \
+    "646eb4cd9c66507cc732e8347158bb7c2f51704bfe6514eea240b28354e26967f60f9d36" \
+    "201a21381fb64a6e4b9970c7470cb21"
+
+/* Polynomials over GF(2) of degree below 2 * DSFMT_CHARPOLY_DEGREE,
+ * bit i of the words being the coefficient of x^i */
+#define POLY_WORDS ((2 * DSFMT_CHARPOLY_DEGREE) / 64 + 1)
+
+typedef struct {
+    uint64_t w[POLY_WORDS];
+} poly_t;
+
+static int poly_degree(const poly_t *p)
+{
+    int i;
+
+    for (i = POLY_WORDS - 1; i >= 0; i--) {
+	if (p->w[i] != 0) {
+	    int d = 63;
+	    while ((p->w[i] >> d) == 0) {
+		d--;
+	    }
+	    return 64 * i + d;
+	}
+    }
+    return -1;
+}
+
+/* Read a polynomial in jump string layout */
+static void poly_from_string(poly_t *p, const char *str)
+{
+    int i;
+
+    memset(p, 0, sizeof(*p));
+    for (i = 0; str[i] != '\0'; i++) {
+	char c = str[i];
+	uint64_t bits = (c >= '0' && c <= '9') ? c - '0' : c - 'a' + 10;
+	p->w[(4 * i) / 64] |= bits << ((4 * i) % 64);
+    }
+}
+
+/* Write a polynomial in jump string layout, without trailing zeros */
+static char *poly_to_string(const poly_t *p)
+{
+    int len = poly_degree(p) / 4 + 1;
+    char *str = (char *)malloc(len + 1);
+    int i;
+
+    for (i = 0; i < len; i++) {
+	str[i] = "0123456789abcdef"[(p->w[(4 * i) / 64] >> ((4 * i) % 64)) & 0xf];
+    }
+    str[len] = '\0';
+    return str;
+}
+
+/* p = p^2 mod q. Squaring over GF(2) spreads the coefficients out to
+ * the even powers, then the result is reduced one term at a time. */
+static void poly_square_mod(poly_t *p, const poly_t *q, int qdeg)
+{
+    poly_t r;
+    int i, j, d;
+
+    memset(&r, 0, sizeof(r));
+    for (i = 0; i < DSFMT_CHARPOLY_DEGREE; i++) {
+	if ((p->w[i / 64] >> (i % 64)) & 1) {
+	    r.w[(2 * i) / 64] |= UINT64_C(1) << ((2 * i) % 64);
+	}
+    }
+
+    for (d = poly_degree(&r); d >= qdeg; d--) {
+	int shift = d - qdeg;
+	int ws = shift / 64;
+	int bs = shift % 64;
+	if (((r.w[d / 64] >> (d % 64)) & 1) == 0) {
+	    continue;
+	}
+	for (j = 0; j <= qdeg / 64; j++) {
+	    r.w[j + ws] ^= q->w[j] << bs;
+	    if (bs != 0 && j + ws + 1 < POLY_WORDS) {
+		r.w[j + ws + 1] ^= q->w[j] >> (64 - bs);
+	    }
+	}
+    }
+    *p = r;
+}
+
+/* x^(2^log_steps) modulo the characteristic polynomial */
+static char *power_jump(int log_steps)
+{
+    static poly_t q, p;
+    int i, qdeg;
+
+    poly_from_string(&q, DSFMT_CHARPOLY);
+    qdeg = poly_degree(&q);
+
+    memset(&p, 0, sizeof(p));
+    p.w[0] = 2;
+    for (i = 0; i < log_steps; i++) {
+	poly_square_mod(&p, &q, qdeg);
+    }
+    return poly_to_string(&p);
+}
+
+/* Compare jump strings, ignoring trailing zeros */
+static int check_string(const char *name, const char *computed,
+			const char *shipped)
+{
+    size_t n = strlen(computed);
+    size_t m = strlen(shipped);
+
+    while (m > 0 && shipped[m - 1] == '0') {
+	m--;
+    }
+    if (n != m || memcmp(computed, shipped, n) != 0) {
+	printf("%s computed from the characteristic polynomial differs"
+	       " from the shipped string\n", name);
+	return 1;
+    }
+    return 0;
+}
+
+/* Write x^steps as a jump string. Only valid below the degree of
+ * the characteristic polynomial, where no reduction is needed. */
+static char *monomial_jump(int steps)
+{
+    int len = steps / 4 + 1;
+    char *str = (char *)malloc(len + 1);
+    memset(str, '0', len);
+    str[len] = '\0';
+    str[steps / 4] = "1248"[steps % 4];
+    return str;
+}
+
+/* Jump one generator and step a copy, from a point offset doubles
+ * into the sequence, then compare what follows. */
+static int check_jump(const char *name, const char *jump, long steps,
+		      uint32_t seed, int offset)
+{
+    dsfmt_t jumped, stepped;
+    long i;
+    int j;
+
+    dsfmt_init_gen_rand(&jumped, seed);
+    for (j = 0; j < offset; j++) {
+	dsfmt_genrand_close_open(&jumped);
+    }
+    stepped = jumped;
+
+    dSFMT_jump(&jumped, jump);
+    for (i = 0; i < 2 * steps; i++) {
+	dsfmt_genrand_close_open(&stepped);
+    }
+
+    for (j = 0; j < NUM_COMPARE; j++) {
+	double a = dsfmt_genrand_close_open(&jumped);
+	double b = dsfmt_genrand_close_open(&stepped);
+	if (memcmp(&a, &b, sizeof(a)) != 0) {
+	    printf("%s from seed %u offset %d: output %d differs"
+		   " (%.17g != %.17g)\n", name, seed, offset, j, a, b);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const int steps[] = { 1, 2, 7, 96, 191, 192, 1000, 5000, 19000 };
+    static const int offsets[] = { 0, 1, 2, 191, DSFMT_N64 - 1, DSFMT_N64, 1001 };
+    static const uint32_t seeds[] = { 4357, 34086 };
+    char name[64];
+    char *jump;
+    int failed = 0;
+    size_t i, j, k;
+
+    for (i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+	jump = monomial_jump(steps[i]);
+	sprintf(name, "x^%d", steps[i]);
+	for (j = 0; j < sizeof(seeds) / sizeof(seeds[0]); j++) {
+	    for (k = 0; k < sizeof(offsets) / sizeof(offsets[0]); k++) {
+		failed += check_jump(name, jump, steps[i], seeds[j], offsets[k]);
+	    }
+	}
+	free(jump);
+    }
+
+    jump = power_jump(20);
+    failed += check_string("x^(2^20)", jump, DSFMT_JUMP_2_20);
+    for (j = 0; j < sizeof(seeds) / sizeof(seeds[0]); j++) {
+	failed += check_jump("x^(2^20)", jump, 1L << 20, seeds[j], 3);
+    }
+    free(jump);
+
+    jump = power_jump(64);
+    failed += check_string("x^(2^64)", jump, DSFMT_JUMP_2_64);
+    free(jump);
+
+    if (failed) {
+	printf("%d jump checks failed\n", failed);
+	return 1;
+    }
+    return 0;
+}
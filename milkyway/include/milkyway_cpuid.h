@@ -33,8 +33,16 @@ int mwHasSSE41(const int abcd[4]);
 int mwHasSSE3(const int abcd[4]);
 int mwHasSSE2(const int abcd[4]);
 int mwHasAVX(const int abcd[4]);
+int mwHasFMA(const int abcd[4]);
+
+/* Fills abcd7 with leaf 7 (structured extended features), or zeros
+ * if the CPU doesn't have it. The following test its results. */
+void mw_cpuid_ext_features(int abcd7[4]);
+int mwHasAVX2(const int abcd7[4]);
+int mwHasAVX512F(const int abcd7[4]);
 
 int mwOSHasAVXSupport(void);
+int mwOSHasAVX512Support(void);
 
 #ifdef __cplusplus
 }
@@ -84,6 +84,9 @@ typedef struct
     int forceSSE3;
     int forceSSE41;
     int forceAVX;
+    int forceAVX2;
+    int forceAVX512;
+    double integralTolerance;  /* Relative error for adaptive integration, 0 for the full grid */
     int verbose;
     int enableProfiling;
 } CLRequest;
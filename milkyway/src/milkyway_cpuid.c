@@ -26,6 +26,11 @@
   #include <sys/sysctl.h>
 #endif
 
+#if defined(_MSC_VER) && MW_IS_X86
+  #include <intrin.h>
+  #include <immintrin.h>
+#endif
+
 #define bit_CMPXCHG8B (1 << 8)
 #define bit_CMOV (1 << 15)
 #define bit_MMX (1 << 23)
@@ -34,6 +39,14 @@
 #define bit_SSE3 (1 << 0)
 #define bit_SSE41 (1 << 19)
 #define bit_AVX (1 << 28)
+#define bit_FMA (1 << 12)
+#define bit_OSXSAVE (1 << 27)
+#define bit_AVX2 (1 << 5)        /* Leaf 7 ebx */
+#define bit_AVX512F (1 << 16)    /* Leaf 7 ebx */
+
+/* XCR0 state which must be enabled by the OS: SSE, AVX and the
+ * AVX-512 opmask, upper ZMM0-15 and ZMM16-31 */
+#define XCR0_AVX512_STATE 0xe6
 #define bit_CMPXCHG16B (1 << 13)
 #define bit_3DNOW (1 << 31)
 #define bit_3DNOWP (1 << 30)
@@ -72,9 +85,9 @@ void mw_cpuid(int abcd[4], int a, int c)
 {
     abcd[0] = abcd[1] = abcd[2] = abcd[3] = 0;
     __cpuid(abcd, 0);
-    if (abcd[0] >= 1) /* Is this really necessary? */
+    if (abcd[0] >= a) /* Is this really necessary? */
     {
-        __cpuid(abcd, a);
+        __cpuidex(abcd, a, c);
     }
     else
     {
@@ -99,6 +112,37 @@ int mwHasAVX(const int abcd[4])
     return !!(abcd[2] & bit_AVX);
 }
 
+int mwHasFMA(const int abcd[4])
+{
+    return !!(abcd[2] & bit_FMA);
+}
+
+int mwHasAVX2(const int abcd7[4])
+{
+    return !!(abcd7[1] & bit_AVX2);
+}
+
+int mwHasAVX512F(const int abcd7[4])
+{
+    return !!(abcd7[1] & bit_AVX512F);
+}
+
+/* Leaf 7 if the CPU has it, otherwise zeros */
+void mw_cpuid_ext_features(int abcd7[4])
+{
+    int abcd[4];
+
+    mw_cpuid(abcd, 0, 0);
+    if (abcd[0] >= 7)
+    {
+        mw_cpuid(abcd7, 7, 0);
+    }
+    else
+    {
+        abcd7[0] = abcd7[1] = abcd7[2] = abcd7[3] = 0;
+    }
+}
+
 int mwHasSSE41(const int abcd[4])
 {
     return !!(abcd[2] & bit_SSE41);
@@ -222,4 +266,44 @@ int mwOSHasAVXSupport()
 #endif /* _WIN32 */
 
 
+#if MW_IS_X86 && (defined(__GNUC__) || defined(_MSC_VER))
+
+static uint64_t mw_xgetbv(unsigned int index)
+{
+  #ifdef _MSC_VER
+    return (uint64_t) _xgetbv(index);
+  #else
+    uint32_t eax, edx;
+
+    /* xgetbv, spelled out for old assemblers */
+    __asm__ volatile(".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (index));
+    return ((uint64_t) edx << 32) | eax;
+  #endif
+}
+
+/* Ask the CPU directly whether the OS saves the ZMM state, which
+ * unlike the AVX check works the same everywhere */
+int mwOSHasAVX512Support(void)
+{
+    int abcd[4];
+
+    mw_cpuid(abcd, 1, 0);
+    if (!(abcd[2] & bit_OSXSAVE))
+    {
+        return FALSE;
+    }
+
+    return (mw_xgetbv(0) & XCR0_AVX512_STATE) == XCR0_AVX512_STATE;
+}
+
+#else
+
+int mwOSHasAVX512Support(void)
+{
+    return FALSE;
+}
+
+#endif /* MW_IS_X86 && (defined(__GNUC__) || defined(_MSC_VER)) */
+
+
 
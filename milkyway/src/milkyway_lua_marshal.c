@@ -122,6 +122,10 @@ static int mw_lua_equal_userdata_name(lua_State* luaSt, int idx, const char* typ
 {
     int equal;
 
+    /* Relative indices would be shifted by the metatable pushed below */
+    if (idx < 0 && idx > LUA_REGISTRYINDEX)
+        idx = lua_gettop(luaSt) + idx + 1;
+
     lua_getfield(luaSt, LUA_REGISTRYINDEX, typeName);  /* get correct metatable */
     if (!lua_getmetatable(luaSt, idx))
     {
@@ -234,13 +238,13 @@ int setNumber(lua_State* luaSt, void* v)
 
 int getBool(lua_State* luaSt, void* v)
 {
-    lua_pushboolean(luaSt, *(int*) v);
+    lua_pushboolean(luaSt, *(mwbool*) v);
     return 1;
 }
 
 int setBool(lua_State* luaSt, void* v)
 {
-    *(int*) v = mw_lua_checkboolean(luaSt, 3);
+    *(mwbool*) v = (mwbool) mw_lua_checkboolean(luaSt, 3);
     return 0;
 }
 
@@ -485,6 +489,10 @@ static void setValueFromType(lua_State* luaSt, void* v, int type, int idx)
             break;
 
         case LUA_TTABLE:
+            /* Only the type is checked. The caller reads the table from
+             * the argument table itself. */
+            break;
+
         case LUA_TFUNCTION:
         case LUA_TLIGHTUSERDATA:
         case LUA_TTHREAD:
@@ -43,6 +43,11 @@ typedef struct
     char* histogramFileName;
     char* histoutFileName;
     char* matchHistogram;   /* Just match this histogram to other histogram, no simulation */
+    char* matchBatch;       /* Match a directory or manifest of histograms to the histogram */
+    char* matchMethod;      /* Likelihood method used with matchBatch */
+    char* snapshotPrefix;   /* Prefix of periodic snapshots */
+    char* printSnapshot;    /* Just print this binary snapshot as text, no simulation */
+    char* trajectoryFile;   /* Add a frame of the bodies to this every trajectoryInterval steps */
     char* graphicsBin;
     char* visArgs;
 
@@ -73,10 +78,19 @@ typedef struct
     int reportProgress;
     int ignoreResponsive;
     int noCleanCheckpoint;
+    int compressCheckpoint;
+    int snapshotInterval;
+    int trajectoryInterval;
+    int trajectoryDecimate;  /* Only every Nth body in the trajectory */
+    int trajectoryStreamOnly; /* Only bodies which aren't ignored in the trajectory */
     int verbose;
+    int tuneSettings;   /* Only find the fastest settings within tuneTolerance */
+    int autoTune;       /* Find them and run with them */
+
+    double tuneTolerance;
 } NBodyFlags;
 
-#define EMPTY_NBODY_FLAGS { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+#define EMPTY_NBODY_FLAGS { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0.0 }
 
 NBodyStatus nbStepSystem(const NBodyCtx* ctx, NBodyState* st);
 NBodyStatus nbRunSystem(const NBodyCtx* ctx, NBodyState* st);
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_BACKGROUND_H_
+#define _NBODY_BACKGROUND_H_
+
+#include "nbody_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Writes data given to it. Returns nonzero on failure. The job owns
+ * the data, and frees it if needed. */
+typedef int (*NBodyBackgroundJob)(void* data);
+
+/* Start a thread which runs queued jobs in order. Where there are no
+ * threads, or in BOINC builds where a checkpoint must be written
+ * before it is reported, the jobs are run as they are queued. */
+NBodyBackgroundWriter* nbStartBackgroundWriter(const char* name);
+
+/* Queue a job without waiting for it. Returns nonzero if any job has
+ * failed so far. */
+int nbQueueBackgroundJob(NBodyBackgroundWriter* w, NBodyBackgroundJob job, void* data);
+
+/* Wait until at most maxPending jobs are queued or running. Returns
+ * nonzero if any job has failed so far. */
+int nbWaitBackgroundWriter(NBodyBackgroundWriter* w, unsigned int maxPending);
+
+/* Finish all queued jobs and free the writer. Returns nonzero if any
+ * job failed. */
+int nbStopBackgroundWriter(NBodyBackgroundWriter* w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_BACKGROUND_H_ */
+
@@ -33,6 +33,12 @@ int nbReadCheckpoint(NBodyCtx* ctx, NBodyState* st);
 int nbWriteCheckpoint(const NBodyCtx* ctx, const NBodyState* st);
 int nbWriteCheckpointWithTmpFile(const NBodyCtx* ctx, const NBodyState* st, const char* tmpFile);
 
+/* Start writing a checkpoint without waiting for it where possible */
+int nbWriteCheckpointBackground(const NBodyCtx* ctx, NBodyState* st);
+
+/* Wait for a background checkpoint. Returns nonzero if it failed */
+int nbFinishCheckpoint(NBodyState* st);
+
 int nbTimeToCheckpoint(const NBodyCtx* ctx, NBodyState* st);
 
 #ifdef __cplusplus
@@ -43,6 +43,8 @@ double nbSystemChisq(const NBodyState* st,
 int nbGetLikelihoodInfo(const NBodyFlags* nbf, HistogramParams* hp, NBodyLikelihoodMethod* method);
 
 double nbMatchHistogramFiles(const char* datHist, const char* matchHist);
+int nbMatchHistogramBatch(FILE* f, const char* datHist, const char* models, NBodyLikelihoodMethod method);
+NBodyLikelihoodMethod nbLikelihoodMethodFromName(const char* name);
 NBodyHistogram* nbReadHistogram(const char* histogramFile);
 NBodyHistogram* nbCreateHistogram(const NBodyCtx* ctx, const NBodyState* st, const HistogramParams* hp);
 
@@ -27,6 +27,8 @@ extern "C" {
 #endif
 
 #define DEFAULT_CHECKPOINT_FILE "nbody_checkpoint"
+#define DEFAULT_SNAPSHOT_PREFIX "nbody_snapshot"
+#define DEFAULT_TRAJECTORY_INTERVAL 100
 #define DEFAULT_HISTOGRAM_FILE  "histogram"
 
 #define DEFAULT_LIKELIHOOD_METHOD NBODY_ORIG_CHISQ
@@ -42,6 +44,16 @@ extern "C" {
 #define DEFAULT_USE_QUADRUPOLE_MOMENTS TRUE
 #define DEFAULT_ALLOW_INCEST FALSE
 #define DEFAULT_QUIET_ERRORS FALSE
+#define DEFAULT_USE_MORTON_TREE FALSE
+#define DEFAULT_USE_INTERACTION_LISTS FALSE
+
+/* Block timesteps are off unless a number of levels is given */
+#define DEFAULT_BLOCK_LEVELS 0
+#define DEFAULT_BLOCK_ETA ((real) 0.02)
+#define MAX_BLOCK_LEVELS 16
+
+/* RMS error in self gravity relative to the RMS self gravity allowed by --tune */
+#define DEFAULT_TUNE_TOLERANCE 1.0e-3
 
 #define histogramPhi 128.79
 #define histogramTheta 54.39
@@ -29,6 +29,12 @@ typedef struct
     float pos;    /* 2nd column */
 } WeightPos;
 
+typedef struct
+{
+    double weight;
+    double pos;
+} WeightPosD;
+
 
 
 #ifdef __cplusplus
@@ -41,6 +47,11 @@ float emdCalc(const float* RESTRICT signature_arr1,
               unsigned int size2,
               float* RESTRICT lower_bound);
 
+double emdCalc1D(const WeightPosD* RESTRICT sig1,
+                 const WeightPosD* RESTRICT sig2,
+                 unsigned int size1,
+                 unsigned int size2);
+
 
 #ifdef __cplusplus
 }
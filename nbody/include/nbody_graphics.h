@@ -20,6 +20,7 @@
 #ifndef _NBODY_GRAPHICS_H_
 #define _NBODY_GRAPHICS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <opa_primitives.h>
 
@@ -27,19 +28,33 @@
   #define NAME_MAX 255
 #endif
 
-#define NBODY_CIRC_QUEUE_SIZE 3
+/* Frames are published in alternating slots, so the simulation never
+ * waits for the graphics unless it is asked to */
+#define NBODY_FEED_FRAMES 2
+
+/* Larger systems are decimated to every n'th body to fit */
+#define NBODY_FEED_MAX_BODIES 131072
+
+/* The top levels of the tree are published with each frame as a
+ * summary of the whole system. 3 levels of octants. */
+#define NBODY_FEED_MAX_CELLS 512
+#define NBODY_FEED_CELL_DEPTH 3
+
+/* Minimum number of seconds between frames, unless the simulation is
+ * blocking on the graphics */
+#define NBODY_FEED_FRAME_INTERVAL (1.0 / 30.0)
 
 /* Number of milliseconds to sleep if we are blocking the simulation
- * waiting for the queue to clear */
-#define NBODY_QUEUE_SLEEP_INTERVAL 16
+ * waiting for the graphics to show the last frame */
+#define NBODY_FEED_SLEEP_INTERVAL 1
 
-/* number of NBODY_QUEUE_SLEEP_INTERVALS to wait before checking if the process is dead */
-#define NBODY_QUEUE_WAIT_PERIODS 7
+/* Number of seconds to wait before checking if the process is dead */
+#define NBODY_FEED_WAIT_PERIOD 0.1
 
 /* Number of seconds to wait on a supposedly living attached garphics
    process before giving up on it
  */
-#define NBODY_QUEUE_TIMEOUT 10.0
+#define NBODY_FEED_TIMEOUT 10.0
 
 typedef struct
 {
@@ -47,6 +62,13 @@ typedef struct
     int32_t ignore;
 } FloatPos;
 
+/* Center of mass of a tree cell */
+typedef struct
+{
+    float x, y, z;
+    float mass;
+} FloatCell;
+
 /* Mostly for progress information */
 typedef struct
 {
@@ -55,14 +77,27 @@ typedef struct
     float rootCenterOfMass[3];     /* Center of mass of the system  */
 } SceneInfo;
 
-/* This should only be used as the last element of the scene_t */
+/* The generation is odd while the frame is being written. A reader
+ * should check it is the same even number before and after reading
+ * the frame, or else the frame was overwritten underneath it. */
 typedef struct
 {
-    OPA_int_t head;
-    OPA_int_t tail;
-    SceneInfo info[NBODY_CIRC_QUEUE_SIZE];
+    OPA_int_t generation;
+    int nbody;                     /* Bodies in this frame */
+    int nCells;
+    SceneInfo info;
+} NBodyFrameHeader;
+
+/* This should only be used as the last element of the scene_t. The
+ * body data is followed by the data for each frame: scene->nbody
+ * FloatPos and then NBODY_FEED_MAX_CELLS FloatCell */
+typedef struct
+{
+    OPA_int_t published;           /* Count of frames published. The newest is in slot published % NBODY_FEED_FRAMES */
+    OPA_int_t consumed;            /* Set by the graphics to the count of the frame it last showed */
+    NBodyFrameHeader frames[NBODY_FEED_FRAMES];
     FloatPos bodyData[1];
-} NBodyCircularQueue;
+} NBodyFeed;
 
 /* the scene structure */
 typedef struct
@@ -95,15 +130,44 @@ typedef struct
     */
     OPA_int_t blockSimulationOnGraphics;
 
-    int nbody;
+    int nbody;                     /* Bodies in each frame */
+    int totalBodies;
+    int stride;                    /* Frames have every stride'th body */
     unsigned int nSteps;
     int hasGalaxy;
     int hasInfo;
     int staticScene;
+    double lastFrameTime;          /* Only used by the simulation */
 
-    NBodyCircularQueue queue;
+    NBodyFeed feed;
 } scene_t;
 
+static inline int nbFeedSlot(int count)
+{
+    return count % NBODY_FEED_FRAMES;
+}
+
+static inline FloatPos* nbFeedBodies(scene_t* scene, int slot)
+{
+    return &scene->feed.bodyData[slot * (scene->nbody + NBODY_FEED_MAX_CELLS)];
+}
+
+static inline FloatCell* nbFeedCells(scene_t* scene, int slot)
+{
+    return (FloatCell*) &nbFeedBodies(scene, slot)[scene->nbody];
+}
+
+static inline size_t nbFindShmemSize(int nbody)
+{
+    return sizeof(scene_t) + NBODY_FEED_FRAMES * (nbody + NBODY_FEED_MAX_CELLS) * sizeof(FloatPos);
+}
+
+/* Every stride'th body of the system is published */
+static inline int nbFeedStride(int totalBodies)
+{
+    return (totalBodies + NBODY_FEED_MAX_BODIES - 1) / NBODY_FEED_MAX_BODIES;
+}
+
 #endif /* _NBODY_GRAPHICS_H_ */
 
 
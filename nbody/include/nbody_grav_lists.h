@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2010-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_GRAV_LISTS_H_
+#define _NBODY_GRAV_LISTS_H_
+
+#include "nbody_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Lists are padded with massless entries to a multiple of this so
+   the vector kernels never need a remainder loop. The padding adds
+   nothing since eps2 is always positive. */
+#define NB_LIST_WIDTH 4
+
+/* Bodies in a group are walked together. Consecutive bodies in tree
+   order are close in space. */
+#define NB_GROUP_SIZE 16
+
+/* Sources gathered by one tree walk for a group of bodies, stored as
+   separate arrays. Monopole sources are bodies, and also cells when
+   quadrupole moments are not used. */
+typedef struct
+{
+    real* mono[4];     /* x, y, z, mass */
+    real* quad[10];    /* x, y, z, mass, xx, xy, xz, yy, yz, zz */
+    int nMono, nQuad;
+    int monoCap, quadCap;
+} NBodyInteractionList;
+
+/* Acceleration at pos from everything in the list except the
+   monopole source self, which is the body at pos or -1 if the body
+   isn't in the list. */
+typedef mwvector (*NBodyListKernel)(const NBodyInteractionList* list, real eps2, mwvector pos, int self);
+
+mwvector nbListGravity_SSE2(const NBodyInteractionList* list, real eps2, mwvector pos, int self);
+mwvector nbListGravity_AVX(const NBodyInteractionList* list, real eps2, mwvector pos, int self);
+
+/* Self gravity into the acceleration arrays using the already built
+   tree, for the listed bodies or every body if active is NULL */
+NBodyStatus nbGravity_Lists(const NBodyCtx* ctx, NBodyState* st, const int* active, int nActive);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_GRAV_LISTS_H_ */
+
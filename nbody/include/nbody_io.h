@@ -28,8 +28,34 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 extern "C" {
 #endif
 
+/* Bodies from a binary snapshot file */
+typedef struct
+{
+    uint32_t nbody;
+    uint32_t step;
+    double time;
+    double sunGCDist;
+    int hasMilkyway;
+    double centerOfMass[3];
+    double* pos[3];
+    double* vel[3];
+    double* mass;
+    uint8_t* ignore;
+} NBodySnapshot;
+
 int nbWriteBodies(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf);
 
+NBodySnapshot* nbTakeSnapshot(const NBodyCtx* ctx, const NBodyState* st);
+NBodySnapshot* nbReadSnapshot(const char* filename);
+void nbFreeSnapshot(NBodySnapshot* snap);
+int nbWriteSnapshotFile(const NBodySnapshot* snap, const char* filename);
+int nbWriteBodySnapshot(const NBodyCtx* ctx, const NBodyState* st, const char* filename);
+int nbPrintSnapshot(FILE* f, const NBodySnapshot* snap, int cartesian);
+int nbPrintSnapshotFile(const char* snapshotFile, const char* outFile, int cartesian);
+
+int nbWriteSnapshotBackground(const NBodyCtx* ctx, NBodyState* st, const char* filename);
+int nbFinishSnapshot(NBodyState* st);
+
 #ifdef __cplusplus
 }
 #endif
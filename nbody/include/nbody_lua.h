@@ -29,6 +29,7 @@ extern "C" {
 #endif
 
 int nbOpenPotentialEvalStatePerThread(NBodyState* st, const NBodyFlags* nbf);
+int nbOpenPotentialProgram(NBodyState* st, const NBodyFlags* nbf);
 void nbEvalPotentialClosure(NBodyState* st, mwvector pos, mwvector* aOut);
 int nbEvaluateHistogramParams(lua_State* luaSt, HistogramParams* hp);
 NBodyLikelihoodMethod nbEvaluateLikelihoodMethod(lua_State* luaSt);
@@ -26,11 +26,19 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <lua.h>
 #include "nbody_types.h"
+#include "milkyway_lua.h"
 
+/* These also accept an element of a BodyArray, giving the body in
+ * the array */
+Body* toBody(lua_State* luaSt, int idx);
 Body* checkBody(lua_State* luaSt, int idx);
 Body* expectBody(lua_State* luaSt, int idx);
 int pushBody(lua_State* luaSt, const Body* b);
 int registerBody(lua_State* luaSt);
 
+/* Accessors for the fields of a body, shared with BodyArray elements */
+extern const Xet_reg_pre gettersBody[];
+extern const Xet_reg_pre settersBody[];
+
 #endif /* _NBODY_LUA_BODY_H_ */
 
@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2011  Matthew Arsenault
+
+This file is part of Milkway@Home.
+
+Milkyway@Home is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Milkyway@Home is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(_NBODY_LUA_TYPES_H_INSIDE_) && !defined(NBODY_LUA_TYPES_COMPILATION)
+  #error "Only nbody_lua_types.h can be included directly."
+#endif
+
+#ifndef _NBODY_LUA_BODY_ARRAY_H_
+#define _NBODY_LUA_BODY_ARRAY_H_
+
+#include <lua.h>
+#include "nbody_types.h"
+
+#define BODY_ARRAY_TYPE "BodyArray"
+#define BODY_ARRAY_ELEMENT_TYPE "BodyArrayElement"
+
+/* Bodies stored contiguously in one userdata, so model generators
+ * don't create a Lua object per body. Indexing one from Lua returns an
+ * element, which reads and writes the body in the array and can be
+ * used anywhere a Body can. Assigning to an index stores a copy of a
+ * body, and assigning one past the end appends. a:bodies() iterates
+ * like ipairs(), which doesn't work on userdata. */
+typedef struct
+{
+    Body* bodies;
+    unsigned int n;
+    unsigned int capacity;
+} BodyArray;
+
+BodyArray* checkBodyArray(lua_State* luaSt, int idx);
+BodyArray* toBodyArray(lua_State* luaSt, int idx);
+
+/* The body an element refers to, or NULL if idx isn't an element */
+Body* toBodyArrayElement(lua_State* luaSt, int idx);
+
+/* Push a new array of n zeroed bodies */
+BodyArray* pushBodyArray(lua_State* luaSt, unsigned int n);
+
+int registerBodyArray(lua_State* luaSt);
+
+#endif /* _NBODY_LUA_BODY_ARRAY_H_ */
+
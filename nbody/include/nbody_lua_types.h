@@ -33,10 +33,12 @@ extern "C" {
 #include "nbody_lua_nbodyctx.h"
 #include "nbody_lua_nbodystate.h"
 #include "nbody_lua_body.h"
+#include "nbody_lua_body_array.h"
 #include "nbody_lua_halo.h"
 #include "nbody_lua_disk.h"
 #include "nbody_lua_spherical.h"
 #include "nbody_lua_potential.h"
+#include "nbody_lua_potential_program.h"
 #include "nbody_lua_histogram_params.h"
 
 
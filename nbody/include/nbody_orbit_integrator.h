@@ -23,6 +23,18 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "nbody_types.h"
 
+typedef enum
+{
+    InvalidOrbitIntegrator = InvalidEnum,
+    OrbitEuler,      /* The original first order kick then drift */
+    OrbitLeapfrog,   /* Second order kick-drift-kick */
+    OrbitYoshida,    /* Fourth order composition of 3 leapfrog steps */
+    OrbitAdaptive    /* Dormand-Prince 5(4) with error controlled steps */
+} orbit_integrator_t;
+
+/* Don't let a bad tolerance run forever */
+#define ORBIT_ADAPTIVE_MAX_STEPS 10000000
+
 void nbReverseOrbit(mwvector* finalPos,
                     mwvector* finalVel,
                     const Potential* pot,
@@ -31,5 +43,35 @@ void nbReverseOrbit(mwvector* finalPos,
                     real tstop,
                     real dt);
 
-#endif /* _NBODY_ORBIT_INTEGRATOR_H_ */
+/* Integrate one orbit backwards for tstop. dt is the step for the
+ * fixed step integrators, and the initial step for the adaptive one,
+ * which keeps the error of each step under tolerance relative to the
+ * size of the position and velocity. If table isn't NULL it is used
+ * instead of the analytic potential, which isn't possible with the
+ * Euler integrator. Returns nonzero on failure. */
+int nbReverseOrbitWith(mwvector* finalPos,
+                       mwvector* finalVel,
+                       const Potential* pot,
+                       mwvector pos,
+                       mwvector vel,
+                       real tstop,
+                       real dt,
+                       orbit_integrator_t integrator,
+                       real tolerance,
+                       const PotentialTable* table);
 
+/* Integrate n independent orbits backwards in the same potential. The
+ * positions and velocities are given as separate x, y and z arrays
+ * and are replaced with the final values. Returns nonzero if any
+ * orbit failed. */
+int nbReverseOrbits(real* pos[3],
+                    real* vel[3],
+                    unsigned int n,
+                    const Potential* pot,
+                    real tstop,
+                    real dt,
+                    orbit_integrator_t integrator,
+                    real tolerance,
+                    const PotentialTable* table);
+
+#endif /* _NBODY_ORBIT_INTEGRATOR_H_ */
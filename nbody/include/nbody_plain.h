@@ -29,6 +29,9 @@ extern "C" {
 
 NBodyStatus nbStepSystemPlain(const NBodyCtx* ctx, NBodyState* st);
 NBodyStatus nbRunSystemPlain(const NBodyCtx* ctx, NBodyState* st);
+NBodyStatus nbTrialStepsPlain(const NBodyCtx* ctx, NBodyState* st, unsigned int nStep, NBodyPhaseTimes* times);
+
+real nbVelocityLead(const NBodyCtx* ctx, const NBodyState* st, int i);
 
 #ifdef __cplusplus
 }
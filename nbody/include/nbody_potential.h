@@ -29,6 +29,9 @@ extern "C" {
 
 mwvector nbExtAcceleration(const Potential* pot, mwvector pos);
 
+/* Acceleration from only the halo part of a potential */
+mwvector nbHaloAcceleration(const Halo* halo, mwvector pos);
+
 #ifdef __cplusplus
 }
 #endif
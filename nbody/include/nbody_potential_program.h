@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_POTENTIAL_PROGRAM_H_
+#define _NBODY_POTENTIAL_PROGRAM_H_
+
+#include "nbody_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bodies evaluated together by each instruction */
+#define POTENTIAL_PROGRAM_BLOCK 64
+
+/* Limits on how deeply expressions can nest */
+#define POTENTIAL_PROGRAM_MAX_STACK 32
+#define POTENTIAL_PROGRAM_MAX_DEPTH 64
+
+/* A custom external potential, compiled once from a list of
+ * assignments such as
+
+     f = -M / (r * sqr(r + a))
+     ax = f * x
+     ay = f * y
+     az = f * z
+
+ * The statements must assign the acceleration ax, ay and az, and may
+ * use x, y, z, r = |pos|, R = sqrt(x^2 + y^2), named parameters,
+ * numbers, earlier assignments, + - * / ^ and the functions sqrt, exp,
+ * log, sin, cos, tan, atan, atan2, abs, sqr, cube, pow, min and
+ * max. Statements may be separated by ';', and '#' starts a comment.
+ *
+ * The program is run on blocks of bodies at a time, one instruction
+ * over the whole block before the next. Anything with only numbers and
+ * parameters is evaluated when compiled. A Potential can be added to
+ * the program, so a custom term can be added to the usual building
+ * blocks. */
+struct _PotentialProgram;
+
+/* Returns NULL after printing an error if the source is invalid. The
+ * parameter names and values are copied, as is base if set. */
+PotentialProgram* nbCompilePotentialProgram(const char* src,
+                                            const char* const* paramNames,
+                                            const real* paramValues,
+                                            unsigned int nParams,
+                                            const Potential* base);
+
+PotentialProgram* nbClonePotentialProgram(const PotentialProgram* p);
+void nbFreePotentialProgram(PotentialProgram* p);
+
+unsigned int nbPotentialProgramLength(const PotentialProgram* p);
+
+/* Add the acceleration at n positions to acc. Body k is pos[][index[k]],
+ * or pos[][k] if index is NULL, and likewise for acc. */
+void nbPotentialProgramAddAccelerations(const PotentialProgram* p,
+                                        const int* index,
+                                        int n,
+                                        real* const pos[3],
+                                        real* const acc[3]);
+
+mwvector nbPotentialProgramAcceleration(const PotentialProgram* p, mwvector pos);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_POTENTIAL_PROGRAM_H_ */
+
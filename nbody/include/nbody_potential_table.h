@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_POTENTIAL_TABLE_H_
+#define _NBODY_POTENTIAL_TABLE_H_
+
+#include "nbody_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Tables are only used inside this radius */
+#define POTENTIAL_TABLE_RADIUS ((real) 200.0)
+
+/* The analytic potential is always used inside this radius, since
+ * near the centre the bulge and halo terms aren't smooth */
+#define POTENTIAL_TABLE_MAX_CORE ((real) 1.0)
+
+/* Cells along each axis of the first and largest tables tried */
+#define POTENTIAL_TABLE_MIN_CELLS 32
+#define POTENTIAL_TABLE_MAX_CELLS 1024
+
+/* The disk, bulge and any axisymmetric halo tabulated on a grid in
+ * cylindrical R and |z|. Each node holds g = aR / R and gz = az / z,
+ * which are smooth across the axis and the plane, so the acceleration
+ * is (g x, g y, gz z). The grid is uniform in t = stretch * s / (s + scale)
+ * for s = R or |z|, which puts most of the nodes near the centre, and
+ * is interpolated with Catmull-Rom cubics. There is an extra node on
+ * each side of each row and column for the cubics. */
+struct _PotentialTable
+{
+    Potential pot;          /* Potential and tolerance the table was made for */
+    real tolerance;
+
+    real* g;                /* [(nCells + 3) * (nCells + 3)] pairs of g and gz, R fastest */
+    unsigned int nCells;    /* 0 if the tolerance couldn't be met */
+    real scale;
+    real stretch;
+    real rMax2;
+    real rCore2;            /* Analytic inside this radius squared */
+    real maxError;          /* Largest relative error found checking the table */
+    mwbool triaxial;        /* Halo isn't tabulated and is added analytically */
+};
+
+/* Tabulate the potential so the relative error in the total
+ * acceleration checked at the centre of each cell is at most
+ * tolerance. If that can't be reached with the largest table, a table
+ * which always uses the analytic potential is returned. */
+PotentialTable* nbCreatePotentialTable(const Potential* pot, real tolerance);
+void nbFreePotentialTable(PotentialTable* t);
+
+/* Make sure the state has a table for the context's potential if it
+ * asks for one. Returns the table to use or NULL for the analytic
+ * potential. */
+const PotentialTable* nbStatePotentialTable(const NBodyCtx* ctx, NBodyState* st);
+
+mwvector nbPotentialTableAcceleration(const PotentialTable* t, mwvector pos);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_POTENTIAL_TABLE_H_ */
+
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_TRAJECTORY_H_
+#define _NBODY_TRAJECTORY_H_
+
+#include "nbody_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Start a trajectory file for the state. A frame is added every
+ * interval steps, with every decimate'th body, and if streamOnly only
+ * bodies which aren't ignored. A resumed run continues the existing
+ * file. Returns nonzero on failure. */
+int nbOpenTrajectory(NBodyState* st,
+                     const char* filename,
+                     unsigned int interval,
+                     unsigned int decimate,
+                     int streamOnly);
+
+/* Add a frame if the current step is due one, or always if force */
+NBodyStatus nbTrajectoryFrame(const NBodyCtx* ctx, NBodyState* st, mwbool force);
+
+/* Wait for the frames added so far to be written. This is done before
+ * each checkpoint, so a resumed run finds every frame up to the
+ * checkpoint in the file. Returns nonzero if any failed. */
+int nbFlushTrajectory(NBodyState* st);
+
+/* Wait for the frames added so far to be written, and close the
+ * file. Returns nonzero if any failed. */
+int nbCloseTrajectory(NBodyState* st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_TRAJECTORY_H_ */
+
@@ -28,6 +28,8 @@ extern "C" {
 #endif
 
 NBodyStatus nbMakeTree(const NBodyCtx*, NBodyState*);    /* construct tree structure */
+void nbFreeLinearTree(NBodyLinearTree* lt);
+void nbFreeCellArena(NBodyCellArena* arena);
 
 #if 0
 void registerFindRCrit(lua_State* luaSt);
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NBODY_TUNE_H_
+#define _NBODY_TUNE_H_
+
+#include "nbody_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+    criterion_t criterion;
+    real theta;
+    mwbool useQuad;
+
+    double forceError;      /* RMS error in self gravity relative to the RMS self gravity */
+    NBodyPhaseTimes times;  /* Seconds per step */
+    mwbool estimated;       /* Time is scaled from the sampled direct sums rather than stepped */
+} NBodyTuneResult;
+
+/* Try the opening criteria, theta and quadrupole moments for a few
+ * steps of the state, and find the fastest with self gravity within
+ * tolerance of direct sums at a sample of the bodies. The state is
+ * left as it was. A table of the trials is printed if report is set. */
+NBodyStatus nbTuneSettings(const NBodyCtx* ctx,
+                           NBodyState* st,
+                           real tolerance,
+                           mwbool report,
+                           NBodyTuneResult* best);
+
+void nbApplyTuneResult(NBodyCtx* ctx, NBodyState* st, const NBodyTuneResult* r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_TUNE_H_ */
+
@@ -166,7 +166,8 @@ typedef enum
 {
     EXTERNAL_POTENTIAL_DEFAULT,
     EXTERNAL_POTENTIAL_NONE,
-    EXTERNAL_POTENTIAL_CUSTOM_LUA
+    EXTERNAL_POTENTIAL_CUSTOM_LUA,
+    EXTERNAL_POTENTIAL_PROGRAM
 } ExternalPotentialType;
 
 
@@ -188,6 +189,41 @@ typedef struct MW_ALIGN_TYPE
 } NBodyTree;
 
 
+/* Storage for the Morton ordered linear tree builder. Cells are
+ * allocated contiguously in depth first order and reused each step. */
+typedef struct MW_ALIGN_TYPE
+{
+    uint64_t* keys;          /* Morton keys of bodies, in sorted order after a build */
+    int* order;              /* Body indices sorted by key */
+    uint64_t* keysTmp;       /* Sort scratch */
+    int* orderTmp;
+    int* common;             /* Number of levels shared by sorted bodies i and i + 1 */
+    int* cellBase;           /* Index of first cell started by sorted body i */
+    int bodyAlloc;
+
+    NBodyCell* cells;
+    int* cellDepth;
+    int* levelCells;         /* Cell indices grouped by depth */
+    unsigned int cellAlloc;
+} NBodyLinearTree;
+
+/* Storage for cells of the insertion built tree. Cells are made in
+ * fixed size blocks while bodies are loaded, then copied into one
+ * array in depth first order so the force walk goes through memory
+ * in order. Both are reused each step. */
+typedef struct MW_ALIGN_TYPE
+{
+    NBodyCell** blocks;      /* Cells as they are made during loading */
+    unsigned int nBlocks;
+    unsigned int nMade;
+
+    NBodyCell* cells;        /* Finished tree in depth first order */
+    unsigned int cellAlloc;
+} NBodyCellArena;
+
+#define EMPTY_CELL_ARENA { NULL, 0, 0, NULL, 0 }
+
+
 
 #if NBODY_OPENCL
 
@@ -254,24 +290,74 @@ typedef struct
 
 
 
+/* Structure of arrays copy of the bodies used by the CPU integrator
+ * and force loops, with the same layout as the CL NBodyBuffers. While
+ * the system is being run this is the authoritative position and
+ * velocity, and bodytab is only updated when the bodies are needed
+ * by the tree, checkpointing, display or output. */
+typedef struct MW_ALIGN_TYPE
+{
+    real* pos[3];
+    real* vel[3];
+    real* acc[3];
+    real* mass;
+    int* level;      /* block step level; each body steps by timestep * 2^level */
+
+    /* Block step scratch, kept to avoid allocating every fine step */
+    int* active;     /* bodies finishing their step */
+    real* oldAcc[3]; /* their accelerations from the start of the step */
+} NBodyBodyArrays;
+
+
+/* Thread writing checkpoints, snapshots or trajectory frames in the background */
+typedef struct _NBodyBackgroundWriter NBodyBackgroundWriter;
+
+/* Trajectory file frames are being added to */
+typedef struct _NBodyTrajectory NBodyTrajectory;
+
+/* Interpolation table of the external potential */
+typedef struct _PotentialTable PotentialTable;
+
+/* Custom external potential compiled from expressions */
+typedef struct _PotentialProgram PotentialProgram;
+
+/* Seconds spent in each part of stepping */
+typedef struct
+{
+    double tree;       /* Building the tree */
+    double force;      /* Self gravity */
+    double external;   /* External potential */
+    double integrate;  /* Everything else */
+} NBodyPhaseTimes;
+
+#define EMPTY_PHASE_TIMES { 0.0, 0.0, 0.0, 0.0 }
+
 /* Mutable state used during an evaluation */
 typedef struct MW_ALIGN_TYPE
 {
     NBodyTree tree;
-    NBodyNode* freeCell;      /* list of free cells */
+    NBodyCellArena cellArena; /* cells of the insertion built tree */
     char* checkpointResolved;
+    NBodyBackgroundWriter* checkpointWriter;
+    char* snapshotPrefix;     /* Periodic snapshots are written to <prefix>.<step> */
+    NBodyBackgroundWriter* snapshotWriter;
+    NBodyTrajectory* trajectory;
     Body* bodytab;            /* points to array of bodies */
-    mwvector* acctab;         /* Corresponding accelerations of bodies */
+    NBodyBodyArrays* bodyArrays; /* SoA positions, velocities, masses and accelerations of bodies */
     mwvector* orbitTrace;     /* Trail of center of masses for display purposes */
     scene_t* scene;
 
     lua_State** potEvalStates;  /* If using a Lua closure as a potential, the evaluation states.
                                   We need one per thread in the general case. */
     int* potEvalClosures;       /* Lua closure for each state */
+    PotentialTable* potTable;   /* Tabulated external potential if ctx.potentialTableTolerance is set */
+    PotentialProgram* potProgram; /* Compiled custom potential */
+    NBodyPhaseTimes* phaseTimes;  /* If set, the time spent in each part of finding forces is added here */
 
     time_t lastCheckpoint;
 
     unsigned int step;
+    unsigned int snapshotInterval; /* Steps between periodic snapshots, 0 for none */
     int nbody;
     int effNBody;            /* Sometimes needed rounded up number of bodies. >= nbody are just padding */
     int treeIncest;          /* Tree incest has occured */
@@ -283,6 +369,7 @@ typedef struct MW_ALIGN_TYPE
     mwbool dirty;      /* Whether the view of the bodies is consistent with the view in the CL buffers */
     mwbool usesCL;
     mwbool reportProgress;
+    mwbool compressCheckpoint;
 
   #if NBODY_OPENCL
     CLInfo* ci;
@@ -294,11 +381,13 @@ typedef struct MW_ALIGN_TYPE
     void* nbb;
   #endif /* NBODY_OPENCL */
     NBodyWorkSizes* workSizes;
+
+    NBodyLinearTree* linearTree;
 } NBodyState;
 
 #define NBODYSTATE_TYPE "NBodyState"
 
-#define EMPTY_NBODYSTATE { EMPTY_TREE, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, NULL, NULL, NULL, NULL }
+#define EMPTY_NBODYSTATE { EMPTY_TREE, EMPTY_CELL_ARENA, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, NULL, NULL, NULL, NULL, NULL }
 
 
 typedef struct
@@ -354,10 +443,17 @@ typedef struct MW_ALIGN_TYPE
     mwbool useQuad;           /* use quadrupole corrections */
     mwbool allowIncest;
     mwbool quietErrors;
+    mwbool useMortonTree;     /* build the tree from Morton ordered bodies */
+    mwbool useInteractionLists; /* walk the tree once per group of nearby bodies */
 
     time_t checkpointT;       /* Period to checkpoint when not using BOINC */
     unsigned int nStep;
 
+    int blockLevels;          /* number of power of 2 block step sizes, 0 or 1 for one shared timestep */
+    real blockEta;            /* accuracy parameter for choosing block step sizes */
+
+    real potentialTableTolerance; /* relative error allowed tabulating the external potential, 0 for the analytic form */
+
     Potential pot;
 } NBodyCtx;
 
@@ -429,8 +525,10 @@ typedef enum
 #define EMPTY_TREE { NULL, 0.0, 0, 0, FALSE }
 #define EMPTY_NBODYCTX { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,                  \
                          InvalidCriterion, EXTERNAL_POTENTIAL_DEFAULT,  \
-                         FALSE, FALSE, FALSE,                           \
+                         FALSE, FALSE, FALSE, FALSE, FALSE,             \
                          0, 0,                                          \
+                         0, 0.0,                                        \
+                         0.0,                                           \
                          EMPTY_POTENTIAL }
 
 typedef enum
@@ -459,6 +557,12 @@ void setInitialNBodyState(NBodyState* st, const NBodyCtx* ctx, Body* bodies, int
 void cloneNBodyState(NBodyState* st, const NBodyState* oldSt);
 int equalNBodyState(const NBodyState* st1, const NBodyState* st2);
 
+NBodyBodyArrays* nbNewBodyArrays(int nbody);
+void nbFreeBodyArrays(NBodyBodyArrays* ba);
+void nbGatherBodyArrays(NBodyState* st);
+void nbScatterBodyArrays(NBodyState* st);
+void nbScatterBodyPositions(NBodyState* st);
+
 void sortBodies(Body* bodies, int nbody);
 
 int equalSpherical(const Spherical* s1, const Spherical* s2);
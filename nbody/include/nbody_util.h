@@ -33,9 +33,6 @@ extern "C" {
 
 mwvector nbCenterOfMass(const NBodyState* st);
 
-double nbEstimateNumberFlops(const NBodyCtx* ctx, int nbody);
-double nbEstimateTime(const NBodyCtx* ctx, int nbody, double flops);
-
 void nbReportTreeIncest(const NBodyCtx* ctx, NBodyState* st);
 
 #ifdef _OPENMP
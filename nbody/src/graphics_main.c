@@ -421,7 +421,7 @@ static int nbglTryReadSceneItems(const char* lineBuf, scene_t* scene)
 
     if (!readCenterOfMass)
     {
-        float* cmPos = scene->queue.info[0].rootCenterOfMass;
+        float* cmPos = scene->feed.frames[0].info.rootCenterOfMass;
 
         if (sscanf(lineBuf,
                    " centerOfMass = %f , %f , %f \n",
@@ -470,16 +470,18 @@ static scene_t* nbglLoadStaticSceneFromFile(const char* filename)
         return NULL;
     }
 
-    scene = mwCalloc(sizeof(scene_t) + 1 * (lnCount * sizeof(FloatPos)), sizeof(char));
+    scene = mwCalloc(nbFindShmemSize((int) lnCount), sizeof(char));
 
-    /* We don't need the buffering features so just use first buffer slot */
-    r = &scene->queue.bodyData[0];
+    /* Make it look like a frame has been published in the first slot,
+     * which starts at the beginning of the body data however many
+     * bodies there turn out to be */
+    r = &scene->feed.bodyData[0];
     scene->hasInfo = FALSE;
     scene->staticScene = TRUE;
+    scene->stride = 1;
 
-    /* Make read data fake that we have 1 element in the queue */
-    OPA_store_int(&scene->queue.head, 0);
-    OPA_store_int(&scene->queue.tail, 1);
+    OPA_store_int(&scene->feed.frames[0].generation, 2);
+    OPA_store_int(&scene->feed.published, NBODY_FEED_FRAMES);
 
 
     readCoordinateSystem = FALSE;
@@ -541,6 +543,8 @@ static scene_t* nbglLoadStaticSceneFromFile(const char* filename)
     }
 
     scene->nbody = nbody;
+    scene->totalBodies = nbody;
+    scene->feed.frames[0].nbody = nbody;
     if (hasError)
     {
         free(scene);
@@ -553,12 +557,6 @@ static scene_t* nbglLoadStaticSceneFromFile(const char* filename)
 
 #if USE_SHMEM
 
-/* FIXME: Duplicated in nbody_shmem.c */
-static size_t nbFindShmemSize(int nbody)
-{
-    size_t snapshotSize = sizeof(NBodyCircularQueue) + nbody * sizeof(FloatPos);
-    return sizeof(scene_t) + NBODY_CIRC_QUEUE_SIZE * snapshotSize;
-}
 
 static scene_t* nbglConnectSharedScene(int instanceId)
 {
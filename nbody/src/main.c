@@ -23,6 +23,7 @@
 #include "milkyway_util.h"
 #include "nbody.h"
 #include "nbody_chisq.h"
+#include "nbody_io.h"
 #include "nbody_defaults.h"
 #include "milkyway_git_version.h"
 
@@ -226,19 +227,71 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
             0, "Only match this histogram against other histogram (requires histogram argument)", NULL
         },
 
+        {
+            "match-batch", '\0',
+            POPT_ARG_STRING, &nbf.matchBatch,
+            0, "Match every histogram in a directory or listed in a file against the histogram, and print a table (requires histogram argument)", NULL
+        },
+
+        {
+            "match-method", '\0',
+            POPT_ARG_STRING, &nbf.matchMethod,
+            0, "Likelihood method to use with --match-batch (default EMD)", NULL
+        },
+
         {
             "output-file", 'o',
             POPT_ARG_STRING, &nbf.outFileName,
             0, "Output file", NULL
         },
 
-      #if 0
         {
-            "binary-output", 'B',
+            "output-binary", 'B',
             POPT_ARG_NONE, &nbf.outputBinary,
-            0, "Write output dump as a binary", NULL
+            0, "Write output dump as a binary snapshot", NULL
+        },
+
+        {
+            "snapshot-interval", '\0',
+            POPT_ARG_INT, &nbf.snapshotInterval,
+            0, "Write a binary snapshot every N steps", NULL
+        },
+
+        {
+            "snapshot-prefix", '\0',
+            POPT_ARG_STRING, &nbf.snapshotPrefix,
+            0, "Periodic snapshots are written to <prefix>.<step> (default " DEFAULT_SNAPSHOT_PREFIX ")", NULL
+        },
+
+        {
+            "trajectory-file", '\0',
+            POPT_ARG_STRING, &nbf.trajectoryFile,
+            0, "Append the positions and velocities of bodies to this file during the run", NULL
+        },
+
+        {
+            "trajectory-interval", '\0',
+            POPT_ARG_INT, &nbf.trajectoryInterval,
+            0, "Steps between trajectory frames (default 100)", NULL
+        },
+
+        {
+            "trajectory-decimate", '\0',
+            POPT_ARG_INT, &nbf.trajectoryDecimate,
+            0, "Only include every Nth body in the trajectory", NULL
+        },
+
+        {
+            "trajectory-stream-only", '\0',
+            POPT_ARG_NONE, &nbf.trajectoryStreamOnly,
+            0, "Only include bodies which aren't ignored in the trajectory", NULL
+        },
+
+        {
+            "print-snapshot", '\0',
+            POPT_ARG_STRING, &nbf.printSnapshot,
+            0, "Only print this binary snapshot as text, to the output file if given", NULL
         },
-      #endif
 
         {
             "output-cartesian", 'x',
@@ -270,6 +323,24 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
             0, "Period (in seconds) to checkpoint. -1 to disable", NULL
         },
 
+        {
+            "tune", '\0',
+            POPT_ARG_NONE, &nbf.tuneSettings,
+            0, "Take trial steps to find the fastest criterion, theta and useQuad with force error within --tune-tolerance, and print them without running", NULL
+        },
+
+        {
+            "auto-tune", '\0',
+            POPT_ARG_NONE, &nbf.autoTune,
+            0, "Find the settings as with --tune, and run with them", NULL
+        },
+
+        {
+            "tune-tolerance", '\0',
+            POPT_ARG_DOUBLE, &nbf.tuneTolerance,
+            0, "RMS error in self gravity relative to the RMS self gravity allowed when tuning (default 1e-3)", NULL
+        },
+
         {
             "debug-boinc", 'g',
             POPT_ARG_NONE, &nbf.debugBOINC,
@@ -372,6 +443,12 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
             0, "Do not delete checkpoint on finish", NULL
         },
 
+        {
+            "compress-checkpoint", '\0',
+            POPT_ARG_NONE, &nbf.compressCheckpoint,
+            0, "Compress the bodies in checkpoints", NULL
+        },
+
         {
             "verbose", '\0',
             POPT_ARG_NONE, &nbf.verbose,
@@ -434,7 +511,7 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
         exit(EXIT_SUCCESS);
     }
 
-    if (!nbf.inputFile && !nbf.checkpointFileName && !nbf.matchHistogram)
+    if (!nbf.inputFile && !nbf.checkpointFileName && !nbf.matchHistogram && !nbf.matchBatch && !nbf.printSnapshot)
     {
         mw_printf("An input file, checkpoint, or matching histogram argument is required\n");
         poptFreeContext(context);
@@ -448,6 +525,41 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
         return TRUE;
     }
 
+    if (nbf.matchBatch && !nbf.histogramFileName)
+    {
+        mw_printf("--match-batch argument requires --histogram-file\n");
+        poptFreeContext(context);
+        return TRUE;
+    }
+
+    if (nbf.snapshotInterval < 0)
+    {
+        mw_printf("--snapshot-interval must be positive\n");
+        poptFreeContext(context);
+        return TRUE;
+    }
+
+    if (nbf.trajectoryInterval < 0 || nbf.trajectoryDecimate < 0)
+    {
+        mw_printf("--trajectory-interval and --trajectory-decimate must be positive\n");
+        poptFreeContext(context);
+        return TRUE;
+    }
+
+    if (nbf.tuneTolerance < 0.0)
+    {
+        mw_printf("--tune-tolerance must be positive\n");
+        poptFreeContext(context);
+        return TRUE;
+    }
+
+    if (nbf.matchMethod && nbLikelihoodMethodFromName(nbf.matchMethod) == NBODY_INVALID_METHOD)
+    {
+        mw_printf("Unknown likelihood method '%s'\n", nbf.matchMethod);
+        poptFreeContext(context);
+        return TRUE;
+    }
+
     nbf.setSeed = !!(argRead & SEED_ARGUMENT);
 
     rest = poptGetArgs(context);
@@ -477,6 +589,21 @@ static void nbSetDefaultFlags(NBodyFlags* nbf)
     /* Use a specified seed or time seeding */
     nbf->seed = nbf->setSeed ? nbf->seed : (uint32_t) time(NULL);
 
+    if (nbf->trajectoryInterval == 0)
+    {
+        nbf->trajectoryInterval = DEFAULT_TRAJECTORY_INTERVAL;
+    }
+
+    if (nbf->trajectoryDecimate == 0)
+    {
+        nbf->trajectoryDecimate = 1;
+    }
+
+    if (nbf->tuneTolerance <= 0.0)  /* Not given */
+    {
+        nbf->tuneTolerance = DEFAULT_TUNE_TOLERANCE;
+    }
+
     if (nbf->checkpointPeriod == 0)
     {
         nbf->checkpointPeriod = NOBOINC_DEFAULT_CHECKPOINT_PERIOD;
@@ -497,6 +624,11 @@ static void freeNBodyFlags(NBodyFlags* nbf)
     free(nbf->histogramFileName);
     free(nbf->histoutFileName);
     free(nbf->matchHistogram);
+    free(nbf->matchBatch);
+    free(nbf->matchMethod);
+    free(nbf->snapshotPrefix);
+    free(nbf->printSnapshot);
+    free(nbf->trajectoryFile);
     free(nbf->forwardedArgs);
     free(nbf->graphicsBin);
     free(nbf->visArgs);
@@ -600,6 +732,17 @@ int main(int argc, const char* argv[])
         mw_printf("%.15f\n", emd);
         rc = isnan(emd);
     }
+    else if (nbf.printSnapshot)
+    {
+        rc = nbPrintSnapshotFile(nbf.printSnapshot, nbf.outFileName, nbf.outputCartesian);
+    }
+    else if (nbf.matchBatch)
+    {
+        NBodyLikelihoodMethod method;
+
+        method = nbf.matchMethod ? nbLikelihoodMethodFromName(nbf.matchMethod) : NBODY_EMD;
+        rc = (nbMatchHistogramBatch(stdout, nbf.histogramFileName, nbf.matchBatch, method) != 0);
+    }
     else
     {
         rc = nbMain(&nbf);
@@ -30,6 +30,8 @@
 #include "nbody_defaults.h"
 #include "nbody_plain.h"
 #include "nbody_chisq.h"
+#include "nbody_trajectory.h"
+#include "nbody_tune.h"
 
 #if NBODY_OPENCL
   #include "nbody_cl.h"
@@ -88,6 +90,15 @@ static NBodyStatus nbResumeOrNewRun(NBodyCtx* ctx, NBodyState* st, const NBodyFl
             return NBODY_PARAM_FILE_ERROR;
         }
     }
+    else if (ctx->potentialType == EXTERNAL_POTENTIAL_PROGRAM && !st->potProgram)
+    {
+        /* The compiled potential isn't checkpointed, so get it from
+         * the script again */
+        if (nbOpenPotentialProgram(st, nbf))
+        {
+            return NBODY_PARAM_FILE_ERROR;
+        }
+    }
 
     return NBODY_SUCCESS;
 }
@@ -101,7 +112,14 @@ static void nbSetCtxFromFlags(NBodyCtx* ctx, const NBodyFlags* nbf)
 static void nbSetStateFromFlags(NBodyState* st, const NBodyFlags* nbf)
 {
     st->reportProgress = nbf->reportProgress;
+    st->compressCheckpoint = nbf->compressCheckpoint;
     st->ignoreResponsive = nbf->ignoreResponsive;
+
+    if (nbf->snapshotInterval > 0)
+    {
+        st->snapshotInterval = (unsigned int) nbf->snapshotInterval;
+        st->snapshotPrefix = strdup(nbf->snapshotPrefix ? nbf->snapshotPrefix : DEFAULT_SNAPSHOT_PREFIX);
+    }
 }
 
 static void nbSetCLRequestFromFlags(CLRequest* clr, const NBodyFlags* nbf)
@@ -113,6 +131,39 @@ static void nbSetCLRequestFromFlags(CLRequest* clr, const NBodyFlags* nbf)
     clr->enableProfiling = TRUE;
 }
 
+/* Find the fastest settings for a new run within the tolerance, and
+ * use them with --auto-tune. A resumed run keeps what it started with. */
+static NBodyStatus nbTuneFromFlags(NBodyCtx* ctx, NBodyState* st, const NBodyFlags* nbf)
+{
+    NBodyStatus rc;
+    NBodyTuneResult best;
+
+    if (st->step != 0)
+    {
+        mw_printf("Not tuning settings of a run resumed from a checkpoint\n");
+        return NBODY_SUCCESS;
+    }
+
+    if (NBODY_OPENCL && !nbf->noCL)
+    {
+        mw_printf("Warning: settings are tuned with the CPU integrator\n");
+    }
+
+    rc = nbTuneSettings(ctx, st, (real) nbf->tuneTolerance, TRUE, &best);
+    if (nbStatusIsFatal(rc))
+    {
+        mw_printf("Failed to tune settings\n");
+        return rc;
+    }
+
+    if (nbf->autoTune && !nbf->tuneSettings)
+    {
+        nbApplyTuneResult(ctx, st, &best);
+    }
+
+    return rc;
+}
+
 /* Try to run a potential function and see if it fails. Return TRUE on failure. */
 static int nbVerifyPotentialFunction(const NBodyFlags* nbf, const NBodyCtx* ctx, NBodyState* st)
 {
@@ -165,7 +216,10 @@ static int nbOutputIsUseful(const NBodyFlags* nbf)
         && !nbf->histoutFileName
         && !nbf->printHistogram
         && !nbf->verifyOnly
-        && !nbf->printTiming)
+        && !nbf->snapshotInterval
+        && !nbf->trajectoryFile
+        && !nbf->printTiming
+        && !nbf->tuneSettings)
     {
         mw_printf("Don't you want some kind of result?\n");
         return FALSE;
@@ -191,6 +245,27 @@ NBodyStatus nbRunSystem(const NBodyCtx* ctx, NBodyState* st)
   #if NBODY_OPENCL
     if (st->usesCL)
     {
+        if (ctx->blockLevels > 1)
+        {
+            mw_printf("Block timesteps are not supported with OpenCL\n");
+            return NBODY_UNSUPPORTED;
+        }
+
+        if (ctx->potentialTableTolerance > 0.0)
+        {
+            mw_printf("Warning: the external potential is not tabulated with OpenCL\n");
+        }
+
+        if (st->snapshotInterval)
+        {
+            mw_printf("Warning: periodic snapshots are not written with OpenCL\n");
+        }
+
+        if (st->trajectory)
+        {
+            mw_printf("Warning: trajectories are not written with OpenCL\n");
+        }
+
         return nbRunSystemCL(ctx, st);
     }
   #endif
@@ -303,6 +378,26 @@ int nbMain(const NBodyFlags* nbf)
     nbSetStateFromFlags(st, nbf);
     nbSetCLRequestFromFlags(&clr, nbf);
 
+    if (nbf->tuneSettings || nbf->autoTune)
+    {
+        rc = nbTuneFromFlags(ctx, st, nbf);
+        if (nbStatusIsFatal(rc) || nbf->tuneSettings)
+        {
+            destroyNBodyState(st);
+            return rc;
+        }
+    }
+
+    if (nbf->trajectoryFile && nbOpenTrajectory(st,
+                                                nbf->trajectoryFile,
+                                                (unsigned int) nbf->trajectoryInterval,
+                                                (unsigned int) nbf->trajectoryDecimate,
+                                                nbf->trajectoryStreamOnly))
+    {
+        destroyNBodyState(st);
+        return NBODY_IO_ERROR;
+    }
+
     if (nbCreateSharedScene(st, ctx))
     {
         mw_printf("Failed to create shared scene\n");
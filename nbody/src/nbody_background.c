@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nbody_config.h"
+
+#include "nbody_background.h"
+#include "milkyway_util.h"
+
+#if HAVE_PTHREAD_H && !BOINC_APPLICATION
+  #include <pthread.h>
+  #define NB_BACKGROUND_THREAD 1
+#else
+  #define NB_BACKGROUND_THREAD 0
+#endif
+
+typedef struct _NBodyBackgroundTask
+{
+    NBodyBackgroundJob job;
+    void* data;
+    struct _NBodyBackgroundTask* next;
+} NBodyBackgroundTask;
+
+struct _NBodyBackgroundWriter
+{
+    int failed;          /* Set once any job fails */
+
+  #if NB_BACKGROUND_THREAD
+    int threaded;        /* The thread was started */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    NBodyBackgroundTask* head;   /* Running or next to run */
+    NBodyBackgroundTask* tail;
+    unsigned int pending;
+    int quit;
+  #endif
+};
+
+#if NB_BACKGROUND_THREAD
+
+static void* nbBackgroundWriterThread(void* arg)
+{
+    NBodyBackgroundWriter* w = (NBodyBackgroundWriter*) arg;
+    NBodyBackgroundTask* task;
+    int failed;
+
+    pthread_mutex_lock(&w->lock);
+
+    while (TRUE)
+    {
+        while (!w->head && !w->quit)
+        {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+
+        task = w->head;
+        if (!task)
+        {
+            break;   /* Told to quit with nothing left */
+        }
+
+        /* The task stays queued while it runs, so waiting for the
+         * queue to empty also waits for it */
+        pthread_mutex_unlock(&w->lock);
+        failed = task->job(task->data);
+        pthread_mutex_lock(&w->lock);
+
+        w->head = task->next;
+        if (!w->head)
+        {
+            w->tail = NULL;
+        }
+
+        --w->pending;
+        w->failed |= failed;
+        free(task);
+        pthread_cond_broadcast(&w->cond);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+#endif /* NB_BACKGROUND_THREAD */
+
+NBodyBackgroundWriter* nbStartBackgroundWriter(const char* name)
+{
+    NBodyBackgroundWriter* w;
+
+    w = (NBodyBackgroundWriter*) mwCalloc(1, sizeof(NBodyBackgroundWriter));
+
+  #if NB_BACKGROUND_THREAD
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    w->threaded = !pthread_create(&w->thread, NULL, nbBackgroundWriterThread, w);
+    if (!w->threaded)
+    {
+        /* Still works, just without overlapping the writes */
+        mw_printf("Failed to start %s writer thread\n", name);
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+    }
+  #else
+    (void) name;
+  #endif
+
+    return w;
+}
+
+int nbQueueBackgroundJob(NBodyBackgroundWriter* w, NBodyBackgroundJob job, void* data)
+{
+    int failed;
+
+  #if NB_BACKGROUND_THREAD
+    if (w->threaded)
+    {
+        NBodyBackgroundTask* task;
+
+        task = (NBodyBackgroundTask*) mwMalloc(sizeof(NBodyBackgroundTask));
+        task->job = job;
+        task->data = data;
+        task->next = NULL;
+
+        pthread_mutex_lock(&w->lock);
+        if (w->tail)
+        {
+            w->tail->next = task;
+        }
+        else
+        {
+            w->head = task;
+        }
+        w->tail = task;
+        ++w->pending;
+        failed = w->failed;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+
+        return failed;
+    }
+  #endif
+
+    failed = job(data);
+    w->failed |= failed;
+
+    return w->failed;
+}
+
+int nbWaitBackgroundWriter(NBodyBackgroundWriter* w, unsigned int maxPending)
+{
+  #if NB_BACKGROUND_THREAD
+    if (w->threaded)
+    {
+        int failed;
+
+        pthread_mutex_lock(&w->lock);
+        while (w->pending > maxPending)
+        {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        failed = w->failed;
+        pthread_mutex_unlock(&w->lock);
+
+        return failed;
+    }
+  #endif
+
+    (void) maxPending;
+    return w->failed;
+}
+
+int nbStopBackgroundWriter(NBodyBackgroundWriter* w)
+{
+    int failed;
+
+    if (!w)
+        return FALSE;
+
+  #if NB_BACKGROUND_THREAD
+    if (w->threaded)
+    {
+        pthread_mutex_lock(&w->lock);
+        w->quit = TRUE;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+
+        pthread_join(w->thread, NULL);
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+    }
+  #endif
+
+    failed = w->failed;
+    free(w);
+
+    return failed;
+}
+
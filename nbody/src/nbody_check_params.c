@@ -21,6 +21,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include "nbody_priv.h"
 #include "milkyway_util.h"
 #include "nbody_check_params.h"
+#include "nbody_defaults.h"
 
 mwbool checkSphericalConstants(Spherical* s)
 {
@@ -181,8 +182,43 @@ static int hasAcceptableSteps(const NBodyCtx* ctx)
     return rc;
 }
 
+static int hasAcceptableBlockSteps(const NBodyCtx* ctx)
+{
+    if (ctx->blockLevels < 0 || ctx->blockLevels > MAX_BLOCK_LEVELS)
+    {
+        mw_printf("Number of block step levels must be 0 <= blockLevels <= %d (blockLevels = %d)\n",
+                  MAX_BLOCK_LEVELS, ctx->blockLevels);
+        return TRUE;
+    }
+
+    if (ctx->blockLevels > 1 && mwCheckNormalPosNumEps(ctx->blockEta))
+    {
+        mw_printf("Got an unacceptable block step accuracy parameter (%.15f)\n", ctx->blockEta);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Much below this the table would need to be enormous */
+static int hasAcceptablePotentialTable(const NBodyCtx* ctx)
+{
+    if (!(ctx->potentialTableTolerance >= 0.0 && ctx->potentialTableTolerance < 1.0))
+    {
+        mw_printf("Potential table tolerance must be 0 or between 0 and 1 (got %g)\n", ctx->potentialTableTolerance);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 mwbool checkNBodyCtxConstants(const NBodyCtx* ctx)
 {
-    return hasAcceptableTimes(ctx) || hasAcceptableSteps(ctx) || hasAcceptableEps2(ctx) || hasAcceptableTheta(ctx);
+    return hasAcceptableTimes(ctx)
+        || hasAcceptableSteps(ctx)
+        || hasAcceptableEps2(ctx)
+        || hasAcceptableTheta(ctx)
+        || hasAcceptableBlockSteps(ctx)
+        || hasAcceptablePotentialTable(ctx);
 }
 
@@ -20,441 +20,931 @@
 
 #include "nbody_types.h"
 #include "nbody_checkpoint.h"
+#include "nbody_background.h"
 #include "milkyway_util.h"
 #include "nbody_defaults.h"
 
-#if HAVE_FCNTL_H
-  #include <fcntl.h>
-#endif
+#include <stddef.h>
 
-#if HAVE_WINDOWS_H
-  #include <windows.h>
-#endif
 
-#if HAVE_SYS_MMAN_H
-  #include <sys/mman.h>
-#endif
+/* Checkpoint file, version 2. Nothing in it depends on the layout of
+   the structs or the pointer size, so a checkpoint can be resumed by
+   any build of the same version. Values are in the byte order of the
+   machine that wrote the file, which the endian tag records, and a
+   reader with the other order swaps them. Reals are always stored as
+   double.
 
-#if HAVE_SYS_TYPES_H
-  #include <sys/types.h>
-#endif
+   Name          Type          Notes
+-------------------------------------------------------
+   magic         char[8]       "mwnbody2"
+   endianTag     uint32        0x01020304 as written
+   format        uint32        2
+   majorVersion  uint32        Version of nbody which wrote it
+   minorVersion  uint32
+   flags         uint32        NB_CHECKPOINT_COMPRESSED, NB_CHECKPOINT_BLOCK_STEPS
+   nbody         uint32
+   step          uint32
+   treeIncest    uint32
+   nOrbitTrace   uint32
+   rsize         double
+   nCtxFields    uint32        Number of context values
+   ctx           values        Each context value from ctxFields
+   checksum      uint32        FNV-1a of the columns as stored
+   columns       column[]      See below
+   ending        char[4]       "end"
+
+   Columns, in order:
+     pos x, y, z          double[nbody]
+     vel x, y, z          double[nbody]
+     mass                 double[nbody]
+     type                 int32[nbody]
+     orbitTrace x, y, z   double[nOrbitTrace]
+     level                int32[nbody]    only with NB_CHECKPOINT_BLOCK_STEPS
+     acc x, y, z          double[nbody]   only with NB_CHECKPOINT_BLOCK_STEPS
+
+   Each column is a uint32 element size, uint32 encoding, uint64 count
+   and uint64 stored size followed by the stored bytes. The encoding is
+   either raw, or the bytes of the elements regrouped so that the nth
+   byte of every element is together and then run length encoded.
+ */
 
-#if HAVE_SYS_STAT_H
-  #include <sys/stat.h>
-#endif
+static const char cpMagic[8] = { 'm', 'w', 'n', 'b', 'o', 'd', 'y', '2' };
+static const char tail[] = "end";
 
-#ifndef _WIN32
+#define NB_CHECKPOINT_FORMAT 2
+#define NB_CHECKPOINT_ENDIAN_TAG 0x01020304u
 
-typedef struct
+#define NB_CHECKPOINT_COMPRESSED  (1 << 0)
+#define NB_CHECKPOINT_BLOCK_STEPS (1 << 1)
+
+typedef enum
 {
-    int fd;            /* File descriptor for checkpoint file */
-    char* mptr;        /* mmap'd pointer for checkpoint file */
-    size_t cpFileSize; /* For checking how big the file should be for expected bodies */
-} CheckpointHandle;
+    NB_COLUMN_RAW = 0,
+    NB_COLUMN_SHUFFLE_RLE = 1
+} NBodyColumnEncoding;
 
-#define EMPTY_CHECKPOINT_HANDLE { 1, NULL, 0 }
 
-#else
+/* The context is written value by value from this table */
+typedef enum
+{
+    CP_REAL,
+    CP_INT,
+    CP_UINT,
+    CP_ENUM,
+    CP_BOOL,
+    CP_TIME
+} CheckpointFieldType;
 
 typedef struct
 {
-    HANDLE file;
-    HANDLE mapFile;
-    char* mptr;
-    DWORD cpFileSize;
-} CheckpointHandle;
-
-#define EMPTY_CHECKPOINT_HANDLE { INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, NULL, 0 }
-
-#endif /* _WIN32 */
-
-
-/* Checkpoint file: Very simple binary "format"
-   Name        Type         Values     Notes
--------------------------------------------------------
-   NBodyCheckpointHeader
-   bodytab       Body[]     anything   Array of bodies
-   orbitTrace    mwvector[] anything   Array of center of mass history
-   ending        string     "end"      Kind of dumb and pointless
- */
+    size_t offset;
+    CheckpointFieldType type;
+} CheckpointField;
 
-static const char hdr[] = "mwnbody";
-static const char tail[] = "end";
+#define CTX_FIELD(field, type) { offsetof(NBodyCtx, field), type }
 
+static const CheckpointField ctxFields[] =
+{
+    CTX_FIELD(eps2,                    CP_REAL),
+    CTX_FIELD(theta,                   CP_REAL),
+    CTX_FIELD(timestep,                CP_REAL),
+    CTX_FIELD(timeEvolve,              CP_REAL),
+    CTX_FIELD(treeRSize,               CP_REAL),
+    CTX_FIELD(sunGCDist,               CP_REAL),
+    CTX_FIELD(criterion,               CP_ENUM),
+    CTX_FIELD(potentialType,           CP_ENUM),
+    CTX_FIELD(useQuad,                 CP_BOOL),
+    CTX_FIELD(allowIncest,             CP_BOOL),
+    CTX_FIELD(quietErrors,             CP_BOOL),
+    CTX_FIELD(useMortonTree,           CP_BOOL),
+    CTX_FIELD(useInteractionLists,     CP_BOOL),
+    CTX_FIELD(checkpointT,             CP_TIME),
+    CTX_FIELD(nStep,                   CP_UINT),
+    CTX_FIELD(blockLevels,             CP_INT),
+    CTX_FIELD(blockEta,                CP_REAL),
+    CTX_FIELD(potentialTableTolerance, CP_REAL),
+
+    CTX_FIELD(pot.sphere[0].type,      CP_ENUM),
+    CTX_FIELD(pot.sphere[0].mass,      CP_REAL),
+    CTX_FIELD(pot.sphere[0].scale,     CP_REAL),
+
+    CTX_FIELD(pot.disk.type,           CP_ENUM),
+    CTX_FIELD(pot.disk.mass,           CP_REAL),
+    CTX_FIELD(pot.disk.scaleLength,    CP_REAL),
+    CTX_FIELD(pot.disk.scaleHeight,    CP_REAL),
+
+    CTX_FIELD(pot.halo.type,           CP_ENUM),
+    CTX_FIELD(pot.halo.vhalo,          CP_REAL),
+    CTX_FIELD(pot.halo.scaleLength,    CP_REAL),
+    CTX_FIELD(pot.halo.flattenZ,       CP_REAL),
+    CTX_FIELD(pot.halo.flattenY,       CP_REAL),
+    CTX_FIELD(pot.halo.flattenX,       CP_REAL),
+    CTX_FIELD(pot.halo.triaxAngle,     CP_REAL),
+    CTX_FIELD(pot.halo.c1,             CP_REAL),
+    CTX_FIELD(pot.halo.c2,             CP_REAL),
+    CTX_FIELD(pot.halo.c3,             CP_REAL)
+};
+
+#define N_CTX_FIELDS (sizeof(ctxFields) / sizeof(ctxFields[0]))
+
+
+/* Everything needed to write a checkpoint, copied out of the state so
+ * the file can be written while the simulation keeps going */
 typedef struct
 {
-    char header[128];                     /* "mwnbody" */
-    uint32_t majorVersion, minorVersion;  /* Version check */
+    NBodyCtx ctx;
     uint32_t nbody;
     uint32_t step;
-    uint32_t realSize;                   /* Does the checkpoint use float or double */
-    uint32_t ptrSize;
-    real rsize;
     uint32_t treeIncest;
     uint32_t nOrbitTrace;
-    NBodyCtx ctx;
-} NBodyCheckpointHeader;
+    uint32_t flags;
+    double rsize;
+
+    double* pos[3];
+    double* vel[3];
+    double* mass;
+    int32_t* type;
+    double* orbitTrace[3];
+    int32_t* level;
+    double* acc[3];
+} NBodyCheckpointSnapshot;
+
+/* A checkpoint copied out of the state for the writer */
+typedef struct
+{
+    NBodyCheckpointSnapshot* snap;
+    char tmpFile[256];
+    char* target;
+} NBodyCheckpointJob;
 
-static const size_t hdrSize = sizeof(NBodyCheckpointHeader) + sizeof(tail);
 
+typedef struct
+{
+    char* buf;
+    size_t len;
+    size_t cap;
+} CheckpointBuffer;
+
+typedef struct
+{
+    const char* p;
+    const char* end;
+    int swap;       /* File has the other byte order */
+    int error;      /* Read past the end */
+} CheckpointReader;
 
 
-static void prepareWriteCheckpointHeader(NBodyCheckpointHeader* cp, const NBodyCtx* ctx, const NBodyState* st)
+static void cpReserve(CheckpointBuffer* b, size_t n)
 {
-    strcpy(cp->header, hdr);
-    cp->realSize = sizeof(real);
-    cp->ptrSize = sizeof(void*);
+    if (b->len + n > b->cap)
+    {
+        b->cap = 2 * b->cap + n + 4096;
+        b->buf = (char*) mwRealloc(b->buf, b->cap);
+    }
+}
 
-    cp->majorVersion = NBODY_VERSION_MAJOR;
-    cp->minorVersion= NBODY_VERSION_MINOR;
+static void cpPutBytes(CheckpointBuffer* b, const void* p, size_t n)
+{
+    cpReserve(b, n);
+    memcpy(&b->buf[b->len], p, n);
+    b->len += n;
+}
 
-    memcpy(&cp->ctx, ctx, sizeof(cp->ctx));
-    cp->nbody = st->nbody;
-    cp->step = st->step;
-    cp->rsize = st->tree.rsize;
-    cp->treeIncest = st->treeIncest;
-    cp->nOrbitTrace = N_ORBIT_TRACE_POINTS;
+static void cpPutU32(CheckpointBuffer* b, uint32_t x)
+{
+    cpPutBytes(b, &x, sizeof(x));
 }
 
-static void readCheckpointHeader(NBodyCheckpointHeader* cp, NBodyCtx* ctx, NBodyState* st)
+static void cpPutU64(CheckpointBuffer* b, uint64_t x)
 {
-    memcpy(ctx, &cp->ctx, sizeof(*ctx));
-    st->nbody = cp->nbody;
-    st->step = cp->step;
-    st->tree.rsize = cp->rsize;
-    st->treeIncest = cp->treeIncest;
+    cpPutBytes(b, &x, sizeof(x));
 }
 
-static int verifyCheckpointHeader(const NBodyCheckpointHeader* cpHdr,
-                                  const CheckpointHandle* cp,
-                                  const NBodyState* st,
-                                  size_t supposedCheckpointSize)
+static void cpPutDouble(CheckpointBuffer* b, double x)
 {
-    if (strncmp(cpHdr->header, hdr, sizeof(cpHdr->header)))
-    {
-        mw_printf("Didn't find header for checkpoint file.\n");
-        return 1;
-    }
+    cpPutBytes(b, &x, sizeof(x));
+}
 
-    /* Make sure the file isn't lying about how many bodies there are */
-    if (supposedCheckpointSize != cp->cpFileSize)
-    {
-        mw_printf("Expected checkpoint file size ("ZU") is incorrect for expected number of bodies "
-                  "(%u bodies, real size "ZU")\n",
-                  supposedCheckpointSize,
-                  st->nbody,
-                  (size_t) cp->cpFileSize);
-        return 1;
-    }
+static void cpSwapBytes(void* p, size_t n)
+{
+    size_t i;
+    unsigned char* c = (unsigned char*) p;
 
-    if (cpHdr->realSize != sizeof(real))
+    for (i = 0; i < n / 2; ++i)
     {
-        mw_printf("Got checkpoint file for wrong type. "
-                  "Expected sizeof(real) = "ZU", got "ZU"\n",
-                  sizeof(real), (size_t) cpHdr->realSize);
-        return 1;
+        unsigned char tmp = c[i];
+        c[i] = c[n - 1 - i];
+        c[n - 1 - i] = tmp;
     }
+}
+
+static const char* cpGetBytes(CheckpointReader* r, size_t n)
+{
+    const char* p = r->p;
 
-    if (cpHdr->ptrSize != sizeof(void*))
+    if (r->error || (size_t) (r->end - r->p) < n)
     {
-        mw_printf("Got checkpoint file for wrong architecture. "
-                  "Expected sizeof(void*) = "ZU", got "ZU"\n", sizeof(void*), (size_t) cpHdr->ptrSize);
-        return 1;
+        r->error = TRUE;
+        return NULL;
     }
 
-    if (   cpHdr->majorVersion != NBODY_VERSION_MAJOR
-        || cpHdr->minorVersion != NBODY_VERSION_MINOR)
+    r->p += n;
+    return p;
+}
+
+static void cpGetValue(CheckpointReader* r, void* x, size_t n)
+{
+    const char* p = cpGetBytes(r, n);
+
+    if (!p)
     {
-        mw_printf("Version mismatch in checkpoint file. File is for %u.%u, But version is %u.%u\n",
-                  cpHdr->majorVersion, cpHdr->minorVersion,
-                  NBODY_VERSION_MAJOR, NBODY_VERSION_MINOR);
-        return 1;
+        memset(x, 0, n);
+        return;
     }
 
-    return 0;
+    memcpy(x, p, n);
+    if (r->swap)
+        cpSwapBytes(x, n);
 }
 
+static uint32_t cpGetU32(CheckpointReader* r)
+{
+    uint32_t x;
+    cpGetValue(r, &x, sizeof(x));
+    return x;
+}
+
+static uint64_t cpGetU64(CheckpointReader* r)
+{
+    uint64_t x;
+    cpGetValue(r, &x, sizeof(x));
+    return x;
+}
 
-#ifndef _WIN32
+static double cpGetDouble(CheckpointReader* r)
+{
+    double x;
+    cpGetValue(r, &x, sizeof(x));
+    return x;
+}
 
-static int nbOpenCheckpointHandle(const NBodyState* st,
-                                  CheckpointHandle* cp,
-                                  const char* filename,
-                                  int writing)
+static uint32_t cpChecksum(const char* p, size_t n)
 {
-    struct stat sb;
+    size_t i;
+    uint32_t h = 2166136261u;
 
-    cp->fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
-    if (cp->fd == -1)
+    for (i = 0; i < n; ++i)
     {
-        mwPerror("Error opening checkpoint '%s'", filename);
-        return TRUE;
+        h ^= (unsigned char) p[i];
+        h *= 16777619u;
     }
 
-    if (fstat(cp->fd, &sb) == -1)
+    return h;
+}
+
+
+static void cpPutCtx(CheckpointBuffer* b, const NBodyCtx* ctx)
+{
+    size_t i;
+    const char* base = (const char*) ctx;
+
+    cpPutU32(b, (uint32_t) N_CTX_FIELDS);
+
+    for (i = 0; i < N_CTX_FIELDS; ++i)
     {
-        mwPerror("Error on fstat() of checkpoint '%s'", filename);
-        return TRUE;
+        const void* p = base + ctxFields[i].offset;
+
+        switch (ctxFields[i].type)
+        {
+            case CP_REAL:
+                cpPutDouble(b, (double) *(const real*) p);
+                break;
+            case CP_INT:
+            case CP_ENUM:
+                cpPutU32(b, (uint32_t) *(const int*) p);
+                break;
+            case CP_UINT:
+                cpPutU32(b, (uint32_t) *(const unsigned int*) p);
+                break;
+            case CP_BOOL:
+                cpPutU32(b, (uint32_t) *(const mwbool*) p);
+                break;
+            case CP_TIME:
+                cpPutU64(b, (uint64_t) (int64_t) *(const time_t*) p);
+                break;
+            default:
+                mw_fail("Bad checkpoint field type: %d\n", ctxFields[i].type);
+        }
     }
+}
+
+static int cpGetCtx(CheckpointReader* r, NBodyCtx* ctx)
+{
+    size_t i;
+    char* base = (char*) ctx;
+    uint32_t nFields = cpGetU32(r);
 
-    if (!S_ISREG(sb.st_mode))
+    if (nFields != N_CTX_FIELDS)
     {
-        mw_printf("Checkpoint '%s' is not a file\n", filename);
+        mw_printf("Checkpoint has %u context values, expected %u\n", nFields, (unsigned int) N_CTX_FIELDS);
         return TRUE;
     }
 
-    if (writing)
+    for (i = 0; i < N_CTX_FIELDS; ++i)
     {
-        cp->cpFileSize = hdrSize + st->nbody * sizeof(Body) + N_ORBIT_TRACE_POINTS * sizeof(mwvector);
-        /* Make the file the right size in case it's a new file */
-        if (ftruncate(cp->fd, cp->cpFileSize) < 0)
+        void* p = base + ctxFields[i].offset;
+
+        switch (ctxFields[i].type)
         {
-            mwPerror("Error ftruncate() on checkpoint '%s'", filename);
-            return TRUE;
+            case CP_REAL:
+                *(real*) p = (real) cpGetDouble(r);
+                break;
+            case CP_INT:
+            case CP_ENUM:
+                *(int*) p = (int) cpGetU32(r);
+                break;
+            case CP_UINT:
+                *(unsigned int*) p = (unsigned int) cpGetU32(r);
+                break;
+            case CP_BOOL:
+                *(mwbool*) p = (mwbool) cpGetU32(r);
+                break;
+            case CP_TIME:
+                *(time_t*) p = (time_t) (int64_t) cpGetU64(r);
+                break;
+            default:
+                mw_fail("Bad checkpoint field type: %d\n", ctxFields[i].type);
         }
     }
-    else
+
+    return r->error;
+}
+
+
+/* PackBits style: a control byte c < 128 is followed by c + 1 literal
+ * bytes, and c > 128 by one byte repeated 257 - c times */
+static size_t nbRunLengthEncode(unsigned char* out, const unsigned char* in, size_t n)
+{
+    size_t i = 0, o = 0;
+
+    while (i < n)
     {
-        cp->cpFileSize = sb.st_size;
-        if (cp->cpFileSize == 0)
+        size_t run = 1;
+
+        while (i + run < n && run < 128 && in[i + run] == in[i])
+            ++run;
+
+        if (run >= 2)
         {
-            mw_printf("Checkpoint '%s' is empty\n", filename);
-            return 1;
+            out[o++] = (unsigned char) (257 - run);
+            out[o++] = in[i];
+            i += run;
+        }
+        else
+        {
+            size_t lit = 1;
+
+            while (   i + lit < n
+                   && lit < 128
+                   && !(i + lit + 1 < n && in[i + lit] == in[i + lit + 1]))
+            {
+                ++lit;
+            }
+
+            out[o++] = (unsigned char) (lit - 1);
+            memcpy(&out[o], &in[i], lit);
+            o += lit;
+            i += lit;
         }
     }
 
-    cp->mptr = mmap(NULL, cp->cpFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, cp->fd, 0);
-    if (cp->mptr == MAP_FAILED)
+    return o;
+}
+
+static int nbRunLengthDecode(unsigned char* out, size_t n, const unsigned char* in, size_t inSize)
+{
+    size_t i = 0, o = 0;
+
+    while (i < inSize)
     {
-        mwPerror("Error mmap()ing checkpoint '%s'", filename);
-        return TRUE;
+        unsigned int c = in[i++];
+
+        if (c < 128)
+        {
+            size_t lit = c + 1;
+
+            if (i + lit > inSize || o + lit > n)
+                return TRUE;
+
+            memcpy(&out[o], &in[i], lit);
+            o += lit;
+            i += lit;
+        }
+        else if (c > 128)
+        {
+            size_t run = 257 - c;
+
+            if (i >= inSize || o + run > n)
+                return TRUE;
+
+            memset(&out[o], in[i++], run);
+            o += run;
+        }
     }
 
-    return FALSE;
+    return o != n;
 }
 
-static int nbCloseCheckpointHandle(CheckpointHandle* cp)
+/* Group the kth byte of every element together. Neighbouring values
+ * usually share their sign and exponent bytes, which then form runs. */
+static void nbShuffleBytes(unsigned char* out, const unsigned char* in, size_t elemSize, size_t count)
 {
-    struct stat sb;
+    size_t i, k;
 
-    /* Clean up the checkpointing */
-    if (cp->fd != -1)
+    for (i = 0; i < count; ++i)
     {
-        if (fstat(cp->fd, &sb) == -1)
+        for (k = 0; k < elemSize; ++k)
         {
-            mwPerror("Error on fstat() closing checkpoint");
-            return TRUE;
+            out[k * count + i] = in[i * elemSize + k];
         }
+    }
+}
 
-        if (close(cp->fd) == -1)
+static void nbUnshuffleBytes(unsigned char* out, const unsigned char* in, size_t elemSize, size_t count)
+{
+    size_t i, k;
+
+    for (i = 0; i < count; ++i)
+    {
+        for (k = 0; k < elemSize; ++k)
         {
-            mwPerror("closing checkpoint file");
-            return TRUE;
+            out[i * elemSize + k] = in[k * count + i];
         }
+    }
+}
+
+static void cpPutColumn(CheckpointBuffer* b, const void* data, size_t elemSize, size_t count, int compress)
+{
+    const size_t headerSize = 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+    size_t size = elemSize * count;
+
+    if (compress && size != 0)
+    {
+        size_t stored;
+        unsigned char* shuffled = (unsigned char*) mwMalloc(size);
 
-        if (cp->mptr && (cp->mptr != MAP_FAILED) && (munmap(cp->mptr, sb.st_size) == -1))
+        nbShuffleBytes(shuffled, (const unsigned char*) data, elemSize, count);
+
+        /* Encode in place after the column header. The worst case is
+         * one extra byte for every 128. */
+        cpReserve(b, headerSize + size + size / 128 + 1);
+        stored = nbRunLengthEncode((unsigned char*) &b->buf[b->len + headerSize], shuffled, size);
+        free(shuffled);
+
+        if (stored < size)
         {
-            mwPerror("munmap() checkpoint");
+            cpPutU32(b, (uint32_t) elemSize);
+            cpPutU32(b, NB_COLUMN_SHUFFLE_RLE);
+            cpPutU64(b, (uint64_t) count);
+            cpPutU64(b, (uint64_t) stored);
+            b->len += stored;
+            return;
+        }
+    }
+
+    cpPutU32(b, (uint32_t) elemSize);
+    cpPutU32(b, NB_COLUMN_RAW);
+    cpPutU64(b, (uint64_t) count);
+    cpPutU64(b, (uint64_t) size);
+    cpPutBytes(b, data, size);
+}
+
+/* Read a column of count elements of elemSize into out */
+static int cpGetColumn(CheckpointReader* r, void* out, size_t elemSize, size_t count)
+{
+    size_t i;
+    const char* p;
+    uint32_t fileElemSize = cpGetU32(r);
+    uint32_t encoding = cpGetU32(r);
+    uint64_t fileCount = cpGetU64(r);
+    uint64_t stored = cpGetU64(r);
+    size_t size = elemSize * count;
+
+    if (r->error || fileElemSize != elemSize || fileCount != count)
+    {
+        mw_printf("Checkpoint column does not match expected size\n");
+        return TRUE;
+    }
+
+    p = cpGetBytes(r, (size_t) stored);
+    if (!p)
+    {
+        mw_printf("Checkpoint column is truncated\n");
+        return TRUE;
+    }
+
+    if (encoding == NB_COLUMN_RAW && stored == size)
+    {
+        memcpy(out, p, size);
+    }
+    else if (encoding == NB_COLUMN_SHUFFLE_RLE)
+    {
+        int failed;
+        unsigned char* shuffled = (unsigned char*) mwMalloc(size);
+
+        failed = nbRunLengthDecode(shuffled, size, (const unsigned char*) p, (size_t) stored);
+        if (!failed)
+            nbUnshuffleBytes((unsigned char*) out, shuffled, elemSize, count);
+        free(shuffled);
+
+        if (failed)
+        {
+            mw_printf("Error decompressing checkpoint column\n");
             return TRUE;
         }
     }
+    else
+    {
+        mw_printf("Bad checkpoint column encoding %u\n", encoding);
+        return TRUE;
+    }
+
+    if (r->swap)
+    {
+        for (i = 0; i < count; ++i)
+            cpSwapBytes((char*) out + i * elemSize, elemSize);
+    }
 
     return FALSE;
 }
 
-#else  /* Windows version */
-
-/* Relevant: http://msdn.microsoft.com/en-us/library/aa366556(VS.85).aspx
-             http://msdn.microsoft.com/en-us/library/aa366548(VS.85).aspx
-             http://msdn.microsoft.com/en-us/library/ms810613.aspx
 
-             Flushing:
-             http://msdn.microsoft.com/en-us/library/aa366563(v=VS.85).aspx
- */
-static int nbOpenCheckpointHandle(const NBodyState* st,
-                                  CheckpointHandle* cp,
-                                  const char* filename,
-                                  int writing)
+static void nbFreeCheckpointSnapshot(NBodyCheckpointSnapshot* snap)
 {
-    SYSTEM_INFO si;
-    DWORD sysGran;
-    DWORD mapViewSize, fileMapStart, fileMapSize;
+    int k;
 
-    /* Try to create a new file */
-    cp->file = CreateFile(filename,
-                          GENERIC_READ | GENERIC_WRITE,
-                          0,     /* Other processes can't touch this */
-                          NULL,
-                          CREATE_NEW,
-                          FILE_FLAG_SEQUENTIAL_SCAN,
-                          NULL);
+    if (!snap)
+        return;
 
-    /* If the checkpoint already exists, open it */
-    if (GetLastError() == ERROR_FILE_EXISTS)
+    for (k = 0; k < 3; ++k)
     {
-        cp->file = CreateFile(filename,
-                              GENERIC_READ | GENERIC_WRITE,
-                              0,     /* Other processes can't touch this */
-                              NULL,
-                              OPEN_EXISTING,
-                              FILE_FLAG_SEQUENTIAL_SCAN,
-                              NULL);
+        free(snap->pos[k]);
+        free(snap->vel[k]);
+        free(snap->orbitTrace[k]);
+        free(snap->acc[k]);
     }
 
-    /* TODO: More filetype checking and stuff */
+    free(snap->mass);
+    free(snap->type);
+    free(snap->level);
+    free(snap);
+}
 
-    if (cp->file == INVALID_HANDLE_VALUE)
+static NBodyCheckpointSnapshot* nbTakeCheckpointSnapshot(const NBodyCtx* ctx, const NBodyState* st)
+{
+    int i, k;
+    const int nbody = st->nbody;
+    const Body* b;
+    NBodyCheckpointSnapshot* snap = (NBodyCheckpointSnapshot*) mwCalloc(1, sizeof(NBodyCheckpointSnapshot));
+
+    snap->ctx = *ctx;
+    snap->nbody = (uint32_t) nbody;
+    snap->step = st->step;
+    snap->treeIncest = (uint32_t) st->treeIncest;
+    snap->nOrbitTrace = N_ORBIT_TRACE_POINTS;
+    snap->rsize = (double) st->tree.rsize;
+    snap->flags = st->compressCheckpoint ? NB_CHECKPOINT_COMPRESSED : 0;
+
+    for (k = 0; k < 3; ++k)
     {
-        mwPerrorW32("Failed to open checkpoint file '%s'\n", filename);
-        return TRUE;
+        snap->pos[k] = (double*) mwMalloc(nbody * sizeof(double));
+        snap->vel[k] = (double*) mwMalloc(nbody * sizeof(double));
+        snap->orbitTrace[k] = (double*) mwMalloc(N_ORBIT_TRACE_POINTS * sizeof(double));
     }
+    snap->mass = (double*) mwMalloc(nbody * sizeof(double));
+    snap->type = (int32_t*) mwMalloc(nbody * sizeof(int32_t));
 
-    if (writing)
+    for (i = 0, b = st->bodytab; i < nbody; ++i, ++b)
     {
-        cp->cpFileSize = (DWORD) (hdrSize + st->nbody * sizeof(Body) + N_ORBIT_TRACE_POINTS * sizeof(mwvector));
+        snap->pos[0][i] = (double) X(Pos(b));
+        snap->pos[1][i] = (double) Y(Pos(b));
+        snap->pos[2][i] = (double) Z(Pos(b));
+
+        snap->vel[0][i] = (double) X(Vel(b));
+        snap->vel[1][i] = (double) Y(Vel(b));
+        snap->vel[2][i] = (double) Z(Vel(b));
+
+        snap->mass[i] = (double) Mass(b);
+        snap->type[i] = (int32_t) Type(b);
     }
-    else
+
+    for (i = 0; i < N_ORBIT_TRACE_POINTS; ++i)
     {
-        /* We don't know how much to expect when reading the file */
-        cp->cpFileSize = GetFileSize(cp->file, NULL);
-        if (cp->cpFileSize == INVALID_FILE_SIZE || cp->cpFileSize == 0)
+        snap->orbitTrace[0][i] = (double) X(st->orbitTrace[i]);
+        snap->orbitTrace[1][i] = (double) Y(st->orbitTrace[i]);
+        snap->orbitTrace[2][i] = (double) Z(st->orbitTrace[i]);
+    }
+
+    /* With block steps most bodies are partway through their step, so
+     * the levels and the accelerations from the start of each body's
+     * step are needed to resume. */
+    if (ctx->blockLevels > 1)
+    {
+        snap->flags |= NB_CHECKPOINT_BLOCK_STEPS;
+        snap->level = (int32_t*) mwMalloc(nbody * sizeof(int32_t));
+
+        for (i = 0; i < nbody; ++i)
+            snap->level[i] = (int32_t) st->bodyArrays->level[i];
+
+        for (k = 0; k < 3; ++k)
         {
-            mwPerrorW32("Invalid checkpoint file size (%ld) or empty checkpoint file '%s'",
-                        cp->cpFileSize, filename);
-            CloseHandle(cp->file);
-            return TRUE;
+            snap->acc[k] = (double*) mwMalloc(nbody * sizeof(double));
+            for (i = 0; i < nbody; ++i)
+                snap->acc[k][i] = (double) st->bodyArrays->acc[k][i];
         }
     }
 
-    GetSystemInfo(&si);
-    sysGran = si.dwAllocationGranularity;
-    fileMapStart = 0;
-    mapViewSize = cp->cpFileSize;
-    fileMapSize = cp->cpFileSize;
+    return snap;
+}
 
-    cp->mapFile = CreateFileMapping(cp->file,
-                                    NULL,
-                                    PAGE_READWRITE,
-                                    0,
-                                    fileMapSize,
-                                    NULL);
-    if (cp->mapFile == NULL)
+/* Encode the snapshot and write it to the file */
+static int nbWriteCheckpointSnapshot(const NBodyCheckpointSnapshot* snap, const char* filename)
+{
+    int k;
+    int failed = FALSE;
+    uint32_t checksum;
+    size_t checksumPos, columnsStart;
+    FILE* f;
+    CheckpointBuffer b = { NULL, 0, 0 };
+    const int compress = (snap->flags & NB_CHECKPOINT_COMPRESSED) != 0;
+
+    cpPutBytes(&b, cpMagic, sizeof(cpMagic));
+    cpPutU32(&b, NB_CHECKPOINT_ENDIAN_TAG);
+    cpPutU32(&b, NB_CHECKPOINT_FORMAT);
+    cpPutU32(&b, NBODY_VERSION_MAJOR);
+    cpPutU32(&b, NBODY_VERSION_MINOR);
+    cpPutU32(&b, snap->flags);
+    cpPutU32(&b, snap->nbody);
+    cpPutU32(&b, snap->step);
+    cpPutU32(&b, snap->treeIncest);
+    cpPutU32(&b, snap->nOrbitTrace);
+    cpPutDouble(&b, snap->rsize);
+    cpPutCtx(&b, &snap->ctx);
+
+    checksumPos = b.len;
+    cpPutU32(&b, 0);
+    columnsStart = b.len;
+
+    for (k = 0; k < 3; ++k)
+        cpPutColumn(&b, snap->pos[k], sizeof(double), snap->nbody, compress);
+    for (k = 0; k < 3; ++k)
+        cpPutColumn(&b, snap->vel[k], sizeof(double), snap->nbody, compress);
+    cpPutColumn(&b, snap->mass, sizeof(double), snap->nbody, compress);
+    cpPutColumn(&b, snap->type, sizeof(int32_t), snap->nbody, compress);
+    for (k = 0; k < 3; ++k)
+        cpPutColumn(&b, snap->orbitTrace[k], sizeof(double), snap->nOrbitTrace, compress);
+
+    if (snap->flags & NB_CHECKPOINT_BLOCK_STEPS)
     {
-        mwPerrorW32("Failed to create mapping for checkpoint file '%s'", filename);
+        cpPutColumn(&b, snap->level, sizeof(int32_t), snap->nbody, compress);
+        for (k = 0; k < 3; ++k)
+            cpPutColumn(&b, snap->acc[k], sizeof(double), snap->nbody, compress);
+    }
+
+    checksum = cpChecksum(&b.buf[columnsStart], b.len - columnsStart);
+    memcpy(&b.buf[checksumPos], &checksum, sizeof(checksum));
+
+    cpPutBytes(&b, tail, sizeof(tail));
+
+    f = mw_fopen(filename, "wb");
+    if (!f)
+    {
+        mwPerror("Error opening checkpoint '%s'", filename);
+        free(b.buf);
         return TRUE;
     }
 
-    cp->mptr = (char*) MapViewOfFile(cp->mapFile,
-                                     FILE_MAP_ALL_ACCESS,
-                                     0,
-                                     fileMapStart,
-                                     mapViewSize);
-    if (cp->mptr == NULL)
+    if (fwrite(b.buf, 1, b.len, f) != b.len)
+    {
+        mwPerror("Error writing checkpoint '%s'", filename);
+        failed = TRUE;
+    }
+
+    if (fclose(f))
     {
-        mwPerrorW32("Failed to open checkpoint file view for file '%s'", filename);
+        mwPerror("Error closing checkpoint '%s'", filename);
+        failed = TRUE;
+    }
+
+    free(b.buf);
+    return failed;
+}
+
+/* Write to the temporary file, and then swap the real checkpoint with
+ * it atomically. This should avoid corruption in the event the file
+ * write is interrupted. */
+static int nbWriteCheckpointSnapshotAtomic(const NBodyCheckpointSnapshot* snap,
+                                           const char* tmpFile,
+                                           const char* target)
+{
+    /* Don't update if the file was not written properly; it can't be trusted. */
+    if (nbWriteCheckpointSnapshot(snap, tmpFile))
+    {
+        mw_printf("Failed to write temporary checkpoint file\n");
+        return TRUE;
+    }
+
+    if (mw_rename(tmpFile, target))
+    {
+        mwPerror("Failed to update checkpoint '%s' with temporary", target);
         return TRUE;
     }
 
     return FALSE;
 }
 
-static int nbCloseCheckpointHandle(CheckpointHandle* cp)
+
+static void nbSetVectorComponent(mwvector* v, int k, real x)
 {
-    if (cp->file != INVALID_HANDLE_VALUE)
+    switch (k)
     {
-        if (cp->mptr && !UnmapViewOfFile((LPVOID) cp->mptr))
-        {
-            mwPerrorW32("Error unmapping the checkpoint view object");
-            return TRUE;
-        }
+        case 0:
+            X(*v) = x;
+            break;
+        case 1:
+            Y(*v) = x;
+            break;
+        default:
+            Z(*v) = x;
+            break;
+    }
+}
 
-        if (cp->mapFile && !CloseHandle(cp->mapFile))
-        {
-            mwPerrorW32("Error closing the checkpoint mapping");
-            return TRUE;
-        }
+/* Returns nonzero if the state failed to be thawed */
+static int nbThawState(NBodyCtx* ctx, NBodyState* st, const char* data, size_t size)
+{
+    int i, k;
+    int failed = FALSE;
+    uint32_t endianTag, format, major, minor, flags, nbody, nOrbitTrace, checksum;
+    double* tmp;
+    int32_t* itmp;
+    Body* b;
+    CheckpointReader r;
+
+    r.p = data;
+    r.end = data + size;
+    r.swap = FALSE;
+    r.error = FALSE;
+
+    if (size < sizeof(cpMagic) || memcmp(data, cpMagic, sizeof(cpMagic)))
+    {
+        mw_printf("Didn't find header for checkpoint file.\n");
+        return TRUE;
+    }
+    r.p += sizeof(cpMagic);
 
-        if (cp->file && !CloseHandle(cp->file))
+    endianTag = cpGetU32(&r);
+    if (endianTag != NB_CHECKPOINT_ENDIAN_TAG)
+    {
+        cpSwapBytes(&endianTag, sizeof(endianTag));
+        if (endianTag != NB_CHECKPOINT_ENDIAN_TAG)
         {
-            mwPerrorW32("Error closing checkpoint file");
+            mw_printf("Unknown byte order in checkpoint file\n");
             return TRUE;
         }
+
+        r.swap = TRUE;
     }
 
-    return FALSE;
-}
+    format = cpGetU32(&r);
+    major = cpGetU32(&r);
+    minor = cpGetU32(&r);
+    if (format != NB_CHECKPOINT_FORMAT)
+    {
+        mw_printf("Checkpoint file format %u is not supported, expected %u\n", format, NB_CHECKPOINT_FORMAT);
+        return TRUE;
+    }
 
-#endif /* _WIN32 */
+    if (major != NBODY_VERSION_MAJOR || minor != NBODY_VERSION_MINOR)
+    {
+        mw_printf("Version mismatch in checkpoint file. File is for %u.%u, But version is %u.%u\n",
+                  major, minor,
+                  NBODY_VERSION_MAJOR, NBODY_VERSION_MINOR);
+        return TRUE;
+    }
 
-/* Should be given the same context as the dump. Returns nonzero if the state failed to be thawed */
-static int nbThawState(NBodyCtx* ctx, NBodyState* st, CheckpointHandle* cp)
-{
-    size_t bodySize, traceSize, supposedCheckpointSize;
-    NBodyCheckpointHeader cpHdr;
-    char* p = cp->mptr;
+    flags = cpGetU32(&r);
+    nbody = cpGetU32(&r);
+    st->step = cpGetU32(&r);
+    st->treeIncest = (int) cpGetU32(&r);
+    nOrbitTrace = cpGetU32(&r);
+    st->tree.rsize = (real) cpGetDouble(&r);
 
-    memset(&cpHdr, 0, sizeof(cpHdr));
-    memcpy(&cpHdr, p, sizeof(cpHdr));
-    p += sizeof(cpHdr);
+    if (cpGetCtx(&r, ctx))
+    {
+        mw_printf("Failed to read context from checkpoint\n");
+        return TRUE;
+    }
 
-    readCheckpointHeader(&cpHdr, ctx, st);
+    checksum = cpGetU32(&r);
+    if (r.error || nbody == 0 || nOrbitTrace != N_ORBIT_TRACE_POINTS)
+    {
+        mw_printf("Checkpoint header is invalid (%u bodies, %u orbit trace points)\n", nbody, nOrbitTrace);
+        return TRUE;
+    }
 
-    assert(cp->cpFileSize != 0);
-    bodySize = st->nbody * sizeof(Body);
-    traceSize = cpHdr.nOrbitTrace * sizeof(mwvector);
-    supposedCheckpointSize = hdrSize + bodySize + traceSize;
+    if (   (size_t) (r.end - r.p) < sizeof(tail)
+        || strncmp(r.end - sizeof(tail), tail, sizeof(tail)))
+    {
+        mw_printf("Failed to find end marker in checkpoint file.\n");
+        return TRUE;
+    }
+    r.end -= sizeof(tail);
 
-    if (verifyCheckpointHeader(&cpHdr, cp, st, supposedCheckpointSize))
+    if (cpChecksum(r.p, (size_t) (r.end - r.p)) != checksum)
     {
+        mw_printf("Checkpoint checksum does not match\n");
         return TRUE;
     }
 
+    st->nbody = (int) nbody;
+    st->bodytab = (Body*) mwCallocA(nbody, sizeof(Body));
+    st->orbitTrace = (mwvector*) mwCallocA(N_ORBIT_TRACE_POINTS, sizeof(mwvector));
 
-    /* Read the bodies */
-    st->bodytab = (Body*) mwMallocA(bodySize);
-    memcpy(st->bodytab, p, bodySize);
-    p += bodySize;
+    tmp = (double*) mwMalloc((nbody > N_ORBIT_TRACE_POINTS ? nbody : N_ORBIT_TRACE_POINTS) * sizeof(double));
+    itmp = (int32_t*) mwMalloc(nbody * sizeof(int32_t));
 
-    st->orbitTrace = (mwvector*) mwMallocA(traceSize);
-    memcpy(st->orbitTrace, p, traceSize);
-    p += traceSize;
+    for (k = 0; k < 3 && !failed; ++k)
+    {
+        failed |= cpGetColumn(&r, tmp, sizeof(double), nbody);
+        for (i = 0, b = st->bodytab; i < st->nbody; ++i, ++b)
+            nbSetVectorComponent(&Pos(b), k, (real) tmp[i]);
+    }
 
-    if (strncmp(p, tail, sizeof(tail)))
+    for (k = 0; k < 3 && !failed; ++k)
     {
-        free(st->bodytab);
-        st->bodytab = NULL;
+        failed |= cpGetColumn(&r, tmp, sizeof(double), nbody);
+        for (i = 0, b = st->bodytab; i < st->nbody; ++i, ++b)
+            nbSetVectorComponent(&Vel(b), k, (real) tmp[i]);
+    }
 
-        free(st->orbitTrace);
-        st->orbitTrace = NULL;
+    if (!failed)
+    {
+        failed |= cpGetColumn(&r, tmp, sizeof(double), nbody);
+        for (i = 0, b = st->bodytab; i < st->nbody; ++i, ++b)
+            Mass(b) = (real) tmp[i];
+    }
 
-        mw_printf("Failed to find end marker in checkpoint file.\n");
-        return TRUE;
+    if (!failed)
+    {
+        failed |= cpGetColumn(&r, itmp, sizeof(int32_t), nbody);
+        for (i = 0, b = st->bodytab; i < st->nbody; ++i, ++b)
+            Type(b) = (body_t) itmp[i];
     }
 
-    return FALSE;
-}
+    for (k = 0; k < 3 && !failed; ++k)
+    {
+        failed |= cpGetColumn(&r, tmp, sizeof(double), N_ORBIT_TRACE_POINTS);
+        for (i = 0; i < N_ORBIT_TRACE_POINTS; ++i)
+            nbSetVectorComponent(&st->orbitTrace[i], k, (real) tmp[i]);
+    }
 
-static void nbFreezeState(const NBodyCtx* ctx, const NBodyState* st, CheckpointHandle* cp)
-{
-    const size_t bodySize =  st->nbody * sizeof(Body);
-    const size_t traceSize = N_ORBIT_TRACE_POINTS * sizeof(mwvector);
-    char* p = cp->mptr;
-    NBodyCheckpointHeader cpHdr;
+    if ((flags & NB_CHECKPOINT_BLOCK_STEPS) && !failed)
+    {
+        st->bodyArrays = nbNewBodyArrays(st->nbody);
+
+        failed |= cpGetColumn(&r, itmp, sizeof(int32_t), nbody);
+        for (i = 0; i < st->nbody; ++i)
+            st->bodyArrays->level[i] = (int) itmp[i];
+
+        for (k = 0; k < 3 && !failed; ++k)
+        {
+            failed |= cpGetColumn(&r, tmp, sizeof(double), nbody);
+            for (i = 0; i < st->nbody; ++i)
+                st->bodyArrays->acc[k][i] = (real) tmp[i];
+        }
+    }
+
+    free(tmp);
+    free(itmp);
+
+    if (failed || r.p != r.end)
+    {
+        mw_printf("Failed to read bodies from checkpoint file\n");
 
-    memset(&cpHdr, 0, sizeof(cpHdr));
-    prepareWriteCheckpointHeader(&cpHdr, ctx, st);
+        mwFreeA(st->bodytab);
+        st->bodytab = NULL;
 
-    memcpy(p, &cpHdr, sizeof(cpHdr));
-    p += sizeof(cpHdr);
+        mwFreeA(st->orbitTrace);
+        st->orbitTrace = NULL;
 
-    /* The main piece of state*/
-    memcpy(p, st->bodytab, bodySize);
-    p += bodySize;
+        nbFreeBodyArrays(st->bodyArrays);
+        st->bodyArrays = NULL;
 
-    memcpy(p, st->orbitTrace, traceSize);
-    p += traceSize;
+        return TRUE;
+    }
 
-    strcpy(p, tail);
+    return FALSE;
 }
 
 /* Open the temporary checkpoint file for writing */
@@ -483,64 +973,32 @@ int nbResolvedCheckpointExists(const NBodyState* st)
     return mw_file_exists(st->checkpointResolved);
 }
 
-/* Try to open a checkpoint with a few tries if the open fails.
-   This is in case of weird/rare failures like interrupted system calls.
- */
-static int nbOpenCheckpointHandleWithAttempts(const NBodyState* st,
-                                              CheckpointHandle* cp,
-                                              const char* filename,
-                                              int writing)
-{
-    unsigned int tries = 0;
-    const unsigned int maxTries = 5;
-
-    do
-    {
-        if (!nbOpenCheckpointHandle(st, cp, filename, writing))
-            break;
-
-        if (nbCloseCheckpointHandle(cp))
-            return TRUE;
-
-        ++tries;
-        mwMilliSleep(10);
-    }
-    while (tries < maxTries);
-
-    if (tries >= maxTries)
-    {
-        mw_printf("Failed to open checkpoint '%s' after %d tries\n", filename, tries);
-        return TRUE;
-    }
-
-    return FALSE;
-}
-
 /* Read the actual checkpoint file to resume */
 int nbReadCheckpoint(NBodyCtx* ctx, NBodyState* st)
 {
-    CheckpointHandle cp = EMPTY_CHECKPOINT_HANDLE;
+    int failed;
+    size_t size = 0;
+    char* data;
 
-    if (nbOpenCheckpointHandleWithAttempts(st, &cp, st->checkpointResolved, FALSE))
+    data = mwReadFileWithSize(st->checkpointResolved, &size);
+    if (!data)
     {
         mw_printf("Opening checkpoint '%s' for resuming failed\n", st->checkpointResolved);
-        nbCloseCheckpointHandle(&cp);
         return TRUE;
     }
 
-    if (nbThawState(ctx, st, &cp))
-    {
-        nbCloseCheckpointHandle(&cp);
-        return TRUE;
-    }
+    failed = nbThawState(ctx, st, data, size);
+    free(data);
 
-    if (nbCloseCheckpointHandle(&cp))
+    if (failed)
     {
         return TRUE;
     }
 
     /* Make sure state is ready to use */
-    st->acctab = (mwvector*) mwCallocA(st->nbody, sizeof(mwvector));
+    if (!st->bodyArrays)
+        st->bodyArrays = nbNewBodyArrays(st->nbody);
+    nbGatherBodyArrays(st);
 
     return FALSE;
 }
@@ -549,49 +1007,89 @@ int nbReadCheckpoint(NBodyCtx* ctx, NBodyState* st)
  * multiple tests running at a time */
 int nbWriteCheckpointWithTmpFile(const NBodyCtx* ctx, const NBodyState* st, const char* tmpFile)
 {
-    int failed = FALSE;
-    CheckpointHandle cp = EMPTY_CHECKPOINT_HANDLE;
+    int failed;
+    NBodyCheckpointSnapshot* snap;
 
     assert(st->checkpointResolved);
 
-    if (nbOpenCheckpointHandleWithAttempts(st, &cp, tmpFile, TRUE))
+    snap = nbTakeCheckpointSnapshot(ctx, st);
+    failed = nbWriteCheckpointSnapshotAtomic(snap, tmpFile, st->checkpointResolved);
+    nbFreeCheckpointSnapshot(snap);
+
+    if (failed)
     {
-        return TRUE;
+        mw_printf("Failed to write checkpoint\n");
     }
 
-    nbFreezeState(ctx, st, &cp);
+    return failed;
+}
+
+static void nbCheckpointTmpFileName(char* buf, size_t size)
+{
+    snprintf(buf, size, "nbody_checkpoint_tmp_%d", (int) getpid());
+}
 
-    if (nbCloseCheckpointHandle(&cp))
+int nbWriteCheckpoint(const NBodyCtx* ctx, const NBodyState* st)
+{
+    char path[256];
+
+    nbCheckpointTmpFileName(path, sizeof(path));
+
+    return nbWriteCheckpointWithTmpFile(ctx, st, path);
+}
+
+static int nbWriteCheckpointJob(void* data)
+{
+    int failed;
+    NBodyCheckpointJob* job = (NBodyCheckpointJob*) data;
+
+    failed = nbWriteCheckpointSnapshotAtomic(job->snap, job->tmpFile, job->target);
+    if (failed)
     {
-        mw_printf("Failed to properly close temporary checkpoint file\n");
-        failed = TRUE;
+        mw_printf("Failed to write checkpoint\n");
     }
 
-    /* Swap the real checkpoint with the temporary atomically. This
-     * should avoid corruption in the event the file write is
-     * interrupted. */
-    /* Don't update if the file was not closed properly; it can't be trusted. */
-    if (!failed && mw_rename(tmpFile, st->checkpointResolved))
+    nbFreeCheckpointSnapshot(job->snap);
+    free(job->target);
+    free(job);
+
+    return failed;
+}
+
+/* Copy what is needed out of the state and write it on another
+ * thread, so the step loop only waits for the copy. Only one
+ * checkpoint is written at a time. */
+int nbWriteCheckpointBackground(const NBodyCtx* ctx, NBodyState* st)
+{
+    NBodyCheckpointJob* job;
+
+    assert(st->checkpointResolved);
+
+    if (!st->checkpointWriter)
     {
-        mwPerror("Failed to update checkpoint '%s' with temporary", st->checkpointResolved);
-        failed = TRUE;
+        st->checkpointWriter = nbStartBackgroundWriter("checkpoint");
     }
 
-    if (failed)
+    if (nbWaitBackgroundWriter(st->checkpointWriter, 0))
     {
-        mw_printf("Failed to write checkpoint\n");
+        return TRUE;
     }
 
-    return failed;
+    job = (NBodyCheckpointJob*) mwCalloc(1, sizeof(NBodyCheckpointJob));
+    job->snap = nbTakeCheckpointSnapshot(ctx, st);
+    job->target = strdup(st->checkpointResolved);
+    nbCheckpointTmpFileName(job->tmpFile, sizeof(job->tmpFile));
+
+    return nbQueueBackgroundJob(st->checkpointWriter, nbWriteCheckpointJob, job);
 }
 
-int nbWriteCheckpoint(const NBodyCtx* ctx, const NBodyState* st)
+int nbFinishCheckpoint(NBodyState* st)
 {
-    char path[256];
+    int failed = nbStopBackgroundWriter(st->checkpointWriter);
 
-    snprintf(path, sizeof(path), "nbody_checkpoint_tmp_%d", (int) getpid());
+    st->checkpointWriter = NULL;
 
-    return nbWriteCheckpointWithTmpFile(ctx, st, path);
+    return failed;
 }
 
 int nbTimeToCheckpoint(const NBodyCtx* ctx, NBodyState* st)
@@ -25,6 +25,16 @@
 #include "nbody_chisq.h"
 #include "milkyway_util.h"
 #include "nbody_emd.h"
+#include "nbody_show.h"
+
+#include <ctype.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+  #include <dirent.h>
+#else
+  #include <windows.h>
+#endif
 
 
 /* From the range of a histogram, find the number of bins */
@@ -612,6 +622,43 @@ NBodyHistogram* nbCreateHistogram(const NBodyCtx* ctx,        /* Simulation cont
 }
 
 
+/* Parse a "useBin lambda count err" histogram line. Returns TRUE if
+ * the line isn't one. This is done by hand since sscanf is most of the
+ * cost of reading a histogram, which adds up when matching many. */
+static mwbool nbParseHistogramLine(const char* line, HistData* histData)
+{
+    char* end;
+    const char* p = line;
+    long useBin;
+    double lambda, count, err;
+
+    useBin = strtol(p, &end, 10);
+    if (end == p)
+        return TRUE;
+
+    p = end;
+    lambda = strtod(p, &end);
+    if (end == p)
+        return TRUE;
+
+    p = end;
+    count = strtod(p, &end);
+    if (end == p)
+        return TRUE;
+
+    p = end;
+    err = strtod(p, &end);
+    if (end == p)
+        return TRUE;
+
+    histData->useBin = (int) useBin;
+    histData->lambda = lambda;
+    histData->count = count;
+    histData->err = err;
+
+    return FALSE;
+}
+
 /* The chisq is calculated by reading a histogram file of normalized data.
    Returns null on failure.
  */
@@ -664,6 +711,13 @@ NBodyHistogram* nbReadHistogram(const char* histogramFile)
         if (lineBuf[0] == '#' || lineBuf[0] == '\n')
             continue;
 
+        /* Almost every line is a bin, so try that first */
+        if (!nbParseHistogramLine(lineBuf, &histData[fileCount]))
+        {
+            ++fileCount;
+            continue;
+        }
+
         if (!readParams)  /* One line is allowed for information on the histogram */
         {
             double phi, theta, psi;
@@ -688,20 +742,9 @@ NBodyHistogram* nbReadHistogram(const char* histogramFile)
             }
         }
 
-        rc = sscanf(lineBuf,
-                    "%d %lf %lf %lf \n",
-                    &histData[fileCount].useBin,
-                    &histData[fileCount].lambda,
-                    &histData[fileCount].count,
-                    &histData[fileCount].err);
-        if (rc != 4)
-        {
-            mw_printf("Error reading histogram line %d: %s", lineNum, lineBuf);
-            error = TRUE;
-            break;
-        }
-
-        ++fileCount;
+        mw_printf("Error reading histogram line %d: %s", lineNum, lineBuf);
+        error = TRUE;
+        break;
     }
 
     fclose(f);
@@ -723,14 +766,43 @@ static double nbWorstCaseEMD(const NBodyHistogram* hist)
     return fabs(hist->data[0].lambda - hist->data[hist->nBin - 1].lambda);
 }
 
+/* Run the general transportation solver on the signatures. Only needed
+ * when the 1D fast path can't be used, i.e. when the data and histogram
+ * totals differ and a partial matching is required. */
+static double nbMatchEMDGeneral(const WeightPosD* dat, const WeightPosD* hist, unsigned int n)
+{
+    unsigned int i;
+    double emd;
+    WeightPos* fHist;
+    WeightPos* fDat;
+
+    fHist = mwCalloc(n, sizeof(WeightPos));
+    fDat = mwCalloc(n, sizeof(WeightPos));
+
+    for (i = 0; i < n; ++i)
+    {
+        fDat[i].weight = (float) dat[i].weight;
+        fDat[i].pos = (float) dat[i].pos;
+        fHist[i].weight = (float) hist[i].weight;
+        fHist[i].pos = (float) hist[i].pos;
+    }
+
+    emd = emdCalc((const float*) fDat, (const float*) fHist, n, n, NULL);
+
+    free(fHist);
+    free(fDat);
+
+    return emd;
+}
+
 double nbMatchEMD(const NBodyHistogram* data, const NBodyHistogram* histogram)
 {
     unsigned int i;
     unsigned int n = data->nBin;
     unsigned int effTotalNum = 0;
     double emd;
-    WeightPos* hist;
-    WeightPos* dat;
+    WeightPosD* hist;
+    WeightPosD* dat;
     double renormalize = 0.0;
 
     if (data->nBin != histogram->nBin)
@@ -759,31 +831,36 @@ double nbMatchEMD(const NBodyHistogram* data, const NBodyHistogram* histogram)
     }
 
     /* We need a correctly normalized histogram with the missing bins filtered out */
-    hist = mwCalloc(n, sizeof(WeightPos));
-    dat = mwCalloc(n, sizeof(WeightPos));
+    hist = mwCalloc(n, sizeof(WeightPosD));
+    dat = mwCalloc(n, sizeof(WeightPosD));
 
     for (i = 0; i < n; ++i)
     {
         if (data->data[i].useBin)
         {
-            dat[i].weight = (float) data->data[i].count;
+            dat[i].weight = data->data[i].count;
             if (histogram->hasRawCounts)
             {
-                double correctedCount = (double) histogram->data[i].rawCount / (double) effTotalNum;
-                hist[i].weight = (float) correctedCount;
+                hist[i].weight = (double) histogram->data[i].rawCount / (double) effTotalNum;
             }
             else
             {
-                hist[i].weight = (float) (histogram->data[i].count / renormalize);
+                hist[i].weight = histogram->data[i].count / renormalize;
             }
         }
         /* Otherwise weight is 0.0 */
 
-        hist[i].pos = (float) histogram->data[i].lambda;
-        dat[i].pos = (float) data->data[i].lambda;
+        hist[i].pos = histogram->data[i].lambda;
+        dat[i].pos = data->data[i].lambda;
     }
 
-    emd = emdCalc((const float*) dat, (const float*) hist, n, n, NULL);
+    /* Histograms are 1D in lambda, so the EMD is just the integrated
+     * difference of the cumulative distributions */
+    emd = emdCalc1D(dat, hist, n, n);
+    if (isnan(emd))
+    {
+        emd = nbMatchEMDGeneral(dat, hist, n);
+    }
 
     free(hist);
     free(dat);
@@ -891,3 +968,278 @@ double nbMatchHistogramFiles(const char* datHist, const char* matchHist)
     return emd;
 }
 
+
+/* Look up a likelihood method by the same name used for
+ * nbodyLikelihoodMethod in input files */
+NBodyLikelihoodMethod nbLikelihoodMethodFromName(const char* name)
+{
+    int i;
+
+    for (i = NBODY_EMD; i <= NBODY_SAHA; ++i)
+    {
+        if (!strcmp(name, showNBodyLikelihoodMethod((NBodyLikelihoodMethod) i)))
+            return (NBodyLikelihoodMethod) i;
+    }
+
+    return NBODY_INVALID_METHOD;
+}
+
+/* Histogram files record the number of bodies in range, so the raw
+ * counts can be recovered for the likelihoods which need them */
+static void nbRecoverRawCounts(NBodyHistogram* histogram)
+{
+    unsigned int i;
+    double totalNum = (double) histogram->totalNum;
+
+    if (histogram->totalNum == 0)
+        return;
+
+    for (i = 0; i < histogram->nBin; ++i)
+    {
+        histogram->data[i].rawCount = (unsigned int) floor(histogram->data[i].count * totalNum + 0.5);
+    }
+
+    histogram->hasRawCounts = TRUE;
+}
+
+static double nbScoreHistogramFile(const NBodyHistogram* data, const char* file, NBodyLikelihoodMethod method)
+{
+    NBodyHistogram* histogram;
+    double score = NAN;
+
+    histogram = nbReadHistogram(file);
+    if (!histogram)
+    {
+        return NAN;
+    }
+
+    if (histogram->nBin != data->nBin)
+    {
+        mw_printf("Histogram '%s' has %u bins, expected %u\n", file, histogram->nBin, data->nBin);
+    }
+    else if (method == NBODY_EMD)
+    {
+        score = nbMatchEMD(data, histogram);
+    }
+    else
+    {
+        nbRecoverRawCounts(histogram);
+        score = nbCalcChisq(data, histogram, method);
+    }
+
+    free(histogram);
+
+    return score;
+}
+
+static void nbAddHistogramName(char*** names, unsigned int* n, unsigned int* size, char* name)
+{
+    if (*n == *size)
+    {
+        *size = *size ? 2 * *size : 64;
+        *names = (char**) mwRealloc(*names, *size * sizeof(char*));
+    }
+
+    (*names)[(*n)++] = name;
+}
+
+static char* nbJoinPath(const char* dir, const char* name)
+{
+    char* path = (char*) mwMalloc(strlen(dir) + strlen(name) + 2);
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+static int nbCompareNames(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/* All regular files in the directory which aren't hidden, sorted so the
+ * table comes out in the same order every time */
+static int nbListHistogramDirectory(const char* dir, char*** names, unsigned int* n, unsigned int* size)
+{
+  #ifndef _WIN32
+    DIR* d;
+    struct dirent* ent;
+    struct stat sb;
+
+    d = opendir(dir);
+    if (!d)
+    {
+        mwPerror("Opening histogram directory '%s'", dir);
+        return TRUE;
+    }
+
+    while ((ent = readdir(d)))
+    {
+        char* path;
+
+        if (ent->d_name[0] == '.')
+            continue;
+
+        path = nbJoinPath(dir, ent->d_name);
+        if (stat(path, &sb) == 0 && (sb.st_mode & S_IFMT) == S_IFREG)
+        {
+            nbAddHistogramName(names, n, size, path);
+        }
+        else
+        {
+            free(path);
+        }
+    }
+
+    closedir(d);
+  #else
+    HANDLE h;
+    WIN32_FIND_DATAA fd;
+    char* pattern;
+
+    pattern = nbJoinPath(dir, "*");
+    h = FindFirstFileA(pattern, &fd);
+    free(pattern);
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        mw_printf("Opening histogram directory '%s'\n", dir);
+        return TRUE;
+    }
+
+    do
+    {
+        if (fd.cFileName[0] != '.' && !(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        {
+            nbAddHistogramName(names, n, size, nbJoinPath(dir, fd.cFileName));
+        }
+    }
+    while (FindNextFileA(h, &fd));
+
+    FindClose(h);
+  #endif /* _WIN32 */
+
+    qsort(*names, *n, sizeof(char*), nbCompareNames);
+
+    return FALSE;
+}
+
+/* One histogram path per line. Blank lines and # comments are skipped */
+static int nbReadHistogramManifest(const char* manifest, char*** names, unsigned int* n, unsigned int* size)
+{
+    char* buf;
+    char* line;
+    char* next;
+
+    buf = mwReadFile(manifest);
+    if (!buf)
+    {
+        mw_printf("Error reading histogram manifest '%s'\n", manifest);
+        return TRUE;
+    }
+
+    for (line = buf; line; line = next)
+    {
+        size_t len;
+
+        next = strchr(line, '\n');
+        if (next)
+        {
+            *next++ = '\0';
+        }
+
+        while (isspace((unsigned char) *line))
+            ++line;
+
+        len = strlen(line);
+        while (len > 0 && isspace((unsigned char) line[len - 1]))
+            line[--len] = '\0';
+
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        nbAddHistogramName(names, n, size, strdup(line));
+    }
+
+    free(buf);
+
+    return FALSE;
+}
+
+/* Score every model histogram in a directory or listed in a manifest
+ * against one data histogram, and print a table of the results.
+ *
+ * The data histogram is only read once, and the models are read and
+ * scored in parallel. Models which fail to read or match are reported
+ * with a likelihood of nan. Returns the number of those, or -1 if the
+ * batch couldn't be run at all. */
+int nbMatchHistogramBatch(FILE* f, const char* datHist, const char* models, NBodyLikelihoodMethod method)
+{
+    int i;
+    int nFail = 0;
+    unsigned int n = 0;
+    unsigned int size = 0;
+    char** names = NULL;
+    double* scores;
+    NBodyHistogram* data;
+    struct stat sb;
+    int failed;
+
+    data = nbReadHistogram(datHist);
+    if (!data)
+    {
+        return -1;
+    }
+
+    if (stat(models, &sb) == 0 && (sb.st_mode & S_IFMT) == S_IFDIR)
+    {
+        failed = nbListHistogramDirectory(models, &names, &n, &size);
+    }
+    else
+    {
+        failed = nbReadHistogramManifest(models, &names, &n, &size);
+    }
+
+    if (failed || n == 0)
+    {
+        if (!failed)
+            mw_printf("No histograms found in '%s'\n", models);
+
+        for (i = 0; i < (int) n; ++i)
+            free(names[i]);
+        free(names);
+        free(data);
+        return -1;
+    }
+
+    scores = (double*) mwMalloc(n * sizeof(double));
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) shared(scores, names, data) schedule(dynamic)
+  #endif
+    for (i = 0; i < (int) n; ++i)
+    {
+        scores[i] = nbScoreHistogramFile(data, names[i], method);
+    }
+
+    fprintf(f,
+            "# data = %s\n"
+            "# method = %s\n"
+            "# n = %u\n"
+            "#\n"
+            "# likelihood histogram\n",
+            datHist,
+            showNBodyLikelihoodMethod(method),
+            n);
+
+    for (i = 0; i < (int) n; ++i)
+    {
+        fprintf(f, "%.15f %s\n", scores[i], names[i]);
+        nFail += isnan(scores[i]) != 0;
+        free(names[i]);
+    }
+
+    free(names);
+    free(scores);
+    free(data);
+
+    return nFail;
+}
+
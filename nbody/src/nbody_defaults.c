@@ -38,11 +38,18 @@ const NBodyCtx defaultNBodyCtx =
     /* .useQuad         */  DEFAULT_USE_QUADRUPOLE_MOMENTS,
     /* .allowIncest     */  DEFAULT_ALLOW_INCEST,
     /* .quietErrors     */  DEFAULT_QUIET_ERRORS,
+    /* .useMortonTree   */  DEFAULT_USE_MORTON_TREE,
+    /* .useInteractionLists */  DEFAULT_USE_INTERACTION_LISTS,
 
 
     /* .checkpointT     */  NOBOINC_DEFAULT_CHECKPOINT_PERIOD,
     /* .nStep           */  0,
 
+    /* .blockLevels     */  DEFAULT_BLOCK_LEVELS,
+    /* .blockEta        */  DEFAULT_BLOCK_ETA,
+
+    /* .potentialTableTolerance */ 0.0,
+
     /* .pot             */  EMPTY_POTENTIAL
 };
 
@@ -1244,3 +1244,71 @@ float emdCalc(const float* RESTRICT signature_arr1,
     return emd;
 }
 
+/* In 1 dimension with the L1 ground distance, the EMD between
+ * signatures of equal total weight is the integral of the absolute
+ * difference of their cumulative distributions. Both signatures are
+ * walked together in position order, so this is O(size1 + size2) and
+ * needs no cost matrix.
+ *
+ * Positions must be in nondecreasing order. If the totals differ, the
+ * general solver's partial matching against a dummy cluster is
+ * required, and EMD_INVALID is returned so the caller can fall back to
+ * emdCalc().
+ */
+double emdCalc1D(const WeightPosD* RESTRICT sig1,
+                 const WeightPosD* RESTRICT sig2,
+                 unsigned int size1,
+                 unsigned int size2)
+{
+    unsigned int i, j;
+    double s_sum = 0.0;
+    double d_sum = 0.0;
+    double cdfDiff = 0.0;
+    double total = 0.0;
+    double x;
+
+    for (i = 0; i < size1; ++i)
+    {
+        if (sig1[i].weight < 0.0 || (i > 0 && sig1[i].pos < sig1[i - 1].pos))
+            return EMD_INVALID;
+        s_sum += sig1[i].weight;
+    }
+
+    for (j = 0; j < size2; ++j)
+    {
+        if (sig2[j].weight < 0.0 || (j > 0 && sig2[j].pos < sig2[j - 1].pos))
+            return EMD_INVALID;
+        d_sum += sig2[j].weight;
+    }
+
+    if (s_sum <= 0.0 || d_sum <= 0.0 || fabs(s_sum - d_sum) >= EMD_EPS * s_sum)
+    {
+        return EMD_INVALID;
+    }
+
+    i = j = 0;
+    x = (size2 == 0 || sig1[0].pos <= sig2[0].pos) ? sig1[0].pos : sig2[0].pos;
+
+    while (i < size1 || j < size2)
+    {
+        double next;
+
+        if (j >= size2 || (i < size1 && sig1[i].pos <= sig2[j].pos))
+        {
+            next = sig1[i].pos;
+            total += fabs(cdfDiff) * (next - x);
+            cdfDiff += sig1[i++].weight;
+        }
+        else
+        {
+            next = sig2[j].pos;
+            total += fabs(cdfDiff) * (next - x);
+            cdfDiff -= sig2[j++].weight;
+        }
+
+        x = next;
+    }
+
+    return total / (s_sum > d_sum ? s_sum : d_sum);
+}
+
@@ -36,6 +36,7 @@
 #include <assert.h>
 #include <iostream>
 #include <stdexcept>
+#include <vector>
 
 static const float zNearView = 0.01f;
 static const float zFarView = 1000.0f;
@@ -150,6 +151,9 @@ private:
     NBodyAxes axes;
     OrbitTrace orbitTrace;
 
+    // a frame from the feed is copied here and checked before upload
+    std::vector<FloatPos> feedBodies;
+
     SceneData sceneData;
     glutil::ViewPole viewPole;
 
@@ -696,6 +700,7 @@ NBodyGraphics::NBodyGraphics(scene_t* scene_, const VisArgs* args)
     : scene(scene_),
       text(NBodyText(&robotoRegular12)),
       orbitTrace(OrbitTrace(scene)),
+      feedBodies(scene->nbody),
       sceneData(SceneData((bool) scene->staticScene)),
       viewPole(glutil::ViewPole(initialViewData, viewScale, glutil::MB_LEFT_BTN)),
       floatState(FloatState(args)),
@@ -801,45 +806,64 @@ void NBodyGraphics::prepareVAOs()
     this->prepareColoredVAO(this->whiteParticleVAO, this->whiteBuffer);
 }
 
-// return TRUE if something was popped from the queue, FALSE if it was empty
-static int nbPopCircularQueue(NBodyCircularQueue* queue,
-                              int nbody,
-                              GLuint positionBuffer,
-                              SceneData* sceneData,
-                              OrbitTrace* trace)
+// return TRUE if a new frame was read, FALSE if there wasn't one or
+// it was overwritten while it was being read, in which case the newer
+// one is read next time. The bodies are copied into staging and only
+// uploaded once the copy is known to be a whole frame.
+static int nbReadFeed(scene_t* scene,
+                      GLuint positionBuffer,
+                      std::vector<FloatPos>& staging,
+                      SceneData* sceneData,
+                      OrbitTrace* trace)
 {
-    int head = OPA_load_int(&queue->head);
-    int tail = OPA_load_int(&queue->tail);
+    NBodyFeed* feed = &scene->feed;
+    int count = OPA_load_int(&feed->published);
+
+    if (count == OPA_load_int(&feed->consumed))
+    {
+        return FALSE;  /* nothing new */
+    }
+
+    int slot = nbFeedSlot(count);
+    NBodyFrameHeader* frame = &feed->frames[slot];
+    int generation = OPA_load_int(&frame->generation);
 
-    if (head == tail)
+    if (generation & 1)
     {
-        return FALSE;  /* queue is empty */
+        return FALSE;  /* being written */
     }
 
-    const SceneInfo* info = &queue->info[head];
-    const GLfloat* bodyData = (const GLfloat*) &queue->bodyData[head * nbody];
+    OPA_read_barrier();
+
+    SceneInfo info = frame->info;
+    memcpy(&staging[0], nbFeedBodies(scene, slot), scene->nbody * sizeof(FloatPos));
+
+    OPA_read_barrier();
+
+    if (OPA_load_int(&frame->generation) != generation)
+    {
+        return FALSE;  /* torn, the copy is thrown away */
+    }
 
     glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, 4 * nbody * sizeof(GLfloat), bodyData);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, scene->nbody * sizeof(FloatPos), &staging[0]);
 
-    sceneData->currentTime = info->currentTime;
-    sceneData->timeEvolve = info->timeEvolve;
-    sceneData->centerOfMass = glm::vec3(info->rootCenterOfMass[0],
-                                        info->rootCenterOfMass[1],
-                                        info->rootCenterOfMass[2]);
+    sceneData->currentTime = info.currentTime;
+    sceneData->timeEvolve = info.timeEvolve;
+    sceneData->centerOfMass = glm::vec3(info.rootCenterOfMass[0],
+                                        info.rootCenterOfMass[1],
+                                        info.rootCenterOfMass[2]);
 
-    trace->addPoint(info->rootCenterOfMass);
+    trace->addPoint(info.rootCenterOfMass);
 
-    head = (head + 1) % NBODY_CIRC_QUEUE_SIZE;
-    OPA_store_int(&queue->head, head);
+    OPA_store_int(&feed->consumed, count);
     return TRUE;
 }
 
 bool NBodyGraphics::readSceneData()
 {
     bool success;
-    success = (bool) nbPopCircularQueue(&this->scene->queue, this->scene->nbody,
-                                        this->positionBuffer, &this->sceneData, &this->orbitTrace);
+    success = (bool) nbReadFeed(this->scene, this->positionBuffer, this->feedBodies, &this->sceneData, &this->orbitTrace);
 
     if (success)
     {
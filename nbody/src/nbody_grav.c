@@ -22,6 +22,9 @@
 #include "nbody_priv.h"
 #include "nbody_util.h"
 #include "nbody_grav.h"
+#include "nbody_grav_lists.h"
+#include "nbody_potential_table.h"
+#include "nbody_potential_program.h"
 #include "milkyway_util.h"
 
 #ifdef _OPENMP
@@ -29,6 +32,11 @@
 #endif /* _OPENMP */
 
 
+/* Test particles are the bodies with exactly zero mass */
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
 /*
  * nbodyGravity: Walk the tree starting at the root to do force
  * calculations.
@@ -112,10 +120,11 @@ static inline mwvector nbGravity(const NBodyCtx* ctx, NBodyState* st, const Body
         }
     }
 
-    if (!skipSelf)
+    if (!skipSelf && Mass(p) != 0.0)
     {
         /* If a body does not encounter itself in its traversal of the
-         * tree, it is "tree incest" */
+         * tree, it is "tree incest". Test particles are never in the
+         * tree to be found. */
 
         nbReportTreeIncest(ctx, st);
     }
@@ -123,21 +132,28 @@ static inline mwvector nbGravity(const NBodyCtx* ctx, NBodyState* st, const Body
     return acc0;
 }
 
-static inline void nbMapForceBody(const NBodyCtx* ctx, NBodyState* st)
+static inline void nbMapForceBody(const NBodyCtx* ctx,
+                                  NBodyState* st,
+                                  const PotentialTable* table,
+                                  const int* active,
+                                  const int nActive)
 {
-    int i;
-    const int nbody = st->nbody;  /* Prevent reload on each loop */
+    int i, k;
     mwvector a, externAcc;
     const Body* b;
 
     const Body* bodies = mw_assume_aligned(st->bodytab, 16);
-    mwvector* accels = mw_assume_aligned(st->acctab, 16);
+    real* ax = mw_assume_aligned(st->bodyArrays->acc[0], 16);
+    real* ay = mw_assume_aligned(st->bodyArrays->acc[1], 16);
+    real* az = mw_assume_aligned(st->bodyArrays->acc[2], 16);
 
   #ifdef _OPENMP
-    #pragma omp parallel for private(i, b, a, externAcc) shared(bodies, accels) schedule(dynamic, 4096 / sizeof(accels[0]))
+    #pragma omp parallel for private(i, k, b, a, externAcc) shared(bodies, ax, ay, az) schedule(dynamic, 4096 / sizeof(Body))
   #endif
-    for (i = 0; i < nbody; ++i)      /* get force on each body */
+    for (k = 0; k < nActive; ++k)      /* get force on each body */
     {
+        i = active ? active[k] : k;
+
         /* Repeat the base hackGrav part in each case or else GCC's
          * -funswitch-loops doesn't happen. Without that this constant
          * gets checked on every body on every step which is dumb.  */
@@ -148,90 +164,210 @@ static inline void nbMapForceBody(const NBodyCtx* ctx, NBodyState* st)
                 b = &bodies[i];
                 a = nbGravity(ctx, st, b);
 
-                externAcc = nbExtAcceleration(&ctx->pot, Pos(b));
+                if (table)
+                    externAcc = nbPotentialTableAcceleration(table, Pos(b));
+                else
+                    externAcc = nbExtAcceleration(&ctx->pot, Pos(b));
                 mw_incaddv(a, externAcc);
-                accels[i] = a;
                 break;
 
             case EXTERNAL_POTENTIAL_NONE:
-                accels[i] = nbGravity(ctx, st, &bodies[i]);
+            case EXTERNAL_POTENTIAL_PROGRAM:   /* Added to the whole list after */
+                a = nbGravity(ctx, st, &bodies[i]);
                 break;
 
             case EXTERNAL_POTENTIAL_CUSTOM_LUA:
                 a = nbGravity(ctx, st, &bodies[i]);
                 nbEvalPotentialClosure(st, Pos(&bodies[i]), &externAcc);
                 mw_incaddv(a, externAcc)
-                accels[i] = a;
                 break;
 
             default:
                 mw_fail("Bad external potential type: %d\n", ctx->potentialType);
         }
+
+        ax[i] = X(a);
+        ay[i] = Y(a);
+        az[i] = Z(a);
+    }
+}
+
+/* Add the external potential to self gravity already in the
+ * acceleration arrays */
+static inline void nbMapExternalAcceleration(const NBodyCtx* ctx,
+                                             NBodyState* st,
+                                             const PotentialTable* table,
+                                             const int* active,
+                                             const int nActive)
+{
+    int i, k;
+    mwvector externAcc;
+
+    const Body* bodies = mw_assume_aligned(st->bodytab, 16);
+    real* ax = mw_assume_aligned(st->bodyArrays->acc[0], 16);
+    real* ay = mw_assume_aligned(st->bodyArrays->acc[1], 16);
+    real* az = mw_assume_aligned(st->bodyArrays->acc[2], 16);
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i, k, externAcc) shared(bodies, ax, ay, az) schedule(dynamic, 4096 / sizeof(Body))
+  #endif
+    for (k = 0; k < nActive; ++k)
+    {
+        i = active ? active[k] : k;
+
+        switch (ctx->potentialType)
+        {
+            case EXTERNAL_POTENTIAL_DEFAULT:
+                if (table)
+                    externAcc = nbPotentialTableAcceleration(table, Pos(&bodies[i]));
+                else
+                    externAcc = nbExtAcceleration(&ctx->pot, Pos(&bodies[i]));
+                break;
+
+            case EXTERNAL_POTENTIAL_NONE:
+            case EXTERNAL_POTENTIAL_PROGRAM:
+                continue;
+
+            case EXTERNAL_POTENTIAL_CUSTOM_LUA:
+                nbEvalPotentialClosure(st, Pos(&bodies[i]), &externAcc);
+                break;
+
+            default:
+                mw_fail("Bad external potential type: %d\n", ctx->potentialType);
+        }
+
+        ax[i] += X(externAcc);
+        ay[i] += Y(externAcc);
+        az[i] += Z(externAcc);
     }
 }
 
-static mwvector nbGravity_Exact(const NBodyCtx* ctx, NBodyState* st, const Body* p)
+/* Add the compiled potential to the acceleration arrays. Threads take
+ * runs of bodies so the program is run on full blocks. */
+static void nbMapProgramAcceleration(NBodyState* st, const int* active, const int nActive)
+{
+    int c, k, n, j;
+    real* pos[3];
+    real* acc[3];
+    const int chunk = 16 * POTENTIAL_PROGRAM_BLOCK;
+    const int nChunk = (nActive + chunk - 1) / chunk;
+    const PotentialProgram* p = st->potProgram;
+    NBodyBodyArrays* ba = st->bodyArrays;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(c, k, n, j, pos, acc) shared(p, ba) schedule(dynamic)
+  #endif
+    for (c = 0; c < nChunk; ++c)
+    {
+        k = c * chunk;
+        n = (nActive - k < chunk) ? nActive - k : chunk;
+
+        if (active)
+        {
+            nbPotentialProgramAddAccelerations(p, &active[k], n, ba->pos, ba->acc);
+        }
+        else
+        {
+            for (j = 0; j < 3; ++j)
+            {
+                pos[j] = &ba->pos[j][k];
+                acc[j] = &ba->acc[j][k];
+            }
+
+            nbPotentialProgramAddAccelerations(p, NULL, n, pos, acc);
+        }
+    }
+}
+
+/* Direct sum over the body arrays. The sources are read as
+ * contiguous streams, and the sum is kept in body order so results
+ * do not depend on how the loop gets vectorized. */
+static mwvector nbGravity_Exact(const NBodyCtx* ctx, const NBodyBodyArrays* ba, const int nbody, const mwvector pos)
 {
     int i;
-    const int nbody = st->nbody;
-    mwvector a = ZERO_VECTOR;
+    mwvector a;
+    real ax = 0.0, ay = 0.0, az = 0.0;
     const real eps2 = ctx->eps2;
+    const real* x = mw_assume_aligned(ba->pos[0], 16);
+    const real* y = mw_assume_aligned(ba->pos[1], 16);
+    const real* z = mw_assume_aligned(ba->pos[2], 16);
+    const real* m = mw_assume_aligned(ba->mass, 16);
 
     for (i = 0; i < nbody; ++i)
     {
-        const Body* b = &st->bodytab[i];
-
-        mwvector dr = mw_subv(Pos(b), Pos(p));
-        real drSq = mw_sqrv(dr) + eps2;
+        real dx = x[i] - X(pos);
+        real dy = y[i] - Y(pos);
+        real dz = z[i] - Z(pos);
+        real drSq = mw_mad(dz, dz, mw_mad(dy, dy, dx * dx)) + eps2;
 
         real drab = mw_sqrt(drSq);
-        real phii = Mass(b) / drab;
+        real phii = m[i] / drab;
         real mor3 = phii / drSq;
 
-        mw_incaddv(a, mw_mulvs(dr, mor3));
+        ax += dx * mor3;
+        ay += dy * mor3;
+        az += dz * mor3;
     }
 
+    SET_VECTOR(a, ax, ay, az);
     return a;
 }
 
-static inline void nbMapForceBody_Exact(const NBodyCtx* ctx, NBodyState* st)
+static inline void nbMapForceBody_Exact(const NBodyCtx* ctx,
+                                        NBodyState* st,
+                                        const PotentialTable* table,
+                                        const int* active,
+                                        const int nActive)
 {
-    int i;
+    int i, k;
     const int nbody = st->nbody;  /* Prevent reload on each loop */
-    mwvector a, externAcc;
-    const Body* b;
+    mwvector a, pos, externAcc;
 
-    Body* bodies = mw_assume_aligned(st->bodytab, 16);
-    mwvector* accels = mw_assume_aligned(st->acctab, 16);
+    NBodyBodyArrays* ba = st->bodyArrays;
+    const real* x = mw_assume_aligned(ba->pos[0], 16);
+    const real* y = mw_assume_aligned(ba->pos[1], 16);
+    const real* z = mw_assume_aligned(ba->pos[2], 16);
+    real* ax = mw_assume_aligned(ba->acc[0], 16);
+    real* ay = mw_assume_aligned(ba->acc[1], 16);
+    real* az = mw_assume_aligned(ba->acc[2], 16);
 
   #ifdef _OPENMP
-    #pragma omp parallel for private(i, b, a, externAcc) shared(bodies, accels) schedule(dynamic, 4096 / sizeof(accels[0]))
+    #pragma omp parallel for private(i, k, a, pos, externAcc) shared(ba, x, y, z, ax, ay, az) schedule(dynamic, 4096 / sizeof(real))
   #endif
-    for (i = 0; i < nbody; ++i)      /* get force on each body */
+    for (k = 0; k < nActive; ++k)      /* get force on each body */
     {
+        i = active ? active[k] : k;
+        SET_VECTOR(pos, x[i], y[i], z[i]);
+
         switch (ctx->potentialType)
         {
             case EXTERNAL_POTENTIAL_DEFAULT:
-                b = &bodies[i];
-                a = nbGravity_Exact(ctx, st, b);
-                mw_incaddv(a, nbExtAcceleration(&ctx->pot, Pos(b)));
-                accels[i] = a;
+                a = nbGravity_Exact(ctx, ba, nbody, pos);
+                if (table)
+                    externAcc = nbPotentialTableAcceleration(table, pos);
+                else
+                    externAcc = nbExtAcceleration(&ctx->pot, pos);
+                mw_incaddv(a, externAcc);
                 break;
 
             case EXTERNAL_POTENTIAL_NONE:
-                accels[i] = nbGravity_Exact(ctx, st, &bodies[i]);
+            case EXTERNAL_POTENTIAL_PROGRAM:
+                a = nbGravity_Exact(ctx, ba, nbody, pos);
                 break;
 
             case EXTERNAL_POTENTIAL_CUSTOM_LUA:
-                a = nbGravity_Exact(ctx, st, &bodies[i]);
-                nbEvalPotentialClosure(st, Pos(&bodies[i]), &externAcc);
+                a = nbGravity_Exact(ctx, ba, nbody, pos);
+                nbEvalPotentialClosure(st, pos, &externAcc);
                 mw_incaddv(a, externAcc);
-                accels[i] = a;
                 break;
 
             default:
                 mw_fail("Bad external potential type: %d\n", ctx->potentialType);
         }
+
+        ax[i] = X(a);
+        ay[i] = Y(a);
+        az[i] = Z(a);
     }
 }
 
@@ -245,21 +381,84 @@ static inline NBodyStatus nbIncestStatusCheck(const NBodyCtx* ctx, const NBodySt
     return NBODY_SUCCESS;
 }
 
-NBodyStatus nbGravMap(const NBodyCtx* ctx, NBodyState* st)
+/* Forces on only the listed bodies. The tree is still built from
+ * every body's current position. A NULL list means all of them. */
+NBodyStatus nbGravMapActive(const NBodyCtx* ctx, NBodyState* st, const int* active, int nActive)
 {
     NBodyStatus rc;
+    NBodyCtx selfCtx;
+    const NBodyCtx* gravCtx = ctx;
+    NBodyPhaseTimes* times = st->phaseTimes;
+    double t0 = 0.0, t1 = 0.0;
+    const PotentialTable* table = nbStatePotentialTable(ctx, st);
+
+    if (ctx->potentialType == EXTERNAL_POTENTIAL_PROGRAM && !st->potProgram)
+    {
+        mw_printf("State is missing the compiled potential\n");
+        return NBODY_LUA_POTENTIAL_ERROR;
+    }
+
+    if (times)
+    {
+        /* Leave the external potential until after self gravity so
+         * each can be timed. The sums are done in the same order. */
+        selfCtx = *ctx;
+        selfCtx.potentialType = EXTERNAL_POTENTIAL_NONE;
+        gravCtx = &selfCtx;
+        t0 = mwGetTime();
+    }
 
     if (mw_likely(ctx->criterion != Exact))
     {
+        nbScatterBodyPositions(st);
         rc = nbMakeTree(ctx, st);
         if (nbStatusIsFatal(rc))
             return rc;
+    }
+    else if (times)
+    {
+        /* The external potential is found from the body positions */
+        nbScatterBodyPositions(st);
+    }
 
-        nbMapForceBody(ctx, st);
+    if (times)
+    {
+        t1 = mwGetTime();
+        times->tree += t1 - t0;
+    }
+
+    if (mw_unlikely(ctx->criterion == Exact))
+    {
+        nbMapForceBody_Exact(gravCtx, st, table, active, nActive);
+    }
+    else if (ctx->useInteractionLists)
+    {
+        rc = nbGravity_Lists(ctx, st, active, nActive);
+        if (nbStatusIsFatal(rc))
+            return rc;
+
+        nbMapExternalAcceleration(gravCtx, st, table, active, nActive);
     }
     else
     {
-        nbMapForceBody_Exact(ctx, st);
+        nbMapForceBody(gravCtx, st, table, active, nActive);
+    }
+
+    if (times)
+    {
+        t0 = mwGetTime();
+        times->force += t0 - t1;
+        nbMapExternalAcceleration(ctx, st, table, active, nActive);
+    }
+
+    if (ctx->potentialType == EXTERNAL_POTENTIAL_PROGRAM)
+    {
+        nbMapProgramAcceleration(st, active, nActive);
+    }
+
+    if (times)
+    {
+        times->external += mwGetTime() - t0;
     }
 
     if (st->potentialEvalError)
@@ -270,3 +469,8 @@ NBodyStatus nbGravMap(const NBodyCtx* ctx, NBodyState* st)
     return nbIncestStatusCheck(ctx, st); /* Check if incest occured during step */
 }
 
+NBodyStatus nbGravMap(const NBodyCtx* ctx, NBodyState* st)
+{
+    return nbGravMapActive(ctx, st, NULL, st->nbody);
+}
+
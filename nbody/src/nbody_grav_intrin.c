@@ -0,0 +1,162 @@
+/*
+ *  Copyright (c) 2010-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Interaction list kernels. This is built once with SSE2 flags and
+ * once with AVX flags, which picks the vector width below. */
+
+#include "nbody_grav_lists.h"
+
+#if defined(__AVX__)
+  #include <immintrin.h>
+
+  typedef __m256d nbvec;
+
+  #define NB_VEC_WIDTH 4
+  #define nbListGravity_INTRIN nbListGravity_AVX
+
+  #define vload(p)    _mm256_loadu_pd(p)
+  #define vstore(p, x) _mm256_storeu_pd(p, x)
+  #define vset1(x)    _mm256_set1_pd(x)
+  #define vzero()     _mm256_setzero_pd()
+  #define vadd(a, b)  _mm256_add_pd(a, b)
+  #define vsub(a, b)  _mm256_sub_pd(a, b)
+  #define vmul(a, b)  _mm256_mul_pd(a, b)
+  #define vdiv(a, b)  _mm256_div_pd(a, b)
+  #define vsqrt(a)    _mm256_sqrt_pd(a)
+  #define vand(a, b)  _mm256_and_pd(a, b)
+  #define vneq(a, b)  _mm256_cmp_pd(a, b, _CMP_NEQ_OQ)
+  #define vlanes()    _mm256_set_pd(3.0, 2.0, 1.0, 0.0)
+
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+
+  typedef __m128d nbvec;
+
+  #define NB_VEC_WIDTH 2
+  #define nbListGravity_INTRIN nbListGravity_SSE2
+
+  #define vload(p)    _mm_loadu_pd(p)
+  #define vstore(p, x) _mm_storeu_pd(p, x)
+  #define vset1(x)    _mm_set1_pd(x)
+  #define vzero()     _mm_setzero_pd()
+  #define vadd(a, b)  _mm_add_pd(a, b)
+  #define vsub(a, b)  _mm_sub_pd(a, b)
+  #define vmul(a, b)  _mm_mul_pd(a, b)
+  #define vdiv(a, b)  _mm_div_pd(a, b)
+  #define vsqrt(a)    _mm_sqrt_pd(a)
+  #define vand(a, b)  _mm_and_pd(a, b)
+  #define vneq(a, b)  _mm_cmpneq_pd(a, b)
+  #define vlanes()    _mm_set_pd(1.0, 0.0)
+
+#else
+  #error "Interaction list kernels need SSE2 or AVX"
+#endif
+
+
+static inline real nbHorizontalSum(nbvec v)
+{
+    int i;
+    double MW_ALIGN_V(32) tmp[NB_VEC_WIDTH];
+    real sum = 0.0;
+
+    vstore(tmp, v);
+    for (i = 0; i < NB_VEC_WIDTH; ++i)
+        sum += tmp[i];
+
+    return sum;
+}
+
+/* One source per lane. The lane holding the body itself is masked
+ * out. The padding has no mass, so it adds zero without a mask. */
+mwvector nbListGravity_INTRIN(const NBodyInteractionList* list, real eps2, mwvector pos, int self)
+{
+    int i;
+    mwvector acc0;
+    nbvec ax = vzero();
+    nbvec ay = vzero();
+    nbvec az = vzero();
+    const nbvec px = vset1(X(pos));
+    const nbvec py = vset1(Y(pos));
+    const nbvec pz = vset1(Z(pos));
+    const nbvec veps2 = vset1(eps2);
+    const nbvec vself = vset1((real) self);
+    const nbvec vwidth = vset1((real) NB_VEC_WIDTH);
+    nbvec index = vlanes();
+
+    for (i = 0; i < list->nMono; i += NB_VEC_WIDTH)
+    {
+        nbvec dx = vsub(vload(&list->mono[0][i]), px);
+        nbvec dy = vsub(vload(&list->mono[1][i]), py);
+        nbvec dz = vsub(vload(&list->mono[2][i]), pz);
+        nbvec drSq = vadd(vadd(vmul(dx, dx), vmul(dy, dy)), vmul(dz, dz));
+        nbvec mask = vneq(index, vself);
+        nbvec drab, mor3;
+
+        drSq = vadd(drSq, veps2);
+        drab = vsqrt(drSq);
+        mor3 = vand(vdiv(vdiv(vload(&list->mono[3][i]), drab), drSq), mask);
+
+        ax = vadd(ax, vmul(mor3, dx));
+        ay = vadd(ay, vmul(mor3, dy));
+        az = vadd(az, vmul(mor3, dz));
+
+        index = vadd(index, vwidth);
+    }
+
+    for (i = 0; i < list->nQuad; i += NB_VEC_WIDTH)
+    {
+        nbvec dx = vsub(vload(&list->quad[0][i]), px);
+        nbvec dy = vsub(vload(&list->quad[1][i]), py);
+        nbvec dz = vsub(vload(&list->quad[2][i]), pz);
+        nbvec drSq = vadd(vadd(vmul(dx, dx), vmul(dy, dy)), vmul(dz, dz));
+        nbvec xx = vload(&list->quad[4][i]);
+        nbvec xy = vload(&list->quad[5][i]);
+        nbvec xz = vload(&list->quad[6][i]);
+        nbvec yy = vload(&list->quad[7][i]);
+        nbvec yz = vload(&list->quad[8][i]);
+        nbvec zz = vload(&list->quad[9][i]);
+        nbvec drab, mor3, qx, qy, qz, drQdr, dr5inv, phiQ;
+
+        drSq = vadd(drSq, veps2);
+        drab = vsqrt(drSq);
+        mor3 = vdiv(vdiv(vload(&list->quad[3][i]), drab), drSq);
+
+        /* Q * dr */
+        qx = vadd(vadd(vmul(xx, dx), vmul(xy, dy)), vmul(xz, dz));
+        qy = vadd(vadd(vmul(xy, dx), vmul(yy, dy)), vmul(yz, dz));
+        qz = vadd(vadd(vmul(xz, dx), vmul(yz, dy)), vmul(zz, dz));
+
+        /* dr * Q * dr */
+        drQdr = vadd(vadd(vmul(qx, dx), vmul(qy, dy)), vmul(qz, dz));
+
+        dr5inv = vdiv(vset1(1.0), vmul(vmul(drSq, drSq), drab));
+        phiQ = vdiv(vmul(vset1(2.5), vmul(dr5inv, drQdr)), drSq);
+        mor3 = vadd(mor3, phiQ);
+
+        ax = vadd(ax, vsub(vmul(mor3, dx), vmul(dr5inv, qx)));
+        ay = vadd(ay, vsub(vmul(mor3, dy), vmul(dr5inv, qy)));
+        az = vadd(az, vsub(vmul(mor3, dz), vmul(dr5inv, qz)));
+    }
+
+    SET_VECTOR(acc0, nbHorizontalSum(ax), nbHorizontalSum(ay), nbHorizontalSum(az));
+
+    return acc0;
+}
+
@@ -0,0 +1,474 @@
+/*
+ *  Copyright (c) 2010-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nbody_priv.h"
+#include "nbody_util.h"
+#include "nbody_grav_lists.h"
+#include "milkyway_util.h"
+#include "milkyway_cpuid.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif /* _OPENMP */
+
+
+/* Same weak import trick as the separation probability dispatch */
+#if !HAVE_AVX || !DOUBLEPREC
+  #define nbListGravity_AVX NULL
+#endif
+
+#if !HAVE_SSE2 || !DOUBLEPREC
+  #define nbListGravity_SSE2 NULL
+#endif
+
+static NBodyListKernel listAVX = nbListGravity_AVX;
+static NBodyListKernel listSSE2 = nbListGravity_SSE2;
+
+static NBodyListKernel listKernel = NULL;
+
+
+/* Plain version of the list kernel with the same arithmetic as the
+ * single body walk in nbGravity() */
+static mwvector nbListGravity(const NBodyInteractionList* list, real eps2, mwvector pos, int self)
+{
+    int i;
+    mwvector acc0 = ZERO_VECTOR;
+
+    for (i = 0; i < list->nMono; ++i)
+    {
+        real drab, phii, mor3;
+        real dx = list->mono[0][i] - X(pos);
+        real dy = list->mono[1][i] - Y(pos);
+        real dz = list->mono[2][i] - Z(pos);
+        real drSq;
+
+        if (i == self)  /* self-interaction */
+            continue;
+
+        drSq = sqr(dx) + sqr(dy) + sqr(dz) + eps2;
+        drab = mw_sqrt(drSq);
+        phii = list->mono[3][i] / drab;
+        mor3 = phii / drSq;
+
+        acc0.x += mor3 * dx;
+        acc0.y += mor3 * dy;
+        acc0.z += mor3 * dz;
+    }
+
+    for (i = 0; i < list->nQuad; ++i)
+    {
+        real drab, phii, mor3, dr5inv, drQdr, phiQ;
+        mwvector Qdr;
+        real dx = list->quad[0][i] - X(pos);
+        real dy = list->quad[1][i] - Y(pos);
+        real dz = list->quad[2][i] - Z(pos);
+        real drSq = sqr(dx) + sqr(dy) + sqr(dz) + eps2;
+
+        drab = mw_sqrt(drSq);
+        phii = list->quad[3][i] / drab;
+        mor3 = phii / drSq;
+
+        Qdr.x = list->quad[4][i] * dx + list->quad[5][i] * dy + list->quad[6][i] * dz;
+        Qdr.y = list->quad[5][i] * dx + list->quad[7][i] * dy + list->quad[8][i] * dz;
+        Qdr.z = list->quad[6][i] * dx + list->quad[8][i] * dy + list->quad[9][i] * dz;
+
+        drQdr = Qdr.x * dx + Qdr.y * dy + Qdr.z * dz;
+        dr5inv = 1.0 / (sqr(drSq) * drab);
+        phiQ = 2.5 * (dr5inv * drQdr) / drSq;
+
+        acc0.x += mor3 * dx + phiQ * dx - dr5inv * Qdr.x;
+        acc0.y += mor3 * dy + phiQ * dy - dr5inv * Qdr.y;
+        acc0.z += mor3 * dz + phiQ * dz - dr5inv * Qdr.z;
+    }
+
+    return acc0;
+}
+
+static NBodyListKernel nbSelectListKernel(void)
+{
+  #if MW_IS_X86
+    int abcd[4];
+
+    mw_cpuid(abcd, 1, 0);
+
+    if (listAVX && mwHasAVX(abcd) && mwOSHasAVXSupport())
+    {
+        return listAVX;
+    }
+
+    if (listSSE2 && mwHasSSE2(abcd))
+    {
+        return listSSE2;
+    }
+  #endif /* MW_IS_X86 */
+
+    return nbListGravity;
+}
+
+
+static void nbGrowListArrays(real** arrays, int nArrays, int n, int newCap)
+{
+    int k;
+
+    for (k = 0; k < nArrays; ++k)
+    {
+        real* a = (real*) mwCallocA(newCap, sizeof(real));
+        if (arrays[k])
+        {
+            memcpy(a, arrays[k], n * sizeof(real));
+            mwFreeA(arrays[k]);
+        }
+        arrays[k] = a;
+    }
+}
+
+static void nbFreeInteractionList(NBodyInteractionList* list)
+{
+    int k;
+
+    for (k = 0; k < 4; ++k)
+        mwFreeA(list->mono[k]);
+    for (k = 0; k < 10; ++k)
+        mwFreeA(list->quad[k]);
+}
+
+static inline void nbListAddMono(NBodyInteractionList* list, const NBodyNode* q)
+{
+    int i = list->nMono++;
+
+    if (i == list->monoCap)
+    {
+        list->monoCap = 2 * list->monoCap + 256;
+        nbGrowListArrays(list->mono, 4, i, list->monoCap);
+    }
+
+    list->mono[0][i] = X(Pos(q));
+    list->mono[1][i] = Y(Pos(q));
+    list->mono[2][i] = Z(Pos(q));
+    list->mono[3][i] = Mass(q);
+}
+
+static inline void nbListAddQuad(NBodyInteractionList* list, const NBodyNode* q)
+{
+    int i = list->nQuad++;
+
+    if (i == list->quadCap)
+    {
+        list->quadCap = 2 * list->quadCap + 256;
+        nbGrowListArrays(list->quad, 10, i, list->quadCap);
+    }
+
+    list->quad[0][i] = X(Pos(q));
+    list->quad[1][i] = Y(Pos(q));
+    list->quad[2][i] = Z(Pos(q));
+    list->quad[3][i] = Mass(q);
+    list->quad[4][i] = Quad(q).xx;
+    list->quad[5][i] = Quad(q).xy;
+    list->quad[6][i] = Quad(q).xz;
+    list->quad[7][i] = Quad(q).yy;
+    list->quad[8][i] = Quad(q).yz;
+    list->quad[9][i] = Quad(q).zz;
+}
+
+/* Pad with zeroed entries so the lengths are a multiple of the vector
+ * width. With no mass or moments they add exactly zero. */
+static void nbPadInteractionList(NBodyInteractionList* list)
+{
+    int k;
+
+    while (list->nMono % NB_LIST_WIDTH != 0)
+    {
+        for (k = 0; k < 4; ++k)
+            list->mono[k][list->nMono] = 0.0;
+        ++list->nMono;
+    }
+
+    while (list->nQuad % NB_LIST_WIDTH != 0)
+    {
+        for (k = 0; k < 10; ++k)
+            list->quad[k][list->nQuad] = 0.0;
+        ++list->nQuad;
+    }
+}
+
+/* Squared distance from the box [lo, hi] to r */
+static inline real nbBoxDistSq(mwvector lo, mwvector hi, mwvector r)
+{
+    real dx = mw_fmax(mw_fmax(X(lo) - X(r), X(r) - X(hi)), 0.0);
+    real dy = mw_fmax(mw_fmax(Y(lo) - Y(r), Y(r) - Y(hi)), 0.0);
+    real dz = mw_fmax(mw_fmax(Z(lo) - Z(r), Z(r) - Z(hi)), 0.0);
+
+    return sqr(dx) + sqr(dy) + sqr(dz);
+}
+
+/* Walk the tree once for the group of bodies order[first, first + n),
+ * collecting what they interact with. A cell is only used whole if it
+ * is far enough away for every point in the group's bounding box, so
+ * each body sees a cell opened whenever nbGravity() would open it for
+ * that body alone.
+ *
+ * self[i] is set to where the group's i'th body is in the monopole
+ * list, or -1 if it isn't there. Returns how many of the group's own
+ * bodies were reached. If any were missed a cell containing them was
+ * accepted, which is tree incest the same as in the single body walk. */
+static int nbWalkGroup(const NBodyCtx* ctx,
+                       const NBodyState* st,
+                       NBodyInteractionList* list,
+                       const int* order,
+                       const int* rank,
+                       int first,
+                       int n,
+                       int* self)
+{
+    int i, found = 0;
+    mwvector lo, hi;
+    const Body* bodies = st->bodytab;
+    const NBodyNode* q = (const NBodyNode*) st->tree.root;
+
+    lo = hi = Pos(&bodies[order[first]]);
+    for (i = first + 1; i < first + n; ++i)
+    {
+        const mwvector* r = &Pos(&bodies[order[i]]);
+
+        X(lo) = mw_fmin(X(lo), X(*r));
+        Y(lo) = mw_fmin(Y(lo), Y(*r));
+        Z(lo) = mw_fmin(Z(lo), Z(*r));
+
+        X(hi) = mw_fmax(X(hi), X(*r));
+        Y(hi) = mw_fmax(Y(hi), Y(*r));
+        Z(hi) = mw_fmax(Z(hi), Z(*r));
+    }
+
+    list->nMono = list->nQuad = 0;
+    for (i = 0; i < n; ++i)
+        self[i] = -1;
+
+    while (q != NULL)
+    {
+        if (isBody(q))
+        {
+            int r = rank[(const Body*) q - bodies];
+
+            if (r >= first && r < first + n)
+            {
+                self[r - first] = list->nMono;
+                ++found;
+            }
+
+            nbListAddMono(list, q);
+            q = Next(q);
+        }
+        else if (nbBoxDistSq(lo, hi, Pos(q)) >= Rcrit2(q))
+        {
+            if (ctx->useQuad)
+                nbListAddQuad(list, q);
+            else
+                nbListAddMono(list, q);
+            q = Next(q);
+        }
+        else
+        {
+            q = More(q);
+        }
+    }
+
+    /* Room for the padding is always there since the capacity grows
+     * in multiples of the width */
+    nbPadInteractionList(list);
+
+    return found;
+}
+
+/* Test particles are the bodies with exactly zero mass */
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+/* Bodies in the order the tree walk reaches them, followed by the
+ * test particles which aren't in the tree, and the position of each
+ * body in that order. Returns how many were reached by the walk, or
+ * -1 if that isn't every body in the tree. */
+static int nbTreeOrder(const NBodyState* st, int* order, int* rank)
+{
+    int i, n = 0, nTree = 0;
+    const NBodyNode* q = (const NBodyNode*) st->tree.root;
+
+    for (i = 0; i < st->nbody; ++i)
+    {
+        if (Mass(&st->bodytab[i]) != 0.0)   /* test particles are left out of the tree */
+            ++nTree;
+    }
+
+    while (q != NULL)
+    {
+        if (isBody(q))
+        {
+            if (n == nTree)
+                return -1;
+
+            order[n] = (int) ((const Body*) q - st->bodytab);
+            rank[order[n]] = n;
+            ++n;
+            q = Next(q);
+        }
+        else
+        {
+            q = More(q);
+        }
+    }
+
+    if (n != nTree)
+        return -1;
+
+    for (i = 0; i < st->nbody; ++i)
+    {
+        if (Mass(&st->bodytab[i]) == 0.0)
+        {
+            order[n] = i;
+            rank[i] = n;
+            ++n;
+        }
+    }
+
+    return nTree;
+}
+
+static int nbGroupHasActive(const char* isActive, const int* order, int first, int n)
+{
+    int i;
+
+    for (i = first; i < first + n; ++i)
+    {
+        if (isActive[order[i]])
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+NBodyStatus nbGravity_Lists(const NBodyCtx* ctx, NBodyState* st, const int* active, int nActive)
+{
+    int g, nTree, nTreeGroup, nGroup;
+    int* order;
+    int* rank;
+    char* isActive = NULL;
+    const int nbody = st->nbody;
+    const Body* bodies = st->bodytab;
+    real* ax = st->bodyArrays->acc[0];
+    real* ay = st->bodyArrays->acc[1];
+    real* az = st->bodyArrays->acc[2];
+
+    if (!listKernel)
+    {
+        listKernel = nbSelectListKernel();
+    }
+
+    order = (int*) mwMalloc(nbody * sizeof(int));
+    rank = (int*) mwMalloc(nbody * sizeof(int));
+
+    nTree = nbTreeOrder(st, order, rank);
+    if (nTree < 0)
+    {
+        mw_printf("Tree walk did not reach every body\n");
+        free(order);
+        free(rank);
+        return NBODY_TREE_STRUCTURE_ERROR;
+    }
+
+    /* Test particles each get their own walk after the groups of
+     * bodies in the tree, which is the same as the single body walk */
+    nTreeGroup = (nTree + NB_GROUP_SIZE - 1) / NB_GROUP_SIZE;
+    nGroup = nTreeGroup + (nbody - nTree);
+
+    /* Groups still follow tree order over all bodies. Only the
+     * inactive ones are skipped, so a group's list is the same as
+     * when every body is stepped. */
+    if (active)
+    {
+        int k;
+
+        isActive = (char*) mwCalloc(nbody, sizeof(char));
+        for (k = 0; k < nActive; ++k)
+            isActive[active[k]] = TRUE;
+    }
+
+  #ifdef _OPENMP
+    #pragma omp parallel private(g) shared(order, rank, isActive, bodies, ax, ay, az, nTree, nTreeGroup, nGroup)
+  #endif
+    {
+        NBodyInteractionList list;
+        int self[NB_GROUP_SIZE];
+
+        memset(&list, 0, sizeof(list));
+
+      #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 1)
+      #endif
+        for (g = 0; g < nGroup; ++g)
+        {
+            int i, first, n, inTree;
+
+            if (g < nTreeGroup)
+            {
+                first = g * NB_GROUP_SIZE;
+                n = (nTree - first < NB_GROUP_SIZE) ? nTree - first : NB_GROUP_SIZE;
+                inTree = n;
+            }
+            else
+            {
+                first = nTree + (g - nTreeGroup);
+                n = 1;
+                inTree = 0;
+            }
+
+            if (isActive && !nbGroupHasActive(isActive, order, first, n))
+                continue;
+
+            if (nbWalkGroup(ctx, st, &list, order, rank, first, n, self) != inTree)
+            {
+                nbReportTreeIncest(ctx, st);
+            }
+
+            for (i = first; i < first + n; ++i)
+            {
+                const int j = order[i];
+                mwvector a;
+
+                if (isActive && !isActive[j])
+                    continue;
+
+                a = listKernel(&list, ctx->eps2, Pos(&bodies[j]), self[i - first]);
+
+                ax[j] = X(a);
+                ay[j] = Y(a);
+                az[j] = Z(a);
+            }
+        }
+
+        nbFreeInteractionList(&list);
+    }
+
+    free(order);
+    free(rank);
+    free(isActive);
+
+    return NBODY_SUCCESS;
+}
+
@@ -25,19 +25,64 @@
 #include "nbody_io.h"
 #include "milkyway_util.h"
 #include "nbody_coordinates.h"
+#include "nbody_background.h"
 
-static void nbPrintSimInfoHeader(FILE* f, const NBodyFlags* nbf, const NBodyCtx* ctx, const NBodyState* st)
+
+/* Binary snapshot, version 1. The columns are written straight from
+   memory, so values are in the byte order of the machine that wrote
+   the file, which the endian tag records. A reader with the other
+   order swaps them. Positions are always Cartesian. Every column
+   starts on an 8 byte boundary, so the file can also be mapped and
+   used in place.
+
+   Name          Type          Notes
+-------------------------------------------------------
+   magic         char[8]       "mwnbsnap"
+   endianTag     uint32        0x01020304 as written
+   format        uint32        1
+   nbody         uint32
+   step          uint32
+   hasMilkyway   uint32
+   reserved      uint32
+   time          double        Simulation time of the snapshot
+   sunGCDist     double        For conversion to lbR
+   centerOfMass  double[3]
+
+   Columns, in order:
+     pos x, y, z   double[nbody]
+     vel x, y, z   double[nbody]
+     mass          double[nbody]
+     ignore        uint8[nbody]   1 if the body's model is ignored
+ */
+
+#define NB_SNAPSHOT_FORMAT 1
+#define NB_SNAPSHOT_ENDIAN_TAG 0x01020304
+#define NB_SNAPSHOT_HEADER_SIZE 72
+
+static const char snapMagic[8] = { 'm', 'w', 'n', 'b', 's', 'n', 'a', 'p' };
+
+/* A snapshot copied out of the state for the writer */
+typedef struct
 {
-    mwvector cmPos;
+    NBodySnapshot* snap;
+    char* filename;
+} NBodySnapshotJob;
 
+static mwvector nbOutputCenterOfMass(const NBodyState* st)
+{
     if (st->tree.root)
     {
-        cmPos = Pos(st->tree.root);
+        return Pos(st->tree.root);
     }
     else
     {
-        cmPos = nbCenterOfMass(st);
+        return nbCenterOfMass(st);
     }
+}
+
+static void nbPrintSimInfoHeader(FILE* f, const NBodyFlags* nbf, const NBodyCtx* ctx, const NBodyState* st)
+{
+    mwvector cmPos = nbOutputCenterOfMass(st);
 
     fprintf(f,
             "cartesian    = %d\n"
@@ -111,30 +156,443 @@ int nbWriteBodies(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* n
         return 1;
     }
 
-    f = mwOpenResolved(nbf->outFileName, nbf->outputBinary ? "wb" : "w");
+    if (nbf->outputBinary)
+    {
+        return nbWriteBodySnapshot(ctx, st, nbf->outFileName);
+    }
+
+    f = mwOpenResolved(nbf->outFileName, "w");
     if (!f)
     {
         mw_printf("Failed to open output file '%s'\n", nbf->outFileName);
         return 1;
     }
 
-    if (nbf->outputBinary)
+    mw_boinc_print(f, "<bodies>\n");
+    rc = nbOutputBodies(f, ctx, st, nbf);
+    mw_boinc_print(f, "</bodies>\n");
+
+    if (fclose(f) < 0)
     {
-        mw_printf("Binary output unimplemented\n");
-        return 1;
+        mwPerror("Error closing output file '%s'", nbf->outFileName);
     }
-    else
+
+    return rc;
+}
+
+
+void nbFreeSnapshot(NBodySnapshot* snap)
+{
+    int k;
+
+    if (!snap)
+        return;
+
+    for (k = 0; k < 3; ++k)
     {
-        mw_boinc_print(f, "<bodies>\n");
-        rc = nbOutputBodies(f, ctx, st, nbf);
-        mw_boinc_print(f, "</bodies>\n");
+        free(snap->pos[k]);
+        free(snap->vel[k]);
     }
 
-    if (fclose(f) < 0)
+    free(snap->mass);
+    free(snap->ignore);
+    free(snap);
+}
+
+static NBodySnapshot* nbAllocSnapshot(uint32_t nbody)
+{
+    int k;
+    NBodySnapshot* snap = (NBodySnapshot*) mwCalloc(1, sizeof(NBodySnapshot));
+
+    snap->nbody = nbody;
+    for (k = 0; k < 3; ++k)
     {
-        mwPerror("Error closing output file '%s'", nbf->outFileName);
+        snap->pos[k] = (double*) mwMalloc(nbody * sizeof(double));
+        snap->vel[k] = (double*) mwMalloc(nbody * sizeof(double));
     }
+    snap->mass = (double*) mwMalloc(nbody * sizeof(double));
+    snap->ignore = (uint8_t*) mwMalloc(nbody * sizeof(uint8_t));
+
+    return snap;
+}
+
+/* Copy the bodies out of the state, which must have bodytab up to date */
+NBodySnapshot* nbTakeSnapshot(const NBodyCtx* ctx, const NBodyState* st)
+{
+    int i;
+    const Body* b;
+    mwvector cmPos;
+    NBodySnapshot* snap = nbAllocSnapshot((uint32_t) st->nbody);
+
+    cmPos = nbOutputCenterOfMass(st);
+
+    snap->step = st->step;
+    snap->time = (double) st->step * (double) ctx->timestep;
+    snap->sunGCDist = (double) ctx->sunGCDist;
+    snap->hasMilkyway = (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT);
+    snap->centerOfMass[0] = (double) X(cmPos);
+    snap->centerOfMass[1] = (double) Y(cmPos);
+    snap->centerOfMass[2] = (double) Z(cmPos);
+
+    for (i = 0, b = st->bodytab; i < st->nbody; ++i, ++b)
+    {
+        snap->pos[0][i] = (double) X(Pos(b));
+        snap->pos[1][i] = (double) Y(Pos(b));
+        snap->pos[2][i] = (double) Z(Pos(b));
+
+        snap->vel[0][i] = (double) X(Vel(b));
+        snap->vel[1][i] = (double) Y(Vel(b));
+        snap->vel[2][i] = (double) Z(Vel(b));
+
+        snap->mass[i] = (double) Mass(b);
+        snap->ignore[i] = (uint8_t) ignoreBody(b);
+    }
+
+    return snap;
+}
+
+static void nbPutU32(unsigned char** p, uint32_t x)
+{
+    memcpy(*p, &x, sizeof(x));
+    *p += sizeof(x);
+}
+
+static void nbPutDouble(unsigned char** p, double x)
+{
+    memcpy(*p, &x, sizeof(x));
+    *p += sizeof(x);
+}
+
+int nbWriteSnapshotFile(const NBodySnapshot* snap, const char* filename)
+{
+    int k;
+    int failed = FALSE;
+    FILE* f;
+    unsigned char header[NB_SNAPSHOT_HEADER_SIZE];
+    unsigned char* p = header;
+    size_t n = snap->nbody;
+
+    memcpy(p, snapMagic, sizeof(snapMagic));
+    p += sizeof(snapMagic);
+    nbPutU32(&p, NB_SNAPSHOT_ENDIAN_TAG);
+    nbPutU32(&p, NB_SNAPSHOT_FORMAT);
+    nbPutU32(&p, snap->nbody);
+    nbPutU32(&p, snap->step);
+    nbPutU32(&p, (uint32_t) snap->hasMilkyway);
+    nbPutU32(&p, 0);
+    nbPutDouble(&p, snap->time);
+    nbPutDouble(&p, snap->sunGCDist);
+    for (k = 0; k < 3; ++k)
+        nbPutDouble(&p, snap->centerOfMass[k]);
+    assert(p == header + sizeof(header));
+
+    f = mwOpenResolved(filename, "wb");
+    if (!f)
+    {
+        mwPerror("Error opening snapshot '%s'", filename);
+        return TRUE;
+    }
+
+    /* Each column goes out in a single write */
+    failed |= (fwrite(header, sizeof(header), 1, f) != 1);
+    for (k = 0; k < 3; ++k)
+        failed |= (fwrite(snap->pos[k], sizeof(double), n, f) != n);
+    for (k = 0; k < 3; ++k)
+        failed |= (fwrite(snap->vel[k], sizeof(double), n, f) != n);
+    failed |= (fwrite(snap->mass, sizeof(double), n, f) != n);
+    failed |= (fwrite(snap->ignore, sizeof(uint8_t), n, f) != n);
+
+    if (failed)
+    {
+        mwPerror("Error writing snapshot '%s'", filename);
+    }
+
+    if (fclose(f))
+    {
+        mwPerror("Error closing snapshot '%s'", filename);
+        failed = TRUE;
+    }
+
+    return failed;
+}
+
+int nbWriteBodySnapshot(const NBodyCtx* ctx, const NBodyState* st, const char* filename)
+{
+    int failed;
+    NBodySnapshot* snap;
+
+    snap = nbTakeSnapshot(ctx, st);
+    failed = nbWriteSnapshotFile(snap, filename);
+    nbFreeSnapshot(snap);
+
+    return failed;
+}
+
+static void nbSwapDoubles(double* x, size_t n)
+{
+    size_t i;
+    unsigned char* p;
+    unsigned char tmp;
+
+    for (i = 0; i < n; ++i)
+    {
+        p = (unsigned char*) &x[i];
+        tmp = p[0]; p[0] = p[7]; p[7] = tmp;
+        tmp = p[1]; p[1] = p[6]; p[6] = tmp;
+        tmp = p[2]; p[2] = p[5]; p[5] = tmp;
+        tmp = p[3]; p[3] = p[4]; p[4] = tmp;
+    }
+}
+
+static uint32_t nbSwapU32(uint32_t x)
+{
+    return ((x & 0xff) << 24) | ((x & 0xff00) << 8) | ((x >> 8) & 0xff00) | (x >> 24);
+}
+
+static uint32_t nbGetU32(const char** p, int swap)
+{
+    uint32_t x;
+
+    memcpy(&x, *p, sizeof(x));
+    *p += sizeof(x);
+    return swap ? nbSwapU32(x) : x;
+}
+
+static double nbGetDouble(const char** p, int swap)
+{
+    double x;
+
+    memcpy(&x, *p, sizeof(x));
+    *p += sizeof(x);
+    if (swap)
+        nbSwapDoubles(&x, 1);
+    return x;
+}
+
+/* Returns NULL on failure */
+NBodySnapshot* nbReadSnapshot(const char* filename)
+{
+    int k;
+    int swap;
+    char* buf;
+    const char* p;
+    size_t size = 0;
+    size_t n;
+    uint32_t tag, format, nbody;
+    NBodySnapshot* snap;
+
+    buf = mwReadFileWithSize(filename, &size);
+    if (!buf)
+    {
+        mw_printf("Failed to read snapshot '%s'\n", filename);
+        return NULL;
+    }
+
+    if (size < NB_SNAPSHOT_HEADER_SIZE || memcmp(buf, snapMagic, sizeof(snapMagic)))
+    {
+        mw_printf("'%s' is not an nbody snapshot\n", filename);
+        free(buf);
+        return NULL;
+    }
+
+    p = buf + sizeof(snapMagic);
+    memcpy(&tag, p, sizeof(tag));
+    swap = (tag != NB_SNAPSHOT_ENDIAN_TAG);
+    if (swap && nbSwapU32(tag) != NB_SNAPSHOT_ENDIAN_TAG)
+    {
+        mw_printf("Snapshot '%s' has bad endian tag 0x%x\n", filename, tag);
+        free(buf);
+        return NULL;
+    }
+    p += sizeof(tag);
+
+    format = nbGetU32(&p, swap);
+    if (format != NB_SNAPSHOT_FORMAT)
+    {
+        mw_printf("Snapshot '%s' has unknown format %u\n", filename, format);
+        free(buf);
+        return NULL;
+    }
+
+    nbody = nbGetU32(&p, swap);
+    n = (size_t) nbody;
+    if (size != NB_SNAPSHOT_HEADER_SIZE + n * (7 * sizeof(double) + sizeof(uint8_t)))
+    {
+        mw_printf("Snapshot '%s' has wrong size for %u bodies\n", filename, nbody);
+        free(buf);
+        return NULL;
+    }
+
+    snap = nbAllocSnapshot(nbody);
+    snap->step = nbGetU32(&p, swap);
+    snap->hasMilkyway = (int) nbGetU32(&p, swap);
+    (void) nbGetU32(&p, swap);
+    snap->time = nbGetDouble(&p, swap);
+    snap->sunGCDist = nbGetDouble(&p, swap);
+    for (k = 0; k < 3; ++k)
+        snap->centerOfMass[k] = nbGetDouble(&p, swap);
+
+    for (k = 0; k < 3; ++k)
+    {
+        memcpy(snap->pos[k], p, n * sizeof(double));
+        p += n * sizeof(double);
+    }
+
+    for (k = 0; k < 3; ++k)
+    {
+        memcpy(snap->vel[k], p, n * sizeof(double));
+        p += n * sizeof(double);
+    }
+
+    memcpy(snap->mass, p, n * sizeof(double));
+    p += n * sizeof(double);
+    memcpy(snap->ignore, p, n * sizeof(uint8_t));
+
+    if (swap)
+    {
+        for (k = 0; k < 3; ++k)
+        {
+            nbSwapDoubles(snap->pos[k], n);
+            nbSwapDoubles(snap->vel[k], n);
+        }
+        nbSwapDoubles(snap->mass, n);
+    }
+
+    free(buf);
+    return snap;
+}
+
+/* Print a snapshot in the same form as the text body output */
+int nbPrintSnapshot(FILE* f, const NBodySnapshot* snap, int cartesian)
+{
+    uint32_t i;
+    mwvector pos = ZERO_VECTOR;
+    mwvector lbr;
+
+    fprintf(f,
+            "cartesian    = %d\n"
+            "hasMilkyway  = %d\n"
+            "centerOfMass = %f, %f, %f\n",
+            cartesian,
+            snap->hasMilkyway,
+            snap->centerOfMass[0], snap->centerOfMass[1], snap->centerOfMass[2]
+        );
+    nbPrintBodyOutputHeader(f, cartesian);
+
+    for (i = 0; i < snap->nbody; ++i)
+    {
+        fprintf(f, "%8d,", (int) snap->ignore[i]);
+        if (cartesian)
+        {
+            fprintf(f,
+                    " %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f\n",
+                    snap->pos[0][i], snap->pos[1][i], snap->pos[2][i],
+                    snap->vel[0][i], snap->vel[1][i], snap->vel[2][i]);
+        }
+        else
+        {
+            SET_VECTOR(pos, snap->pos[0][i], snap->pos[1][i], snap->pos[2][i]);
+            lbr = cartesianToLbr(pos, (real) snap->sunGCDist);
+            fprintf(f,
+                    " %22.15f, %22.15f, %22.15f, %22.15f, %22.15f, %22.15f\n",
+                    L(lbr), B(lbr), R(lbr),
+                    snap->vel[0][i], snap->vel[1][i], snap->vel[2][i]);
+        }
+    }
+
+    if (fflush(f))
+    {
+        mwPerror("Snapshot output flush");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Print a snapshot file as text to outFile, or stdout if NULL */
+int nbPrintSnapshotFile(const char* snapshotFile, const char* outFile, int cartesian)
+{
+    int rc;
+    FILE* f = stdout;
+    NBodySnapshot* snap;
+
+    snap = nbReadSnapshot(snapshotFile);
+    if (!snap)
+    {
+        return TRUE;
+    }
+
+    if (outFile)
+    {
+        f = mwOpenResolved(outFile, "w");
+        if (!f)
+        {
+            mw_printf("Failed to open output file '%s'\n", outFile);
+            nbFreeSnapshot(snap);
+            return TRUE;
+        }
+    }
+
+    rc = nbPrintSnapshot(f, snap, cartesian);
+
+    if (outFile && fclose(f) < 0)
+    {
+        mwPerror("Error closing output file '%s'", outFile);
+        rc = TRUE;
+    }
+
+    nbFreeSnapshot(snap);
 
     return rc;
 }
 
+static int nbWriteSnapshotJob(void* data)
+{
+    int failed;
+    NBodySnapshotJob* job = (NBodySnapshotJob*) data;
+
+    failed = nbWriteSnapshotFile(job->snap, job->filename);
+    if (failed)
+    {
+        mw_printf("Failed to write snapshot '%s'\n", job->filename);
+    }
+
+    nbFreeSnapshot(job->snap);
+    free(job->filename);
+    free(job);
+
+    return failed;
+}
+
+/* Copy the bodies and write them on another thread, so the step loop
+ * only waits for the copy. Only one snapshot is written at a time. */
+int nbWriteSnapshotBackground(const NBodyCtx* ctx, NBodyState* st, const char* filename)
+{
+    NBodySnapshotJob* job;
+
+    if (!st->snapshotWriter)
+    {
+        st->snapshotWriter = nbStartBackgroundWriter("snapshot");
+    }
+
+    if (nbWaitBackgroundWriter(st->snapshotWriter, 0))
+    {
+        return TRUE;
+    }
+
+    job = (NBodySnapshotJob*) mwMalloc(sizeof(NBodySnapshotJob));
+    job->snap = nbTakeSnapshot(ctx, st);
+    job->filename = strdup(filename);
+
+    return nbQueueBackgroundJob(st->snapshotWriter, nbWriteSnapshotJob, job);
+}
+
+int nbFinishSnapshot(NBodyState* st)
+{
+    int failed = nbStopBackgroundWriter(st->snapshotWriter);
+
+    st->snapshotWriter = NULL;
+
+    return failed;
+}
+
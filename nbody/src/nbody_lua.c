@@ -33,6 +33,7 @@
 #include "milkyway_lua.h"
 #include "nbody_check_params.h"
 #include "nbody_defaults.h"
+#include "nbody_potential_program.h"
 
 static int getNBodyCtxFunc(lua_State* luaSt)
 {
@@ -344,7 +345,7 @@ void nbEvalPotentialClosure(NBodyState* st, mwvector pos, mwvector* aOut)
     lua_pop(luaSt, 3);
 }
 
-static int nbEvaluatePotential(lua_State* luaSt, NBodyCtx* ctx)
+static int nbEvaluatePotential(lua_State* luaSt, NBodyCtx* ctx, NBodyState* st)
 {
     int top;
 
@@ -366,10 +367,53 @@ static int nbEvaluatePotential(lua_State* luaSt, NBodyCtx* ctx)
         return 1;
     }
 
+    if (ctx->potentialType == EXTERNAL_POTENTIAL_PROGRAM)
+    {
+        /* The state this came from is closed before the run */
+        nbFreePotentialProgram(st->potProgram);
+        st->potProgram = nbClonePotentialProgram(toPotentialProgram(luaSt, top));
+    }
+
     lua_pop(luaSt, 1);
     return 0;
 }
 
+/* Reevaluate the script for the compiled potential when resuming */
+int nbOpenPotentialProgram(NBodyState* st, const NBodyFlags* nbf)
+{
+    PotentialProgram* p;
+    lua_State* luaSt;
+
+    luaSt = nbOpenLuaStateWithScript(nbf);
+    if (!luaSt || getNBodyPotentialFunc(luaSt))
+    {
+        if (luaSt)
+            lua_close(luaSt);
+        return 1;
+    }
+
+    if (lua_pcall(luaSt, 0, 1, 0))
+    {
+        mw_lua_perror(luaSt, "Error evaluating makePotential()");
+        lua_close(luaSt);
+        return 1;
+    }
+
+    p = toPotentialProgram(luaSt, lua_gettop(luaSt));
+    if (!p)
+    {
+        mw_printf("Expected makePotential() to return a PotentialProgram\n");
+        lua_close(luaSt);
+        return 1;
+    }
+
+    nbFreePotentialProgram(st->potProgram);
+    st->potProgram = nbClonePotentialProgram(p);
+    lua_close(luaSt);
+
+    return 0;
+}
+
 NBodyLikelihoodMethod nbEvaluateLikelihoodMethod(lua_State* luaSt)
 {
     int top;
@@ -480,7 +524,7 @@ static int nbEvaluateInitialNBodyState(lua_State* luaSt, NBodyCtx* ctx, NBodySta
     if (nbEvaluateContext(luaSt, ctx))
         return 1;
 
-    if (nbEvaluatePotential(luaSt, ctx))
+    if (nbEvaluatePotential(luaSt, ctx, st))
         return 1;
 
     bodies = nbEvaluateBodies(luaSt, ctx, &nbody);
@@ -41,6 +41,13 @@ int nbGetPotentialTyped(lua_State* luaSt, NBodyCtx* ctx, int idx, const char* er
         ctx->potentialType = EXTERNAL_POTENTIAL_CUSTOM_LUA;
         return 0;
     }
+    else if (toPotentialProgram(luaSt, idx))
+    {
+        /* The program itself is kept in the state, so the caller
+         * needs to take a copy */
+        ctx->potentialType = EXTERNAL_POTENTIAL_PROGRAM;
+        return 0;
+    }
     else /* The default kind of potential */
     {
         Potential* tmp;
@@ -23,6 +23,7 @@
 #include "nbody_types.h"
 #include "milkyway_util.h"
 #include "nbody_orbit_integrator.h"
+#include "nbody_potential_table.h"
 #include "nbody_coordinates.h"
 
 #include "nbody_lua.h"
@@ -166,25 +167,51 @@ static int luaCalculateEps2(lua_State* luaSt)
     return 1;
 }
 
+static const MWEnumAssociation orbitIntegratorOptions[] =
+{
+    { "Euler",    OrbitEuler    },
+    { "Leapfrog", OrbitLeapfrog },
+    { "Yoshida",  OrbitYoshida  },
+    { "Adaptive", OrbitAdaptive },
+    END_MW_ENUM_ASSOCIATION
+};
+
+/* The tolerance used by the adaptive integrator if none is given */
+#define DEFAULT_ORBIT_TOLERANCE 1.0e-8
+
+static orbit_integrator_t readOrbitIntegrator(lua_State* luaSt, const char* name)
+{
+    /* Default to the original integrator so old workunits don't change */
+    return name ? (orbit_integrator_t) readEnum(luaSt, orbitIntegratorOptions, name) : OrbitEuler;
+}
+
 static int luaReverseOrbit(lua_State* luaSt)
 {
     mwvector finalPos, finalVel;
+    orbit_integrator_t integrator;
     static real dt = 0.0;
     static real tstop = 0.0;
+    static real tolerance = 0.0;
     static Potential* pot = NULL;
     static const mwvector* pos = NULL;
     static const mwvector* vel = NULL;
+    static const char* integratorName = NULL;
 
     static const MWNamedArg argTable[] =
         {
-            { "potential", LUA_TUSERDATA, POTENTIAL_TYPE, TRUE, &pot   },
-            { "position",  LUA_TUSERDATA, MWVECTOR_TYPE,  TRUE, &pos   },
-            { "velocity",  LUA_TUSERDATA, MWVECTOR_TYPE,  TRUE, &vel   },
-            { "tstop",     LUA_TNUMBER,   NULL,           TRUE, &tstop },
-            { "dt",        LUA_TNUMBER,   NULL,           TRUE, &dt    },
+            { "potential",  LUA_TUSERDATA, POTENTIAL_TYPE, TRUE,  &pot            },
+            { "position",   LUA_TUSERDATA, MWVECTOR_TYPE,  TRUE,  &pos            },
+            { "velocity",   LUA_TUSERDATA, MWVECTOR_TYPE,  TRUE,  &vel            },
+            { "tstop",      LUA_TNUMBER,   NULL,           TRUE,  &tstop          },
+            { "dt",         LUA_TNUMBER,   NULL,           TRUE,  &dt             },
+            { "integrator", LUA_TSTRING,   NULL,           FALSE, &integratorName },
+            { "tolerance",  LUA_TNUMBER,   NULL,           FALSE, &tolerance      },
             END_MW_NAMED_ARG
         };
 
+    integratorName = NULL;
+    tolerance = DEFAULT_ORBIT_TOLERANCE;
+
     switch (lua_gettop(luaSt))
     {
         case 1:
@@ -203,21 +230,154 @@ static int luaReverseOrbit(lua_State* luaSt)
             return luaL_argerror(luaSt, 1, "Expected 1 or 5 arguments");
     }
 
+    integrator = readOrbitIntegrator(luaSt, integratorName);
+
     /* Make sure precalculated constants ready for use */
     if (checkPotentialConstants(pot))
         luaL_error(luaSt, "Error with potential");
 
-    nbReverseOrbit(&finalPos, &finalVel, pot, *pos, *vel, tstop, dt);
+    if (nbReverseOrbitWith(&finalPos, &finalVel, pot, *pos, *vel, tstop, dt, integrator, tolerance, NULL))
+        luaL_error(luaSt, "Error integrating orbit");
+
     pushVector(luaSt, finalPos);
     pushVector(luaSt, finalVel);
 
     return 2;
 }
 
+/* Read a table of n vectors into x, y and z arrays. Returns nonzero
+ * if an item isn't a vector. */
+static int readVectorTable(lua_State* luaSt, int table, unsigned int n, real* v[3])
+{
+    unsigned int i;
+    const mwvector* item;
+
+    for (i = 0; i < n; ++i)
+    {
+        lua_rawgeti(luaSt, table, i + 1);
+        item = toVector(luaSt, lua_gettop(luaSt));
+        lua_pop(luaSt, 1);
+
+        if (!item)
+            return 1;
+
+        v[0][i] = X(*item);
+        v[1][i] = Y(*item);
+        v[2][i] = Z(*item);
+    }
+
+    return 0;
+}
+
+static void pushVectorTable(lua_State* luaSt, unsigned int n, real* v[3])
+{
+    unsigned int i;
+    int table;
+
+    lua_createtable(luaSt, n, 0);
+    table = lua_gettop(luaSt);
+
+    for (i = 0; i < n; ++i)
+    {
+        mwvector item = mw_vec(v[0][i], v[1][i], v[2][i]);
+        pushVector(luaSt, item);
+        lua_rawseti(luaSt, table, i + 1);
+    }
+}
+
+/* Like reverseOrbit, but for tables of positions and velocities
+ * integrated together in the same potential */
+static int luaReverseOrbits(lua_State* luaSt)
+{
+    orbit_integrator_t integrator;
+    unsigned int n;
+    int positions, velocities, rc;
+    real* data;
+    real* pos[3];
+    real* vel[3];
+    static real dt = 0.0;
+    static real tstop = 0.0;
+    PotentialTable* table = NULL;
+    static real tolerance = 0.0;
+    static real tableTolerance = 0.0;
+    static Potential* pot = NULL;
+    static const char* integratorName = NULL;
+
+    static const MWNamedArg argTable[] =
+        {
+            { "potential",      LUA_TUSERDATA, POTENTIAL_TYPE, TRUE,  &pot            },
+            { "positions",      LUA_TTABLE,    NULL,           TRUE,  NULL            },
+            { "velocities",     LUA_TTABLE,    NULL,           TRUE,  NULL            },
+            { "tstop",          LUA_TNUMBER,   NULL,           TRUE,  &tstop          },
+            { "dt",             LUA_TNUMBER,   NULL,           TRUE,  &dt             },
+            { "integrator",     LUA_TSTRING,   NULL,           FALSE, &integratorName },
+            { "tolerance",      LUA_TNUMBER,   NULL,           FALSE, &tolerance      },
+            { "tableTolerance", LUA_TNUMBER,   NULL,           FALSE, &tableTolerance },
+            END_MW_NAMED_ARG
+        };
+
+    integratorName = NULL;
+    tolerance = DEFAULT_ORBIT_TOLERANCE;
+    tableTolerance = 0.0;
+
+    if (lua_gettop(luaSt) != 1)
+        return luaL_argerror(luaSt, 1, "Expected 1 argument");
+
+    handleNamedArgumentTable(luaSt, argTable, 1);
+    integrator = readOrbitIntegrator(luaSt, integratorName);
+
+    if (tableTolerance < 0.0 || tableTolerance >= 1.0)
+        return luaL_argerror(luaSt, 1, "Expected 0 <= tableTolerance < 1");
+
+    lua_getfield(luaSt, 1, "positions");
+    positions = lua_gettop(luaSt);
+    lua_getfield(luaSt, 1, "velocities");
+    velocities = lua_gettop(luaSt);
+
+    n = (unsigned int) luaL_getn(luaSt, positions);
+    if ((unsigned int) luaL_getn(luaSt, velocities) != n)
+        return luaL_argerror(luaSt, 1, "Expected the same number of positions and velocities");
+
+    if (checkPotentialConstants(pot))
+        luaL_error(luaSt, "Error with potential");
+
+    data = (real*) mwMalloc(6 * (n ? n : 1) * sizeof(real));
+    pos[0] = &data[0];
+    pos[1] = &data[n];
+    pos[2] = &data[2 * n];
+    vel[0] = &data[3 * n];
+    vel[1] = &data[4 * n];
+    vel[2] = &data[5 * n];
+
+    if (readVectorTable(luaSt, positions, n, pos) || readVectorTable(luaSt, velocities, n, vel))
+    {
+        free(data);
+        return luaL_argerror(luaSt, 1, "Expected tables of vectors for positions and velocities");
+    }
+
+    if (tableTolerance > 0.0)
+        table = nbCreatePotentialTable(pot, tableTolerance);
+
+    rc = nbReverseOrbits(pos, vel, n, pot, tstop, dt, integrator, tolerance, table);
+    nbFreePotentialTable(table);
+    if (rc)
+    {
+        free(data);
+        return luaL_error(luaSt, "Error integrating orbits");
+    }
+
+    pushVectorTable(luaSt, n, pos);
+    pushVectorTable(luaSt, n, vel);
+    free(data);
+
+    return 2;
+}
+
 void registerModelFunctions(lua_State* luaSt)
 {
     lua_register(luaSt, "plummerTimestepIntegral", luaPlummerTimestepIntegral);
     lua_register(luaSt, "reverseOrbit", luaReverseOrbit);
+    lua_register(luaSt, "reverseOrbits", luaReverseOrbits);
     lua_register(luaSt, "calculateEps2", luaCalculateEps2);
     lua_register(luaSt, "calculateTimestep", luaCalculateTimestep);
 }
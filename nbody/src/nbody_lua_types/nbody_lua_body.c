@@ -23,17 +23,22 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include "nbody_types.h"
 #include "nbody_show.h"
 #include "nbody_lua_body.h"
+#include "nbody_lua_body_array.h"
 #include "milkyway_lua.h"
 #include "milkyway_util.h"
 
 Body* toBody(lua_State* luaSt, int idx)
 {
-    return (Body*) mw_tonamedudata(luaSt, idx, BODY_TYPE);
+    Body* b = (Body*) mw_tonamedudata(luaSt, idx, BODY_TYPE);
+
+    return b ? b : toBodyArrayElement(luaSt, idx);
 }
 
 Body* checkBody(lua_State* luaSt, int idx)
 {
-    return (Body*) mw_checknamedudata(luaSt, idx, BODY_TYPE);
+    Body* b = toBody(luaSt, idx);
+
+    return b ? b : (Body*) mw_checknamedudata(luaSt, idx, BODY_TYPE);
 }
 
 /* Like checkBody() except for non-Lua called C functions */
@@ -132,7 +137,7 @@ static const luaL_reg methodsBody[] =
     { NULL, NULL }
 };
 
-static const Xet_reg_pre gettersBody[] =
+const Xet_reg_pre gettersBody[] =
 {
     { "velocity", getVector,     offsetof(Body, vel)           },
     { "position", getVector,     offsetof(Body, bodynode.pos)  },
@@ -141,7 +146,7 @@ static const Xet_reg_pre gettersBody[] =
     { NULL, NULL, 0 }
 };
 
-static const Xet_reg_pre settersBody[] =
+const Xet_reg_pre settersBody[] =
 {
     { "velocity", setVector,     offsetof(Body, vel)           },
     { "position", setVector,     offsetof(Body, bodynode.pos)  },
@@ -0,0 +1,327 @@
+/*
+Copyright (C) 2011  Matthew Arsenault
+
+This file is part of Milkway@Home.
+
+Milkyway@Home is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Milkyway@Home is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "nbody_types.h"
+#include "nbody_show.h"
+#include "nbody_lua_body.h"
+#include "nbody_lua_body_array.h"
+#include "milkyway_lua.h"
+#include "milkyway_util.h"
+
+BodyArray* toBodyArray(lua_State* luaSt, int idx)
+{
+    return (BodyArray*) mw_tonamedudata(luaSt, idx, BODY_ARRAY_TYPE);
+}
+
+BodyArray* checkBodyArray(lua_State* luaSt, int idx)
+{
+    return (BodyArray*) mw_checknamedudata(luaSt, idx, BODY_ARRAY_TYPE);
+}
+
+/* An element is the index of a body. Its environment is the same as
+ * the array's, a table holding the array, which keeps the array alive
+ * as long as any of its elements are. */
+typedef struct
+{
+    unsigned int index;
+} BodyArrayElement;
+
+BodyArray* pushBodyArray(lua_State* luaSt, unsigned int n)
+{
+    BodyArray* arr;
+
+    arr = (BodyArray*) lua_newuserdata(luaSt, sizeof(BodyArray));
+    arr->n = n;
+    arr->capacity = n;
+    arr->bodies = n ? (Body*) mwCalloc(n, sizeof(Body)) : NULL;
+
+    luaL_getmetatable(luaSt, BODY_ARRAY_TYPE);
+    lua_setmetatable(luaSt, -2);
+
+    lua_createtable(luaSt, 1, 0);
+    lua_pushvalue(luaSt, -2);
+    lua_rawseti(luaSt, -2, 1);
+    lua_setfenv(luaSt, -2);
+
+    return arr;
+}
+
+/* Push an element for body i of the array at idx */
+static void pushBodyArrayElement(lua_State* luaSt, int idx, unsigned int i)
+{
+    BodyArrayElement* e;
+
+    e = (BodyArrayElement*) lua_newuserdata(luaSt, sizeof(BodyArrayElement));
+    e->index = i;
+
+    luaL_getmetatable(luaSt, BODY_ARRAY_ELEMENT_TYPE);
+    lua_setmetatable(luaSt, -2);
+
+    lua_getfenv(luaSt, idx);
+    lua_setfenv(luaSt, -2);
+}
+
+Body* toBodyArrayElement(lua_State* luaSt, int idx)
+{
+    const BodyArrayElement* e;
+    const BodyArray* arr;
+
+    e = (const BodyArrayElement*) mw_tonamedudata(luaSt, idx, BODY_ARRAY_ELEMENT_TYPE);
+    if (!e)
+        return NULL;
+
+    lua_getfenv(luaSt, idx);
+    lua_rawgeti(luaSt, -1, 1);
+    arr = toBodyArray(luaSt, lua_gettop(luaSt));
+    lua_pop(luaSt, 2);
+
+    /* Arrays never shrink, so this is only a sanity check */
+    if (!arr || e->index >= arr->n)
+        return NULL;
+
+    return &arr->bodies[e->index];
+}
+
+static Body* checkBodyArrayElement(lua_State* luaSt, int idx)
+{
+    Body* b = toBodyArrayElement(luaSt, idx);
+
+    return b ? b : (Body*) mw_checknamedudata(luaSt, idx, BODY_ARRAY_ELEMENT_TYPE);
+}
+
+static int createBodyArray(lua_State* luaSt)
+{
+    int n;
+
+    n = (int) luaL_optinteger(luaSt, 1, 0);
+    if (n < 0)
+        return luaL_argerror(luaSt, 1, "Expected non-negative number of bodies");
+
+    pushBodyArray(luaSt, (unsigned int) n);
+    return 1;
+}
+
+static int gcBodyArray(lua_State* luaSt)
+{
+    BodyArray* arr = checkBodyArray(luaSt, 1);
+
+    free(arr->bodies);
+    arr->bodies = NULL;
+    arr->n = arr->capacity = 0;
+
+    return 0;
+}
+
+static int lenBodyArray(lua_State* luaSt)
+{
+    lua_pushinteger(luaSt, (lua_Integer) checkBodyArray(luaSt, 1)->n);
+    return 1;
+}
+
+static int toStringBodyArray(lua_State* luaSt)
+{
+    lua_pushfstring(luaSt, "BodyArray { n = %d }", (int) checkBodyArray(luaSt, 1)->n);
+    return 1;
+}
+
+/* Numbers index the bodies like a table, and anything else looks up
+ * methods */
+static int indexBodyArray(lua_State* luaSt)
+{
+    BodyArray* arr;
+    lua_Integer i;
+
+    arr = checkBodyArray(luaSt, 1);
+    if (lua_type(luaSt, 2) != LUA_TNUMBER)
+    {
+        lua_pushvalue(luaSt, 2);
+        lua_gettable(luaSt, lua_upvalueindex(1));
+        return 1;
+    }
+
+    i = lua_tointeger(luaSt, 2);
+    if (i < 1 || (lua_Integer) arr->n < i)
+    {
+        lua_pushnil(luaSt);
+        return 1;
+    }
+
+    pushBodyArrayElement(luaSt, 1, (unsigned int) (i - 1));
+    return 1;
+}
+
+static int newIndexBodyArray(lua_State* luaSt)
+{
+    BodyArray* arr;
+    Body b;
+    lua_Integer i;
+
+    arr = checkBodyArray(luaSt, 1);
+    i = luaL_checkinteger(luaSt, 2);
+    b = *checkBody(luaSt, 3);   /* Copied, since it may be in this array */
+
+    if (i < 1 || i > (lua_Integer) arr->n + 1)
+        return luaL_argerror(luaSt, 2, "Body array index out of range");
+
+    if ((unsigned int) i > arr->capacity)
+    {
+        arr->capacity = arr->capacity ? 2 * arr->capacity : 16;
+        arr->bodies = (Body*) mwRealloc(arr->bodies, arr->capacity * sizeof(Body));
+    }
+
+    arr->bodies[i - 1] = b;
+    if ((unsigned int) i > arr->n)
+        arr->n = (unsigned int) i;
+
+    return 0;
+}
+
+static int iterBodyArray(lua_State* luaSt)
+{
+    BodyArray* arr;
+    lua_Integer i;
+
+    arr = checkBodyArray(luaSt, 1);
+    i = luaL_checkinteger(luaSt, 2) + 1;
+    if (i < 1 || (lua_Integer) arr->n < i)
+        return 0;
+
+    lua_pushinteger(luaSt, i);
+    pushBodyArrayElement(luaSt, 1, (unsigned int) (i - 1));
+    return 2;
+}
+
+/* for i, b in a:bodies() do ... end */
+static int bodiesBodyArray(lua_State* luaSt)
+{
+    checkBodyArray(luaSt, 1);
+    lua_pushcfunction(luaSt, iterBodyArray);
+    lua_pushvalue(luaSt, 1);
+    lua_pushinteger(luaSt, 0);
+    return 3;
+}
+
+/* Fields of an element go to the body in the array with the same
+ * accessors as a Body */
+static int xetBodyArrayElement(lua_State* luaSt, const char* what)
+{
+    Body* b;
+    Xet_reg m;
+
+    b = checkBodyArrayElement(luaSt, 1);
+    lua_pushvalue(luaSt, 2);
+    lua_rawget(luaSt, lua_upvalueindex(1));
+    if (!lua_islightuserdata(luaSt, -1))
+        return luaL_error(luaSt, "cannot %s member '%s'", what, lua_tostring(luaSt, 2));
+
+    m = (Xet_reg) lua_touserdata(luaSt, -1);
+    lua_pop(luaSt, 1);
+
+    return m->func(luaSt, (void*) ((char*) b + m->offset));
+}
+
+static int indexBodyArrayElement(lua_State* luaSt)
+{
+    return xetBodyArrayElement(luaSt, "get");
+}
+
+static int newIndexBodyArrayElement(lua_State* luaSt)
+{
+    return xetBodyArrayElement(luaSt, "set");
+}
+
+static int toStringBodyArrayElement(lua_State* luaSt)
+{
+    return toStringType(luaSt, (StructShowFunc) showBody, (LuaTypeCheckFunc) checkBodyArrayElement);
+}
+
+static const luaL_reg metaMethodsBodyArray[] =
+{
+    { "__gc",       gcBodyArray       },
+    { "__len",      lenBodyArray      },
+    { "__tostring", toStringBodyArray },
+    { "__newindex", newIndexBodyArray },
+    { NULL, NULL }
+};
+
+static const luaL_reg methodsBodyArray[] =
+{
+    { "create", createBodyArray },
+    { "bodies", bodiesBodyArray },
+    { NULL, NULL }
+};
+
+static const luaL_reg metaMethodsBodyArrayElement[] =
+{
+    { "__tostring", toStringBodyArrayElement },
+    { NULL, NULL }
+};
+
+/* Not registerStruct() types since the array's __index handler needs
+ * to deal with numbers, and elements find their body in the array */
+int registerBodyArray(lua_State* luaSt)
+{
+    int metatable, methods;
+
+    luaL_register(luaSt, BODY_ARRAY_TYPE, methodsBodyArray);
+    methods = lua_gettop(luaSt);
+
+    luaL_newmetatable(luaSt, BODY_ARRAY_TYPE);
+    luaL_register(luaSt, NULL, metaMethodsBodyArray);
+    metatable = lua_gettop(luaSt);
+
+    lua_pushliteral(luaSt, "__metatable");
+    lua_pushvalue(luaSt, methods);
+    lua_rawset(luaSt, metatable);
+
+    lua_pushliteral(luaSt, "__index");
+    lua_pushvalue(luaSt, methods);
+    lua_pushcclosure(luaSt, indexBodyArray, 1);
+    lua_rawset(luaSt, metatable);
+
+    lua_pop(luaSt, 2);
+
+    /* Elements have no methods of their own */
+    luaL_newmetatable(luaSt, BODY_ARRAY_ELEMENT_TYPE);
+    luaL_register(luaSt, NULL, metaMethodsBodyArrayElement);
+    metatable = lua_gettop(luaSt);
+
+    lua_pushliteral(luaSt, "__metatable");
+    lua_pushliteral(luaSt, BODY_ARRAY_ELEMENT_TYPE);
+    lua_rawset(luaSt, metatable);
+
+    lua_pushliteral(luaSt, "__index");
+    lua_newtable(luaSt);
+    Xet_add(luaSt, gettersBody);
+    lua_pushcclosure(luaSt, indexBodyArrayElement, 1);
+    lua_rawset(luaSt, metatable);
+
+    lua_pushliteral(luaSt, "__newindex");
+    lua_newtable(luaSt);
+    Xet_add(luaSt, settersBody);
+    lua_pushcclosure(luaSt, newIndexBodyArrayElement, 1);
+    lua_rawset(luaSt, metatable);
+
+    lua_pop(luaSt, 1);
+    return 0;
+}
+
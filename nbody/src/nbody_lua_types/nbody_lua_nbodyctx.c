@@ -82,24 +82,31 @@ static int createNBodyCtx(lua_State* luaSt)
     static NBodyCtx ctx;
     static const char* criterionName = NULL;
     double nStepf = 0.0;
+    static real blockLevelsf = 0.0;
 
     static const MWNamedArg argTable[] =
         {
-            { "timestep",    LUA_TNUMBER,  NULL, TRUE,  &ctx.timestep    },
-            { "timeEvolve",  LUA_TNUMBER,  NULL, TRUE,  &ctx.timeEvolve  },
-            { "theta",       LUA_TNUMBER,  NULL, FALSE, &ctx.theta       },
-            { "eps2",        LUA_TNUMBER,  NULL, TRUE,  &ctx.eps2        },
-            { "treeRSize",   LUA_TNUMBER,  NULL, FALSE, &ctx.treeRSize   },
-            { "sunGCDist",   LUA_TNUMBER,  NULL, FALSE, &ctx.sunGCDist   },
-            { "criterion",   LUA_TSTRING,  NULL, FALSE, &criterionName   },
-            { "useQuad",     LUA_TBOOLEAN, NULL, FALSE, &ctx.useQuad     },
-            { "allowIncest", LUA_TBOOLEAN, NULL, FALSE, &ctx.allowIncest },
-            { "quietErrors", LUA_TBOOLEAN, NULL, FALSE, &ctx.quietErrors },
+            { "timestep",            LUA_TNUMBER,  NULL, TRUE,  &ctx.timestep            },
+            { "timeEvolve",          LUA_TNUMBER,  NULL, TRUE,  &ctx.timeEvolve          },
+            { "theta",               LUA_TNUMBER,  NULL, FALSE, &ctx.theta               },
+            { "eps2",                LUA_TNUMBER,  NULL, TRUE,  &ctx.eps2                },
+            { "treeRSize",           LUA_TNUMBER,  NULL, FALSE, &ctx.treeRSize           },
+            { "sunGCDist",           LUA_TNUMBER,  NULL, FALSE, &ctx.sunGCDist           },
+            { "criterion",           LUA_TSTRING,  NULL, FALSE, &criterionName           },
+            { "useQuad",             LUA_TBOOLEAN, NULL, FALSE, &ctx.useQuad             },
+            { "allowIncest",         LUA_TBOOLEAN, NULL, FALSE, &ctx.allowIncest         },
+            { "quietErrors",         LUA_TBOOLEAN, NULL, FALSE, &ctx.quietErrors         },
+            { "useMortonTree",       LUA_TBOOLEAN, NULL, FALSE, &ctx.useMortonTree       },
+            { "useInteractionLists", LUA_TBOOLEAN, NULL, FALSE, &ctx.useInteractionLists },
+            { "blockLevels",         LUA_TNUMBER,  NULL, FALSE, &blockLevelsf            },
+            { "blockEta",            LUA_TNUMBER,  NULL, FALSE, &ctx.blockEta            },
+            { "potentialTableTolerance", LUA_TNUMBER, NULL, FALSE, &ctx.potentialTableTolerance },
             END_MW_NAMED_ARG
         };
 
     criterionName = NULL;
     ctx = defaultNBodyCtx;
+    blockLevelsf = (real) ctx.blockLevels;
 
     if (lua_gettop(luaSt) != 1)
         return luaL_argerror(luaSt, 1, "Expected named argument table");
@@ -135,6 +142,12 @@ static int createNBodyCtx(lua_State* luaSt)
 
     ctx.nStep = (unsigned int) nStepf;
 
+    if (blockLevelsf < 0.0 || blockLevelsf > (real) MAX_BLOCK_LEVELS)
+    {
+        return luaL_error(luaSt, "blockLevels must be between 0 and %d (got %f)\n", MAX_BLOCK_LEVELS, blockLevelsf);
+    }
+    ctx.blockLevels = (int) blockLevelsf;
+
     pushNBodyCtx(luaSt, &ctx);
     return 1;
 }
@@ -189,6 +202,11 @@ static const Xet_reg_pre gettersNBodyCtx[] =
     { "useQuad",         getBool,       offsetof(NBodyCtx, useQuad)     },
     { "allowIncest",     getBool,       offsetof(NBodyCtx, allowIncest) },
     { "quietErrors",     getBool,       offsetof(NBodyCtx, quietErrors) },
+    { "useMortonTree",   getBool,       offsetof(NBodyCtx, useMortonTree) },
+    { "useInteractionLists", getBool,   offsetof(NBodyCtx, useInteractionLists) },
+    { "blockLevels",     getInt,        offsetof(NBodyCtx, blockLevels) },
+    { "blockEta",        getNumber,     offsetof(NBodyCtx, blockEta)    },
+    { "potentialTableTolerance", getNumber, offsetof(NBodyCtx, potentialTableTolerance) },
     { NULL, NULL, 0 }
 };
 
@@ -204,6 +222,11 @@ static const Xet_reg_pre settersNBodyCtx[] =
     { "useQuad",         setBool,       offsetof(NBodyCtx, useQuad)     },
     { "allowIncest",     setBool,       offsetof(NBodyCtx, allowIncest) },
     { "quietErrors",     setBool,       offsetof(NBodyCtx, quietErrors) },
+    { "useMortonTree",   setBool,       offsetof(NBodyCtx, useMortonTree) },
+    { "useInteractionLists", setBool,   offsetof(NBodyCtx, useInteractionLists) },
+    { "blockLevels",     setInt,        offsetof(NBodyCtx, blockLevels) },
+    { "blockEta",        setNumber,     offsetof(NBodyCtx, blockEta)    },
+    { "potentialTableTolerance", setNumber, offsetof(NBodyCtx, potentialTableTolerance) },
     { NULL, NULL, 0 }
 };
 
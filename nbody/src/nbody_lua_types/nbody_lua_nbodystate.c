@@ -27,12 +27,17 @@
 #include "milkyway_util.h"
 #include "nbody_lua_nbodyctx.h"
 #include "nbody_lua_potential.h"
+#include "nbody_lua_potential_program.h"
+#include "nbody_potential_program.h"
 #include "nbody_lua_type_marshal.h"
 #include "nbody_defaults.h"
 #include "nbody_checkpoint.h"
 #include "nbody_lua_misc.h"
+#include "nbody_lua_body.h"
 #include "nbody_grav.h"
+#include "nbody_tune.h"
 #include "nbody.h"
+#include "nbody_io.h"
 
 
 NBodyState* checkNBodyState(lua_State* luaSt, int idx)
@@ -91,12 +96,80 @@ static int luaRunSystem(lua_State* luaSt)
         return luaL_argerror(luaSt, 3, "Expected potential as argument 3\n");
     }
 
+    if (ctx.potentialType == EXTERNAL_POTENTIAL_PROGRAM)
+    {
+        nbFreePotentialProgram(st->potProgram);
+        st->potProgram = nbClonePotentialProgram(checkPotentialProgram(luaSt, 3));
+    }
+
+    /* There's no checkpoint file set for a state made from Lua, so
+     * writing one is left to writeCheckpoint() */
+    ctx.checkpointT = -1;
+
     rc = nbRunSystem(&ctx, st);
     lua_pushstring(luaSt, showNBodyStatus(rc));
 
     return 1;
 }
 
+/* NBodyState:tune(ctx, tolerance). Returns a table of the fastest
+ * criterion, theta and useQuad found, with their force error and
+ * seconds per step. The state is left as it was. */
+static int luaTuneNBodyState(lua_State* luaSt)
+{
+    NBodyState* st;
+    NBodyCtx ctx;
+    NBodyTuneResult best;
+    real tolerance;
+
+    st = checkNBodyState(luaSt, 1);
+    ctx = *checkNBodyCtx(luaSt, 2);
+    tolerance = (real) luaL_optnumber(luaSt, 3, DEFAULT_TUNE_TOLERANCE);
+
+    if (nbStatusIsFatal(nbTuneSettings(&ctx, st, tolerance, FALSE, &best)))
+    {
+        return luaL_error(luaSt, "Error tuning settings");
+    }
+
+    lua_createtable(luaSt, 0, 5);
+    lua_pushstring(luaSt, showCriterionT(best.criterion));
+    lua_setfield(luaSt, -2, "criterion");
+    lua_pushnumber(luaSt, (lua_Number) best.theta);
+    lua_setfield(luaSt, -2, "theta");
+    lua_pushboolean(luaSt, best.useQuad);
+    lua_setfield(luaSt, -2, "useQuad");
+    lua_pushnumber(luaSt, (lua_Number) best.forceError);
+    lua_setfield(luaSt, -2, "forceError");
+    lua_pushnumber(luaSt, (lua_Number) (best.times.tree + best.times.force + best.times.external + best.times.integrate));
+    lua_setfield(luaSt, -2, "stepTime");
+
+    return 1;
+}
+
+/* NBodyState:applyTuneResult(ctx, result). Uses the settings from a
+ * result of tune() in the context and state. */
+static int luaApplyTuneResult(lua_State* luaSt)
+{
+    NBodyState* st;
+    NBodyCtx* ctx;
+    NBodyTuneResult r;
+
+    st = checkNBodyState(luaSt, 1);
+    ctx = checkNBodyCtx(luaSt, 2);
+    luaL_checktype(luaSt, 3, LUA_TTABLE);
+
+    lua_getfield(luaSt, 3, "criterion");
+    r.criterion = readCriterion(luaSt, luaL_checkstring(luaSt, -1));
+    lua_getfield(luaSt, 3, "theta");
+    r.theta = (real) luaL_checknumber(luaSt, -1);
+    lua_getfield(luaSt, 3, "useQuad");
+    r.useQuad = (mwbool) mw_lua_checkboolean(luaSt, -1);
+    lua_pop(luaSt, 3);
+
+    nbApplyTuneResult(ctx, st, &r);
+    return 0;
+}
+
 static int gcNBodyState(lua_State* luaSt)
 {
     destroyNBodyState(checkNBodyState(luaSt, 1));
@@ -151,6 +224,7 @@ static int luaWriteCheckpoint(lua_State* luaSt)
     char tmpPath[256];
     int pid;
     int failed;
+    mwbool compress;
 
     st = checkNBodyState(luaSt, 1);
     ctx = checkNBodyCtx(luaSt, 2);
@@ -162,7 +236,10 @@ static int luaWriteCheckpoint(lua_State* luaSt)
 
     st->checkpointResolved = strdup(luaL_optstring(luaSt, 3, DEFAULT_CHECKPOINT_FILE));
 
+    compress = st->compressCheckpoint;
+    st->compressCheckpoint = lua_toboolean(luaSt, 5);
     failed = nbWriteCheckpointWithTmpFile(ctx, st, luaL_optstring(luaSt, 4, tmpPath));
+    st->compressCheckpoint = compress;
     free(st->checkpointResolved);
     st->checkpointResolved = NULL;
 
@@ -197,8 +274,9 @@ static int luaReadCheckpoint(lua_State* luaSt)
 
     st.checkpointResolved = NULL;
 
-    /* Run the prestep so the accelerations are ready for the resumed state */
-    if (nbStatusIsFatal(nbGravMap(&ctx, &st)))
+    /* Run the prestep so the accelerations are ready for the resumed
+     * state. With block steps they were saved in the checkpoint. */
+    if ((ctx.blockLevels <= 1 || st.step == 0) && nbStatusIsFatal(nbGravMap(&ctx, &st)))
     {
         return luaL_error(luaSt, "Error running prestep from checkpoint");
     }
@@ -209,6 +287,61 @@ static int luaReadCheckpoint(lua_State* luaSt)
     return 2;
 }
 
+/* NBodyState:writeSnapshot(ctx, file) */
+static int luaWriteSnapshot(lua_State* luaSt)
+{
+    const NBodyState* st;
+    const NBodyCtx* ctx;
+
+    st = checkNBodyState(luaSt, 1);
+    ctx = checkNBodyCtx(luaSt, 2);
+
+    if (nbWriteBodySnapshot(ctx, st, luaL_checkstring(luaSt, 3)))
+    {
+        return luaL_error(luaSt, "Error writing snapshot");
+    }
+
+    return 0;
+}
+
+/* Returns a table with the step, time and a list of the bodies */
+static int luaReadSnapshot(lua_State* luaSt)
+{
+    uint32_t i;
+    Body b = EMPTY_BODY;
+    NBodySnapshot* snap;
+    const char* file = luaL_checkstring(luaSt, 1);
+
+    snap = nbReadSnapshot(file);
+    if (!snap)
+    {
+        return luaL_error(luaSt, "Error reading snapshot '%s'", file);
+    }
+
+    lua_createtable(luaSt, 0, 3);
+    lua_pushnumber(luaSt, (lua_Number) snap->step);
+    lua_setfield(luaSt, -2, "step");
+    lua_pushnumber(luaSt, (lua_Number) snap->time);
+    lua_setfield(luaSt, -2, "time");
+
+    lua_createtable(luaSt, (int) snap->nbody, 0);
+    for (i = 0; i < snap->nbody; ++i)
+    {
+        SET_VECTOR(b.bodynode.pos, snap->pos[0][i], snap->pos[1][i], snap->pos[2][i]);
+        SET_VECTOR(b.vel, snap->vel[0][i], snap->vel[1][i], snap->vel[2][i]);
+        b.bodynode.mass = (real) snap->mass[i];
+        b.bodynode.type = BODY(snap->ignore[i]);
+
+        pushBody(luaSt, &b);
+        lua_rawseti(luaSt, -2, (int) i + 1);
+    }
+    lua_setfield(luaSt, -2, "bodies");
+
+    nbFreeSnapshot(snap);
+
+    return 1;
+}
+
 static int eqNBodyState(lua_State* luaSt)
 {
     lua_pushboolean(luaSt, equalNBodyState(checkNBodyState(luaSt, 1), checkNBodyState(luaSt, 2)));
@@ -242,10 +375,14 @@ static const luaL_reg methodsNBodyState[] =
     { "create",          createNBodyState     },
     { "step",            stepNBodyState       },
     { "runSystem",       luaRunSystem         },
+    { "tune",            luaTuneNBodyState    },
+    { "applyTuneResult", luaApplyTuneResult   },
     { "sortBodies",      sortBodiesNBodyState },
     { "clone",           luaCloneNBodyState   },
     { "writeCheckpoint", luaWriteCheckpoint   },
     { "readCheckpoint",  luaReadCheckpoint    },
+    { "writeSnapshot",   luaWriteSnapshot     },
+    { "readSnapshot",    luaReadSnapshot      },
     { NULL, NULL }
 };
 
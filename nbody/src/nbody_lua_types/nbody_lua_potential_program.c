@@ -0,0 +1,200 @@
+/*
+Copyright (C) 2012  Matthew Arsenault
+
+This file is part of Milkway@Home.
+
+Milkyway@Home is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Milkyway@Home is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "nbody_types.h"
+#include "nbody_check_params.h"
+#include "nbody_potential_program.h"
+#include "nbody_lua_potential.h"
+#include "nbody_lua_potential_program.h"
+#include "milkyway_lua.h"
+#include "milkyway_util.h"
+
+PotentialProgram* toPotentialProgram(lua_State* luaSt, int idx)
+{
+    PotentialProgram** p = (PotentialProgram**) mw_tonamedudata(luaSt, idx, POTENTIAL_PROGRAM_TYPE);
+    return p ? *p : NULL;
+}
+
+PotentialProgram* checkPotentialProgram(lua_State* luaSt, int idx)
+{
+    return *(PotentialProgram**) mw_checknamedudata(luaSt, idx, POTENTIAL_PROGRAM_TYPE);
+}
+
+static void pushPotentialProgram(lua_State* luaSt, PotentialProgram* p)
+{
+    PotentialProgram** box;
+
+    box = (PotentialProgram**) lua_newuserdata(luaSt, sizeof(PotentialProgram*));
+    *box = p;
+
+    luaL_getmetatable(luaSt, POTENTIAL_PROGRAM_TYPE);
+    lua_setmetatable(luaSt, -2);
+}
+
+/* Read a table of name = number pairs. The names stay on the Lua
+ * stack in the table. Returns the number read, or -1 on error. */
+static int readPotentialParameters(lua_State* luaSt, int table, const char*** names, real** values)
+{
+    int n = 0;
+
+    *names = NULL;
+    *values = NULL;
+
+    if (lua_isnil(luaSt, table))
+        return 0;
+
+    lua_pushnil(luaSt);
+    while (lua_next(luaSt, table))
+    {
+        if (lua_type(luaSt, -2) != LUA_TSTRING || lua_type(luaSt, -1) != LUA_TNUMBER)
+        {
+            lua_pop(luaSt, 2);
+            free(*names);
+            free(*values);
+            return -1;
+        }
+
+        *names = (const char**) mwRealloc(*names, (n + 1) * sizeof(const char*));
+        *values = (real*) mwRealloc(*values, (n + 1) * sizeof(real));
+        (*names)[n] = lua_tostring(luaSt, -2);
+        (*values)[n] = (real) lua_tonumber(luaSt, -1);
+        ++n;
+
+        lua_pop(luaSt, 1);
+    }
+
+    return n;
+}
+
+/* PotentialProgram.create{ acceleration = string, parameters = table, potential = Potential } */
+static int createPotentialProgram(lua_State* luaSt)
+{
+    int nParams;
+    const char** names;
+    real* values;
+    PotentialProgram* p;
+    static const char* src = NULL;
+    static Potential* base = NULL;
+
+    static const MWNamedArg argTable[] =
+        {
+            { "acceleration", LUA_TSTRING,   NULL,           TRUE,  &src  },
+            { "parameters",   LUA_TTABLE,    NULL,           FALSE, NULL  },
+            { "potential",    LUA_TUSERDATA, POTENTIAL_TYPE, FALSE, &base },
+            END_MW_NAMED_ARG
+        };
+
+    base = NULL;
+
+    if (lua_gettop(luaSt) != 1)
+        return luaL_argerror(luaSt, 1, "Expected 1 argument");
+
+    handleNamedArgumentTable(luaSt, argTable, 1);
+
+    if (base && checkPotentialConstants(base))
+        return luaL_argerror(luaSt, 1, "Invalid potential");
+
+    lua_getfield(luaSt, 1, "parameters");
+    nParams = readPotentialParameters(luaSt, lua_gettop(luaSt), &names, &values);
+    if (nParams < 0)
+        return luaL_argerror(luaSt, 1, "Expected parameters to be a table of names and numbers");
+
+    p = nbCompilePotentialProgram(src, (const char* const*) names, values, (unsigned int) nParams, base);
+    free(names);
+    free(values);
+    lua_pop(luaSt, 1);
+
+    if (!p)
+        return luaL_error(luaSt, "Failed to compile potential");
+
+    pushPotentialProgram(luaSt, p);
+    return 1;
+}
+
+static int luaProgramAcceleration(lua_State* luaSt)
+{
+    const PotentialProgram* p;
+    const mwvector* r;
+
+    p = checkPotentialProgram(luaSt, 1);
+    r = checkVector(luaSt, 2);
+
+    pushVector(luaSt, nbPotentialProgramAcceleration(p, *r));
+    return 1;
+}
+
+static int gcPotentialProgram(lua_State* luaSt)
+{
+    PotentialProgram** box;
+
+    box = (PotentialProgram**) mw_checknamedudata(luaSt, 1, POTENTIAL_PROGRAM_TYPE);
+    nbFreePotentialProgram(*box);
+    *box = NULL;
+
+    return 0;
+}
+
+static int toStringPotentialProgram(lua_State* luaSt)
+{
+    lua_pushfstring(luaSt, "PotentialProgram { instructions = %d }",
+                    (int) nbPotentialProgramLength(checkPotentialProgram(luaSt, 1)));
+    return 1;
+}
+
+static const luaL_reg metaMethodsPotentialProgram[] =
+{
+    { "__gc",       gcPotentialProgram       },
+    { "__tostring", toStringPotentialProgram },
+    { NULL, NULL }
+};
+
+static const luaL_reg methodsPotentialProgram[] =
+{
+    { "create",       createPotentialProgram },
+    { "acceleration", luaProgramAcceleration },
+    { NULL, NULL }
+};
+
+/* Not a registerStruct() type since there are no fields to get or set */
+int registerPotentialProgram(lua_State* luaSt)
+{
+    int metatable, methods;
+
+    luaL_register(luaSt, POTENTIAL_PROGRAM_TYPE, methodsPotentialProgram);
+    methods = lua_gettop(luaSt);
+
+    luaL_newmetatable(luaSt, POTENTIAL_PROGRAM_TYPE);
+    luaL_register(luaSt, NULL, metaMethodsPotentialProgram);
+    metatable = lua_gettop(luaSt);
+
+    lua_pushliteral(luaSt, "__metatable");
+    lua_pushvalue(luaSt, methods);
+    lua_rawset(luaSt, metatable);
+
+    lua_pushliteral(luaSt, "__index");
+    lua_pushvalue(luaSt, methods);
+    lua_rawset(luaSt, metatable);
+
+    lua_pop(luaSt, 2);
+    return 0;
+}
+
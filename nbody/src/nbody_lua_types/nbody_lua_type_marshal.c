@@ -26,6 +26,14 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include "milkyway_util.h"
 #include "nbody_show.h"
 
+/* A model is either a table of bodies or a BodyArray */
+static int modelBodyCount(lua_State* luaSt, int idx)
+{
+    const BodyArray* arr = toBodyArray(luaSt, idx);
+
+    return arr ? (int) arr->n : luaL_getn(luaSt, idx);
+}
+
 static int totalBodies(lua_State* luaSt, int nModels)
 {
     int top, i, n = 0;
@@ -33,6 +41,12 @@ static int totalBodies(lua_State* luaSt, int nModels)
     top = lua_gettop(luaSt);
     for (i = top; i > top - nModels; --i)
     {
+        if (toBodyArray(luaSt, i))
+        {
+            n += modelBodyCount(luaSt, i);
+            continue;
+        }
+
         if (expectTable(luaSt, i))
         {
             mw_lua_perror(luaSt, "Error reading body table");
@@ -49,6 +63,15 @@ static int readBodyArray(lua_State* luaSt, int table, Body* bodies, int n)
 {
     int i;
     Body* b;
+    const BodyArray* arr;
+
+    arr = toBodyArray(luaSt, table);
+    if (arr)
+    {
+        if (n > 0)
+            memcpy(bodies, arr->bodies, n * sizeof(Body));
+        return 0;
+    }
 
     for (i = 0; i < n; ++i)
     {
@@ -86,7 +109,7 @@ Body* readModels(lua_State* luaSt, int nModels, int* nOut)
     for (i = 0; i < nModels; ++i)
     {
         top = lua_gettop(luaSt);
-        n = luaL_getn(luaSt, top);
+        n = modelBodyCount(luaSt, top);
 
         if (readBodyArray(luaSt, top, bodies, n))
         {
@@ -28,12 +28,14 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 void registerNBodyTypes(lua_State* luaSt)
 {
     registerBody(luaSt);
+    registerBodyArray(luaSt);
 
     registerHalo(luaSt);
     registerDisk(luaSt);
     registerSpherical(luaSt);
 
     registerPotential(luaSt);
+    registerPotentialProgram(luaSt);
     registerHistogramParams(luaSt);
 
     registerNBodyCtx(luaSt);
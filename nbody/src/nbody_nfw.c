@@ -146,8 +146,8 @@ static int nbGenerateNFWCore(lua_State* luaSt,
                              real R_S)
 {
     unsigned int i;
-    int table;
     Body b;
+    Body* bodies;
     real r;
     real totalMass = 0.0;
     real radius = 0.0;
@@ -160,8 +160,7 @@ static int nbGenerateNFWCore(lua_State* luaSt,
     b.bodynode.mass = mass / nbody;    /* Mass per particle */
 
 
-    lua_createtable(luaSt, nbody, 0);
-    table = lua_gettop(luaSt);
+    bodies = pushBodyArray(luaSt, nbody)->bodies;
 
 
     /* Start with half an epsilon */
@@ -179,8 +178,7 @@ static int nbGenerateNFWCore(lua_State* luaSt,
         b.bodynode.pos = nfwBodyPosition(prng, rShift, 1, r);
         b.vel = nfwBodyVelocity(prng, vShift, r, rho_0, R_S);
 
-        pushBody(luaSt, &b);
-        lua_rawseti(luaSt, table, i + 1);
+        bodies[i] = b;
     }
 
     return 1;
@@ -21,6 +21,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include "nbody_priv.h"
 #include "nbody_orbit_integrator.h"
 #include "nbody_potential.h"
+#include "nbody_potential_table.h"
 
 /* Simple orbit integrator in user-defined potential
     Written for BOINC Nbody
@@ -62,3 +63,293 @@ void nbReverseOrbit(mwvector* finalPos,
     *finalVel = v;
 }
 
+
+static inline mwvector orbitAcceleration(const Potential* pot, const PotentialTable* table, mwvector x)
+{
+    return table ? nbPotentialTableAcceleration(table, x) : nbExtAcceleration(pot, x);
+}
+
+/* w1 = 1 / (2 - 2^(1/3)), w0 = 1 - 2 w1 */
+static const real yoshidaW1 = 1.3512071919596576340476878089715;
+static const real yoshidaW0 = -1.7024143839193152680953756179429;
+
+/* Kick-drift-kick; acc holds the acceleration at x on entry and exit */
+static void leapfrogStep(const Potential* pot,
+                         const PotentialTable* table,
+                         mwvector* x,
+                         mwvector* v,
+                         mwvector* acc,
+                         real h)
+{
+    mw_incaddv_s(*v, *acc, 0.5 * h);
+    mw_incaddv_s(*x, *v, h);
+    *acc = orbitAcceleration(pot, table, *x);
+    mw_incaddv_s(*v, *acc, 0.5 * h);
+}
+
+/* Steps of dt are shortened a little so the last one ends on tstop */
+static void integrateFixed(const Potential* pot,
+                           const PotentialTable* table,
+                           mwvector* x,
+                           mwvector* v,
+                           real tstop,
+                           real dt,
+                           orbit_integrator_t integrator)
+{
+    mwvector acc;
+    real h;
+    unsigned int i, nSteps;
+
+    nSteps = (unsigned int) mw_ceil(tstop / dt);
+    if (nSteps == 0)
+        return;
+
+    h = tstop / (real) nSteps;
+    acc = orbitAcceleration(pot, table, *x);
+
+    for (i = 0; i < nSteps; ++i)
+    {
+        if (integrator == OrbitYoshida)
+        {
+            leapfrogStep(pot, table, x, v, &acc, yoshidaW1 * h);
+            leapfrogStep(pot, table, x, v, &acc, yoshidaW0 * h);
+            leapfrogStep(pot, table, x, v, &acc, yoshidaW1 * h);
+        }
+        else
+        {
+            leapfrogStep(pot, table, x, v, &acc, h);
+        }
+    }
+}
+
+/* Dormand-Prince 5(4) tableau. The last row is also the 5th order
+ * solution, so the final stage is the first stage of the next step. */
+static const real dpA[7][6] =
+{
+    { 0.0,                0.0,                0.0,               0.0,            0.0,                0.0        },
+    { 1.0 / 5.0,          0.0,                0.0,               0.0,            0.0,                0.0        },
+    { 3.0 / 40.0,         9.0 / 40.0,         0.0,               0.0,            0.0,                0.0        },
+    { 44.0 / 45.0,        -56.0 / 15.0,       32.0 / 9.0,        0.0,            0.0,                0.0        },
+    { 19372.0 / 6561.0,   -25360.0 / 2187.0,  64448.0 / 6561.0,  -212.0 / 729.0, 0.0,                0.0        },
+    { 9017.0 / 3168.0,    -355.0 / 33.0,      46732.0 / 5247.0,  49.0 / 176.0,   -5103.0 / 18656.0,  0.0        },
+    { 35.0 / 384.0,       0.0,                500.0 / 1113.0,    125.0 / 192.0,  -2187.0 / 6784.0,   11.0 / 84.0 }
+};
+
+/* Difference between the 5th and 4th order weights */
+static const real dpE[7] =
+{
+    71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0, 22.0 / 525.0, -1.0 / 40.0
+};
+
+/* Error of a step in units of the allowed error. The small floors
+ * keep an orbit passing through the origin or stopping from demanding
+ * an impossible relative accuracy. */
+static real stepError(mwvector ex, mwvector ev,
+                      mwvector x, mwvector xn,
+                      mwvector v, mwvector vn,
+                      real tolerance)
+{
+    real xScale = tolerance * (mw_fmax(mw_absv(x), mw_absv(xn)) + 1.0e-3);
+    real vScale = tolerance * (mw_fmax(mw_absv(v), mw_absv(vn)) + 1.0e-3);
+
+    return mw_fmax(mw_absv(ex) / xScale, mw_absv(ev) / vScale);
+}
+
+static int integrateAdaptive(const Potential* pot,
+                             const PotentialTable* table,
+                             mwvector* xOut,
+                             mwvector* vOut,
+                             real tstop,
+                             real dt,
+                             real tolerance)
+{
+    mwvector kx[7], kv[7];
+    mwvector x, v, xs, vs, ex, ev;
+    real t, h, err, fac;
+    int last;
+    unsigned int i, j, nSteps = 0;
+
+    x = *xOut;
+    v = *vOut;
+    t = 0.0;
+    h = dt;
+
+    kx[0] = v;
+    kv[0] = orbitAcceleration(pot, table, x);
+
+    while (t < tstop)
+    {
+        if (++nSteps > ORBIT_ADAPTIVE_MAX_STEPS)
+        {
+            mw_printf("Adaptive orbit exceeded %d steps at t = %g\n", ORBIT_ADAPTIVE_MAX_STEPS, t);
+            return 1;
+        }
+
+        last = (t + h >= tstop);
+        if (last)
+            h = tstop - t;
+
+        for (i = 1; i < 7; ++i)
+        {
+            xs = x;
+            vs = v;
+            for (j = 0; j < i; ++j)
+            {
+                mw_incaddv_s(xs, kx[j], h * dpA[i][j]);
+                mw_incaddv_s(vs, kv[j], h * dpA[i][j]);
+            }
+
+            kx[i] = vs;
+            kv[i] = orbitAcceleration(pot, table, xs);
+        }
+
+        SET_VECTOR(ex, 0.0, 0.0, 0.0);
+        SET_VECTOR(ev, 0.0, 0.0, 0.0);
+        for (j = 0; j < 7; ++j)
+        {
+            mw_incaddv_s(ex, kx[j], h * dpE[j]);
+            mw_incaddv_s(ev, kv[j], h * dpE[j]);
+        }
+
+        err = stepError(ex, ev, x, xs, v, vs, tolerance);
+        if (isnan(err))
+        {
+            mw_printf("Adaptive orbit failed at t = %g\n", t);
+            return 1;
+        }
+
+        fac = (err > 0.0) ? 0.9 * mw_pow(err, -0.2) : 5.0;
+
+        if (err <= 1.0)
+        {
+            x = xs;
+            v = vs;
+            kx[0] = kx[6];
+            kv[0] = kv[6];
+
+            if (last)
+                break;
+
+            t += h;
+            h *= mw_fmin(mw_fmax(fac, 0.2), 5.0);
+        }
+        else
+        {
+            h *= mw_fmax(fac, 0.2);
+            if (h <= REAL_EPSILON * tstop)
+            {
+                mw_printf("Adaptive orbit step underflow at t = %g\n", t);
+                return 1;
+            }
+        }
+    }
+
+    *xOut = x;
+    *vOut = v;
+
+    return 0;
+}
+
+int nbReverseOrbitWith(mwvector* finalPos,
+                       mwvector* finalVel,
+                       const Potential* pot,
+                       mwvector pos,
+                       mwvector vel,
+                       real tstop,
+                       real dt,
+                       orbit_integrator_t integrator,
+                       real tolerance,
+                       const PotentialTable* table)
+{
+    mwvector x = pos;
+    mwvector v = vel;
+
+    if (!(dt > 0.0))
+    {
+        mw_printf("Orbit timestep must be positive (got %g)\n", dt);
+        return 1;
+    }
+
+    switch (integrator)
+    {
+        case OrbitEuler:
+            if (table)
+            {
+                mw_printf("Potential tables can't be used with the Euler orbit integrator\n");
+                return 1;
+            }
+
+            nbReverseOrbit(finalPos, finalVel, pot, pos, vel, tstop, dt);
+            return 0;
+
+        case OrbitLeapfrog:
+        case OrbitYoshida:
+            mw_incnegv(v);
+            integrateFixed(pot, table, &x, &v, tstop, dt, integrator);
+            break;
+
+        case OrbitAdaptive:
+            if (!(tolerance > 0.0))
+            {
+                mw_printf("Adaptive orbit tolerance must be positive (got %g)\n", tolerance);
+                return 1;
+            }
+
+            mw_incnegv(v);
+            if (integrateAdaptive(pot, table, &x, &v, tstop, dt, tolerance))
+                return 1;
+            break;
+
+        case InvalidOrbitIntegrator:
+        default:
+            mw_printf("Invalid orbit integrator %d\n", integrator);
+            return 1;
+    }
+
+    mw_incnegv(v);
+
+    *finalPos = x;
+    *finalVel = v;
+
+    return 0;
+}
+
+/* Orbits are independent, so each thread takes whole orbits. They
+ * finish at different times with the adaptive integrator. */
+int nbReverseOrbits(real* pos[3],
+                    real* vel[3],
+                    unsigned int n,
+                    const Potential* pot,
+                    real tstop,
+                    real dt,
+                    orbit_integrator_t integrator,
+                    real tolerance,
+                    const PotentialTable* table)
+{
+    int i;
+    int failed = FALSE;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) shared(pos, vel) reduction(|:failed) schedule(dynamic)
+  #endif
+    for (i = 0; i < (int) n; ++i)
+    {
+        mwvector x = mw_vec(pos[0][i], pos[1][i], pos[2][i]);
+        mwvector v = mw_vec(vel[0][i], vel[1][i], vel[2][i]);
+
+        if (nbReverseOrbitWith(&x, &v, pot, x, v, tstop, dt, integrator, tolerance, table))
+        {
+            failed |= TRUE;
+            continue;
+        }
+
+        pos[0][i] = X(x);
+        pos[1][i] = Y(x);
+        pos[2][i] = Z(x);
+        vel[0][i] = X(v);
+        vel[1][i] = Y(v);
+        vel[2][i] = Z(v);
+    }
+
+    return failed;
+}
@@ -25,6 +25,8 @@
 #include "nbody_util.h"
 #include "nbody_checkpoint.h"
 #include "nbody_grav.h"
+#include "nbody_io.h"
+#include "nbody_trajectory.h"
 
 static void nbReportProgress(const NBodyCtx* ctx, NBodyState* st)
 {
@@ -45,11 +47,64 @@ static void nbReportProgress(const NBodyCtx* ctx, NBodyState* st)
     }
 }
 
+static inline mwbool nbUseBlockSteps(const NBodyCtx* ctx)
+{
+    return ctx->blockLevels > 1;
+}
+
+/* With block steps a body partway through its step has already had
+ * the opening half kick for the whole step, so its velocity is ahead
+ * of the current fine step. This is how far ahead, to first order in
+ * the acceleration from the start of the step. Output subtracts the
+ * acceleration times this to report velocities at the current step,
+ * while the state itself is left as it is so a resumed run continues
+ * the same step. */
+real nbVelocityLead(const NBodyCtx* ctx, const NBodyState* st, int i)
+{
+    int level;
+    unsigned int k;
+
+    if (!nbUseBlockSteps(ctx))
+        return 0.0;
+
+    level = st->bodyArrays->level[i];
+    k = st->step % (1u << level);
+
+    return (k == 0) ? 0.0 : mw_ldexp(ctx->timestep, level - 1) - (real) k * ctx->timestep;
+}
+
+/* bodytab is only a copy while running, so it can hold the
+ * synchronized velocities for output */
+static void nbSyncOutputVelocities(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i;
+    Body* b;
+    const NBodyBodyArrays* ba = st->bodyArrays;
+
+    if (!nbUseBlockSteps(ctx))
+        return;
+
+    for (i = 0, b = st->bodytab; i < st->nbody; ++i, ++b)
+    {
+        real lead = nbVelocityLead(ctx, st, i);
+
+        X(Vel(b)) -= ba->acc[0][i] * lead;
+        Y(Vel(b)) -= ba->acc[1][i] * lead;
+        Z(Vel(b)) -= ba->acc[2][i] * lead;
+    }
+}
+
 static inline NBodyStatus nbCheckpoint(const NBodyCtx* ctx, NBodyState* st)
 {
     if (nbTimeToCheckpoint(ctx, st))
     {
-        if (nbWriteCheckpoint(ctx, st))
+        if (nbFlushTrajectory(st))
+        {
+            return NBODY_IO_ERROR;
+        }
+
+        nbScatterBodyArrays(st);
+        if (nbWriteCheckpointBackground(ctx, st))
         {
             return NBODY_CHECKPOINT_ERROR;
         }
@@ -60,60 +115,83 @@ static inline NBodyStatus nbCheckpoint(const NBodyCtx* ctx, NBodyState* st)
     return NBODY_SUCCESS;
 }
 
-/* Advance velocity by half a timestep */
-static inline void bodyAdvanceVel(Body* p, const mwvector a, const real dtHalf)
+static inline NBodyStatus nbSnapshot(const NBodyCtx* ctx, NBodyState* st)
 {
-    mwvector dv;
+    char path[1024];
 
-    dv = mw_mulvs(a, dtHalf);   /* get velocity increment */
-    mw_incaddv(Vel(p), dv);     /* advance v by 1/2 step */
-}
+    if (st->snapshotInterval == 0 || st->step % st->snapshotInterval != 0)
+    {
+        return NBODY_SUCCESS;
+    }
 
-/* Advance body position by 1 timestep */
-static inline void bodyAdvancePos(Body* p, const real dt)
-{
-    mwvector dr;
+    nbScatterBodyArrays(st);
+    nbSyncOutputVelocities(ctx, st);
+    snprintf(path, sizeof(path), "%s.%u", st->snapshotPrefix, st->step);
+    if (nbWriteSnapshotBackground(ctx, st, path))
+    {
+        return NBODY_IO_ERROR;
+    }
 
-    dr = mw_mulvs(Vel(p), dt);  /* get position increment */
-    mw_incaddv(Pos(p), dr);     /* advance r by 1 step */
+    return NBODY_SUCCESS;
 }
 
+/* Advance velocities by half a timestep and positions by 1 timestep */
 static inline void advancePosVel(NBodyState* st, const int nbody, const real dt)
 {
     int i;
     real dtHalf = 0.5 * dt;
-    Body* bodies = mw_assume_aligned(st->bodytab, 16);
-    const mwvector* accs = mw_assume_aligned(st->acctab, 16);
+    NBodyBodyArrays* ba = st->bodyArrays;
+    real* x = mw_assume_aligned(ba->pos[0], 16);
+    real* y = mw_assume_aligned(ba->pos[1], 16);
+    real* z = mw_assume_aligned(ba->pos[2], 16);
+    real* vx = mw_assume_aligned(ba->vel[0], 16);
+    real* vy = mw_assume_aligned(ba->vel[1], 16);
+    real* vz = mw_assume_aligned(ba->vel[2], 16);
+    const real* ax = mw_assume_aligned(ba->acc[0], 16);
+    const real* ay = mw_assume_aligned(ba->acc[1], 16);
+    const real* az = mw_assume_aligned(ba->acc[2], 16);
 
   #ifdef _OPENMP
-    #pragma omp parallel for private(i) shared(bodies, accs) schedule(dynamic, 4096 / sizeof(accs[0]))
+    #pragma omp parallel for private(i) shared(x, y, z, vx, vy, vz, ax, ay, az) schedule(static)
   #endif
     for (i = 0; i < nbody; ++i)
     {
-        bodyAdvanceVel(&bodies[i], accs[i], dtHalf);
-        bodyAdvancePos(&bodies[i], dt);
-    }
+        vx[i] += ax[i] * dtHalf;
+        vy[i] += ay[i] * dtHalf;
+        vz[i] += az[i] * dtHalf;
 
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        z[i] += vz[i] * dt;
+    }
 }
 
+/* Advance velocities by half a timestep */
 static inline void advanceVelocities(NBodyState* st, const int nbody, const real dt)
 {
     int i;
     real dtHalf = 0.5 * dt;
-    Body* bodies = mw_assume_aligned(st->bodytab, 16);
-    const mwvector* accs = mw_assume_aligned(st->acctab, 16);
+    NBodyBodyArrays* ba = st->bodyArrays;
+    real* vx = mw_assume_aligned(ba->vel[0], 16);
+    real* vy = mw_assume_aligned(ba->vel[1], 16);
+    real* vz = mw_assume_aligned(ba->vel[2], 16);
+    const real* ax = mw_assume_aligned(ba->acc[0], 16);
+    const real* ay = mw_assume_aligned(ba->acc[1], 16);
+    const real* az = mw_assume_aligned(ba->acc[2], 16);
 
   #ifdef _OPENMP
-    #pragma omp parallel for private(i) schedule(dynamic, 4096 / sizeof(accs[0]))
+    #pragma omp parallel for private(i) shared(vx, vy, vz, ax, ay, az) schedule(static)
   #endif
     for (i = 0; i < nbody; ++i)      /* loop over all bodies */
     {
-        bodyAdvanceVel(&bodies[i], accs[i], dtHalf);
+        vx[i] += ax[i] * dtHalf;
+        vy[i] += ay[i] * dtHalf;
+        vz[i] += az[i] * dtHalf;
     }
 }
 
-/* stepSystem: advance N-body system one time-step. */
-NBodyStatus nbStepSystemPlain(const NBodyCtx* ctx, NBodyState* st)
+/* Step using the body arrays without updating the velocities in bodytab */
+static NBodyStatus nbStepSystemArrays(const NBodyCtx* ctx, NBodyState* st)
 {
     NBodyStatus rc;
     const real dt = ctx->timestep;
@@ -128,28 +206,208 @@ NBodyStatus nbStepSystemPlain(const NBodyCtx* ctx, NBodyState* st)
     return rc;
 }
 
+/* Pick the largest level whose step is within the accuracy estimate
+ * from the change in acceleration over the last step, and which keeps
+ * the body on the block boundaries. Steps may not run past the end. */
+static int nbChooseBlockLevel(const NBodyCtx* ctx, real aSq, real daSq, real dtLast, unsigned int next)
+{
+    int k = 0;
+    const real dt = ctx->timestep;
+    real target = REAL_MAX;
+
+    if (daSq > 0.0)
+    {
+        target = ctx->blockEta * mw_sqrt(aSq / daSq) * dtLast;
+    }
+
+    while (k + 1 < ctx->blockLevels && mw_ldexp(dt, k + 1) <= target)
+    {
+        ++k;
+    }
+
+    while (k > 0 && (next % (1u << k) != 0 || next + (1u << k) > ctx->nStep))
+    {
+        --k;
+    }
+
+    return k;
+}
+
+/* Kick-drift-kick with block timesteps. ctx->timestep is the finest
+ * step and st->step counts those, so every body is drifted each fine
+ * step while only the bodies at the end of their own step get new
+ * forces. The tree is still built from all of the bodies each time. */
+static NBodyStatus nbStepSystemBlock(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i, nActive = 0;
+    NBodyStatus rc;
+    const int nbody = st->nbody;
+    const unsigned int s = st->step;
+    const real dt = ctx->timestep;
+    NBodyBodyArrays* ba = st->bodyArrays;
+    int* level = ba->level;
+    int* active = ba->active;
+
+    for (i = 0; i < nbody; ++i)
+    {
+        /* Opening half kick for bodies starting a step */
+        if (s % (1u << level[i]) == 0)
+        {
+            real dtHalf = 0.5 * mw_ldexp(dt, level[i]);
+
+            ba->vel[0][i] += ba->acc[0][i] * dtHalf;
+            ba->vel[1][i] += ba->acc[1][i] * dtHalf;
+            ba->vel[2][i] += ba->acc[2][i] * dtHalf;
+        }
+
+        ba->pos[0][i] += ba->vel[0][i] * dt;
+        ba->pos[1][i] += ba->vel[1][i] * dt;
+        ba->pos[2][i] += ba->vel[2][i] * dt;
+
+        if ((s + 1) % (1u << level[i]) == 0)
+        {
+            ba->oldAcc[0][nActive] = ba->acc[0][i];
+            ba->oldAcc[1][nActive] = ba->acc[1][i];
+            ba->oldAcc[2][nActive] = ba->acc[2][i];
+            active[nActive++] = i;
+        }
+    }
+
+    rc = nbGravMapActive(ctx, st, active, nActive);
+
+    for (i = 0; i < nActive; ++i)
+    {
+        const int j = active[i];
+        const real dtLast = mw_ldexp(dt, level[j]);
+        real dax = ba->acc[0][j] - ba->oldAcc[0][i];
+        real day = ba->acc[1][j] - ba->oldAcc[1][i];
+        real daz = ba->acc[2][j] - ba->oldAcc[2][i];
+
+        /* Closing half kick */
+        ba->vel[0][j] += ba->acc[0][j] * 0.5 * dtLast;
+        ba->vel[1][j] += ba->acc[1][j] * 0.5 * dtLast;
+        ba->vel[2][j] += ba->acc[2][j] * 0.5 * dtLast;
+
+        level[j] = nbChooseBlockLevel(ctx,
+                                      sqr(ba->acc[0][j]) + sqr(ba->acc[1][j]) + sqr(ba->acc[2][j]),
+                                      sqr(dax) + sqr(day) + sqr(daz),
+                                      dtLast,
+                                      s + 1);
+    }
+
+    st->step++;
+
+    return rc;
+}
+
+/* stepSystem: advance N-body system one time-step. */
+NBodyStatus nbStepSystemPlain(const NBodyCtx* ctx, NBodyState* st)
+{
+    NBodyStatus rc;
+
+    nbGatherBodyArrays(st);
+    if (nbUseBlockSteps(ctx))
+        rc = nbStepSystemBlock(ctx, st);
+    else
+        rc = nbStepSystemArrays(ctx, st);
+    nbScatterBodyArrays(st);
+
+    return rc;
+}
+
+/* Take steps with the shared timestep and nothing else, adding the
+ * time spent in each part of them to times. The body arrays and
+ * accelerations must already be current. */
+NBodyStatus nbTrialStepsPlain(const NBodyCtx* ctx, NBodyState* st, unsigned int nStep, NBodyPhaseTimes* times)
+{
+    unsigned int i;
+    double ts, te;
+    NBodyStatus rc = NBODY_SUCCESS;
+    NBodyPhaseTimes grav = EMPTY_PHASE_TIMES;
+
+    st->phaseTimes = &grav;
+
+    ts = mwGetTime();
+    for (i = 0; i < nStep && !nbStatusIsFatal(rc); ++i)
+    {
+        rc |= nbStepSystemArrays(ctx, st);
+    }
+    te = mwGetTime();
+
+    st->phaseTimes = NULL;
+
+    times->tree += grav.tree;
+    times->force += grav.force;
+    times->external += grav.external;
+    times->integrate += (te - ts) - (grav.tree + grav.force + grav.external);
+
+    return rc;
+}
+
 NBodyStatus nbRunSystemPlain(const NBodyCtx* ctx, NBodyState* st)
 {
     NBodyStatus rc = NBODY_SUCCESS;
+    int ioFailed;
+
+    nbGatherBodyArrays(st);
+
+    /* Calculate accelerations for 1st step this episode. With block
+     * steps a resumed run already has them from the checkpoint, and
+     * most bodies are partway through a step. */
+    if (!nbUseBlockSteps(ctx) || st->step == 0)
+    {
+        rc |= nbGravMap(ctx, st);
+        if (nbStatusIsFatal(rc))
+            return rc;
+    }
 
-    rc |= nbGravMap(ctx, st); /* Calculate accelerations for 1st step this episode */
-    if (nbStatusIsFatal(rc))
-        return rc;
+    /* The trajectory starts with the initial state */
+    if (st->step == 0)
+    {
+        rc |= nbTrajectoryFrame(ctx, st, FALSE);
+    }
 
     while (st->step < ctx->nStep)
     {
-        rc |= nbStepSystemPlain(ctx, st);
+        if (nbUseBlockSteps(ctx))
+            rc |= nbStepSystemBlock(ctx, st);
+        else
+            rc |= nbStepSystemArrays(ctx, st);
         if (nbStatusIsFatal(rc))   /* advance N-body system */
+        {
+            nbScatterBodyArrays(st);
             return rc;
+        }
 
+        /* The frame for this step goes in before a checkpoint of it */
+        rc |= nbTrajectoryFrame(ctx, st, st->step == ctx->nStep);
         rc |= nbCheckpoint(ctx, st);
+        rc |= nbSnapshot(ctx, st);
         if (nbStatusIsFatal(rc))
+        {
+            nbScatterBodyArrays(st);
             return rc;
+        }
 
         nbReportProgress(ctx, st);
         nbUpdateDisplayedBodies(ctx, st);
     }
 
+    nbScatterBodyArrays(st);
+
+    /* Both are always finished, even if one fails */
+    ioFailed = nbFinishSnapshot(st);
+    ioFailed |= nbCloseTrajectory(st);
+    if (ioFailed)
+    {
+        return NBODY_IO_ERROR;
+    }
+
+    if (nbFinishCheckpoint(st))
+    {
+        return NBODY_CHECKPOINT_ERROR;
+    }
+
     if (BOINC_APPLICATION || ctx->checkpointT >= 0)
     {
         mw_report("Making final checkpoint\n");
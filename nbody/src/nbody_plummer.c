@@ -24,6 +24,10 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include "milkyway_lua.h"
 #include "nbody_lua_types.h"
 #include "nbody_plummer.h"
+#include "dSFMT-jump.h"
+
+/* Bodies generated from each substream when generating in parallel */
+#define PLUMMER_BLOCK_SIZE 32768
 
 /* pickshell: pick a random point on a sphere of specified radius. */
 static inline mwvector pickShell(dsfmt_t* dsfmtState, real rad)
@@ -101,6 +105,66 @@ static inline mwvector plummerBodyVelocity(dsfmt_t* dsfmtState, mwvector vshift,
     return vel;
 }
 
+typedef struct
+{
+    Body b;           /* Mass and type for all bodies */
+    mwvector rShift;
+    mwvector vShift;
+    real radiusScale;
+    real velScale;
+} PlummerParams;
+
+static void plummerFillBodies(dsfmt_t* prng, const PlummerParams* pp, Body* bodies, unsigned int n)
+{
+    unsigned int i;
+    Body b = pp->b;
+    real r;
+
+    for (i = 0; i < n; ++i)
+    {
+        r = plummerRandomR(prng);
+
+        b.bodynode.pos = plummerBodyPosition(prng, pp->rShift, pp->radiusScale, r);
+        b.vel = plummerBodyVelocity(prng, pp->vShift, pp->velScale, r);
+
+        bodies[i] = b;
+    }
+}
+
+/* Each block of bodies is generated from its own substream, 2^64
+ * steps of the generator after the previous block's. The substreams
+ * only depend on the starting state, so the bodies are the same for
+ * any number of threads. The generator is left at the start of the
+ * substream after the last block so following models don't reuse
+ * any numbers. */
+static void plummerFillBodiesParallel(dsfmt_t* prng, const PlummerParams* pp, Body* bodies, unsigned int nbody)
+{
+    int i, nBlocks;
+    dsfmt_t* streams;
+
+    nBlocks = (int) ((nbody + PLUMMER_BLOCK_SIZE - 1) / PLUMMER_BLOCK_SIZE);
+    streams = (dsfmt_t*) mwMallocA(nBlocks * sizeof(dsfmt_t));
+
+    for (i = 0; i < nBlocks; ++i)
+    {
+        streams[i] = *prng;
+        dSFMT_jump(prng, DSFMT_JUMP_2_64);
+    }
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) shared(streams, bodies) schedule(dynamic, 1)
+  #endif
+    for (i = 0; i < nBlocks; ++i)
+    {
+        unsigned int first = (unsigned int) i * PLUMMER_BLOCK_SIZE;
+        unsigned int n = MIN(PLUMMER_BLOCK_SIZE, nbody - first);
+
+        plummerFillBodies(&streams[i], pp, &bodies[first], n);
+    }
+
+    mwFreeA(streams);
+}
+
 /* generatePlummer: generate Plummer model initial conditions for test
  * runs, scaled to units such that M = -4E = G = 1 (Henon, Hegge,
  * etc).  See Aarseth, SJ, Henon, M, & Wielen, R (1974) Astr & Ap, 37,
@@ -113,36 +177,31 @@ static int nbGeneratePlummerCore(lua_State* luaSt,
                                  real mass,
 
                                  mwbool ignore,
+                                 mwbool parallel,
 
                                  mwvector rShift,
                                  mwvector vShift,
                                  real radiusScale)
 {
-    unsigned int i;
-    int table;
-    Body b;
-    real r, velScale;
+    PlummerParams pp;
+    Body* bodies;
 
-    memset(&b, 0, sizeof(b));
+    memset(&pp, 0, sizeof(pp));
 
-    velScale = mw_sqrt(mass / radiusScale);     /* and recip. speed scale */
+    pp.velScale = mw_sqrt(mass / radiusScale);     /* and recip. speed scale */
+    pp.radiusScale = radiusScale;
+    pp.rShift = rShift;
+    pp.vShift = vShift;
 
-    b.bodynode.type = BODY(ignore);    /* Same for all in the model */
-    b.bodynode.mass = mass / nbody;    /* Mass per particle */
+    pp.b.bodynode.type = BODY(ignore);    /* Same for all in the model */
+    pp.b.bodynode.mass = mass / nbody;    /* Mass per particle */
 
-    lua_createtable(luaSt, nbody, 0);
-    table = lua_gettop(luaSt);
+    bodies = pushBodyArray(luaSt, nbody)->bodies;
 
-    for (i = 0; i < nbody; ++i)
-    {
-        r = plummerRandomR(prng);
-
-        b.bodynode.pos = plummerBodyPosition(prng, rShift, radiusScale, r);
-        b.vel = plummerBodyVelocity(prng, vShift, velScale, r);
-
-        pushBody(luaSt, &b);
-        lua_rawseti(luaSt, table, i + 1);
-    }
+    if (parallel)
+        plummerFillBodiesParallel(prng, &pp, bodies, nbody);
+    else
+        plummerFillBodies(prng, &pp, bodies, nbody);
 
     return 1;
 }
@@ -153,6 +212,7 @@ int nbGeneratePlummer(lua_State* luaSt)
     static const mwvector* position = NULL;
     static const mwvector* velocity = NULL;
     static mwbool ignore;
+    static mwbool parallel = FALSE;
     static real mass = 0.0, nbodyf = 0.0, radiusScale = 0.0;
 
     static const MWNamedArg argTable[] =
@@ -164,15 +224,19 @@ int nbGeneratePlummer(lua_State* luaSt)
             { "velocity",     LUA_TUSERDATA, MWVECTOR_TYPE, TRUE,  &velocity    },
             { "ignore",       LUA_TBOOLEAN,  NULL,          FALSE, &ignore      },
             { "prng",         LUA_TUSERDATA, DSFMT_TYPE,    TRUE,  &prng        },
+            { "parallel",     LUA_TBOOLEAN,  NULL,          FALSE, &parallel    },
             END_MW_NAMED_ARG
         };
 
     if (lua_gettop(luaSt) != 1)
         return luaL_argerror(luaSt, 1, "Expected 1 arguments");
 
+    /* The parallel generator gives different bodies for the same
+     * seed, so it has to be asked for */
+    parallel = FALSE;
     handleNamedArgumentTable(luaSt, argTable, 1);
 
-    return nbGeneratePlummerCore(luaSt, prng, (unsigned int) nbodyf, mass, ignore,
+    return nbGeneratePlummerCore(luaSt, prng, (unsigned int) nbodyf, mass, ignore, parallel,
                                  *position, *velocity, radiusScale);
 }
 
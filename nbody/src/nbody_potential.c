@@ -116,6 +116,29 @@ static inline mwvector triaxialHaloAccel(const Halo* h, mwvector pos, real r)
     return acc;
 }
 
+static inline mwvector haloAccel(const Halo* halo, mwvector pos, real r)
+{
+    mwvector acc;
+
+    switch (halo->type)
+    {
+        case LogarithmicHalo:
+            acc = logHaloAccel(halo, pos, r);
+            break;
+        case NFWHalo:
+            acc = nfwHaloAccel(halo, pos, r);
+            break;
+        case TriaxialHalo:
+            acc = triaxialHaloAccel(halo, pos, r);
+            break;
+        case InvalidHalo:
+        default:
+            mw_fail("Invalid halo type in external acceleration\n");
+    }
+
+    return acc;
+}
+
 mwvector nbExtAcceleration(const Potential* pot, mwvector pos)
 {
     mwvector acc, acctmp;
@@ -134,22 +157,7 @@ mwvector nbExtAcceleration(const Potential* pot, mwvector pos)
             mw_fail("Invalid disk type in external acceleration\n");
     }
 
-    switch (pot->halo.type)
-    {
-        case LogarithmicHalo:
-            acctmp = logHaloAccel(&pot->halo, pos, r);
-            break;
-        case NFWHalo:
-            acctmp = nfwHaloAccel(&pot->halo, pos, r);
-            break;
-        case TriaxialHalo:
-            acctmp = triaxialHaloAccel(&pot->halo, pos, r);
-            break;
-        case InvalidHalo:
-        default:
-            mw_fail("Invalid halo type in external acceleration\n");
-    }
-
+    acctmp = haloAccel(&pot->halo, pos, r);
     mw_incaddv(acc, acctmp);
     acctmp = sphericalAccel(&pot->sphere[0], pos, r);
     mw_incaddv(acc, acctmp);
@@ -157,3 +165,8 @@ mwvector nbExtAcceleration(const Potential* pot, mwvector pos)
     return acc;
 }
 
+mwvector nbHaloAcceleration(const Halo* halo, mwvector pos)
+{
+    return haloAccel(halo, pos, mw_absv(pos));
+}
+
@@ -0,0 +1,1002 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <ctype.h>
+
+#include "nbody_priv.h"
+#include "nbody_potential.h"
+#include "nbody_potential_program.h"
+#include "milkyway_util.h"
+
+
+typedef enum
+{
+    PROG_CONST,   /* Push k */
+    PROG_LOAD,    /* Push variable arg */
+    PROG_STORE,   /* Pop into variable arg */
+
+    /* Pop b and a, push a op b */
+    PROG_ADD,
+    PROG_SUB,
+    PROG_MUL,
+    PROG_DIV,
+    PROG_POW,
+    PROG_ATAN2,
+    PROG_MIN,
+    PROG_MAX,
+
+    /* Replace the top a with a op k, or k op a for the R forms */
+    PROG_ADDK,
+    PROG_SUBK,
+    PROG_MULK,
+    PROG_DIVK,
+    PROG_POWK,
+    PROG_RSUBK,
+    PROG_RDIVK,
+
+    /* Replace the top a with f(a) */
+    PROG_NEG,
+    PROG_POWI,    /* a^arg */
+    PROG_SQRT,
+    PROG_EXP,
+    PROG_LOG,
+    PROG_SIN,
+    PROG_COS,
+    PROG_TAN,
+    PROG_ATAN,
+    PROG_ABS
+} ProgramOp;
+
+typedef struct
+{
+    ProgramOp op;
+    int arg;
+    real k;
+} ProgramInstr;
+
+/* Variables are numbered with the inputs and outputs first */
+enum
+{
+    PROG_VAR_X,
+    PROG_VAR_Y,
+    PROG_VAR_Z,
+    PROG_VAR_r,
+    PROG_VAR_R,
+    PROG_VAR_AX,
+    PROG_VAR_AY,
+    PROG_VAR_AZ,
+    PROG_N_FIXED_VARS
+};
+
+static const char* const fixedVarNames[PROG_N_FIXED_VARS] =
+{
+    "x", "y", "z", "r", "R", "ax", "ay", "az"
+};
+
+typedef struct
+{
+    const char* name;
+    int nArgs;
+    ProgramOp op;
+    int arg;
+} ProgramFunction;
+
+static const ProgramFunction programFunctions[] =
+{
+    { "sqrt",  1, PROG_SQRT,  0 },
+    { "exp",   1, PROG_EXP,   0 },
+    { "log",   1, PROG_LOG,   0 },
+    { "sin",   1, PROG_SIN,   0 },
+    { "cos",   1, PROG_COS,   0 },
+    { "tan",   1, PROG_TAN,   0 },
+    { "atan",  1, PROG_ATAN,  0 },
+    { "abs",   1, PROG_ABS,   0 },
+    { "sqr",   1, PROG_POWI,  2 },
+    { "cube",  1, PROG_POWI,  3 },
+    { "atan2", 2, PROG_ATAN2, 0 },
+    { "pow",   2, PROG_POW,   0 },
+    { "min",   2, PROG_MIN,   0 },
+    { "max",   2, PROG_MAX,   0 },
+    { NULL,    0, PROG_CONST, 0 }
+};
+
+/* Integer powers up to this are done by multiplication */
+#define PROGRAM_MAX_POWI 16
+
+#define PROGRAM_MAX_NAME 64
+
+struct _PotentialProgram
+{
+    ProgramInstr* code;
+    unsigned int nCode;
+    unsigned int nVars;
+    unsigned int maxStack;
+    mwbool needr;
+    mwbool needR;
+    mwbool hasBase;
+    Potential base;
+};
+
+typedef enum
+{
+    TOK_END,
+    TOK_NUMBER,
+    TOK_NAME,
+    TOK_CHAR
+} ProgramToken;
+
+typedef struct
+{
+    const char* p;
+    int line;
+
+    ProgramToken tok;
+    char c;
+    char name[PROGRAM_MAX_NAME];
+    real num;
+
+    ProgramInstr* code;
+    unsigned int nCode;
+    unsigned int capacity;
+
+    char** varNames;
+    unsigned int nVars;
+    mwbool outputSet[3];
+
+    const char* const* paramNames;
+    const real* paramValues;
+    unsigned int nParams;
+
+    int sp;
+    int maxStack;
+    int depth;
+    mwbool needr;
+    mwbool needR;
+    mwbool failed;
+} ProgramParser;
+
+
+static void programError(ProgramParser* ps, const char* fmt, ...)
+{
+    va_list args;
+    char buf[256];
+
+    if (ps->failed)
+        return;
+
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    mw_printf("Error compiling potential on line %d: %s\n", ps->line, buf);
+    ps->failed = TRUE;
+}
+
+static void nextToken(ProgramParser* ps)
+{
+    const char* p = ps->p;
+    char* end;
+    size_t len;
+
+    while (*p)
+    {
+        if (*p == '#')
+        {
+            while (*p && *p != '\n')
+                ++p;
+        }
+        else if (isspace((unsigned char) *p))
+        {
+            if (*p == '\n')
+                ++ps->line;
+            ++p;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (*p == '\0')
+    {
+        ps->tok = TOK_END;
+    }
+    else if (isdigit((unsigned char) *p) || (*p == '.' && isdigit((unsigned char) p[1])))
+    {
+        ps->tok = TOK_NUMBER;
+        ps->num = (real) strtod(p, &end);
+        p = end;
+    }
+    else if (isalpha((unsigned char) *p) || *p == '_')
+    {
+        for (len = 0; isalnum((unsigned char) p[len]) || p[len] == '_'; ++len)
+            ;
+
+        if (len >= PROGRAM_MAX_NAME)
+        {
+            programError(ps, "Name '%.*s...' is too long", 16, p);
+            len = PROGRAM_MAX_NAME - 1;
+        }
+
+        ps->tok = TOK_NAME;
+        memcpy(ps->name, p, len);
+        ps->name[len] = '\0';
+
+        while (isalnum((unsigned char) *p) || *p == '_')
+            ++p;
+    }
+    else
+    {
+        ps->tok = TOK_CHAR;
+        ps->c = *p++;
+    }
+
+    ps->p = p;
+}
+
+static mwbool isChar(const ProgramParser* ps, char c)
+{
+    return ps->tok == TOK_CHAR && ps->c == c;
+}
+
+static void expectChar(ProgramParser* ps, char c)
+{
+    if (isChar(ps, c))
+    {
+        nextToken(ps);
+    }
+    else
+    {
+        programError(ps, "Expected '%c'", c);
+    }
+}
+
+static void emit(ProgramParser* ps, ProgramOp op, int arg, real k, int stackChange)
+{
+    ProgramInstr* in;
+
+    if (ps->nCode == ps->capacity)
+    {
+        ps->capacity = ps->capacity ? 2 * ps->capacity : 64;
+        ps->code = (ProgramInstr*) mwRealloc(ps->code, ps->capacity * sizeof(ProgramInstr));
+    }
+
+    in = &ps->code[ps->nCode++];
+    in->op = op;
+    in->arg = arg;
+    in->k = k;
+
+    ps->sp += stackChange;
+    if (ps->sp > ps->maxStack)
+    {
+        ps->maxStack = ps->sp;
+        if (ps->maxStack > POTENTIAL_PROGRAM_MAX_STACK)
+            programError(ps, "Expression is too complicated");
+    }
+}
+
+/* The code from start on is a single constant */
+static mwbool isConstant(const ProgramParser* ps, unsigned int start)
+{
+    return ps->nCode == start + 1 && ps->code[start].op == PROG_CONST;
+}
+
+/* a^n by repeated multiplication, so sqr() and cube() give the same
+ * as written out */
+static inline real programPowi(real a, int n)
+{
+    int i;
+    real r;
+
+    if (n == 0)
+        return 1.0;
+
+    r = a;
+    for (i = 1; i < abs(n); ++i)
+        r *= a;
+
+    return (n < 0) ? 1.0 / r : r;
+}
+
+static void runCode(const ProgramInstr* code, unsigned int nCode, real* vars, real* slots, int n);
+
+/* Evaluate the code from start on, which has only constants, and
+ * replace it with the result. This is done with the same code as
+ * when running the program so the result can't differ. */
+static void foldConstant(ProgramParser* ps, unsigned int start)
+{
+    real slots[2 * POTENTIAL_PROGRAM_BLOCK];
+
+    runCode(&ps->code[start], ps->nCode - start, NULL, slots, 1);
+    ps->nCode = start;
+    emit(ps, PROG_CONST, 0, slots[0], 0);
+}
+
+static void unary(ProgramParser* ps, ProgramOp op, int arg, unsigned int start)
+{
+    emit(ps, op, arg, 0.0, 0);
+    if (start + 2 == ps->nCode && ps->code[start].op == PROG_CONST)
+        foldConstant(ps, start);
+}
+
+/* Exponents are only special cased when they are exactly integers or 1/2 */
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+/* Powers by a constant exponent */
+static void powerConstant(ProgramParser* ps, real k)
+{
+    if (k == mw_floor(k) && mw_abs(k) <= PROGRAM_MAX_POWI)
+        emit(ps, PROG_POWI, (int) k, 0.0, 0);
+    else if (k == 0.5)
+        emit(ps, PROG_SQRT, 0, 0.0, 0);
+    else
+        emit(ps, PROG_POWK, 0, k, 0);
+}
+
+/* Combine the operands starting at lStart and rStart. Constants are
+ * folded, and a constant operand is used from the instruction rather
+ * than being pushed. */
+static void binary(ProgramParser* ps, ProgramOp op, unsigned int lStart, unsigned int rStart)
+{
+    /* Forms of add, subtract, multiply and divide with a constant on
+     * the right or the left */
+    static const ProgramOp rightConstantOps[] = { PROG_ADDK, PROG_SUBK, PROG_MULK, PROG_DIVK };
+    static const ProgramOp leftConstantOps[] = { PROG_ADDK, PROG_RSUBK, PROG_MULK, PROG_RDIVK };
+
+    real k;
+    mwbool lConst = (rStart == lStart + 1 && ps->code[lStart].op == PROG_CONST);
+    mwbool rConst = isConstant(ps, rStart);
+
+    if (lConst && rConst)
+    {
+        emit(ps, op, 0, 0.0, -1);
+        foldConstant(ps, lStart);
+    }
+    else if (rConst && op >= PROG_ADD && op <= PROG_POW)
+    {
+        k = ps->code[rStart].k;
+        ps->nCode = rStart;
+        ps->sp -= 1;
+
+        if (op == PROG_POW)
+            powerConstant(ps, k);
+        else
+            emit(ps, rightConstantOps[op - PROG_ADD], 0, k, 0);
+    }
+    else if (lConst && op >= PROG_ADD && op <= PROG_DIV)
+    {
+        k = ps->code[lStart].k;
+        memmove(&ps->code[lStart], &ps->code[rStart], (ps->nCode - rStart) * sizeof(ProgramInstr));
+        ps->nCode -= 1;
+        ps->sp -= 1;
+
+        emit(ps, leftConstantOps[op - PROG_ADD], 0, k, 0);
+    }
+    else
+    {
+        emit(ps, op, 0, 0.0, -1);
+    }
+}
+
+static int findVariable(const ProgramParser* ps, const char* name)
+{
+    unsigned int i;
+
+    for (i = 0; i < ps->nVars; ++i)
+    {
+        if (!strcmp(ps->varNames[i], name))
+            return (int) i;
+    }
+
+    return -1;
+}
+
+static int findParameter(const ProgramParser* ps, const char* name)
+{
+    unsigned int i;
+
+    for (i = 0; i < ps->nParams; ++i)
+    {
+        if (!strcmp(ps->paramNames[i], name))
+            return (int) i;
+    }
+
+    return -1;
+}
+
+static const ProgramFunction* findFunction(const char* name)
+{
+    const ProgramFunction* f;
+
+    for (f = programFunctions; f->name; ++f)
+    {
+        if (!strcmp(f->name, name))
+            return f;
+    }
+
+    return NULL;
+}
+
+static unsigned int parseExpression(ProgramParser* ps);
+static unsigned int parseUnary(ProgramParser* ps);
+
+static void parseCall(ProgramParser* ps, const ProgramFunction* f, unsigned int start)
+{
+    unsigned int second;
+
+    nextToken(ps);
+    expectChar(ps, '(');
+    parseExpression(ps);
+
+    if (f->nArgs == 2)
+    {
+        expectChar(ps, ',');
+        second = parseExpression(ps);
+        expectChar(ps, ')');
+        if (!ps->failed)
+            binary(ps, f->op, start, second);
+    }
+    else
+    {
+        expectChar(ps, ')');
+        if (!ps->failed)
+            unary(ps, f->op, f->arg, start);
+    }
+}
+
+static void parseName(ProgramParser* ps, unsigned int start)
+{
+    int i;
+    const ProgramFunction* f;
+
+    f = findFunction(ps->name);
+    if (f)
+    {
+        parseCall(ps, f, start);
+        return;
+    }
+
+    i = findParameter(ps, ps->name);
+    if (i >= 0)
+    {
+        emit(ps, PROG_CONST, 0, ps->paramValues[i], 1);
+    }
+    else if (!strcmp(ps->name, "pi"))
+    {
+        emit(ps, PROG_CONST, 0, M_PI, 1);
+    }
+    else
+    {
+        i = findVariable(ps, ps->name);
+        if (i < 0 || (i >= PROG_VAR_AX && i <= PROG_VAR_AZ && !ps->outputSet[i - PROG_VAR_AX]))
+        {
+            programError(ps, "Unknown name '%s'", ps->name);
+            return;
+        }
+
+        ps->needr |= (i == PROG_VAR_r);
+        ps->needR |= (i == PROG_VAR_R);
+        emit(ps, PROG_LOAD, i, 0.0, 1);
+    }
+
+    nextToken(ps);
+}
+
+static unsigned int parsePrimary(ProgramParser* ps)
+{
+    unsigned int start = ps->nCode;
+
+    if (ps->failed)
+        return start;
+
+    if (ps->tok == TOK_NUMBER)
+    {
+        emit(ps, PROG_CONST, 0, ps->num, 1);
+        nextToken(ps);
+    }
+    else if (ps->tok == TOK_NAME)
+    {
+        parseName(ps, start);
+    }
+    else if (isChar(ps, '('))
+    {
+        nextToken(ps);
+        parseExpression(ps);
+        expectChar(ps, ')');
+    }
+    else
+    {
+        programError(ps, "Expected an expression");
+    }
+
+    return start;
+}
+
+/* ^ binds more tightly than unary minus and is right associative */
+static unsigned int parsePower(ProgramParser* ps)
+{
+    unsigned int exponent;
+    unsigned int start = parsePrimary(ps);
+
+    if (!ps->failed && isChar(ps, '^'))
+    {
+        nextToken(ps);
+        exponent = parseUnary(ps);
+        if (!ps->failed)
+            binary(ps, PROG_POW, start, exponent);
+    }
+
+    return start;
+}
+
+static unsigned int parseUnary(ProgramParser* ps)
+{
+    unsigned int start;
+
+    if (++ps->depth > POTENTIAL_PROGRAM_MAX_DEPTH)
+    {
+        programError(ps, "Expression is nested too deeply");
+        return ps->nCode;
+    }
+
+    if (isChar(ps, '-'))
+    {
+        nextToken(ps);
+        start = parseUnary(ps);
+        if (!ps->failed)
+            unary(ps, PROG_NEG, 0, start);
+    }
+    else
+    {
+        if (isChar(ps, '+'))
+            nextToken(ps);
+        start = parsePower(ps);
+    }
+
+    --ps->depth;
+    return start;
+}
+
+static unsigned int parseTerm(ProgramParser* ps)
+{
+    ProgramOp op;
+    unsigned int rStart;
+    unsigned int start = parseUnary(ps);
+
+    while (!ps->failed && (isChar(ps, '*') || isChar(ps, '/')))
+    {
+        op = isChar(ps, '*') ? PROG_MUL : PROG_DIV;
+        nextToken(ps);
+        rStart = parseUnary(ps);
+        if (!ps->failed)
+            binary(ps, op, start, rStart);
+    }
+
+    return start;
+}
+
+static unsigned int parseExpression(ProgramParser* ps)
+{
+    ProgramOp op;
+    unsigned int rStart;
+    unsigned int start = parseTerm(ps);
+
+    while (!ps->failed && (isChar(ps, '+') || isChar(ps, '-')))
+    {
+        op = isChar(ps, '+') ? PROG_ADD : PROG_SUB;
+        nextToken(ps);
+        rStart = parseTerm(ps);
+        if (!ps->failed)
+            binary(ps, op, start, rStart);
+    }
+
+    return start;
+}
+
+static void parseStatement(ProgramParser* ps)
+{
+    int var;
+    char name[PROGRAM_MAX_NAME];
+
+    if (ps->tok != TOK_NAME)
+    {
+        programError(ps, "Expected an assignment");
+        return;
+    }
+
+    strcpy(name, ps->name);
+    var = findVariable(ps, name);
+    if ((var >= 0 && var < PROG_VAR_AX) || findParameter(ps, name) >= 0 || findFunction(name) || !strcmp(name, "pi"))
+    {
+        programError(ps, "Cannot assign to '%s'", name);
+        return;
+    }
+
+    nextToken(ps);
+    expectChar(ps, '=');
+    parseExpression(ps);
+    if (ps->failed)
+        return;
+
+    if (var < 0)
+    {
+        var = (int) ps->nVars++;
+        ps->varNames = (char**) mwRealloc(ps->varNames, ps->nVars * sizeof(char*));
+        ps->varNames[var] = strdup(name);
+    }
+    else if (var <= PROG_VAR_AZ)
+    {
+        ps->outputSet[var - PROG_VAR_AX] = TRUE;
+    }
+
+    emit(ps, PROG_STORE, var, 0.0, -1);
+}
+
+static int checkParameterNames(ProgramParser* ps)
+{
+    unsigned int i;
+    const char* name;
+
+    for (i = 0; i < ps->nParams; ++i)
+    {
+        name = ps->paramNames[i];
+        if (findVariable(ps, name) >= 0 || findFunction(name) || !strcmp(name, "pi"))
+        {
+            mw_printf("Potential parameter '%s' has the name of a builtin\n", name);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+PotentialProgram* nbCompilePotentialProgram(const char* src,
+                                            const char* const* paramNames,
+                                            const real* paramValues,
+                                            unsigned int nParams,
+                                            const Potential* base)
+{
+    unsigned int i;
+    PotentialProgram* p = NULL;
+    ProgramParser ps;
+
+    memset(&ps, 0, sizeof(ps));
+    ps.p = src;
+    ps.line = 1;
+    ps.paramNames = paramNames;
+    ps.paramValues = paramValues;
+    ps.nParams = nParams;
+
+    ps.nVars = PROG_N_FIXED_VARS;
+    ps.varNames = (char**) mwMalloc(ps.nVars * sizeof(char*));
+    for (i = 0; i < PROG_N_FIXED_VARS; ++i)
+        ps.varNames[i] = strdup(fixedVarNames[i]);
+
+    ps.failed = checkParameterNames(&ps);
+
+    nextToken(&ps);
+    while (!ps.failed && ps.tok != TOK_END)
+    {
+        parseStatement(&ps);
+        while (isChar(&ps, ';'))
+            nextToken(&ps);
+    }
+
+    for (i = 0; !ps.failed && i < 3; ++i)
+    {
+        if (!ps.outputSet[i])
+            programError(&ps, "'%s' is never assigned", fixedVarNames[PROG_VAR_AX + i]);
+    }
+
+    if (!ps.failed)
+    {
+        p = (PotentialProgram*) mwCalloc(1, sizeof(PotentialProgram));
+        p->code = ps.code;
+        p->nCode = ps.nCode;
+        p->nVars = ps.nVars;
+        p->maxStack = (unsigned int) ps.maxStack;
+        p->needr = ps.needr;
+        p->needR = ps.needR;
+        p->hasBase = (base != NULL);
+        if (base)
+            p->base = *base;
+    }
+    else
+    {
+        free(ps.code);
+    }
+
+    for (i = 0; i < ps.nVars; ++i)
+        free(ps.varNames[i]);
+    free(ps.varNames);
+
+    return p;
+}
+
+PotentialProgram* nbClonePotentialProgram(const PotentialProgram* p)
+{
+    PotentialProgram* newP;
+
+    if (!p)
+        return NULL;
+
+    newP = (PotentialProgram*) mwMalloc(sizeof(PotentialProgram));
+    *newP = *p;
+    newP->code = (ProgramInstr*) mwMalloc(p->nCode * sizeof(ProgramInstr));
+    memcpy(newP->code, p->code, p->nCode * sizeof(ProgramInstr));
+
+    return newP;
+}
+
+void nbFreePotentialProgram(PotentialProgram* p)
+{
+    if (p)
+    {
+        free(p->code);
+        free(p);
+    }
+}
+
+unsigned int nbPotentialProgramLength(const PotentialProgram* p)
+{
+    return p->nCode;
+}
+
+#define PROGRAM_UNARY(expr)                     \
+    a = stk[sp];                                \
+    d = &slots[sp * POTENTIAL_PROGRAM_BLOCK];   \
+    stk[sp] = d;                                \
+    for (i = 0; i < n; ++i)                     \
+    {                                           \
+        d[i] = (expr);                          \
+    }
+
+#define PROGRAM_BINARY(expr)                    \
+    b = stk[sp--];                              \
+    a = stk[sp];                                \
+    d = &slots[sp * POTENTIAL_PROGRAM_BLOCK];   \
+    stk[sp] = d;                                \
+    for (i = 0; i < n; ++i)                     \
+    {                                           \
+        d[i] = (expr);                          \
+    }
+
+/* Run each instruction over the n bodies in the block. Loads just
+ * refer to the variable, and anything computed goes into the slot for
+ * its position on the stack, so variables are only written by
+ * stores. */
+static void runCode(const ProgramInstr* code, unsigned int nCode, real* vars, real* slots, int n)
+{
+    unsigned int pc;
+    int i, sp = -1;
+    real k;
+    real* d;
+    const real* a;
+    const real* b;
+    const real* stk[POTENTIAL_PROGRAM_MAX_STACK];
+
+    for (pc = 0; pc < nCode; ++pc)
+    {
+        const ProgramInstr* in = &code[pc];
+        k = in->k;
+
+        switch (in->op)
+        {
+            case PROG_CONST:
+                ++sp;
+                d = &slots[sp * POTENTIAL_PROGRAM_BLOCK];
+                stk[sp] = d;
+                for (i = 0; i < n; ++i)
+                    d[i] = k;
+                break;
+
+            case PROG_LOAD:
+                stk[++sp] = &vars[in->arg * POTENTIAL_PROGRAM_BLOCK];
+                break;
+
+            case PROG_STORE:
+                a = stk[sp--];
+                d = &vars[in->arg * POTENTIAL_PROGRAM_BLOCK];
+                if (d != a)
+                    memcpy(d, a, n * sizeof(real));
+                break;
+
+            case PROG_ADD:
+                PROGRAM_BINARY(a[i] + b[i]);
+                break;
+            case PROG_SUB:
+                PROGRAM_BINARY(a[i] - b[i]);
+                break;
+            case PROG_MUL:
+                PROGRAM_BINARY(a[i] * b[i]);
+                break;
+            case PROG_DIV:
+                PROGRAM_BINARY(a[i] / b[i]);
+                break;
+            case PROG_POW:
+                PROGRAM_BINARY(mw_pow(a[i], b[i]));
+                break;
+            case PROG_ATAN2:
+                PROGRAM_BINARY(mw_atan2(a[i], b[i]));
+                break;
+            case PROG_MIN:
+                PROGRAM_BINARY(mw_fmin(a[i], b[i]));
+                break;
+            case PROG_MAX:
+                PROGRAM_BINARY(mw_fmax(a[i], b[i]));
+                break;
+
+            case PROG_ADDK:
+                PROGRAM_UNARY(a[i] + k);
+                break;
+            case PROG_SUBK:
+                PROGRAM_UNARY(a[i] - k);
+                break;
+            case PROG_MULK:
+                PROGRAM_UNARY(a[i] * k);
+                break;
+            case PROG_DIVK:
+                PROGRAM_UNARY(a[i] / k);
+                break;
+            case PROG_POWK:
+                PROGRAM_UNARY(mw_pow(a[i], k));
+                break;
+            case PROG_RSUBK:
+                PROGRAM_UNARY(k - a[i]);
+                break;
+            case PROG_RDIVK:
+                PROGRAM_UNARY(k / a[i]);
+                break;
+
+            case PROG_NEG:
+                PROGRAM_UNARY(-a[i]);
+                break;
+            case PROG_POWI:
+                if (in->arg == 2)
+                {
+                    PROGRAM_UNARY(a[i] * a[i]);
+                }
+                else if (in->arg == 3)
+                {
+                    PROGRAM_UNARY(a[i] * a[i] * a[i]);
+                }
+                else
+                {
+                    PROGRAM_UNARY(programPowi(a[i], in->arg));
+                }
+                break;
+            case PROG_SQRT:
+                PROGRAM_UNARY(mw_sqrt(a[i]));
+                break;
+            case PROG_EXP:
+                PROGRAM_UNARY(mw_exp(a[i]));
+                break;
+            case PROG_LOG:
+                PROGRAM_UNARY(mw_log(a[i]));
+                break;
+            case PROG_SIN:
+                PROGRAM_UNARY(mw_sin(a[i]));
+                break;
+            case PROG_COS:
+                PROGRAM_UNARY(mw_cos(a[i]));
+                break;
+            case PROG_TAN:
+                PROGRAM_UNARY(mw_tan(a[i]));
+                break;
+            case PROG_ATAN:
+                PROGRAM_UNARY(mw_atan(a[i]));
+                break;
+            case PROG_ABS:
+                PROGRAM_UNARY(mw_abs(a[i]));
+                break;
+
+            default:
+                mw_panic("Bad potential program op %d\n", in->op);
+        }
+    }
+}
+
+void nbPotentialProgramAddAccelerations(const PotentialProgram* p,
+                                        const int* index,
+                                        int n,
+                                        real* const pos[3],
+                                        real* const acc[3])
+{
+    int i, j, k, m;
+    mwvector r, a, baseAcc;
+    real* vars;
+    real* slots;
+    real* x;
+    real* y;
+    real* z;
+
+    vars = (real*) mwMallocA((p->nVars + p->maxStack) * POTENTIAL_PROGRAM_BLOCK * sizeof(real));
+    slots = &vars[p->nVars * POTENTIAL_PROGRAM_BLOCK];
+    x = &vars[PROG_VAR_X * POTENTIAL_PROGRAM_BLOCK];
+    y = &vars[PROG_VAR_Y * POTENTIAL_PROGRAM_BLOCK];
+    z = &vars[PROG_VAR_Z * POTENTIAL_PROGRAM_BLOCK];
+
+    for (k = 0; k < n; k += POTENTIAL_PROGRAM_BLOCK)
+    {
+        m = (n - k < POTENTIAL_PROGRAM_BLOCK) ? n - k : POTENTIAL_PROGRAM_BLOCK;
+
+        for (j = 0; j < m; ++j)
+        {
+            i = index ? index[k + j] : k + j;
+            x[j] = pos[0][i];
+            y[j] = pos[1][i];
+            z[j] = pos[2][i];
+        }
+
+        if (p->needr)
+        {
+            for (j = 0; j < m; ++j)
+                vars[PROG_VAR_r * POTENTIAL_PROGRAM_BLOCK + j] = mw_sqrt(sqr(x[j]) + sqr(y[j]) + sqr(z[j]));
+        }
+
+        if (p->needR)
+        {
+            for (j = 0; j < m; ++j)
+                vars[PROG_VAR_R * POTENTIAL_PROGRAM_BLOCK + j] = mw_sqrt(sqr(x[j]) + sqr(y[j]));
+        }
+
+        runCode(p->code, p->nCode, vars, slots, m);
+
+        for (j = 0; j < m; ++j)
+        {
+            i = index ? index[k + j] : k + j;
+
+            SET_VECTOR(a,
+                       vars[PROG_VAR_AX * POTENTIAL_PROGRAM_BLOCK + j],
+                       vars[PROG_VAR_AY * POTENTIAL_PROGRAM_BLOCK + j],
+                       vars[PROG_VAR_AZ * POTENTIAL_PROGRAM_BLOCK + j]);
+
+            if (p->hasBase)
+            {
+                SET_VECTOR(r, x[j], y[j], z[j]);
+                baseAcc = nbExtAcceleration(&p->base, r);
+                mw_incaddv(a, baseAcc);
+            }
+
+            acc[0][i] += X(a);
+            acc[1][i] += Y(a);
+            acc[2][i] += Z(a);
+        }
+    }
+
+    mwFreeA(vars);
+}
+
+mwvector nbPotentialProgramAcceleration(const PotentialProgram* p, mwvector pos)
+{
+    real x = X(pos), y = Y(pos), z = Z(pos);
+    real ax = 0.0, ay = 0.0, az = 0.0;
+    real* const posp[3] = { &x, &y, &z };
+    real* const accp[3] = { &ax, &ay, &az };
+    mwvector acc;
+
+    nbPotentialProgramAddAccelerations(p, NULL, 1, posp, accp);
+
+    SET_VECTOR(acc, ax, ay, az);
+    return acc;
+}
+
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nbody_priv.h"
+#include "nbody_potential.h"
+#include "nbody_potential_table.h"
+#include "milkyway_util.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif /* _OPENMP */
+
+
+/* Inverse of the grid map, the R or |z| of grid coordinate tc. The
+ * nodes before the first are mirror images, since g and gz are even
+ * in R and z. */
+static real tableCoord(const PotentialTable* t, real tc)
+{
+    tc = mw_abs(tc);
+    return t->scale * tc / (t->stretch - tc);
+}
+
+/* The part of the potential which is tabulated */
+static mwvector tabulatedAcceleration(const PotentialTable* t, mwvector pos)
+{
+    mwvector halo;
+    mwvector acc = nbExtAcceleration(&t->pot, pos);
+
+    if (t->triaxial)
+    {
+        halo = nbHaloAcceleration(&t->pot.halo, pos);
+        mw_incsubv(acc, halo);
+    }
+
+    return acc;
+}
+
+/* Nodes on the axis or in the plane are taken just off of it, where
+ * aR / R and az / z have their limits */
+static void fillTableRow(PotentialTable* t, int j)
+{
+    int i;
+    mwvector pos, acc;
+    const int n = (int) t->nCells;
+    const real eps = 1.0e-6 * t->scale;
+    const real z = mw_fmax(tableCoord(t, (real) j), eps);
+    real* g = &t->g[2 * (j + 1) * (n + 3)];
+
+    for (i = -1; i <= n + 1; ++i)
+    {
+        real R = mw_fmax(tableCoord(t, (real) i), eps);
+
+        SET_VECTOR(pos, R, 0.0, z);
+        acc = tabulatedAcceleration(t, pos);
+
+        g[2 * (i + 1)]     = X(acc) / R;
+        g[2 * (i + 1) + 1] = Z(acc) / z;
+    }
+}
+
+/* Catmull-Rom weights of the 4 nodes around a point w of the way
+ * between the middle 2 */
+static inline void cubicWeights(real c[4], real w)
+{
+    const real w2 = w * w;
+    const real w3 = w2 * w;
+
+    c[0] = 0.5 * (2.0 * w2 - w3 - w);
+    c[1] = 0.5 * (3.0 * w3 - 5.0 * w2 + 2.0);
+    c[2] = 0.5 * (4.0 * w2 - 3.0 * w3 + w);
+    c[3] = 0.5 * (w3 - w2);
+}
+
+static mwvector tableLookup(const PotentialTable* t, mwvector pos, real R)
+{
+    mwvector acc;
+    real dr, dz, inv, fr, fz, cr[4], cz[4];
+    real g = 0.0, gz = 0.0;
+    unsigned int i, j, k;
+    const real* p;
+    const unsigned int n = t->nCells;
+    const unsigned int stride = 2 * (n + 3);
+    const real az = mw_abs(Z(pos));
+
+    /* Both grid maps with one division */
+    dr = R + t->scale;
+    dz = az + t->scale;
+    inv = t->stretch / (dr * dz);
+    fr = R * dz * inv;
+    fz = az * dr * inv;
+
+    i = (unsigned int) fr;
+    j = (unsigned int) fz;
+    i = (i < n) ? i : n - 1;
+    j = (j < n) ? j : n - 1;
+    cubicWeights(cr, fr - (real) i);
+    cubicWeights(cz, fz - (real) j);
+
+    /* Node i - 1 is the first in the padded rows */
+    p = &t->g[j * stride + 2 * i];
+
+    for (k = 0; k < 4; ++k, p += stride)
+    {
+        g  += cz[k] * (cr[0] * p[0] + cr[1] * p[2] + cr[2] * p[4] + cr[3] * p[6]);
+        gz += cz[k] * (cr[0] * p[1] + cr[1] * p[3] + cr[2] * p[5] + cr[3] * p[7]);
+    }
+
+    SET_VECTOR(acc, g * X(pos), g * Y(pos), gz * Z(pos));
+    return acc;
+}
+
+/* Check the table at the centre of each cell in a row. Returns the
+ * largest relative error in the row, and twice the distance of the
+ * far corner of the furthest cell which failed, if any did. The error
+ * grows quickly towards the centre, so the margin covers the cells
+ * just outside the failed ones which passed at their centre but not
+ * everywhere. */
+static real checkTableRow(const PotentialTable* t, int j, real* rFail)
+{
+    int i;
+    mwvector pos, exact, approx;
+    real R, err, maxErr = 0.0;
+    const real z = tableCoord(t, (real) j + 0.5);
+    const real zFar = tableCoord(t, (real) j + 1.0);
+
+    *rFail = 0.0;
+    for (i = 0; i < (int) t->nCells; ++i)
+    {
+        R = tableCoord(t, (real) i + 0.5);
+
+        SET_VECTOR(pos, R, 0.0, z);
+        exact = tabulatedAcceleration(t, pos);
+        approx = tableLookup(t, pos, R);
+
+        err = mw_absv(mw_subv(approx, exact)) / mw_absv(exact);
+        if (!(err <= t->tolerance))
+        {
+            R = tableCoord(t, (real) i + 1.0);
+            *rFail = mw_fmax(*rFail, 2.0 * mw_sqrt(sqr(R) + sqr(zFar)));
+        }
+        else
+        {
+            maxErr = mw_fmax(maxErr, err);
+        }
+    }
+
+    return maxErr;
+}
+
+/* Fill a table with n cells along each axis and find where it is
+ * accurate enough. Returns nonzero if the part needing the analytic
+ * potential is too large. */
+static int tryPotentialTable(PotentialTable* t, unsigned int n)
+{
+    int j;
+    int nRow = (int) n;
+    real* rowErr;
+    real* rowFail;
+    real rCore = 0.0;
+    const real rMax = POTENTIAL_TABLE_RADIUS;
+
+    t->nCells = n;
+    t->stretch = (real) n * (rMax + t->scale) / rMax;
+    t->g = (real*) mwMallocA(2 * (n + 3) * (n + 3) * sizeof(real));
+
+    rowErr = (real*) mwMalloc(n * sizeof(real));
+    rowFail = (real*) mwMalloc(n * sizeof(real));
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(j) shared(t) schedule(dynamic)
+  #endif
+    for (j = -1; j <= nRow + 1; ++j)
+    {
+        fillTableRow(t, j);
+    }
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(j) shared(t, rowErr, rowFail) schedule(dynamic)
+  #endif
+    for (j = 0; j < nRow; ++j)
+    {
+        rowErr[j] = checkTableRow(t, j, &rowFail[j]);
+    }
+
+    t->maxError = 0.0;
+    for (j = 0; j < nRow; ++j)
+    {
+        t->maxError = mw_fmax(t->maxError, rowErr[j]);
+        rCore = mw_fmax(rCore, rowFail[j]);
+    }
+
+    free(rowErr);
+    free(rowFail);
+
+    t->rCore2 = sqr(rCore);
+    if (rCore > POTENTIAL_TABLE_MAX_CORE)
+    {
+        mwFreeA(t->g);
+        t->g = NULL;
+        t->nCells = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* The table is uniform in R / (R + scale), so about half of the nodes
+ * are inside the scale. Too small a scale leaves the outer cells too
+ * large, and too large a scale does the same near the centre. */
+static real tableScale(const Potential* pot)
+{
+    return mw_fmax(pot->disk.scaleLength, 0.5 * pot->halo.scaleLength);
+}
+
+PotentialTable* nbCreatePotentialTable(const Potential* pot, real tolerance)
+{
+    unsigned int n;
+    PotentialTable* t;
+
+    t = (PotentialTable*) mwCalloc(1, sizeof(PotentialTable));
+    t->pot = *pot;
+    t->tolerance = tolerance;
+    t->triaxial = (pot->halo.type == TriaxialHalo);
+    t->scale = tableScale(pot);
+    t->rMax2 = sqr(POTENTIAL_TABLE_RADIUS);
+
+    for (n = POTENTIAL_TABLE_MIN_CELLS; n <= POTENTIAL_TABLE_MAX_CELLS; n *= 2)
+    {
+        if (!tryPotentialTable(t, n))
+        {
+            mw_printf("Tabulated external potential with %u x %u cells, max relative error %g, analytic inside r = %g\n",
+                      n, n, t->maxError, mw_sqrt(t->rCore2));
+            return t;
+        }
+    }
+
+    mw_printf("Warning: Failed to tabulate the external potential to within %g "
+              "with %u x %u cells. Using the analytic potential\n",
+              tolerance,
+              POTENTIAL_TABLE_MAX_CELLS,
+              POTENTIAL_TABLE_MAX_CELLS);
+    return t;
+}
+
+void nbFreePotentialTable(PotentialTable* t)
+{
+    if (t)
+    {
+        mwFreeA(t->g);
+        free(t);
+    }
+}
+
+/* The cached table is remade if any of its parameters differ at all */
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+
+const PotentialTable* nbStatePotentialTable(const NBodyCtx* ctx, NBodyState* st)
+{
+    PotentialTable* t = st->potTable;
+
+    if (ctx->potentialType != EXTERNAL_POTENTIAL_DEFAULT || ctx->potentialTableTolerance <= 0.0)
+    {
+        return NULL;
+    }
+
+    /* The potential may be changed between steps from Lua */
+    if (!t || t->tolerance != ctx->potentialTableTolerance || !equalPotential(&t->pot, &ctx->pot))
+    {
+        nbFreePotentialTable(t);
+        t = st->potTable = nbCreatePotentialTable(&ctx->pot, ctx->potentialTableTolerance);
+    }
+
+    return (t->nCells != 0) ? t : NULL;
+}
+
+mwvector nbPotentialTableAcceleration(const PotentialTable* t, mwvector pos)
+{
+    mwvector acc, halo;
+    const real R2 = sqr(X(pos)) + sqr(Y(pos));
+    const real z2 = sqr(Z(pos));
+
+    if (t->nCells == 0 || R2 + z2 < t->rCore2 || R2 > t->rMax2 || z2 > t->rMax2)
+    {
+        return nbExtAcceleration(&t->pot, pos);
+    }
+
+    acc = tableLookup(t, pos, mw_sqrt(R2));
+
+    if (t->triaxial)
+    {
+        halo = nbHaloAcceleration(&t->pot.halo, pos);
+        mw_incaddv(acc, halo);
+    }
+
+    return acc;
+}
+
@@ -51,22 +51,24 @@
 
 #define MAX_INSTANCES 256
 
+static int nbFeedBodyCount(int totalBodies)
+{
+    int stride = nbFeedStride(totalBodies);
+    return (totalBodies + stride - 1) / stride;
+}
+
 static void nbPrepareSceneFromState(const NBodyCtx* ctx, const NBodyState* st)
 {
     st->scene->nbodyMajorVersion = NBODY_VERSION_MAJOR;
     st->scene->nbodyMinorVersion = NBODY_VERSION_MINOR;
-    st->scene->nbody = st->nbody;
+    st->scene->totalBodies = st->nbody;
+    st->scene->stride = nbFeedStride(st->nbody);
+    st->scene->nbody = nbFeedBodyCount(st->nbody);
     st->scene->nSteps = ctx->nStep;
     st->scene->hasInfo = TRUE;
     st->scene->hasGalaxy = (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT);
 }
 
-static size_t nbFindShmemSize(int nbody)
-{
-    size_t snapshotSize = sizeof(NBodyCircularQueue) + nbody * sizeof(FloatPos);
-    return sizeof(scene_t) + NBODY_CIRC_QUEUE_SIZE * snapshotSize;
-}
-
 #if USE_SHMEM
 
 /* Map the header of a shared memory segment and see if it is owned by
@@ -209,7 +211,7 @@ int nbCreateSharedScene(NBodyState* st, const NBodyCtx* ctx)
     int instanceId;
     char name[128];
     scene_t* scene = NULL;
-    size_t size = nbFindShmemSize(st->nbody);
+    size_t size = nbFindShmemSize(nbFeedBodyCount(st->nbody));
 
     /* Try looking for the next available segment of the form /milkyway_nbody_<n> */
     for (instanceId = 0; instanceId < MAX_INSTANCES; ++instanceId)
@@ -248,7 +250,7 @@ int nbCreateSharedScene(NBodyState* st, const NBodyCtx* ctx)
 
 int nbCreateSharedScene(NBodyState* st, const NBodyCtx* ctx)
 {
-    size_t size = nbFindShmemSize(st->nbody);
+    size_t size = nbFindShmemSize(nbFeedBodyCount(st->nbody));
 
     st->scene = (scene_t*) mw_graphics_make_shmem(NBODY_BIN_NAME, (int) size);
     if (!st->scene)
@@ -440,63 +442,124 @@ void nbLaunchVisualizer(NBodyState* st, const char* graphicsBin, const char* vis
 
 #endif /* _WIN32 */
 
-static void nbWriteSnapshot(NBodyCircularQueue* queue, int buffer, const NBodyCtx* ctx, const NBodyState* st)
+/* With the direct sum there is no tree to get it from */
+static mwvector nbFeedCenterOfMass(const NBodyState* st)
+{
+    int i;
+    real m = 0.0;
+    mwvector cm = ZERO_VECTOR;
+    const NBodyBodyArrays* ba = st->bodyArrays;
+
+    for (i = 0; i < st->nbody; ++i)
+    {
+        X(cm) += ba->mass[i] * ba->pos[0][i];
+        Y(cm) += ba->mass[i] * ba->pos[1][i];
+        Z(cm) += ba->mass[i] * ba->pos[2][i];
+        m += ba->mass[i];
+    }
+
+    mw_incdivs(cm, m);
+    return cm;
+}
+
+/* Add the nodes NBODY_FEED_CELL_DEPTH levels below node, or the
+ * bodies above that level */
+static int nbCollectFeedCells(const NBodyNode* node, int depth, FloatCell* cells, int n)
+{
+    const NBodyNode* p;
+
+    if (isBody(node) || depth == NBODY_FEED_CELL_DEPTH)
+    {
+        if (n < NBODY_FEED_MAX_CELLS)
+        {
+            cells[n].x = (float) X(Pos(node));
+            cells[n].y = (float) Y(Pos(node));
+            cells[n].z = (float) Z(Pos(node));
+            cells[n].mass = (float) Mass(node);
+            ++n;
+        }
+
+        return n;
+    }
+
+    for (p = More(node); p != Next(node); p = Next(p))
+    {
+        n = nbCollectFeedCells(p, depth + 1, cells, n);
+    }
+
+    return n;
+}
+
+/* While the system is running the body arrays are authoritative, and
+ * otherwise they are the same as bodytab, so the frame is taken from
+ * them without bringing bodytab up to date. */
+static void nbWriteFrame(NBodyFrameHeader* frame, int slot, const NBodyCtx* ctx, const NBodyState* st)
 {
     int i;
-    const Body* b;
     mwvector cmPos;
-    int nbody = st->nbody;
-    SceneInfo* info = &queue->info[buffer];
-    FloatPos* r = &queue->bodyData[buffer * nbody];
+    scene_t* scene = st->scene;
+    const int n = scene->nbody;
+    const int stride = scene->stride;
+    const NBodyBodyArrays* ba = st->bodyArrays;
+    FloatPos* r = nbFeedBodies(scene, slot);
 
     if (st->tree.root)
     {
         cmPos = Pos(st->tree.root);
+        frame->nCells = nbCollectFeedCells((const NBodyNode*) st->tree.root, 0, nbFeedCells(scene, slot), 0);
     }
     else
     {
         /* If we are using exact nbody or haven't constructed the tree
          * yet we need to calculate the center of mass on our own */
-        cmPos = nbCenterOfMass(st);
+        cmPos = nbFeedCenterOfMass(st);
+        frame->nCells = 0;
     }
 
-    info->currentTime = (float) st->step * (float) ctx->timestep;
-    info->timeEvolve = (float) ctx->timeEvolve;
+    frame->nbody = n;
+    frame->info.currentTime = (float) st->step * (float) ctx->timestep;
+    frame->info.timeEvolve = (float) ctx->timeEvolve;
 
-    info->rootCenterOfMass[0] = (float) X(cmPos);
-    info->rootCenterOfMass[1] = (float) Y(cmPos);
-    info->rootCenterOfMass[2] = (float) Z(cmPos);
+    frame->info.rootCenterOfMass[0] = (float) X(cmPos);
+    frame->info.rootCenterOfMass[1] = (float) Y(cmPos);
+    frame->info.rootCenterOfMass[2] = (float) Z(cmPos);
 
   #ifdef _OPENMP
-    #pragma omp parallel for private(i, b) schedule(guided, 4096 / sizeof(Body))
+    #pragma omp parallel for private(i) schedule(static)
   #endif
-    for (i = 0; i < nbody; ++i)
+    for (i = 0; i < n; ++i)
     {
-        b = &st->bodytab[i];
-        r[i].x = (float) X(Pos(b));
-        r[i].y = (float) Y(Pos(b));
-        r[i].z = (float) Z(Pos(b));
-        r[i].ignore = ignoreBody(b);
+        int j = i * stride;
+
+        r[i].x = (float) ba->pos[0][j];
+        r[i].y = (float) ba->pos[1][j];
+        r[i].z = (float) ba->pos[2][j];
+        r[i].ignore = ignoreBody(&st->bodytab[j]);
     }
 }
 
-static int nbPushCircularQueue(NBodyCircularQueue* queue, const NBodyCtx* ctx, const NBodyState* st)
+/* Write the next frame into the slot after the newest one. The
+ * graphics may still be reading that slot, but then it sees the
+ * generation change and reads the new frame instead. */
+static void nbPublishFrame(const NBodyCtx* ctx, const NBodyState* st)
 {
-    int head, tail, nextTail;
-    tail = OPA_load_int(&queue->tail);
-    head = OPA_load_int(&queue->head);
+    scene_t* scene = st->scene;
+    NBodyFeed* feed = &scene->feed;
+    int count = OPA_load_int(&feed->published) + 1;
+    int slot = nbFeedSlot(count);
+    NBodyFrameHeader* frame = &feed->frames[slot];
+    int generation = OPA_load_int(&frame->generation);
 
-    nextTail = (tail + 1) % NBODY_CIRC_QUEUE_SIZE;
-    if (nextTail != head)
-    {
-        nbWriteSnapshot(queue, tail, ctx, st);
-        OPA_store_int(&queue->tail, nextTail);
-        return TRUE;
-    }
-    else /* write failed, queue full */
-    {
-        return FALSE;
-    }
+    OPA_store_int(&frame->generation, generation + 1);
+    OPA_write_barrier();
+
+    nbWriteFrame(frame, slot, ctx, st);
+
+    OPA_write_barrier();
+    OPA_store_int(&frame->generation, generation + 2);
+    OPA_store_int(&feed->published, count);
+
+    scene->lastFrameTime = mwGetTime();
 }
 
 static void nbReleaseSceneLocks(scene_t* scene)
@@ -507,63 +570,29 @@ static void nbReleaseSceneLocks(scene_t* scene)
     OPA_store_int(&scene->attachedPID, 0);
 }
 
-/* TODO: Should we quit if we are supposed to be blocking on graphics
- * and the graphics dies? */
-NBodyStatus nbUpdateDisplayedBodies(const NBodyCtx* ctx, NBodyState* st)
+/* Wait for the graphics to show the last frame published */
+static NBodyStatus nbWaitForGraphics(scene_t* scene)
 {
     int pid;
-    scene_t* scene = st->scene;
-
-    if (!scene)
-    {
-        return NBODY_SUCCESS;
-    }
-
-    /* No copying when no screensaver attached */
-    pid = OPA_load_int(&scene->attachedPID);
-    if (pid == 0)
-    {
-        return NBODY_SUCCESS;
-    }
+    double now;
+    double startTime = mwGetTime();
+    double waitTime = 0.0;
+    double lastCheck = startTime;
+    const NBodyFeed* feed = &scene->feed;
 
-    if (OPA_load_int(&scene->blockSimulationOnGraphics))
+    while (OPA_load_int(&feed->consumed) != OPA_load_int(&feed->published))
     {
-        int updated = FALSE;
-        double dt = -1.0;
-        double startTime = mwGetTime();
-
-        /* FIXME: This needs to change if we allow changing
-         * whether the simulation should block
-         */
-
-        do
+        /* The PID was reset by the graphics to 0, the process quit normally */
+        pid = OPA_load_int(&scene->attachedPID);
+        if (pid == 0)
         {
-            int attempt = 0;
-
-            /* Keep trying to push to the queue as long as the
-             * process is still attached. */
-            while (   !(updated = nbPushCircularQueue(&scene->queue, ctx, st))
-                   && ((pid = OPA_load_int(&scene->attachedPID)) != 0)
-                   && (attempt < NBODY_QUEUE_WAIT_PERIODS))
-            {
-                mwMilliSleep(NBODY_QUEUE_SLEEP_INTERVAL);
-                ++attempt;
-            }
-
-            /* We did update successfully, we are done */
-            if (updated)
-            {
-                return NBODY_SUCCESS;
-            }
-
-            /* The PID was reset by the graphics to 0, the process quit normally */
-            if (pid == 0)
-            {
-                mw_report("Graphics process quit while waiting (waited %f seconds)\n",
-                          mwGetTime() - startTime);
-                return NBODY_GRAPHICS_DEAD;
-            }
+            mw_report("Graphics process quit while waiting (waited %f seconds)\n", mwGetTime() - startTime);
+            return NBODY_GRAPHICS_DEAD;
+        }
 
+        now = mwGetTime();
+        if (now - lastCheck > NBODY_FEED_WAIT_PERIOD)
+        {
             /* It's been a while, so the graphics may have
              * crashed. If the process is dead, we give up and
              * remove it's locks */
@@ -574,24 +603,70 @@ NBodyStatus nbUpdateDisplayedBodies(const NBodyCtx* ctx, NBodyState* st)
                 return NBODY_GRAPHICS_DEAD;
             }
 
-            /* FIXME: What if it goes into an infinite loop while
+            /* Time spent paused doesn't count.
+             * FIXME: What if it goes into an infinite loop while
              * paused? */
+            if (!OPA_load_int(&scene->paused))
+            {
+                waitTime += now - lastCheck;
+            }
+
+            /* The process is supposedly still alive, but it has
+             * been a long time and it isn't paused.
+             * TODO: Should we kill it?
+             */
+            if (waitTime > NBODY_FEED_TIMEOUT)
+            {
+                mw_report("Waiting on graphics timed out (%f seconds)\n", now - startTime);
+                return NBODY_GRAPHICS_TIMEOUT;
+            }
+
+            lastCheck = now;
         }
-        while (OPA_load_int(&scene->paused) || (dt = mwGetTime() - startTime) < NBODY_QUEUE_TIMEOUT);
 
-        /* The process is supposedly still alive, but it has
-         * been a long time and it isn't paused.
-         * TODO: Should we kill it?
-         */
-        mw_report("Waiting on graphics timed out (%f seconds)\n", mwGetTime() - startTime);
+        mwMilliSleep(NBODY_FEED_SLEEP_INTERVAL);
+    }
+
+    return NBODY_SUCCESS;
+}
 
-        return NBODY_GRAPHICS_TIMEOUT;
+/* TODO: Should we quit if we are supposed to be blocking on graphics
+ * and the graphics dies? */
+NBodyStatus nbUpdateDisplayedBodies(const NBodyCtx* ctx, NBodyState* st)
+{
+    NBodyStatus rc;
+    scene_t* scene = st->scene;
+
+    if (!scene)
+    {
+        return NBODY_SUCCESS;
     }
-    else
+
+    /* No copying when no screensaver attached */
+    if (OPA_load_int(&scene->attachedPID) == 0)
     {
-        nbPushCircularQueue(&scene->queue, ctx, st);
+        return NBODY_SUCCESS;
     }
 
+    /* FIXME: This needs to change if we allow changing
+     * whether the simulation should block
+     */
+    if (OPA_load_int(&scene->blockSimulationOnGraphics))
+    {
+        rc = nbWaitForGraphics(scene);
+        if (rc != NBODY_SUCCESS)
+        {
+            return rc;
+        }
+    }
+    else if (mwGetTime() - scene->lastFrameTime < NBODY_FEED_FRAME_INTERVAL)
+    {
+        /* More frames than this would never be seen */
+        return NBODY_SUCCESS;
+    }
+
+    nbPublishFrame(ctx, st);
+
     return NBODY_SUCCESS;
 }
 
@@ -211,6 +211,8 @@ const char* showExternalPotentialType(ExternalPotentialType x)
             return "None";
         case EXTERNAL_POTENTIAL_CUSTOM_LUA:
             return "Lua";
+        case EXTERNAL_POTENTIAL_PROGRAM:
+            return "Compiled";
         default:
             return "Unknown ExternalPotentialType";
     }
@@ -462,8 +464,13 @@ char* showNBodyCtx(const NBodyCtx* ctx)
                      "  criterion       = %s\n"
                      "  useQuad         = %s\n"
                      "  allowIncest     = %s\n"
+                     "  useMortonTree   = %s\n"
+                     "  useInteractionLists = %s\n"
                      "  checkpointT     = %d\n"
                      "  nStep           = %u\n"
+                     "  blockLevels     = %d\n"
+                     "  blockEta        = %f\n"
+                     "  potentialTableTolerance = %g\n"
                      "  potentialType   = %s\n"
                      "  pot = %s\n"
                      "};\n",
@@ -476,8 +483,13 @@ char* showNBodyCtx(const NBodyCtx* ctx)
                      showCriterionT(ctx->criterion),
                      showBool(ctx->useQuad),
                      showBool(ctx->allowIncest),
+                     showBool(ctx->useMortonTree),
+                     showBool(ctx->useInteractionLists),
                      (int) ctx->checkpointT,
                      ctx->nStep,
+                     ctx->blockLevels,
+                     ctx->blockEta,
+                     ctx->potentialTableTolerance,
                      showExternalPotentialType(ctx->potentialType),
                      potBuf
             ))
@@ -608,22 +620,22 @@ char* showNBodyState(const NBodyState* st)
     if (0 > asprintf(&buf,
                      "NBodyState %p = {\n"
                      "  tree           = %s\n"
-                     "  freeCell       = %p\n"
+                     "  cells          = %p\n"
                      "  lastCheckpoint = %d\n"
                      "  step           = %u\n"
                      "  nbody          = %u\n"
                      "  bodytab        = %p\n"
-                     "  acctab         = %p\n"
+                     "  bodyArrays     = %p\n"
                      "  treeIncest     = %s\n"
                      "};\n",
                      st,
                      treeBuf,
-                     st->freeCell,
+                     st->cellArena.cells,
                      (int) st->lastCheckpoint,
                      st->step,
                      st->nbody,
                      st->bodytab,
-                     st->acctab,
+                     st->bodyArrays,
                      showBool(st->treeIncest)
             ))
     {
@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nbody_config.h"
+
+#include "nbody_types.h"
+#include "nbody_trajectory.h"
+#include "nbody_plain.h"
+#include "nbody_background.h"
+#include "milkyway_util.h"
+
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <sys/types.h>
+#else
+  #include <io.h>
+#endif
+
+
+/* Trajectory file, version 1. The header describes which bodies are
+   in the frames, and frames are appended to it as the run goes. Values
+   are in the byte order of the machine that wrote the file, which the
+   endian tag records.
+
+   Name          Type          Notes
+-------------------------------------------------------
+   magic         char[8]       "mwnbtraj"
+   endianTag     uint32        0x01020304 as written
+   format        uint32        1
+   nbody         uint32        Bodies in the simulation
+   nSelected     uint32        Bodies in each frame
+   flags         uint32        NB_TRAJECTORY_STREAM_ONLY
+   decimate      uint32
+   interval      uint32        Steps between frames
+   reserved      uint32
+   index         uint32[nSelected]  Body each frame entry is from,
+                                    padded to a multiple of 8 bytes
+
+   Each frame is:
+     step          uint32
+     reserved      uint32
+     time          double
+     pos x, y, z   double[nSelected]
+     vel x, y, z   double[nSelected]
+
+   Frames all have the same size, so a frame cut off by the run being
+   killed is easy to spot and ignore. A resumed run drops any frames
+   after the step it resumed from before appending.
+ */
+
+#define NB_TRAJECTORY_FORMAT 1
+#define NB_TRAJECTORY_ENDIAN_TAG 0x01020304
+#define NB_TRAJECTORY_STREAM_ONLY 0x1
+
+#define NB_TRAJECTORY_FIXED_HEADER_SIZE 40
+#define NB_TRAJECTORY_FRAME_HEADER_SIZE 16
+
+static const char trajMagic[8] = { 'm', 'w', 'n', 'b', 't', 'r', 'a', 'j' };
+
+typedef struct
+{
+    NBodyTrajectory* traj;
+    uint32_t step;
+    double time;
+    double* data;   /* pos x, y, z then vel x, y, z, nSelected each */
+} NBodyTrajectoryFrame;
+
+/* Frames are copied into one buffer while the other is written, so the
+ * integrator only waits when the disk falls 2 frames behind */
+struct _NBodyTrajectory
+{
+    FILE* f;
+    char* filename;
+    unsigned int interval;
+    uint32_t nSelected;
+    uint32_t* index;
+
+    NBodyTrajectoryFrame frames[2];
+    int fill;       /* Frame the integrator fills next */
+    NBodyBackgroundWriter* writer;
+};
+
+
+static size_t nbTrajectoryHeaderSize(uint32_t nSelected)
+{
+    size_t indexSize = nSelected * sizeof(uint32_t);
+
+    return NB_TRAJECTORY_FIXED_HEADER_SIZE + ((indexSize + 7) & ~(size_t) 7);
+}
+
+static size_t nbTrajectoryFrameSize(uint32_t nSelected)
+{
+    return NB_TRAJECTORY_FRAME_HEADER_SIZE + 6 * nSelected * sizeof(double);
+}
+
+static int nbTrajectorySeek(FILE* f, uint64_t offset)
+{
+  #ifndef _WIN32
+    return fseeko(f, (off_t) offset, SEEK_SET);
+  #else
+    return _fseeki64(f, (__int64) offset, SEEK_SET);
+  #endif
+}
+
+static int nbTrajectoryTruncate(FILE* f, uint64_t size)
+{
+    fflush(f);
+
+  #ifndef _WIN32
+    return ftruncate(fileno(f), (off_t) size);
+  #else
+    return _chsize_s(_fileno(f), (__int64) size);
+  #endif
+}
+
+static int nbWriteTrajectoryFrame(NBodyTrajectory* traj, const NBodyTrajectoryFrame* frame)
+{
+    unsigned char header[NB_TRAJECTORY_FRAME_HEADER_SIZE];
+    uint32_t reserved = 0;
+    size_t n = 6 * (size_t) traj->nSelected;
+
+    memcpy(&header[0], &frame->step, sizeof(uint32_t));
+    memcpy(&header[4], &reserved, sizeof(uint32_t));
+    memcpy(&header[8], &frame->time, sizeof(double));
+
+    if (   fwrite(header, sizeof(header), 1, traj->f) != 1
+        || fwrite(frame->data, sizeof(double), n, traj->f) != n
+        || fflush(traj->f))
+    {
+        mwPerror("Error writing trajectory '%s'", traj->filename);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static int nbWriteTrajectoryHeader(NBodyTrajectory* traj, uint32_t nbody, uint32_t flags, uint32_t decimate)
+{
+    size_t size = nbTrajectoryHeaderSize(traj->nSelected);
+    unsigned char* header = (unsigned char*) mwCalloc(size, sizeof(unsigned char));
+    uint32_t fields[8];
+    int failed;
+
+    fields[0] = NB_TRAJECTORY_ENDIAN_TAG;
+    fields[1] = NB_TRAJECTORY_FORMAT;
+    fields[2] = nbody;
+    fields[3] = traj->nSelected;
+    fields[4] = flags;
+    fields[5] = decimate;
+    fields[6] = traj->interval;
+    fields[7] = 0;
+
+    memcpy(header, trajMagic, sizeof(trajMagic));
+    memcpy(header + sizeof(trajMagic), fields, sizeof(fields));
+    memcpy(header + NB_TRAJECTORY_FIXED_HEADER_SIZE, traj->index, traj->nSelected * sizeof(uint32_t));
+
+    failed = (fwrite(header, size, 1, traj->f) != 1) || fflush(traj->f);
+    if (failed)
+    {
+        mwPerror("Error writing trajectory header '%s'", traj->filename);
+    }
+
+    free(header);
+    return failed;
+}
+
+/* Continue a trajectory from a resumed run. The file must be from the
+ * same selection of bodies, and any frames past the resumed step are
+ * dropped since they will be written again. Frames are flushed before
+ * each checkpoint, so the last one kept must be the last one due by
+ * the checkpointed step. Otherwise frames were lost and the file
+ * can't be continued. */
+static int nbResumeTrajectory(NBodyTrajectory* traj, const NBodyState* st, uint32_t flags, uint32_t decimate)
+{
+    size_t headerSize = nbTrajectoryHeaderSize(traj->nSelected);
+    size_t frameSize = nbTrajectoryFrameSize(traj->nSelected);
+    unsigned char* header;
+    uint32_t expected[8];
+    uint64_t nFrame, keep;
+    uint32_t lastStep = 0;
+    const uint32_t expectedStep = st->step - st->step % traj->interval;
+    int ok;
+
+    header = (unsigned char*) mwMalloc(headerSize);
+
+    expected[0] = NB_TRAJECTORY_ENDIAN_TAG;
+    expected[1] = NB_TRAJECTORY_FORMAT;
+    expected[2] = (uint32_t) st->nbody;
+    expected[3] = traj->nSelected;
+    expected[4] = flags;
+    expected[5] = decimate;
+    expected[6] = traj->interval;
+    expected[7] = 0;
+
+    ok = (fread(header, headerSize, 1, traj->f) == 1)
+        && !memcmp(header, trajMagic, sizeof(trajMagic))
+        && !memcmp(header + sizeof(trajMagic), expected, sizeof(expected))
+        && !memcmp(header + NB_TRAJECTORY_FIXED_HEADER_SIZE, traj->index, traj->nSelected * sizeof(uint32_t));
+    free(header);
+
+    if (!ok)
+    {
+        mw_printf("Trajectory '%s' does not match the resumed run\n", traj->filename);
+        return TRUE;
+    }
+
+    for (nFrame = 0; ; ++nFrame)
+    {
+        uint32_t step;
+
+        if (   nbTrajectorySeek(traj->f, headerSize + nFrame * frameSize + frameSize - 1)
+            || fgetc(traj->f) == EOF)
+        {
+            break;  /* Only complete frames */
+        }
+
+        if (   nbTrajectorySeek(traj->f, headerSize + nFrame * frameSize)
+            || fread(&step, sizeof(step), 1, traj->f) != 1
+            || step > st->step)
+        {
+            break;
+        }
+
+        lastStep = step;
+    }
+
+    /* The final frame is forced, so a finished run may end off the
+     * interval. A file first opened by a resumed run may have no
+     * frames yet. */
+    if (nFrame > 0 && lastStep != expectedStep && lastStep != st->step)
+    {
+        mw_printf("Trajectory '%s' ends at step %u, but the checkpoint is at step %u\n",
+                  traj->filename, lastStep, st->step);
+        return TRUE;
+    }
+
+    keep = headerSize + nFrame * frameSize;
+    if (nbTrajectoryTruncate(traj->f, keep) || nbTrajectorySeek(traj->f, keep))
+    {
+        mwPerror("Error truncating trajectory '%s'", traj->filename);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static int nbTrajectoryFrameJob(void* data)
+{
+    NBodyTrajectoryFrame* frame = (NBodyTrajectoryFrame*) data;
+
+    return nbWriteTrajectoryFrame(frame->traj, frame);
+}
+
+static void nbFreeTrajectory(NBodyTrajectory* traj)
+{
+    nbStopBackgroundWriter(traj->writer);
+
+    if (traj->f)
+    {
+        fclose(traj->f);
+    }
+
+    free(traj->frames[0].data);
+    free(traj->frames[1].data);
+    free(traj->index);
+    free(traj->filename);
+    free(traj);
+}
+
+int nbOpenTrajectory(NBodyState* st,
+                     const char* filename,
+                     unsigned int interval,
+                     unsigned int decimate,
+                     int streamOnly)
+{
+    int i;
+    uint32_t n = 0;
+    uint32_t seen = 0;
+    uint32_t flags = streamOnly ? NB_TRAJECTORY_STREAM_ONLY : 0;
+    int failed;
+    NBodyTrajectory* traj;
+
+    assert(st->trajectory == NULL);
+
+    if (interval == 0 || decimate == 0)
+    {
+        mw_printf("Trajectory interval and decimation must be positive\n");
+        return TRUE;
+    }
+
+    traj = (NBodyTrajectory*) mwCalloc(1, sizeof(NBodyTrajectory));
+    traj->filename = strdup(filename);
+    traj->interval = interval;
+    traj->index = (uint32_t*) mwMalloc(st->nbody * sizeof(uint32_t));
+
+    for (i = 0; i < st->nbody; ++i)
+    {
+        if (streamOnly && ignoreBody(&st->bodytab[i]))
+            continue;
+
+        if (seen++ % decimate == 0)
+            traj->index[n++] = (uint32_t) i;
+    }
+    traj->nSelected = n;
+
+    if (n == 0)
+    {
+        mw_printf("No bodies selected for trajectory '%s'\n", filename);
+        nbFreeTrajectory(traj);
+        return TRUE;
+    }
+
+    for (i = 0; i < 2; ++i)
+    {
+        traj->frames[i].traj = traj;
+        traj->frames[i].data = (double*) mwMalloc(6 * n * sizeof(double));
+    }
+
+    /* Keep the frames already written if this is a resumed run */
+    traj->f = (st->step > 0) ? mw_fopen(filename, "r+b") : NULL;
+    if (traj->f)
+    {
+        failed = nbResumeTrajectory(traj, st, flags, decimate);
+    }
+    else
+    {
+        traj->f = mw_fopen(filename, "wb");
+        if (!traj->f)
+        {
+            mwPerror("Error opening trajectory '%s'", filename);
+            nbFreeTrajectory(traj);
+            return TRUE;
+        }
+
+        failed = nbWriteTrajectoryHeader(traj, (uint32_t) st->nbody, flags, decimate);
+    }
+
+    if (failed)
+    {
+        nbFreeTrajectory(traj);
+        return TRUE;
+    }
+
+    traj->writer = nbStartBackgroundWriter("trajectory");
+    st->trajectory = traj;
+
+    return FALSE;
+}
+
+/* Copy the selected bodies into a free frame. While the system is
+ * running the body arrays are authoritative, so they are copied from
+ * there without bringing bodytab up to date first. Velocities are
+ * synchronized to the current step like snapshots. */
+NBodyStatus nbTrajectoryFrame(const NBodyCtx* ctx, NBodyState* st, mwbool force)
+{
+    uint32_t j;
+    int k;
+    double* data;
+    NBodyTrajectoryFrame* frame;
+    NBodyTrajectory* traj = st->trajectory;
+    const NBodyBodyArrays* ba = st->bodyArrays;
+    const uint32_t n = traj ? traj->nSelected : 0;
+
+    if (!traj || (!force && st->step % traj->interval != 0))
+    {
+        return NBODY_SUCCESS;
+    }
+
+    /* Frames are written in order, so once at most one is left to
+     * write the one to fill next is done */
+    if (nbWaitBackgroundWriter(traj->writer, 1))
+    {
+        return NBODY_IO_ERROR;
+    }
+
+    frame = &traj->frames[traj->fill];
+    traj->fill = !traj->fill;
+
+    frame->step = st->step;
+    frame->time = (double) st->step * (double) ctx->timestep;
+    data = frame->data;
+
+    for (k = 0; k < 3; ++k)
+    {
+        const real* pos = ba->pos[k];
+        const real* vel = ba->vel[k];
+        const real* acc = ba->acc[k];
+        double* posOut = &data[k * n];
+        double* velOut = &data[(3 + k) * n];
+
+        for (j = 0; j < n; ++j)
+        {
+            const uint32_t i = traj->index[j];
+
+            posOut[j] = (double) pos[i];
+            velOut[j] = (double) (vel[i] - acc[i] * nbVelocityLead(ctx, st, (int) i));
+        }
+    }
+
+    if (nbQueueBackgroundJob(traj->writer, nbTrajectoryFrameJob, frame))
+    {
+        return NBODY_IO_ERROR;
+    }
+
+    return NBODY_SUCCESS;
+}
+
+int nbFlushTrajectory(NBodyState* st)
+{
+    return st->trajectory ? nbWaitBackgroundWriter(st->trajectory->writer, 0) : FALSE;
+}
+
+int nbCloseTrajectory(NBodyState* st)
+{
+    int failed;
+    NBodyTrajectory* traj = st->trajectory;
+
+    if (!traj)
+        return FALSE;
+
+    failed = nbStopBackgroundWriter(traj->writer);
+    traj->writer = NULL;
+
+    if (fclose(traj->f))
+    {
+        mwPerror("Error closing trajectory '%s'", traj->filename);
+        failed = TRUE;
+    }
+    traj->f = NULL;
+
+    nbFreeTrajectory(traj);
+    st->trajectory = NULL;
+
+    return failed;
+}
+
@@ -25,6 +25,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include <lua.h>
 #include <lauxlib.h>
 #include "nbody_lua_types.h"
+#include "nbody_util.h"
 #include "milkyway_util.h"
 
 #if defined(__GNUC__) && !defined(__INTEL_COMPILER)
@@ -175,20 +176,47 @@ static void expandBox(NBodyTree* t, const Body* btab, int nbody)
     }
 }
 
+/* Cells made while loading come in blocks of this many. Blocks are
+ * never moved, so cells keep their addresses until the tree is laid
+ * out. */
+#define NB_CELL_BLOCK_SIZE 4096
+
+void nbFreeCellArena(NBodyCellArena* arena)
+{
+    unsigned int i;
+
+    for (i = 0; i < arena->nBlocks; ++i)
+    {
+        mwFreeA(arena->blocks[i]);
+    }
+
+    free(arena->blocks);
+    mwFreeA(arena->cells);
+
+    arena->blocks = NULL;
+    arena->nBlocks = 0;
+    arena->nMade = 0;
+    arena->cells = NULL;
+    arena->cellAlloc = 0;
+}
+
 /* makecell: return pointer to free cell. */
 static NBodyCell* nbMakeCell(NBodyState* st, NBodyTree* t)
 {
     NBodyCell* c;
+    NBodyCellArena* arena = &st->cellArena;
+    unsigned int block = arena->nMade / NB_CELL_BLOCK_SIZE;
 
-    if (st->freeCell == NULL)                   /* no free cells left? */
-    {
-        c = (NBodyCell*) mwMallocA(sizeof(*c)); /* allocate a new one */
-    }
-    else                                        /* use existing free cell */
+    if (block == arena->nBlocks)                /* no free cells left? */
     {
-        c = (NBodyCell*) st->freeCell;          /* take one on front */
-        st->freeCell = Next(c);                 /* go on to next one */
+        arena->blocks = (NBodyCell**) mwRealloc(arena->blocks, (block + 1) * sizeof(NBodyCell*));
+        arena->blocks[block] = (NBodyCell*) mwMallocA(NB_CELL_BLOCK_SIZE * sizeof(NBodyCell));
+        arena->nBlocks = block + 1;
     }
+
+    c = &arena->blocks[block][arena->nMade % NB_CELL_BLOCK_SIZE];
+    arena->nMade++;
+
     Type(c) = CELL(0);                          /* initialize cell type */
     More(c) = NULL;
     memset(&c->stuff, 0, sizeof(c->stuff));     /* empty sub cells */
@@ -197,26 +225,18 @@ static NBodyCell* nbMakeCell(NBodyState* st, NBodyTree* t)
 }
 
 /* reclaim cells in tree, prepare to build new one. */
-static void nbNewTree(NBodyState* st, NBodyTree* t)
+static void nbReclaimTree(NBodyState* st, NBodyTree* t)
 {
-    NBodyNode* p = (NBodyNode*) t->root;              /* start with the root */
-
-    while (p != NULL)                       /* loop scanning tree */
-    {
-        if (isCell(p))                      /* found cell to free? */
-        {
-            Next(p) = st->freeCell;         /* link to front of */
-            st->freeCell = p;               /* ...existing list */
-            p = More(p);                    /* scan down tree */
-        }
-        else                                /* skip over bodies */
-        {
-            p = Next(p);                    /* go on to next */
-        }
-    }
+    st->cellArena.nMade = 0;
 
+    t->root = NULL;
     t->cellUsed = 0;   /* init count of cells, levels */
     t->maxDepth = 0;
+}
+
+static void nbNewTree(NBodyState* st, NBodyTree* t)
+{
+    nbReclaimTree(st, t);
 
     t->root = nbMakeCell(st, t);      /* allocate the root cell */
     mw_zerov(Pos(t->root));           /* initialize the midpoint */
@@ -423,10 +443,48 @@ static void hackCofM(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real ps
     Pos(p) = cmpos;             /* and center-of-mass pos */
 }
 
-/* nbMakeTree: initialize tree structure for hierarchical force calculation
+/* Copy the subtree of p into cells starting at *n, parents before
+ * children and children in subcell order. This is the order threadTree
+ * visits cells in. */
+static NBodyCell* nbLayoutCell(const NBodyCell* p, NBodyCell* cells, unsigned int* n)
+{
+    int i;
+    NBodyCell* c = &cells[(*n)++];
+
+    *c = *p;
+    for (i = 0; i < NSUB; ++i)
+    {
+        if (Subp(c)[i] != NULL && isCell(Subp(c)[i]))
+        {
+            Subp(c)[i] = (NBodyNode*) nbLayoutCell((const NBodyCell*) Subp(c)[i], cells, n);
+        }
+    }
+
+    return c;
+}
+
+/* Move the loaded tree into one array in depth first order */
+static void nbLayoutTree(NBodyState* st, NBodyTree* t)
+{
+    unsigned int n = 0;
+    NBodyCellArena* arena = &st->cellArena;
+
+    if (arena->cellAlloc < t->cellUsed)
+    {
+        /* Grow with some slack since the count changes a little every step */
+        mwFreeA(arena->cells);
+        arena->cellAlloc = t->cellUsed + t->cellUsed / 8 + 1;
+        arena->cells = (NBodyCell*) mwMallocA(arena->cellAlloc * sizeof(NBodyCell));
+    }
+
+    t->root = nbLayoutCell(t->root, arena->cells, &n);
+    assert(n == t->cellUsed);
+}
+
+/* nbMakeTreeInsert: initialize tree structure for hierarchical force calculation
  * from body array btab, which contains ctx.nbody bodies.
  */
-NBodyStatus nbMakeTree(const NBodyCtx* ctx, NBodyState* st)
+static NBodyStatus nbMakeTreeInsert(const NBodyCtx* ctx, NBodyState* st)
 {
     Body* p;
     const Body* endp = st->bodytab + st->nbody;
@@ -445,6 +503,7 @@ NBodyStatus nbMakeTree(const NBodyCtx* ctx, NBodyState* st)
     if (st->tree.structureError)
         return NBODY_TREE_STRUCTURE_ERROR;
 
+    nbLayoutTree(st, t);                          /* make cells contiguous */
 
     hackCofM(ctx, &st->tree, t->root, t->rsize);   /* find c-of-m coordinates */
 
@@ -459,6 +518,536 @@ NBodyStatus nbMakeTree(const NBodyCtx* ctx, NBodyState* st)
     return NBODY_SUCCESS;
 }
 
+/* The Morton ordered linear tree builder.
+ *
+ * Each body gets a key made of the subcell indices (as nbSubIndex
+ * would find them) on its path down from the root, found with the
+ * same midpoint arithmetic as nbLoadBody so that the result matches
+ * the insertion builder. After sorting by key every cell is a run of
+ * bodies sharing a key prefix, and bodies in a cell come in the order
+ * threadTree visits them. A cell of depth d exists for every prefix
+ * of d levels shared by at least 2 bodies.
+ *
+ * If common[i] is the number of levels shared by sorted bodies i and
+ * i + 1, body i starts the cells with depths common[i - 1] + 1 through
+ * common[i]. Numbering cells in order of the body that starts them
+ * and then depth is the depth first order, so every cell and its
+ * Next and More links can be found independently for each body. The
+ * centers of mass, critical radii and quadrupole moments are then
+ * found one level at a time from the deepest level up.
+ *
+ * Keys hold NB_MORTON_LEVELS levels. If any 2 bodies need a deeper
+ * tree than that, the insertion builder is used instead.
+ */
+
+#define NB_MORTON_LEVELS 21
+#define NB_MORTON_RADIX_BITS 11
+#define NB_MORTON_RADIX_SIZE (1 << NB_MORTON_RADIX_BITS)
+#define NB_MORTON_RADIX_PASSES ((64 + NB_MORTON_RADIX_BITS - 1) / NB_MORTON_RADIX_BITS)
+
+/* Test particles are not in the tree. Their keys sort after every real key */
+#define NB_MORTON_EXCLUDED_KEY UINT64_MAX
+
+#ifdef _OPENMP
+  #define nbThreadNum() omp_get_thread_num()
+  #define nbNumThreads() omp_get_num_threads()
+#else
+  #define nbThreadNum() (0)
+  #define nbNumThreads() (1)
+#endif
+
+void nbFreeLinearTree(NBodyLinearTree* lt)
+{
+    if (!lt)
+        return;
+
+    mwFreeA(lt->keys);
+    mwFreeA(lt->order);
+    mwFreeA(lt->keysTmp);
+    mwFreeA(lt->orderTmp);
+    mwFreeA(lt->common);
+    mwFreeA(lt->cellBase);
+    mwFreeA(lt->cells);
+    mwFreeA(lt->cellDepth);
+    mwFreeA(lt->levelCells);
+    mwFreeA(lt);
+}
+
+static void nbLinearTreeReserveBodies(NBodyLinearTree* lt, int nbody)
+{
+    if (lt->bodyAlloc >= nbody)
+        return;
+
+    mwFreeA(lt->keys);
+    mwFreeA(lt->order);
+    mwFreeA(lt->keysTmp);
+    mwFreeA(lt->orderTmp);
+    mwFreeA(lt->common);
+    mwFreeA(lt->cellBase);
+
+    lt->keys = (uint64_t*) mwMallocA(nbody * sizeof(uint64_t));
+    lt->order = (int*) mwMallocA(nbody * sizeof(int));
+    lt->keysTmp = (uint64_t*) mwMallocA(nbody * sizeof(uint64_t));
+    lt->orderTmp = (int*) mwMallocA(nbody * sizeof(int));
+    lt->common = (int*) mwMallocA(nbody * sizeof(int));
+    lt->cellBase = (int*) mwMallocA((nbody + 1) * sizeof(int));
+    lt->bodyAlloc = nbody;
+}
+
+static void nbLinearTreeReserveCells(NBodyLinearTree* lt, unsigned int nCells)
+{
+    if (lt->cellAlloc >= nCells)
+        return;
+
+    /* Grow with some slack since the count changes a little every step */
+    nCells += nCells / 8 + 1;
+
+    mwFreeA(lt->cells);
+    mwFreeA(lt->cellDepth);
+    mwFreeA(lt->levelCells);
+
+    lt->cells = (NBodyCell*) mwMallocA(nCells * sizeof(NBodyCell));
+    lt->cellDepth = (int*) mwMallocA(nCells * sizeof(int));
+    lt->levelCells = (int*) mwMallocA(nCells * sizeof(int));
+    lt->cellAlloc = nCells;
+}
+
+static inline real nbMortonOffset(real qPos, int upper, real qsize)
+{
+    /* Same as calcOffset */
+    return qPos + 0.25 * (upper ? qsize : -qsize);
+}
+
+/* Descend from the root in the same way nbLoadBody does, recording
+ * the subcell index at each level */
+static uint64_t nbMortonKey(mwvector pos, mwvector rootPos, real rsize)
+{
+    int lev;
+    int xb, yb, zb;
+    uint64_t key = 0;
+    real qsize = rsize;
+    mwvector q = rootPos;
+
+    for (lev = 0; lev < NB_MORTON_LEVELS; ++lev)
+    {
+        xb = (X(q) <= X(pos));
+        yb = (Y(q) <= Y(pos));
+        zb = (Z(q) <= Z(pos));
+
+        key = (key << NDIM) | (uint64_t) ((xb << 2) | (yb << 1) | zb);
+
+        X(q) = nbMortonOffset(X(q), xb, qsize);
+        Y(q) = nbMortonOffset(Y(q), yb, qsize);
+        Z(q) = nbMortonOffset(Z(q), zb, qsize);
+        qsize *= 0.5;
+    }
+
+    return key;
+}
+
+static inline int nbMortonShift(int depth)
+{
+    return NDIM * (NB_MORTON_LEVELS - depth);
+}
+
+/* Number of leading levels 2 keys have in common */
+static inline int nbMortonCommonLevels(uint64_t a, uint64_t b)
+{
+    int lev;
+    uint64_t x = a ^ b;
+
+    for (lev = 0; lev < NB_MORTON_LEVELS; ++lev)
+    {
+        if (x >> nbMortonShift(lev + 1))
+            break;
+    }
+
+    return lev;
+}
+
+/* Midpoint of the cell containing key at depth, found the same way
+ * nbInitMidpoint does */
+static mwvector nbMortonCellCenter(uint64_t key, int depth, mwvector rootPos, real rsize)
+{
+    int lev;
+    unsigned int ind;
+    real qsize = rsize;
+    mwvector q = rootPos;
+
+    for (lev = 0; lev < depth; ++lev)
+    {
+        ind = (unsigned int) (key >> nbMortonShift(lev + 1)) & (NSUB - 1);
+
+        X(q) = nbMortonOffset(X(q), (ind & 4) != 0, qsize);
+        Y(q) = nbMortonOffset(Y(q), (ind & 2) != 0, qsize);
+        Z(q) = nbMortonOffset(Z(q), (ind & 1) != 0, qsize);
+        qsize *= 0.5;
+    }
+
+    return q;
+}
+
+/* Stable LSD radix sort of the keys, carrying the body indices
+ * along. Each thread counts and then scatters its own contiguous
+ * chunk, so the result does not depend on the thread count. */
+static void nbMortonSort(NBodyLinearTree* lt, int n)
+{
+    int pass;
+    int nThreadMax = nbGetMaxThreads();
+    int* hist = (int*) mwMallocA(nThreadMax * NB_MORTON_RADIX_SIZE * sizeof(int));
+    uint64_t* srcKeys = lt->keys;
+    uint64_t* dstKeys = lt->keysTmp;
+    int* srcOrder = lt->order;
+    int* dstOrder = lt->orderTmp;
+    uint64_t* tmpKeys;
+    int* tmpOrder;
+
+    for (pass = 0; pass < NB_MORTON_RADIX_PASSES; ++pass)
+    {
+        const int shift = pass * NB_MORTON_RADIX_BITS;
+
+      #ifdef _OPENMP
+        #pragma omp parallel shared(hist, srcKeys, dstKeys, srcOrder, dstOrder)
+      #endif
+        {
+            int i, d, t;
+            int tid = nbThreadNum();
+            int nThread = nbNumThreads();
+            int lo = (int) (((long long) n * tid) / nThread);
+            int hi = (int) (((long long) n * (tid + 1)) / nThread);
+            int* h = &hist[tid * NB_MORTON_RADIX_SIZE];
+
+            memset(h, 0, NB_MORTON_RADIX_SIZE * sizeof(int));
+            for (i = lo; i < hi; ++i)
+            {
+                ++h[(srcKeys[i] >> shift) & (NB_MORTON_RADIX_SIZE - 1)];
+            }
+
+          #ifdef _OPENMP
+            #pragma omp barrier
+            #pragma omp single
+          #endif
+            {
+                int sum = 0;
+                int count;
+
+                for (d = 0; d < NB_MORTON_RADIX_SIZE; ++d)
+                {
+                    for (t = 0; t < nThread; ++t)
+                    {
+                        count = hist[t * NB_MORTON_RADIX_SIZE + d];
+                        hist[t * NB_MORTON_RADIX_SIZE + d] = sum;
+                        sum += count;
+                    }
+                }
+            }
+
+            for (i = lo; i < hi; ++i)
+            {
+                int j = h[(srcKeys[i] >> shift) & (NB_MORTON_RADIX_SIZE - 1)]++;
+                dstKeys[j] = srcKeys[i];
+                dstOrder[j] = srcOrder[i];
+            }
+        }
+
+        tmpKeys = srcKeys;
+        srcKeys = dstKeys;
+        dstKeys = tmpKeys;
+
+        tmpOrder = srcOrder;
+        srcOrder = dstOrder;
+        dstOrder = tmpOrder;
+    }
+
+    /* Leave the sorted result in keys and order */
+    lt->keys = srcKeys;
+    lt->keysTmp = dstKeys;
+    lt->order = srcOrder;
+    lt->orderTmp = dstOrder;
+
+    mwFreeA(hist);
+}
+
+static inline int nbMortonCommonPrev(const NBodyLinearTree* lt, int i)
+{
+    return i > 0 ? lt->common[i - 1] : 0;
+}
+
+/* The node of depth depth that starts with sorted body i, either a
+ * cell or the body itself */
+static inline NBodyNode* nbMortonNodeAt(const NBodyLinearTree* lt, const Body* bodies, int n, int i, int depth)
+{
+    if (i >= n)
+        return NULL;
+
+    if (lt->common[i] >= depth)
+        return (NBodyNode*) &lt->cells[lt->cellBase[i] + depth - nbMortonCommonPrev(lt, i) - 1];
+
+    return (NBodyNode*) &bodies[lt->order[i]];
+}
+
+/* Node visited after the subtree ending with sorted body i */
+static inline NBodyNode* nbMortonNextAfter(const NBodyLinearTree* lt, const Body* bodies, int n, int i)
+{
+    if (i + 1 >= n)
+        return NULL;
+
+    return nbMortonNodeAt(lt, bodies, n, i + 1, lt->common[i] + 1);
+}
+
+/* Last sorted body in the cell of depth depth starting with sorted body i */
+static int nbMortonCellEnd(const NBodyLinearTree* lt, int n, int i, int depth)
+{
+    const uint64_t* keys = lt->keys;
+    const uint64_t prefix = keys[i] >> nbMortonShift(depth);
+    int lo = i + 1;
+    int hi = n;
+    int mid;
+
+    /* First body past the end of the cell */
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if ((keys[mid] >> nbMortonShift(depth)) == prefix)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo - 1;
+}
+
+static void nbMortonInitCell(NBodyCell* c, mwvector center)
+{
+    Type(c) = CELL(0);
+    Mass(c) = 0.0;
+    Pos(c) = center;
+    More(c) = NULL;
+    Next(c) = NULL;
+    Rcrit2(c) = 0.0;
+    memset(&c->stuff, 0, sizeof(c->stuff));
+}
+
+/* Same as hackCofM and hackQuad for a single cell, with the children
+ * already done. The children are found through the threading. */
+static void nbMortonFinishCell(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real psize)
+{
+    NBodyNode* q;
+    NBodyNode* end = Next(p);
+    mwvector cmpos = ZERO_VECTOR;
+    mwvector dr;
+    real drsq, m;
+    NBodyQuadMatrix quad;
+
+    Mass(p) = 0.0;
+    for (q = More(p); q != end; q = Next(q))
+    {
+        Mass(p) += Mass(q);
+        mw_incaddv_s(cmpos, Pos(q), Mass(q));
+    }
+
+    mw_incdivs(cmpos, Mass(p));  /* Every cell has at least 2 massive bodies */
+
+    nbCheckTreeStructure(tree, Pos(p), cmpos, psize);
+
+    Rcrit2(p) = findRCrit(ctx, p, tree->rsize, cmpos, psize);
+    Pos(p) = cmpos;
+
+    if (!ctx->useQuad)
+        return;
+
+    for (q = More(p); q != end; q = Next(q))
+    {
+        dr = mw_subv(Pos(q), Pos(p));
+        drsq = mw_sqrv(dr);
+        m = Mass(q);
+
+        quad.xx = m * (3.0 * (X(dr) * X(dr)) - drsq);
+        quad.xy = m * (3.0 * (X(dr) * Y(dr)));
+        quad.xz = m * (3.0 * (X(dr) * Z(dr)));
+
+        quad.yy = m * (3.0 * (Y(dr) * Y(dr)) - drsq);
+        quad.yz = m * (3.0 * (Y(dr) * Z(dr)));
+
+        quad.zz = m * (3.0 * (Z(dr) * Z(dr)) - drsq);
+
+        if (isCell(q))
+        {
+            nbIncAddNBodyQuadMatrix(&quad, &Quad(q));
+        }
+
+        nbIncAddNBodyQuadMatrix(&Quad(p), &quad);
+    }
+}
+
+static NBodyStatus nbMakeTreeMorton(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i, d;
+    int n;                  /* Number of massive bodies */
+    int nbody = st->nbody;
+    int maxDepth = 0;
+    int tooDeep = FALSE;
+    int nCells;
+    int levelStart[NB_MORTON_LEVELS + 2];
+    mwvector rootPos;
+    NBodyTree* t = &st->tree;
+    NBodyLinearTree* lt;
+    Body* bodies = st->bodytab;
+    NBodyCell* root;
+
+    if (!st->linearTree)
+    {
+        st->linearTree = (NBodyLinearTree*) mwCallocA(1, sizeof(NBodyLinearTree));
+    }
+    lt = st->linearTree;
+
+    nbLinearTreeReserveBodies(lt, nbody);
+    nbLinearTreeReserveCells(lt, 1);
+
+    nbReclaimTree(st, t);
+
+    /* The root is the same as the one nbNewTree makes */
+    root = &lt->cells[0];
+    mw_zerov(rootPos);
+    nbMortonInitCell(root, rootPos);
+    t->root = root;
+
+    expandBox(t, bodies, nbody);
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(static)
+  #endif
+    for (i = 0; i < nbody; ++i)
+    {
+        const Body* b = &bodies[i];
+
+        lt->keys[i] = (Mass(b) != 0.0) ? nbMortonKey(Pos(b), rootPos, t->rsize) : NB_MORTON_EXCLUDED_KEY;
+        lt->order[i] = i;
+    }
+
+    nbMortonSort(lt, nbody);
+
+    for (n = nbody; n > 0 && lt->keys[n - 1] == NB_MORTON_EXCLUDED_KEY; --n)
+        ;
+
+    if (n == 0)
+    {
+        /* No massive bodies; let the insertion builder deal with it */
+        t->root = NULL;
+        return nbMakeTreeInsert(ctx, st);
+    }
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(static)
+  #endif
+    for (i = 0; i < n; ++i)
+    {
+        lt->common[i] = (i + 1 < n) ? nbMortonCommonLevels(lt->keys[i], lt->keys[i + 1]) : 0;
+    }
+
+    /* Number the cells started by each body */
+    lt->cellBase[0] = 1;
+    for (i = 0; i < n; ++i)
+    {
+        tooDeep |= (lt->common[i] >= NB_MORTON_LEVELS);
+        maxDepth = MAX(maxDepth, lt->common[i]);
+        lt->cellBase[i + 1] = lt->cellBase[i] + MAX(0, lt->common[i] - nbMortonCommonPrev(lt, i));
+    }
+    nCells = lt->cellBase[n];
+
+    if (tooDeep)
+    {
+        t->root = NULL;
+        return nbMakeTreeInsert(ctx, st);
+    }
+
+    nbLinearTreeReserveCells(lt, (unsigned int) nCells);
+    root = &lt->cells[0];
+    nbMortonInitCell(root, rootPos);
+    t->root = root;
+    lt->cellDepth[0] = 0;
+
+    More(root) = nbMortonNodeAt(lt, bodies, n, 0, 1);
+    Next(root) = NULL;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i, d) schedule(static)
+  #endif
+    for (i = 0; i < n; ++i)
+    {
+        const int first = nbMortonCommonPrev(lt, i) + 1;
+        NBodyCell* c;
+
+        /* The body itself. Test particles are left alone */
+        Next(&bodies[lt->order[i]]) = nbMortonNextAfter(lt, bodies, n, i);
+
+        for (d = first; d <= lt->common[i]; ++d)
+        {
+            int idx = lt->cellBase[i] + d - first;
+
+            c = &lt->cells[idx];
+            nbMortonInitCell(c, nbMortonCellCenter(lt->keys[i], d, rootPos, t->rsize));
+            More(c) = nbMortonNodeAt(lt, bodies, n, i, d + 1);
+            Next(c) = nbMortonNextAfter(lt, bodies, n, nbMortonCellEnd(lt, n, i, d));
+            lt->cellDepth[idx] = d;
+        }
+    }
+
+    /* Group cells by depth, keeping depth first order within a level */
+    memset(levelStart, 0, sizeof(levelStart));
+    for (i = 0; i < nCells; ++i)
+    {
+        ++levelStart[lt->cellDepth[i] + 1];
+    }
+
+    for (d = 0; d <= maxDepth; ++d)
+    {
+        levelStart[d + 1] += levelStart[d];
+    }
+
+    {
+        int fill[NB_MORTON_LEVELS + 1];
+
+        memcpy(fill, levelStart, sizeof(fill));
+        for (i = 0; i < nCells; ++i)
+        {
+            lt->levelCells[fill[lt->cellDepth[i]]++] = i;
+        }
+    }
+
+    /* Centers of mass, critical radii and moments from the bottom up */
+    for (d = maxDepth; d >= 0; --d)
+    {
+        const real psize = mw_ldexp(t->rsize, -d);
+        const int lo = levelStart[d];
+        const int hi = levelStart[d + 1];
+
+      #ifdef _OPENMP
+        #pragma omp parallel for private(i) schedule(static)
+      #endif
+        for (i = lo; i < hi; ++i)
+        {
+            nbMortonFinishCell(ctx, t, &lt->cells[lt->levelCells[i]], psize);
+        }
+    }
+
+    t->cellUsed = (unsigned int) nCells;
+    t->maxDepth = (unsigned int) maxDepth;
+
+    if (t->structureError)
+        return NBODY_TREE_STRUCTURE_ERROR;
+
+    return NBODY_SUCCESS;
+}
+
+NBodyStatus nbMakeTree(const NBodyCtx* ctx, NBodyState* st)
+{
+    if (ctx->useMortonTree)
+        return nbMakeTreeMorton(ctx, st);
+
+    return nbMakeTreeInsert(ctx, st);
+}
+
 #if 0
 /* For testing */
 static int luaFindRCrit(lua_State* luaSt)
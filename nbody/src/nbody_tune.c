@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2012 Matthew Arsenault
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nbody_tune.h"
+#include "nbody_grav.h"
+#include "nbody_plain.h"
+#include "nbody_show.h"
+#include "milkyway_util.h"
+
+/* Most bodies the force error is measured at */
+#define TUNE_MAX_SAMPLE 256
+
+/* Trials take at least the minimum number of steps, and then keep
+ * going up to the maximum until they have taken TUNE_MIN_TIME */
+#define TUNE_MIN_STEPS 2
+#define TUNE_MAX_STEPS 50
+#define TUNE_MIN_TIME 0.2
+
+/* Up to this many bodies Exact is stepped like the others. Past it
+ * the time is scaled up from the sampled direct sums. */
+#define TUNE_MAX_EXACT_TRIAL 2048
+
+static const criterion_t tuneCriteria[] = { NewCriterion, SW93, BH86 };
+
+/* Largest first since the error mostly grows with theta */
+static const real tuneThetas[] = { 1.0, 0.9, 0.8, 0.7, 0.6, 0.5, 0.4, 0.3 };
+
+typedef struct
+{
+    Body* bodies;          /* Bodies to put back between trials */
+    real* acc[3];
+    unsigned int step;
+    real rsize;
+    int treeIncest;
+
+    int nSample;
+    int* sample;           /* Bodies the force error is measured at */
+    mwvector* exact;       /* Direct sum self gravity at the sampled bodies */
+    double exactTime;      /* Seconds to find them */
+} NBodyTuneState;
+
+
+static void nbSaveTuneState(NBodyTuneState* ts, const NBodyState* st)
+{
+    int i;
+    const int nbody = st->nbody;
+
+    ts->bodies = (Body*) mwMallocA(nbody * sizeof(Body));
+    memcpy(ts->bodies, st->bodytab, nbody * sizeof(Body));
+
+    for (i = 0; i < 3; ++i)
+    {
+        ts->acc[i] = (real*) mwMallocA(nbody * sizeof(real));
+        memcpy(ts->acc[i], st->bodyArrays->acc[i], nbody * sizeof(real));
+    }
+
+    ts->step = st->step;
+    ts->rsize = st->tree.rsize;
+    ts->treeIncest = st->treeIncest;
+}
+
+static void nbRestoreTuneState(NBodyState* st, const NBodyTuneState* ts)
+{
+    int i;
+    const int nbody = st->nbody;
+
+    memcpy(st->bodytab, ts->bodies, nbody * sizeof(Body));
+    nbGatherBodyArrays(st);
+
+    for (i = 0; i < 3; ++i)
+    {
+        memcpy(st->bodyArrays->acc[i], ts->acc[i], nbody * sizeof(real));
+    }
+
+    st->step = ts->step;
+    st->tree.rsize = ts->rsize;
+    st->treeIncest = ts->treeIncest;
+}
+
+static void nbFreeTuneState(NBodyTuneState* ts)
+{
+    int i;
+
+    mwFreeA(ts->bodies);
+    for (i = 0; i < 3; ++i)
+    {
+        mwFreeA(ts->acc[i]);
+    }
+
+    free(ts->sample);
+    mwFreeA(ts->exact);
+}
+
+/* Self gravity on body k from all of the others */
+static mwvector nbDirectSum(const NBodyCtx* ctx, const NBodyBodyArrays* ba, int nbody, int k)
+{
+    int i;
+    mwvector a;
+    real ax = 0.0, ay = 0.0, az = 0.0;
+
+    for (i = 0; i < nbody; ++i)
+    {
+        real dx, dy, dz, drSq, drab, phii, mor3;
+
+        if (i == k)
+            continue;
+
+        dx = ba->pos[0][i] - ba->pos[0][k];
+        dy = ba->pos[1][i] - ba->pos[1][k];
+        dz = ba->pos[2][i] - ba->pos[2][k];
+        drSq = dx * dx + dy * dy + dz * dz + ctx->eps2;
+
+        drab = mw_sqrt(drSq);
+        phii = ba->mass[i] / drab;
+        mor3 = phii / drSq;
+
+        ax += dx * mor3;
+        ay += dy * mor3;
+        az += dz * mor3;
+    }
+
+    SET_VECTOR(a, ax, ay, az);
+    return a;
+}
+
+/* Pick bodies spread through the list and find the reference forces
+ * on them. The state must be at the saved positions. */
+static void nbFindTuneReference(const NBodyCtx* ctx, const NBodyState* st, NBodyTuneState* ts)
+{
+    int i;
+    double t0;
+    const int nbody = st->nbody;
+
+    ts->nSample = nbody < TUNE_MAX_SAMPLE ? nbody : TUNE_MAX_SAMPLE;
+    ts->sample = (int*) mwMalloc(ts->nSample * sizeof(int));
+    ts->exact = (mwvector*) mwMallocA(ts->nSample * sizeof(mwvector));
+
+    for (i = 0; i < ts->nSample; ++i)
+    {
+        ts->sample[i] = (int) (((long long) i * nbody) / ts->nSample);
+    }
+
+    t0 = mwGetTime();
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) shared(ts, st) schedule(static)
+  #endif
+    for (i = 0; i < ts->nSample; ++i)
+    {
+        ts->exact[i] = nbDirectSum(ctx, st->bodyArrays, nbody, ts->sample[i]);
+    }
+
+    ts->exactTime = mwGetTime() - t0;
+}
+
+static void nbSetTuneCtx(NBodyCtx* trialCtx, const NBodyCtx* ctx, const NBodyTuneResult* r)
+{
+    *trialCtx = *ctx;
+    trialCtx->criterion = r->criterion;
+    trialCtx->theta = r->theta;
+    trialCtx->useQuad = r->useQuad;
+
+    /* Incest is found after the fact here, and just rules the settings out */
+    trialCtx->allowIncest = TRUE;
+    trialCtx->quietErrors = TRUE;
+}
+
+/* Find the error in self gravity at the sample with the settings in
+ * r. Returns TRUE if they can't be used. */
+static mwbool nbTuneForceError(const NBodyCtx* ctx, NBodyState* st, const NBodyTuneState* ts, NBodyTuneResult* r)
+{
+    int i;
+    NBodyCtx trialCtx;
+    NBodyStatus rc;
+    const NBodyBodyArrays* ba = st->bodyArrays;
+    double errSq = 0.0, accSq = 0.0;
+
+    nbSetTuneCtx(&trialCtx, ctx, r);
+    trialCtx.potentialType = EXTERNAL_POTENTIAL_NONE;
+
+    nbRestoreTuneState(st, ts);
+    st->treeIncest = FALSE;
+
+    /* The tree is built from everything, but only the sample needs forces */
+    rc = nbGravMapActive(&trialCtx, st, ts->sample, ts->nSample);
+    if (rc != NBODY_SUCCESS || st->treeIncest)
+    {
+        return TRUE;
+    }
+
+    for (i = 0; i < ts->nSample; ++i)
+    {
+        const int k = ts->sample[i];
+        const mwvector e = ts->exact[i];
+
+        errSq += sqr(ba->acc[0][k] - X(e)) + sqr(ba->acc[1][k] - Y(e)) + sqr(ba->acc[2][k] - Z(e));
+        accSq += mw_sqrv(e);
+    }
+
+    r->forceError = accSq > 0.0 ? mw_sqrt(errSq / accSq) : 0.0;
+    return FALSE;
+}
+
+/* Time steps with the settings in r. These always use the shared
+ * timestep. Returns TRUE if they can't be used. */
+static mwbool nbTuneStepTime(const NBodyCtx* ctx, NBodyState* st, const NBodyTuneState* ts, NBodyTuneResult* r)
+{
+    unsigned int n = 0;
+    double t0;
+    NBodyCtx trialCtx;
+    NBodyStatus rc = NBODY_SUCCESS;
+    NBodyPhaseTimes times = EMPTY_PHASE_TIMES;
+
+    /* The saved accelerations start the steps. They may not be
+     * current, but only the time matters here. */
+    nbSetTuneCtx(&trialCtx, ctx, r);
+    nbRestoreTuneState(st, ts);
+
+    t0 = mwGetTime();
+    do
+    {
+        rc |= nbTrialStepsPlain(&trialCtx, st, 1, &times);
+        ++n;
+    }
+    while (   !nbStatusIsFatal(rc)
+           && (n < TUNE_MIN_STEPS || (n < TUNE_MAX_STEPS && mwGetTime() - t0 < TUNE_MIN_TIME)));
+
+    if (nbStatusIsFatal(rc))
+    {
+        return TRUE;
+    }
+
+    r->times.tree = times.tree / n;
+    r->times.force = times.force / n;
+    r->times.external = times.external / n;
+    r->times.integrate = times.integrate / n;
+    r->estimated = FALSE;
+
+    return FALSE;
+}
+
+/* Everything but self gravity is about the same with any settings, so
+ * take that from a trial which was stepped */
+static void nbEstimateExactTime(const NBodyState* st,
+                                const NBodyTuneState* ts,
+                                const NBodyTuneResult* ref,
+                                NBodyTuneResult* r)
+{
+    r->times.tree = 0.0;
+    r->times.force = ts->exactTime * (double) st->nbody / (double) ts->nSample;
+    r->times.external = ref ? ref->times.external : 0.0;
+    r->times.integrate = ref ? ref->times.integrate : 0.0;
+    r->estimated = TRUE;
+}
+
+static double nbTuneTotalTime(const NBodyTuneResult* r)
+{
+    return r->times.tree + r->times.force + r->times.external + r->times.integrate;
+}
+
+static void nbPrintTuneResult(const NBodyTuneResult* r, const char* note)
+{
+    mw_printf("  %-12s  %5.2f  %-5s  %9.3e  %9.3e  %9.3e  %9.3e  %9.3e  %9.3e  %s\n",
+              showCriterionT(r->criterion),
+              r->theta,
+              showBool(r->useQuad),
+              r->forceError,
+              r->times.tree,
+              r->times.force,
+              r->times.external,
+              r->times.integrate,
+              nbTuneTotalTime(r),
+              note);
+}
+
+static void nbPrintTuneHeader(void)
+{
+    mw_printf("  %-12s  %5s  %-5s  %9s  %9s  %9s  %9s  %9s  %9s\n",
+              "criterion", "theta", "quad", "error", "tree", "force", "external", "integrate", "total");
+}
+
+NBodyStatus nbTuneSettings(const NBodyCtx* ctx,
+                           NBodyState* st,
+                           real tolerance,
+                           mwbool report,
+                           NBodyTuneResult* best)
+{
+    unsigned int i, j, q;
+    NBodyTuneState ts;
+    NBodyTuneResult r, current, stepped, exact;
+    mwbool haveCurrent = FALSE, haveStepped = FALSE, haveBest = FALSE;
+
+    if (st->nbody <= 0)
+    {
+        mw_printf("Need bodies to tune settings\n");
+        return NBODY_USER_ERROR;
+    }
+
+    nbSaveTuneState(&ts, st);
+    nbRestoreTuneState(st, &ts);
+    nbFindTuneReference(ctx, st, &ts);
+
+    if (report)
+    {
+        mw_printf("Tuning with %d bodies, error found at %d (target %g). Seconds per step:\n",
+                  st->nbody, ts.nSample, tolerance);
+        nbPrintTuneHeader();
+    }
+
+    /* The settings from the input, for comparison */
+    current.criterion = ctx->criterion;
+    current.theta = ctx->theta;
+    current.useQuad = ctx->useQuad;
+    if (ctx->criterion != Exact)
+    {
+        haveCurrent = !nbTuneForceError(ctx, st, &ts, &current) && !nbTuneStepTime(ctx, st, &ts, &current);
+    }
+
+    if (haveCurrent)
+    {
+        if (report)
+            nbPrintTuneResult(&current, "(input)");
+
+        stepped = current;
+        haveStepped = TRUE;
+
+        if (current.forceError <= tolerance)
+        {
+            *best = current;
+            haveBest = TRUE;
+        }
+    }
+
+    /* The largest theta within the tolerance for each criterion and
+     * use of quadrupole moments */
+    for (i = 0; i < sizeof(tuneCriteria) / sizeof(tuneCriteria[0]); ++i)
+    {
+        for (q = 0; q < 2; ++q)
+        {
+            for (j = 0; j < sizeof(tuneThetas) / sizeof(tuneThetas[0]); ++j)
+            {
+                r.criterion = tuneCriteria[i];
+                r.theta = tuneThetas[j];
+                r.useQuad = (mwbool) q;
+
+                if (nbTuneForceError(ctx, st, &ts, &r) || r.forceError > tolerance)
+                    continue;
+
+                if (!nbTuneStepTime(ctx, st, &ts, &r))
+                {
+                    if (report)
+                        nbPrintTuneResult(&r, "");
+
+                    stepped = r;
+                    haveStepped = TRUE;
+
+                    if (!haveBest || nbTuneTotalTime(&r) < nbTuneTotalTime(best))
+                    {
+                        *best = r;
+                        haveBest = TRUE;
+                    }
+                }
+
+                break;
+            }
+        }
+    }
+
+    /* Exact always meets the tolerance */
+    exact.criterion = Exact;
+    exact.theta = 0.0;
+    exact.useQuad = FALSE;
+    exact.forceError = 0.0;
+
+    if (st->nbody > TUNE_MAX_EXACT_TRIAL || nbTuneStepTime(ctx, st, &ts, &exact))
+    {
+        nbEstimateExactTime(st, &ts, haveStepped ? &stepped : NULL, &exact);
+    }
+
+    if (report)
+        nbPrintTuneResult(&exact, exact.estimated ? "(estimated)" : "");
+
+    if (!haveBest || nbTuneTotalTime(&exact) < nbTuneTotalTime(best))
+    {
+        *best = exact;
+    }
+
+    nbRestoreTuneState(st, &ts);
+    nbFreeTuneState(&ts);
+
+    if (report)
+    {
+        mw_printf("Fastest settings within the tolerance:\n"
+                  "  criterion = \"%s\", theta = %.2f, useQuad = %s\n",
+                  showCriterionT(best->criterion),
+                  best->theta,
+                  showBool(best->useQuad));
+
+        if (haveCurrent)
+        {
+            mw_printf("  %.2f times as fast as the input settings, which have error %.3e\n",
+                      nbTuneTotalTime(&current) / nbTuneTotalTime(best),
+                      current.forceError);
+        }
+    }
+
+    return NBODY_SUCCESS;
+}
+
+void nbApplyTuneResult(NBodyCtx* ctx, NBodyState* st, const NBodyTuneResult* r)
+{
+    ctx->criterion = r->criterion;
+    ctx->theta = r->theta;
+    ctx->useQuad = r->useQuad;
+
+    st->usesExact = (r->criterion == Exact);
+    st->usesQuad = r->useQuad;
+}
+
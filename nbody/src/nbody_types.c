@@ -24,6 +24,12 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include "nbody_types.h"
 #include "nbody_show.h"
 #include "nbody_defaults.h"
+#include "nbody_tree.h"
+#include "nbody_checkpoint.h"
+#include "nbody_io.h"
+#include "nbody_trajectory.h"
+#include "nbody_potential_table.h"
+#include "nbody_potential_program.h"
 
 #if NBODY_OPENCL
   #include "nbody_cl.h"
@@ -33,45 +39,14 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
   #include <sys/mman.h>
 #endif
 
+/* Cells are owned by the cell arena or the linear tree storage */
 static void freeNBodyTree(NBodyTree* t)
 {
-    NBodyNode* p;
-    NBodyNode* tmp;
-
-    p = (NBodyNode*) t->root;
-    while (p != NULL)
-    {
-        if (isCell(p))
-        {
-            tmp = More(p);
-            mwFreeA(p);
-            p = tmp;
-        }
-        else                        /* skip over bodies */
-        {
-            p = Next(p);
-        }
-    }
-
     t->root = NULL;
     t->cellUsed = 0;
     t->maxDepth = 0;
 }
 
-static void freeFreeCells(NBodyNode* freeCell)
-{
-    NBodyNode* p;
-    NBodyNode* tmp;
-
-    p = freeCell;
-    while (p)
-    {
-        tmp = Next(p);
-        mwFreeA(p);
-        p = tmp;
-    }
-}
-
 int nbDetachSharedScene(NBodyState* st)
 {
     (void) st;
@@ -100,13 +75,25 @@ int destroyNBodyState(NBodyState* st)
     int nThread = nbGetMaxThreads();
     int i;
 
+    /* Don't pull the state out from under a checkpoint or snapshot being written */
+    failed |= nbFinishCheckpoint(st);
+    failed |= nbFinishSnapshot(st);
+    failed |= nbCloseTrajectory(st);
+
     freeNBodyTree(&st->tree);
-    freeFreeCells(st->freeCell);
+    nbFreeCellArena(&st->cellArena);
+    nbFreeLinearTree(st->linearTree);
+    st->linearTree = NULL;
+    nbFreePotentialTable(st->potTable);
+    st->potTable = NULL;
+    nbFreePotentialProgram(st->potProgram);
+    st->potProgram = NULL;
     mwFreeA(st->bodytab);
-    mwFreeA(st->acctab);
+    nbFreeBodyArrays(st->bodyArrays);
     mwFreeA(st->orbitTrace);
 
     free(st->checkpointResolved);
+    free(st->snapshotPrefix);
 
     if (st->potEvalStates)
     {
@@ -162,11 +149,12 @@ int destroyNBodyState(NBodyState* st)
 void setInitialNBodyState(NBodyState* st, const NBodyCtx* ctx, Body* bodies, int nbody)
 {
     static const NBodyTree emptyTree = EMPTY_TREE;
+    static const NBodyCellArena emptyArena = EMPTY_CELL_ARENA;
     static const mwvector maxV = mw_vec(REAL_MAX, REAL_MAX, REAL_MAX);
     int i;
 
     st->tree = emptyTree;
-    st->freeCell = NULL;
+    st->cellArena = emptyArena;
     st->usesQuad = ctx->useQuad;
     st->usesExact = (ctx->criterion == Exact);
 
@@ -183,7 +171,104 @@ void setInitialNBodyState(NBodyState* st, const NBodyCtx* ctx, Body* bodies, int
     }
 
     /* The tests may step the system from an arbitrary place, so make sure this is 0'ed */
-    st->acctab = (mwvector*) mwCallocA(nbody, sizeof(mwvector));
+    st->bodyArrays = nbNewBodyArrays(nbody);
+    nbGatherBodyArrays(st);
+}
+
+NBodyBodyArrays* nbNewBodyArrays(int nbody)
+{
+    int i;
+    NBodyBodyArrays* ba = (NBodyBodyArrays*) mwCallocA(1, sizeof(NBodyBodyArrays));
+
+    for (i = 0; i < 3; ++i)
+    {
+        ba->pos[i] = (real*) mwCallocA(nbody, sizeof(real));
+        ba->vel[i] = (real*) mwCallocA(nbody, sizeof(real));
+        ba->acc[i] = (real*) mwCallocA(nbody, sizeof(real));
+        ba->oldAcc[i] = (real*) mwCallocA(nbody, sizeof(real));
+    }
+
+    ba->mass = (real*) mwCallocA(nbody, sizeof(real));
+    ba->level = (int*) mwCallocA(nbody, sizeof(int));
+    ba->active = (int*) mwCallocA(nbody, sizeof(int));
+
+    return ba;
+}
+
+void nbFreeBodyArrays(NBodyBodyArrays* ba)
+{
+    int i;
+
+    if (!ba)
+        return;
+
+    for (i = 0; i < 3; ++i)
+    {
+        mwFreeA(ba->pos[i]);
+        mwFreeA(ba->vel[i]);
+        mwFreeA(ba->acc[i]);
+        mwFreeA(ba->oldAcc[i]);
+    }
+
+    mwFreeA(ba->mass);
+    mwFreeA(ba->level);
+    mwFreeA(ba->active);
+    mwFreeA(ba);
+}
+
+/* Load positions, velocities and masses from bodytab. Accelerations are untouched */
+void nbGatherBodyArrays(NBodyState* st)
+{
+    int i;
+    const Body* b;
+    NBodyBodyArrays* ba = st->bodyArrays;
+
+    for (i = 0, b = st->bodytab; i < st->nbody; ++i, ++b)
+    {
+        ba->pos[0][i] = X(Pos(b));
+        ba->pos[1][i] = Y(Pos(b));
+        ba->pos[2][i] = Z(Pos(b));
+
+        ba->vel[0][i] = X(Vel(b));
+        ba->vel[1][i] = Y(Vel(b));
+        ba->vel[2][i] = Z(Vel(b));
+
+        ba->mass[i] = Mass(b);
+    }
+}
+
+/* Store positions and velocities back into bodytab */
+void nbScatterBodyArrays(NBodyState* st)
+{
+    int i;
+    Body* b;
+    const NBodyBodyArrays* ba = st->bodyArrays;
+
+    for (i = 0, b = st->bodytab; i < st->nbody; ++i, ++b)
+    {
+        X(Pos(b)) = ba->pos[0][i];
+        Y(Pos(b)) = ba->pos[1][i];
+        Z(Pos(b)) = ba->pos[2][i];
+
+        X(Vel(b)) = ba->vel[0][i];
+        Y(Vel(b)) = ba->vel[1][i];
+        Z(Vel(b)) = ba->vel[2][i];
+    }
+}
+
+/* The tree is built from the bodies, so it only needs the positions */
+void nbScatterBodyPositions(NBodyState* st)
+{
+    int i;
+    Body* b;
+    const NBodyBodyArrays* ba = st->bodyArrays;
+
+    for (i = 0, b = st->bodytab; i < st->nbody; ++i, ++b)
+    {
+        X(Pos(b)) = ba->pos[0][i];
+        Y(Pos(b)) = ba->pos[1][i];
+        Z(Pos(b)) = ba->pos[2][i];
+    }
 }
 
 NBodyState* newNBodyState()
@@ -209,6 +294,12 @@ NBodyStatus nbInitNBodyStateCL(NBodyState* st, const NBodyCtx* ctx, const CLRequ
         return NBODY_UNSUPPORTED;
     }
 
+    if (ctx->potentialType == EXTERNAL_POTENTIAL_PROGRAM)
+    {
+        mw_printf("Cannot use compiled potential with OpenCL\n");
+        return NBODY_UNSUPPORTED;
+    }
+
     st->usesQuad = ctx->useQuad;
     st->usesExact = (ctx->criterion == Exact);
     st->usesCL = TRUE;
@@ -290,7 +381,7 @@ int equalBody(const Body* a, const Body* b)
     return TRUE;
 }
 
-static int equalVectorArray(const mwvector* a, const mwvector* b, size_t n)
+static int equalRealArray(const real* a, const real* b, size_t n)
 {
     size_t i;
 
@@ -302,7 +393,7 @@ static int equalVectorArray(const mwvector* a, const mwvector* b, size_t n)
 
     for (i = 0; i < n; ++i)
     {
-        if (!equalVector(&a[i], &b[i]))
+        if (a[i] != b[i])
         {
             return FALSE;
         }
@@ -311,6 +402,22 @@ static int equalVectorArray(const mwvector* a, const mwvector* b, size_t n)
     return TRUE;
 }
 
+/* Compare the accelerations. The positions and velocities are
+ * compared through the bodies */
+static int equalBodyArrays(const NBodyBodyArrays* a, const NBodyBodyArrays* b, size_t n)
+{
+    if (!a && !b)
+        return TRUE;
+
+    if (!a || !b)
+        return FALSE;
+
+    return equalRealArray(a->acc[0], b->acc[0], n)
+        && equalRealArray(a->acc[1], b->acc[1], n)
+        && equalRealArray(a->acc[2], b->acc[2], n)
+        && !memcmp(a->level, b->level, n * sizeof(int));
+}
+
 static int equalBodyArray(const Body* a, const Body* b, size_t n)
 {
     size_t i;
@@ -350,19 +457,21 @@ int equalNBodyState(const NBodyState* st1, const NBodyState* st2)
         return FALSE;
     }
 
-    return equalVectorArray(st1->acctab, st2->acctab, st1->nbody);
+    return equalBodyArrays(st1->bodyArrays, st2->bodyArrays, st1->nbody);
 }
 
 /* TODO: Doesn't clone tree or CL stuffs */
 void cloneNBodyState(NBodyState* st, const NBodyState* oldSt)
 {
     static const NBodyTree emptyTree = EMPTY_TREE;
+    static const NBodyCellArena emptyArena = EMPTY_CELL_ARENA;
     unsigned int nbody = oldSt->nbody;
+    int i;
 
     st->tree = emptyTree;
     st->tree.rsize = oldSt->tree.rsize;
 
-    st->freeCell = NULL;
+    st->cellArena = emptyArena;
 
     st->lastCheckpoint = oldSt->lastCheckpoint;
     st->step           = oldSt->step;
@@ -375,22 +484,32 @@ void cloneNBodyState(NBodyState* st, const NBodyState* oldSt)
     st->dirty = oldSt->dirty;
     st->usesCL = oldSt->usesCL;
     st->reportProgress = oldSt->reportProgress;
+    st->compressCheckpoint = oldSt->compressCheckpoint;
 
     st->treeIncest = oldSt->treeIncest;
     st->tree.structureError = oldSt->tree.structureError;
 
     assert(nbody > 0);
-    assert(st->bodytab == NULL && st->acctab == NULL);
+    assert(st->bodytab == NULL && st->bodyArrays == NULL);
 
     st->bodytab = (Body*) mwMallocA(nbody * sizeof(Body));
     memcpy(st->bodytab, oldSt->bodytab, nbody * sizeof(Body));
 
-    st->acctab = (mwvector*) mwMallocA(nbody * sizeof(mwvector));
-    memcpy(st->acctab, oldSt->acctab, nbody * sizeof(mwvector));
+    st->bodyArrays = nbNewBodyArrays(nbody);
+    for (i = 0; i < 3; ++i)
+    {
+        memcpy(st->bodyArrays->pos[i], oldSt->bodyArrays->pos[i], nbody * sizeof(real));
+        memcpy(st->bodyArrays->vel[i], oldSt->bodyArrays->vel[i], nbody * sizeof(real));
+        memcpy(st->bodyArrays->acc[i], oldSt->bodyArrays->acc[i], nbody * sizeof(real));
+    }
+    memcpy(st->bodyArrays->mass, oldSt->bodyArrays->mass, nbody * sizeof(real));
+    memcpy(st->bodyArrays->level, oldSt->bodyArrays->level, nbody * sizeof(int));
 
     st->orbitTrace = (mwvector*) mwMallocA(N_ORBIT_TRACE_POINTS * sizeof(mwvector));
     memcpy(st->orbitTrace, oldSt->orbitTrace, N_ORBIT_TRACE_POINTS * sizeof(mwvector));
 
+    st->potProgram = nbClonePotentialProgram(oldSt->potProgram);
+
     if (st->ci)
     {
         mw_panic("OpenCL NBodyState cloning not implemented\n");
@@ -553,8 +672,13 @@ int equalNBodyCtx(const NBodyCtx* ctx1, const NBodyCtx* ctx2)
         && feqWithNan(ctx1->useQuad, ctx2->useQuad)
         && feqWithNan(ctx1->allowIncest, ctx2->allowIncest)
         && feqWithNan(ctx1->quietErrors, ctx2->quietErrors)
+        && feqWithNan(ctx1->useMortonTree, ctx2->useMortonTree)
+        && feqWithNan(ctx1->useInteractionLists, ctx2->useInteractionLists)
         && ctx1->checkpointT == ctx2->checkpointT
         && feqWithNan(ctx1->nStep, ctx2->nStep)
+        && ctx1->blockLevels == ctx2->blockLevels
+        && feqWithNan(ctx1->blockEta, ctx2->blockEta)
+        && feqWithNan(ctx1->potentialTableTolerance, ctx2->potentialTableTolerance)
         && equalPotential(&ctx1->pot, &ctx2->pot);
 }
 
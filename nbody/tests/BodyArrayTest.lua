@@ -0,0 +1,239 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Generated models are BodyArray userdata rather than tables of
+-- Body. Check they still behave like tables of bodies from Lua.
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+local function check(cond, msg, ...)
+   if not cond then
+      error(string.format(msg, ...), 2)
+   end
+end
+
+local function sameVector(a, b)
+   return a.x == b.x and a.y == b.y and a.z == b.z
+end
+
+local function sameBody(a, b)
+   return a.mass == b.mass
+      and a.ignore == b.ignore
+      and sameVector(a.position, b.position)
+      and sameVector(a.velocity, b.velocity)
+end
+
+local function makeBody(mass)
+   return Body.create{
+      mass     = mass,
+      position = Vector.create(mass, 2 * mass, 3 * mass),
+      velocity = Vector.create(-mass, 0, mass),
+      ignore   = false
+   }
+end
+
+-- Copy the bodies into a plain table
+local function toTable(m)
+   local t = { }
+   for i = 1, #m do
+      local b = m[i]
+      t[i] = Body.create(b.mass, b.position, b.velocity, b.ignore)
+   end
+   return t
+end
+
+local function plummer(nbody, prng, ignore)
+   return predefinedModels.plummer{
+      nbody       = nbody,
+      prng        = prng,
+      position    = Vector.create(-22.0415, -3.35444, 19.9539),
+      velocity    = Vector.create(118.444, 168.874, -67.6378),
+      mass        = 12,
+      scaleRadius = 0.2,
+      ignore      = ignore
+   }
+end
+
+
+local function testCreate()
+   local a = BodyArray.create(5)
+   check(#a == 5, "BodyArray.create(5) has %d bodies", #a)
+   check(a[1].mass == 0 and sameVector(a[5].position, Vector.create(0, 0, 0)),
+         "BodyArray.create() bodies aren't empty")
+
+   check(#BodyArray.create() == 0, "BodyArray.create() isn't empty")
+   check(not pcall(BodyArray.create, -1), "BodyArray.create(-1) should fail")
+   check(tostring(a) == "BodyArray { n = 5 }", "Unexpected tostring '%s'", tostring(a))
+end
+
+-- Indexing gives an element which reads and writes the body in the
+-- array, so the usual idioms for changing a model work
+local function testIndexWrite()
+   local m = plummer(10, DSFMT.create(2319), false)
+   local mass = m[3].mass
+
+   m[3].mass = 2 * mass
+   m[3].position = Vector.create(1, 2, 3)
+   check(m[3].mass == 2 * mass, "Setting the mass of an indexed body didn't change the array")
+   check(sameVector(m[3].position, Vector.create(1, 2, 3)),
+         "Setting the position of an indexed body didn't change the array")
+
+   local b = m[4]
+   b.velocity = Vector.create(4, 5, 6)
+   b.ignore = true
+   check(sameVector(m[4].velocity, Vector.create(4, 5, 6)) and m[4].ignore,
+         "Changing a held element didn't change the array")
+
+   -- Storing copies, whether from a Body or another element
+   local c = makeBody(7)
+   m[5] = c
+   c.mass = 99
+   check(m[5].mass == 7, "Changing a stored Body changed the array")
+
+   m[1] = m[3]
+   m[3].mass = 1
+   check(m[1].mass == 2 * mass, "Storing an element didn't copy the body")
+   check(#m == 10, "Storing bodies changed the length to %d", #m)
+
+   check(tostring(m[5]) == tostring(makeBody(7)), "Element shows as '%s'", tostring(m[5]))
+   check(not pcall(function() return m[1].nonsense end), "Getting an unknown field should fail")
+   check(not pcall(function() m[1].nonsense = 1 end), "Setting an unknown field should fail")
+   check(not pcall(function() m[1].mass = "heavy" end), "Setting a field to the wrong type should fail")
+
+   -- Appending an element of the same array, which grows it
+   local a = BodyArray.create(1)
+   a[1] = makeBody(3)
+   for i = 2, 40 do
+      a[i] = a[1]
+   end
+   check(sameBody(a[40], makeBody(3)), "Appending an element of the same array failed")
+
+   -- An element keeps its array alive
+   local e
+   do
+      local tmp = BodyArray.create(3)
+      tmp[2].mass = 5
+      e = tmp[2]
+   end
+   collectgarbage("collect")
+   check(e.mass == 5, "Element of a collected array has mass %g", e.mass)
+end
+
+local function testBounds()
+   local a = BodyArray.create(2)
+
+   check(a[0] == nil and a[3] == nil and a[-1] == nil, "Out of range index should be nil")
+
+   -- Assigning one past the end appends, many times over to grow it
+   for i = 3, 40 do
+      a[i] = makeBody(i)
+      check(#a == i, "Appending body %d gave length %d", i, #a)
+   end
+
+   for i = 3, 40 do
+      check(sameBody(a[i], makeBody(i)), "Appended body %d differs", i)
+   end
+
+   check(not pcall(function() a[42] = makeBody(1) end), "Writing past the end should fail")
+   check(not pcall(function() a[0] = makeBody(1) end), "Writing index 0 should fail")
+   check(not pcall(function() a[1] = 3 end), "Storing a non-body should fail")
+   check(#a == 40, "Failed writes changed the length to %d", #a)
+end
+
+-- ipairs doesn't work on userdata, so a:bodies() is there instead
+local function testIteration()
+   local m = plummer(10, DSFMT.create(4417), false)
+   check(not pcall(ipairs, m), "ipairs should not work on a BodyArray")
+
+   local n = 0
+   for i, b in m:bodies() do
+      n = n + 1
+      check(i == n, "Iterated index %d, expected %d", i, n)
+      check(sameBody(b, m[i]), "Iterated body %d differs", i)
+      b.mass = i
+   end
+   check(n == 10, "Iterated over %d bodies", n)
+
+   for i = 1, #m do
+      check(m[i].mass == i, "Setting body %d while iterating didn't change the array", i)
+   end
+
+   for _ in BodyArray.create():bodies() do
+      error("Iterated over an empty array")
+   end
+end
+
+-- The merged model is the first model with the second appended, and
+-- gives the same state as a plain table of the same bodies
+local function testMergeTables()
+   local seed = 9134
+   local m1 = plummer(100, DSFMT.create(seed), true)
+   local m2 = plummer(300, DSFMT.create(seed + 1), false)
+   local t1, t2 = toTable(m1), toTable(m2)
+
+   local merged = mergeTables(m1, m2)
+   check(#merged == 400, "Merged model has %d bodies", #merged)
+   for i = 1, #t1 do
+      check(sameBody(merged[i], t1[i]), "Merged body %d differs", i)
+   end
+   for i = 1, #t2 do
+      check(sameBody(merged[#t1 + i], t2[i]), "Merged body %d differs", #t1 + i)
+   end
+
+   -- Into a plain table too
+   local mergedTable = mergeTables({ }, plummer(100, DSFMT.create(seed), true), m2)
+   check(#mergedTable == 400, "Merged table has %d bodies", #mergedTable)
+
+   local ctx = NBodyCtx.create{
+      timestep    = 1.0e-4,
+      timeEvolve  = 1.0e-3,
+      theta       = 0.7,
+      eps2        = 1.0e-6,
+      criterion   = "SW93",
+      allowIncest = true,
+      quietErrors = true
+   }
+   ctx:addPotential(SP.samplePotentials.potentialA)
+
+   local all = toTable(t1)
+   for i = 1, #t2 do
+      all[#t1 + i] = t2[i]
+   end
+
+   local st = NBodyState.create(ctx, merged)
+   check(st ~= nil, "Creating a state from a merged model failed")
+   check(st == NBodyState.create(ctx, all), "Merged model gives a different state")
+   check(st == NBodyState.create(ctx, mergedTable), "Merged table gives a different state")
+
+   -- The sample model built with mergeTables
+   local mod = SM.sampleModels.modelB(500, seed)
+   check(#mod == 500, "modelB has %d bodies", #mod)
+end
+
+
+testCreate()
+testIndexWrite()
+testBounds()
+testIteration()
+testMergeTables()
+
+printf("BodyArray tests passed\n")
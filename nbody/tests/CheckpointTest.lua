@@ -35,6 +35,8 @@ function randomNBodyCtx(prng)
       treeRSize   = prng:randomListItem({ 4, 8, 2, 16 }),
       criterion   = prng:randomListItem({"NewCriterion", "SW93", "BH86", "Exact"}),
       useQuad     = prng:randomBool(),
+      blockLevels = prng:randomListItem({ 0, 4 }),
+      potentialTableTolerance = prng:randomListItem({ 0, 1.0e-4 }),
       allowIncest = true,
       quietErrors = true
    }
@@ -55,7 +57,7 @@ function runInterruptedSteps(st, totalSteps, ctx, prng)
       st:step(ctx)
       if prng:randomBool() then
          local tmp = tmpDir .. os.tmpname()
-         st:writeCheckpoint(ctx, checkpoint, tmp)
+         st:writeCheckpoint(ctx, checkpoint, tmp, prng:randomBool())
          ctx, st = NBodyState.readCheckpoint(checkpoint)
          os.remove(checkpoint)
       end
@@ -0,0 +1,122 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+
+-- The interaction list walk should find the same self gravity as the
+-- single body tree walk. Cells are opened at least as often, so the
+-- difference is limited by the tree's own error against a direct sum.
+-- Test particles aren't in the tree, and get the same walk as the
+-- single body walk.
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+local function rmsError(accs, exact)
+   local errSq, normSq = 0.0, 0.0
+   for i = 1, #exact do
+      errSq = errSq + Vector.length(accs[i] - exact[i])^2
+      normSq = normSq + Vector.length(exact[i])^2
+   end
+   return math.sqrt(errSq / normSq)
+end
+
+local prng = DSFMT.create(5521)
+
+for i = 1, 6 do
+   local args = {
+      timestep    = 1.0e-4,
+      timeEvolve  = 1.0e-3,
+      theta       = prng:random(0.4, 0.9),
+      eps2        = prng:random(1.0e-9, 1.0e-3),
+      criterion   = prng:randomListItem({ "NewCriterion", "SW93", "BH86" }),
+      useQuad     = i % 2 == 0,
+      allowIncest = true,
+      quietErrors = true
+   }
+
+   local ctx = NBodyCtx.create(args)
+   args.useInteractionLists = true
+   local listCtx = NBodyCtx.create(args)
+   args.criterion = "Exact"
+   local exactCtx = NBodyCtx.create(args)
+
+   -- Only needed to create the state, self gravity leaves it out
+   ctx:addPotential(SP.randomPotential(prng))
+   local st = NBodyState.create(ctx, SM.randomPlummer(prng, 1000))
+
+   local tree = st:selfGravity(ctx)
+   local lists = st:selfGravity(listCtx)
+   local exact = st:selfGravity(exactCtx)
+
+   local treeErr, listErr = rmsError(tree, exact), rmsError(lists, exact)
+   local diff = rmsError(lists, tree)
+
+   assert(diff <= 2.0 * treeErr + 1.0e-12,
+          string.format("List and tree walk accelerations differ by %g with tree error %g", diff, treeErr))
+   assert(listErr <= treeErr * (1.0 + 1.0e-6) + 1.0e-12,
+          string.format("List accelerations are less accurate than the tree walk: %g vs. %g", listErr, treeErr))
+end
+
+
+-- A model with test particles, with incest fatal so a test particle
+-- missing from the tree isn't mistaken for it
+for _, useQuad in ipairs({ false, true }) do
+   local args = {
+      timestep    = 1.0e-4,
+      timeEvolve  = 1.0e-3,
+      theta       = 0.7,
+      eps2        = 1.0e-6,
+      criterion   = "SW93",
+      useQuad     = useQuad,
+      allowIncest = false
+   }
+
+   local ctx = NBodyCtx.create(args)
+   args.useInteractionLists = true
+   local listCtx = NBodyCtx.create(args)
+
+   local function plummer(nbody, mass)
+      return predefinedModels.plummer{
+         nbody       = nbody,
+         prng        = prng,
+         position    = Vector.create(1, 2, 3),
+         velocity    = Vector.create(0, 0, 0),
+         mass        = mass,
+         scaleRadius = 0.5
+      }
+   end
+
+   local nMassive, nTest = 700, 300
+   ctx:addPotential(SP.samplePotentials.potentialA)
+   local st = NBodyState.create(ctx, mergeTables(plummer(nMassive, 10), plummer(nTest, 0)))
+   assert(st ~= nil, "Creating a state with test particles failed")
+
+   local tree = st:selfGravity(ctx)
+   local lists = st:selfGravity(listCtx)
+
+   -- The single walk for each test particle is the same as the tree walk
+   local testParticles, testTree = { }, { }
+   for i = nMassive + 1, nMassive + nTest do
+      testParticles[#testParticles + 1] = lists[i]
+      testTree[#testTree + 1] = tree[i]
+   end
+
+   local diff = rmsError(testParticles, testTree)
+   assert(diff <= 1.0e-12,
+          string.format("List and tree walk test particle accelerations differ by %g", diff))
+end
@@ -119,9 +119,10 @@ end
 function mergeTables(m1, ...)
    local i = #m1
    for _, m in ipairs({...}) do
-      for _, v in ipairs(m) do
+      -- Models may be BodyArrays, which ipairs doesn't work on
+      for j = 1, #m do
          i = i + 1
-         m1[i] = v
+         m1[i] = m[j]
       end
    end
    return m1
@@ -0,0 +1,165 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- The orbit integrators should agree with each other as the step
+-- shrinks, and integrating a batch of orbits should give the same
+-- results as integrating them one at a time.
+
+require "NBodyTesting"
+
+local integrators = { "Euler", "Leapfrog", "Yoshida", "Adaptive" }
+
+local function relativeDifference(a, b)
+   return Vector.length(a - b) / Vector.length(b)
+end
+
+local function sameVector(a, b)
+   return a.x == b.x and a.y == b.y and a.z == b.z
+end
+
+local function randomDirection(prng)
+   local z = prng:random(-1, 1)
+   local phi = prng:random(0, 2 * math.pi)
+   local r = math.sqrt(1 - z * z)
+   return Vector.create(r * math.cos(phi), r * math.sin(phi), z)
+end
+
+-- Keep the orbits bound and out of the core, where close passes need
+-- far smaller steps than the tolerances below assume. Near circular
+-- orbits starting between 10 and 30 kpc never get close.
+local function randomOrbits(prng, pot, n)
+   local positions, velocities = { }, { }
+   for i = 1, n do
+      local r = prng:random(10, 30)
+      local pos = r * randomDirection(prng)
+      local vCirc = math.sqrt(r * Vector.length(Potential.acceleration(pot, pos)))
+      local tangent = Vector.cross(pos, randomDirection(prng))
+
+      positions[i] = pos
+      velocities[i] = (prng:random(0.8, 1.1) * vCirc / Vector.length(tangent)) * tangent
+                    + (prng:random(-0.1, 0.1) * vCirc / r) * pos
+   end
+   return positions, velocities
+end
+
+local function reverse(pot, pos, vel, tstop, dt, integrator, tolerance)
+   return reverseOrbit{
+      potential  = pot,
+      position   = pos,
+      velocity   = vel,
+      tstop      = tstop,
+      dt         = dt,
+      integrator = integrator,
+      tolerance  = tolerance
+   }
+end
+
+
+-- The random sample potentials are often far too massive for orbits to
+-- be integrated accurately with a reasonable step
+local pot = Potential.create{
+   spherical = Spherical.spherical{ mass = 1.52954402e5, scale = 0.7 },
+   disk      = Disk.miyamotoNagai{ mass = 4.45865888e5, scaleLength = 6.5, scaleHeight = 0.26 },
+   halo      = Halo.logarithmic{ vhalo = 73, scaleLength = 12.0, flattenZ = 1.0 }
+}
+
+local nTests = 3
+local nOrbits = 8
+local tstop = 1.0
+local prng = DSFMT.create(7152)
+
+for i = 1, nTests do
+   local positions, velocities = randomOrbits(prng, pot, nOrbits)
+
+   -- The default is still the original integrator
+   local defPos, defVel = reverseOrbit{ potential = pot,
+                                        position  = positions[1],
+                                        velocity  = velocities[1],
+                                        tstop     = tstop,
+                                        dt        = 1.0e-3 }
+   local eulerPos, eulerVel = reverse(pot, positions[1], velocities[1], tstop, 1.0e-3, "Euler")
+   assert(sameVector(defPos, eulerPos) and sameVector(defVel, eulerVel),
+          "Default orbit integrator changed")
+
+   for _, integrator in ipairs(integrators) do
+      local batchPos, batchVel = reverseOrbits{
+         potential  = pot,
+         positions  = positions,
+         velocities = velocities,
+         tstop      = tstop,
+         dt         = 1.0e-3,
+         integrator = integrator,
+         tolerance  = 1.0e-9
+      }
+
+      for j = 1, nOrbits do
+         local pos, vel = reverse(pot, positions[j], velocities[j], tstop, 1.0e-3, integrator, 1.0e-9)
+         assert(sameVector(pos, batchPos[j]) and sameVector(vel, batchVel[j]),
+                string.format("Batch %s orbit %d differs: %s vs. %s",
+                              integrator, j, tostring(batchPos[j]), tostring(pos)))
+      end
+   end
+
+   for j = 1, nOrbits do
+      local refPos, refVel = reverse(pot, positions[j], velocities[j], tstop, 1.0e-3, "Adaptive", 1.0e-12)
+      local yPos, yVel = reverse(pot, positions[j], velocities[j], tstop, 1.0e-4, "Yoshida")
+      local lPos, lVel = reverse(pot, positions[j], velocities[j], tstop, 1.0e-5, "Leapfrog")
+
+      assert(relativeDifference(yPos, refPos) < 1.0e-4 and relativeDifference(yVel, refVel) < 1.0e-4,
+             string.format("Yoshida orbit %s differs from adaptive orbit %s", tostring(yPos), tostring(refPos)))
+      assert(relativeDifference(lPos, refPos) < 1.0e-4 and relativeDifference(lVel, refVel) < 1.0e-4,
+             string.format("Leapfrog orbit %s differs from adaptive orbit %s", tostring(lPos), tostring(refPos)))
+
+      -- Integrating forward again should return to the start
+      local backPos = reverse(pot, yPos, -yVel, tstop, 1.0e-4, "Yoshida")
+      assert(relativeDifference(backPos, positions[j]) < 1.0e-9,
+             string.format("Yoshida orbit is not reversible: %s vs. %s", tostring(backPos), tostring(positions[j])))
+   end
+end
+
+-- Orbits in a tabulated potential should stay close to the orbits in
+-- the analytic potential for a while
+for i = 1, nTests do
+   local positions, velocities = randomOrbits(prng, pot, nOrbits)
+   local args = {
+      potential  = pot,
+      positions  = positions,
+      velocities = velocities,
+      tstop      = 0.25,
+      dt         = 1.0e-3,
+      integrator = "Yoshida"
+   }
+
+   local refPos = reverseOrbits(args)
+   args.tableTolerance = 1.0e-5
+   local tabPos = reverseOrbits(args)
+
+   local same = true
+   for j = 1, nOrbits do
+      same = same and sameVector(tabPos[j], refPos[j])
+      assert(relativeDifference(tabPos[j], refPos[j]) < 1.0e-2,
+             string.format("Tabulated orbit %s differs from analytic orbit %s",
+                           tostring(tabPos[j]), tostring(refPos[j])))
+   end
+   assert(not same, "Tabulated potential wasn't used")
+
+   args.integrator = "Euler"
+   assert(not pcall(reverseOrbits, args), "Tabulated potential accepted with the Euler integrator")
+end
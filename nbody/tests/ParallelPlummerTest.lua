@@ -0,0 +1,98 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Generate a Plummer model with parallel = true in separate processes
+-- with 1 and several OpenMP threads, and check the bodies are the
+-- same. The model is large enough to use several substreams.
+
+require "NBodyTesting"
+
+local args = {...}
+local driver = assert(args[1], "Missing test driver name")
+local script = "ParallelPlummerTest.lua"
+
+local nbody = 100000
+local nThreads = 4
+
+
+local function writeBodies(fileName)
+   local bodies = predefinedModels.plummer{
+      nbody       = nbody,
+      prng        = DSFMT.create(5839),
+      position    = Vector.create(-22.0415, -3.35444, 19.9539),
+      velocity    = Vector.create(118.444, 168.874, -67.6378),
+      mass        = 16,
+      scaleRadius = 0.2,
+      parallel    = true
+   }
+
+   local f = assert(io.open(fileName, "w"))
+   for i = 1, #bodies do
+      local b = bodies[i]
+      local r, v = b.position, b.velocity
+      f:write(string.format("%.17g %.17g %.17g %.17g %.17g %.17g %.17g\n",
+                            b.mass, r.x, r.y, r.z, v.x, v.y, v.z))
+   end
+   f:close()
+end
+
+local function readFile(name)
+   local f = io.open(name, "r")
+   if f == nil then
+      return nil
+   end
+   local s = assert(f:read("*a"))
+   f:close()
+   return s
+end
+
+-- Run ourselves to generate the bodies with a number of threads
+local function generate(threads)
+   local fileName = (os.getenv("TMP") or "") .. os.tmpname()
+   local out = os.readProcess("OMP_NUM_THREADS=" .. threads, driver, script, driver, fileName)
+   local s = readFile(fileName)
+   os.remove(fileName)
+
+   if s == nil or s == "" then
+      eprintf("Generating bodies with %d threads failed:\n", threads)
+      error(out)
+   end
+   return s
+end
+
+
+if args[2] ~= nil then
+   writeBodies(args[2])
+   return
+end
+
+local serial = generate(1)
+local threaded = generate(nThreads)
+
+local _, lines = serial:gsub("\n", "\n")
+if lines ~= nbody then
+   error(string.format("Expected %d bodies, got %d", nbody, lines))
+end
+
+if serial ~= threaded then
+   error(string.format("Parallel Plummer bodies differ between 1 and %d threads", nThreads))
+end
+
+printf("Parallel Plummer bodies match with 1 and %d threads\n", nThreads)
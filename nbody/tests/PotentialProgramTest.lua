@@ -0,0 +1,135 @@
+--
+-- Copyright (C) 2012  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+local function relativeDifference(a, b)
+   return Vector.length(a - b) / Vector.length(b)
+end
+
+local function sameVector(a, b)
+   return a.x == b.x and a.y == b.y and a.z == b.z
+end
+
+local hernquist = [[
+   # Hernquist sphere
+   f = -M / (r * sqr(r + a))
+   ax = f * x; ay = f * y
+   az = f * z
+]]
+
+local prng = DSFMT.create()
+
+
+-- A program with no terms of its own is exactly its potential
+for i = 1, 100 do
+   local pot = SP.randomPotential(prng)
+   local prog = PotentialProgram.create{
+      acceleration = "ax = 0; ay = 0; az = 0",
+      potential    = pot
+   }
+
+   local r = prng:randomVector(50)
+   assert(sameVector(prog:acceleration(r), pot:acceleration(r)),
+          "Program with only a potential differs from the potential")
+end
+
+
+do
+   local M, a = 5.0e5, 12.0
+   local prog = PotentialProgram.create{
+      acceleration = hernquist,
+      parameters   = { M = M, a = a }
+   }
+
+   for i = 1, 100 do
+      local r = prng:randomVector(100)
+      local rl = Vector.length(r)
+      local expected = (-M / (rl * (rl + a)^2)) * r
+
+      assert(relativeDifference(prog:acceleration(r), expected) < 1.0e-14,
+             "Hernquist program gives wrong acceleration")
+   end
+end
+
+
+-- Constants are folded, leaving a constant and a store for each component
+do
+   local prog = PotentialProgram.create{
+      acceleration = "ax = 2 * 3 + 1; ay = -(k^3); az = sqrt(16) / min(k, 4)",
+      parameters   = { k = 2 }
+   }
+
+   assert(sameVector(prog:acceleration(Vector.create(1, 2, 3)), Vector.create(7, -8, 2)),
+          "Wrong result from constants")
+   assert(tostring(prog) == "PotentialProgram { instructions = 6 }",
+          "Constants were not folded: " .. tostring(prog))
+end
+
+
+local badPrograms = {
+   { acceleration = "ax = x; ay = y" },
+   { acceleration = "ax = x; ay = y; az = w" },
+   { acceleration = "x = 1; ax = x; ay = y; az = z" },
+   { acceleration = "ax = (x; ay = y; az = z" },
+   { acceleration = "ax = sqrt(x, y); ay = y; az = z" },
+   { acceleration = "ax = x; ay = y; az = z", parameters = { r = 1 } },
+   { acceleration = "ax = x; ay = y; az = z", parameters = { 1 } }
+}
+
+for _, args in ipairs(badPrograms) do
+   assert(not pcall(PotentialProgram.create, args),
+          "Invalid program accepted: " .. args.acceleration)
+end
+
+
+-- Running with a program adding nothing to the potential gives exactly
+-- the same as running with the potential
+for i = 1, 3 do
+   local pot = SP.randomPotential(prng)
+   local prog = PotentialProgram.create{
+      acceleration = "ax = 0; ay = 0; az = 0",
+      potential    = pot
+   }
+
+   local ctx = NBodyCtx.create{
+      timestep    = 1.0e-4,
+      timeEvolve  = 2.0e-3,
+      theta       = 0.7,
+      eps2        = 1.0e-5,
+      criterion   = prng:randomListItem({ "SW93", "BH86", "Exact" }),
+      useQuad     = prng:randomBool(),
+      allowIncest = true,
+      quietErrors = true
+   }
+
+   ctx:addPotential(pot)
+
+   local st = NBodyState.create(ctx, SM.randomPlummer(prng, 500))
+   local stProg = st:clone()
+
+   st:runSystem(ctx, pot)
+   stProg:runSystem(ctx, prog)
+
+   assert(st == stProg, "Running with a program differs from running with its potential")
+end
+
@@ -0,0 +1,80 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+local function vectorsEqual(a, b)
+   return a.x == b.x and a.y == b.y and a.z == b.z
+end
+
+-- Write a snapshot, read it back, and check that a state made from
+-- the bodies read writes back exactly the same bodies.
+
+local nTests = 5
+
+for i = 1, nTests do
+   local prng = DSFMT.create()
+   local tmpDir = os.getenv("TMP") or ""
+   local file1 = tmpDir .. os.tmpname()
+   local file2 = tmpDir .. os.tmpname()
+   local nSteps = floor(prng:random(0, 10))
+
+   local ctx = NBodyCtx.create{
+      timestep    = prng:random(1.0e-5, 1.0e-4),
+      timeEvolve  = 10.0,
+      theta       = prng:random(0, 1),
+      eps2        = prng:random(1.0e-9, 1.0e-3),
+      criterion   = "NewCriterion",
+      useQuad     = true,
+      allowIncest = true,
+      quietErrors = true
+   }
+   ctx:addPotential(SP.randomPotential(prng))
+
+   local m = SM.randomPlummer(prng, 600)
+   local nbody = #m
+
+   local st = NBodyState.create(ctx, m)
+   for j = 1, nSteps do
+      st:step(ctx)
+   end
+
+   st:writeSnapshot(ctx, file1)
+   local snap1 = NBodyState.readSnapshot(file1)
+   os.remove(file1)
+
+   assert(snap1.step == nSteps, "Snapshot has wrong step")
+   assert(#snap1.bodies == nbody, string.format("Expected %d bodies, got %d", nbody, #snap1.bodies))
+
+   local st2 = NBodyState.create(ctx, snap1.bodies)
+   st2:writeSnapshot(ctx, file2)
+   local snap2 = NBodyState.readSnapshot(file2)
+   os.remove(file2)
+
+   for j = 1, nbody do
+      local a, b = snap1.bodies[j], snap2.bodies[j]
+      assert(a.mass == b.mass and a.ignore == b.ignore
+             and vectorsEqual(a.position, b.position)
+             and vectorsEqual(a.velocity, b.velocity),
+             string.format("Body %d differs after snapshot round trip:\n%s\n%s\n", j, tostring(a), tostring(b)))
+   end
+end
@@ -0,0 +1,124 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Kill a run after it has checkpointed, resume it, and check the
+-- trajectory is the same as from a run which was never interrupted.
+
+require "NBodyTesting"
+
+local args = {...}
+local nbodyBin = assert(args[1], "Missing binary name")
+local input = "TrajectoryTestInput.lua"
+
+local tmpDir = os.getenv("TMP") or ""
+local checkpoint = tmpDir .. os.tmpname()
+local refTrajectory = tmpDir .. os.tmpname()
+local trajectory = tmpDir .. os.tmpname()
+
+local commonArgs = table.concat({ "--nthreads 1",
+                                  "--trajectory-interval 10",
+                                  "-f", input,
+                                  "-c", checkpoint }, " ")
+
+local function fileExists(name)
+   local f = io.open(name, "rb")
+   if f == nil then
+      return false
+   end
+   f:close()
+   return true
+end
+
+local function fileSize(name)
+   local f = io.open(name, "rb")
+   if f == nil then
+      return 0
+   end
+   local size = f:seek("end")
+   f:close()
+   return size
+end
+
+local function readFile(name)
+   local f = assert(io.open(name, "rb"))
+   local s = assert(f:read("*a"))
+   f:close()
+   return s
+end
+
+local function cleanup()
+   os.remove(checkpoint)
+   os.remove(refTrajectory)
+   os.remove(trajectory)
+end
+
+
+local out = os.readProcess(nbodyBin, commonArgs,
+                           "-i --checkpoint-interval=-1",
+                           "--trajectory-file", refTrajectory)
+if not fileExists(refTrajectory) then
+   cleanup()
+   eprintf("Reference run failed:\n")
+   error(out)
+end
+os.remove(checkpoint)
+
+
+-- Start the run in the background, and kill it halfway through. The
+-- first checkpoint is made on the first step, so there is always one
+-- by then, with later frames after it.
+local pidFile = assert(io.popen(table.concat({ nbodyBin, commonArgs,
+                                               "-i --checkpoint-interval=1",
+                                               "--trajectory-file", trajectory,
+                                               ">/dev/null 2>&1 & echo $!" }, " ")))
+local pid = assert(tonumber(pidFile:read("*l")))
+pidFile:close()
+
+local alive = true
+while not fileExists(checkpoint) or 2 * fileSize(trajectory) < fileSize(refTrajectory) do
+   if os.execute("kill -0 " .. pid .. " 2>/dev/null") ~= 0 then
+      alive = false
+      break
+   end
+   os.execute("sleep 0.1")
+end
+
+if not alive then
+   cleanup()
+   error("Run finished before it was killed")
+end
+
+os.execute("kill -9 " .. pid)
+os.execute("sleep 0.1")
+
+
+out = os.readProcess(nbodyBin, commonArgs,
+                     "--checkpoint-interval=1",
+                     "--trajectory-file", trajectory)
+
+local same = fileExists(trajectory) and readFile(trajectory) == readFile(refTrajectory)
+cleanup()
+
+if not same then
+   eprintf("Resumed trajectory differs from the uninterrupted run:\n")
+   error(out)
+end
+
+printf("Resumed trajectory matches\n")
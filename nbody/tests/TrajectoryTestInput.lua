@@ -0,0 +1,61 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- A small Plummer sphere which runs for several seconds, long enough
+-- to be checkpointed and killed partway through.
+
+nbody = 2000
+r0 = 0.2
+mass = 16
+
+function makeHistogram()
+   return HistogramParams.create()
+end
+
+function makePotential()
+   return Potential.create{
+      spherical = Spherical.spherical{ mass = 1.52954402e5, scale = 0.7 },
+      disk      = Disk.miyamotoNagai{ mass = 4.45865888e5, scaleLength = 6.5, scaleHeight = 0.26 },
+      halo      = Halo.logarithmic{ vhalo = 73, scaleLength = 12.0, flattenZ = 1.0 }
+   }
+end
+
+function makeContext()
+   local eps = r0 / (10.0 * sqrt(nbody))
+   return NBodyCtx.create{
+      timeEvolve = 0.25,
+      timestep   = sqr(1 / 10.0) * sqrt((pi_4_3 * cube(r0)) / mass),
+      eps2       = eps * eps,
+      criterion  = "sw93",
+      useQuad    = true,
+      theta      = 1.0
+   }
+end
+
+function makeBodies(ctx, potential)
+   return predefinedModels.plummer{
+      nbody       = nbody,
+      prng        = DSFMT.create(7731),
+      position    = Vector.create(-22.0415, -3.35444, 19.9539),
+      velocity    = Vector.create(118.444, 168.874, -67.6378),
+      mass        = mass,
+      scaleRadius = r0
+   }
+end
@@ -0,0 +1,82 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- The Morton ordered tree builder should build the same tree as the
+-- insertion builder, so stepping with either should give identical states.
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+function randomTreeCtxArgs(prng, useQuad)
+   return {
+      timestep    = prng:random(1.0e-5, 1.0e-4),
+      timeEvolve  = prng:random(0, 10),
+      theta       = prng:random(0.1, 1),
+      eps2        = prng:random(1.0e-9, 1.0e-3),
+      treeRSize   = prng:randomListItem({ 4, 8, 2, 16 }),
+      criterion   = prng:randomListItem({"NewCriterion", "SW93", "BH86"}),
+      useQuad     = useQuad,
+      allowIncest = true,
+      quietErrors = true
+   }
+end
+
+function runNSteps(st, n, ctx)
+   for i = 1, n do
+      st:step(ctx)
+   end
+   return st
+end
+
+
+local nTests = 6
+local prng = DSFMT.create(2419)
+
+for i = 1, nTests do
+   local testSteps, args, pot
+   local st, stMorton
+   local ctx, ctxMorton
+
+   args = randomTreeCtxArgs(prng, i % 2 == 0)
+   pot = SP.randomPotential(prng)
+
+   ctx = NBodyCtx.create(args)
+   ctx:addPotential(pot)
+
+   args.useMortonTree = true
+   ctxMorton = NBodyCtx.create(args)
+   ctxMorton:addPotential(pot)
+
+   st = NBodyState.create(ctx, SM.randomPlummer(prng, 1000))
+   stMorton = st:clone()
+
+   testSteps = floor(prng:random(1, 21))
+
+   st = runNSteps(st, testSteps, ctx)
+   stMorton = runNSteps(stMorton, testSteps, ctxMorton)
+
+   assert(st == stMorton,
+          string.format("Morton tree state does not match:\nstate 1 = %s\n state 2 = %s\n",
+                        tostring(st),
+                        tostring(stMorton))
+       )
+end
+
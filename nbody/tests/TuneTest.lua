@@ -0,0 +1,76 @@
+--
+-- Copyright (C) 2012  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+-- Fixed so the same models are tuned every time. Which passing
+-- settings are fastest may still vary from run to run.
+local prng = DSFMT.create(8431)
+
+local criteria = { NewCriterion = true, SW93 = true, BH86 = true, Exact = true }
+
+for i = 1, 3 do
+   local tolerance = prng:random(1.0e-3, 1.0e-2)
+   local ctx = NBodyCtx.create{
+      timestep    = 1.0e-4,
+      timeEvolve  = 1.0e-3,
+      theta       = prng:random(0.5, 0.8),
+      eps2        = 1.0e-5,
+      criterion   = prng:randomListItem({ "NewCriterion", "SW93" }),
+      useQuad     = prng:randomBool(),
+      allowIncest = true,
+      quietErrors = true
+   }
+   ctx:addPotential(SP.randomPotential(prng))
+
+   local st = NBodyState.create(ctx, SM.randomPlummer(prng, 1000))
+   local orig = st:clone()
+
+   local tuned = st:tune(ctx, tolerance)
+   assert(criteria[tuned.criterion], "Unknown criterion " .. tostring(tuned.criterion))
+   assert(tuned.forceError <= tolerance,
+          string.format("Tuned error %g is larger than the tolerance %g", tuned.forceError, tolerance))
+   assert(tuned.stepTime > 0.0, "Expected a time per step")
+
+   -- The trials don't change the state
+   assert(st == orig, "State changed by tuning")
+   st:step(ctx)
+   orig:step(ctx)
+   assert(st == orig, "State stepped differently after tuning")
+
+   -- Only the direct sum has no error
+   local exact = st:tune(ctx, 0.0)
+   assert(exact.criterion == "Exact" and exact.forceError == 0.0,
+          "Expected Exact with no tolerance, got " .. exact.criterion)
+
+   -- Applying the result sets only the tuned parts of the context
+   st:applyTuneResult(ctx, tuned)
+   assert(ctx.criterion == tuned.criterion and ctx.theta == tuned.theta and ctx.useQuad == tuned.useQuad,
+          "Tuned settings were not applied")
+   assert(ctx.allowIncest and ctx.quietErrors, "Applying tuned settings changed the rest of the context")
+
+   local rc = st:step(ctx)
+   assert(rc == "NBODY_SUCCESS" or rc == "NBODY_TREE_INCEST_NONFATAL",
+          "Stepping with the tuned settings failed: " .. rc)
+end
+
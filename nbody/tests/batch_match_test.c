@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2011 Matthew Arsenault
+ * Copyright (c) 2011 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "milkyway_util.h"
+#include "nbody_chisq.h"
+#include "nbody_show.h"
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+  #include <direct.h>
+  #define mkdir(x, y) _mkdir(x)
+#endif
+
+/* Histograms are written under the working directory */
+#define TEST_DIR "batch_match_test"
+#define MODEL_DIR TEST_DIR "/models"
+
+#define DATA_HIST TEST_DIR "/data"
+#define SAME_HIST MODEL_DIR "/a_same"
+#define OTHER_HIST MODEL_DIR "/b_other"
+#define MALFORMED_HIST TEST_DIR "/malformed"
+#define SHORT_HIST TEST_DIR "/short"
+#define MISSING_HIST TEST_DIR "/missing"
+#define MANIFEST TEST_DIR "/manifest"
+#define EMPTY_MANIFEST TEST_DIR "/empty_manifest"
+
+#define NBIN 20
+
+#define ZERO_THRESHOLD 1.0e-6
+
+/* Every name accepted for nbodyLikelihoodMethod */
+static const struct
+{
+    const char* name;
+    NBodyLikelihoodMethod method;
+} methodNames[] =
+    {
+        { "EMD",             NBODY_EMD              },
+        { "Original",        NBODY_ORIG_CHISQ       },
+        { "AltOriginal",     NBODY_ORIG_ALT         },
+        { "ChisqAlt",        NBODY_CHISQ_ALT        },
+        { "Poisson",         NBODY_POISSON          },
+        { "Kolmogorov",      NBODY_KOLMOGOROV       },
+        { "KullbackLeibler", NBODY_KULLBACK_LEIBLER },
+        { "Saha",            NBODY_SAHA             }
+    };
+
+#define N_METHODS (sizeof(methodNames) / sizeof(methodNames[0]))
+
+static unsigned int dataCounts[NBIN];
+static unsigned int otherCounts[NBIN];
+
+
+/* Bin counts are written normalized to the number in range, as
+ * histograms written by a run are */
+static int writeHistogram(const char* file, const unsigned int* counts, unsigned int nBin, const char* badLine)
+{
+    FILE* f;
+    unsigned int i;
+    unsigned int total = 0;
+
+    for (i = 0; i < nBin; ++i)
+    {
+        total += counts[i];
+    }
+
+    f = fopen(file, "w");
+    if (!f)
+    {
+        mwPerror("Opening '%s'", file);
+        return 1;
+    }
+
+    fprintf(f,
+            "# A test histogram\n"
+            "#\n"
+            "n = %u\n"
+            "\n",
+            total);
+
+    for (i = 0; i < nBin; ++i)
+    {
+        if (badLine && i == nBin / 2)
+        {
+            fputs(badLine, f);
+        }
+
+        fprintf(f, "1 %.10f %.10f %.10f\n",
+                -50.0 + 5.0 * (double) i,
+                (double) counts[i] / (double) total,
+                sqrt((double) counts[i]) / (double) total);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static int writeText(const char* file, const char* text)
+{
+    FILE* f;
+
+    f = fopen(file, "w");
+    if (!f)
+    {
+        mwPerror("Opening '%s'", file);
+        return 1;
+    }
+
+    fputs(text, f);
+    fclose(f);
+    return 0;
+}
+
+static int setupFiles(void)
+{
+    unsigned int i;
+    int rc = 0;
+
+    mkdir(TEST_DIR, 0777);
+    mkdir(MODEL_DIR, 0777);
+    mkdir(MODEL_DIR "/subdir", 0777);
+
+    /* Totals which don't divide the counts exactly, so the raw
+     * counts have to be rounded back */
+    for (i = 0; i < NBIN; ++i)
+    {
+        dataCounts[i] = 10 + 7 * i + (i * i) % 13;
+        otherCounts[i] = 5 + (37 * i) % 23;
+    }
+
+    rc |= writeHistogram(DATA_HIST, dataCounts, NBIN, NULL);
+    rc |= writeHistogram(SAME_HIST, dataCounts, NBIN, NULL);
+    rc |= writeHistogram(OTHER_HIST, otherCounts, NBIN, NULL);
+    rc |= writeHistogram(MALFORMED_HIST, dataCounts, NBIN, "1 -2.5 oops 0.01\n");
+    rc |= writeHistogram(SHORT_HIST, dataCounts, NBIN / 2, NULL);
+
+    /* Hidden files in a directory are skipped */
+    rc |= writeHistogram(MODEL_DIR "/.hidden", dataCounts, NBIN, "not a histogram\n");
+
+    remove(MISSING_HIST);
+
+    rc |= writeText(MANIFEST,
+                    "# Models to score\n"
+                    "\n"
+                    SAME_HIST "\n"
+                    "   " OTHER_HIST "   \n"
+                    MALFORMED_HIST "\n"
+                    "# " SHORT_HIST "\n"
+                    SHORT_HIST "\n"
+                    MISSING_HIST "\n");
+
+    rc |= writeText(EMPTY_MANIFEST, "# Nothing\n\n");
+
+    return rc;
+}
+
+/* The score for a model, with its raw counts known exactly rather
+ * than recovered from the file */
+static double expectedScore(const char* file, const unsigned int* counts, NBodyLikelihoodMethod method)
+{
+    NBodyHistogram* data;
+    NBodyHistogram* histogram;
+    unsigned int i;
+    double score;
+
+    data = nbReadHistogram(DATA_HIST);
+    histogram = nbReadHistogram(file);
+    if (!data || !histogram)
+    {
+        free(data);
+        free(histogram);
+        return NAN;
+    }
+
+    if (method == NBODY_EMD)
+    {
+        score = nbMatchEMD(data, histogram);
+    }
+    else
+    {
+        for (i = 0; i < histogram->nBin; ++i)
+        {
+            histogram->data[i].rawCount = counts[i];
+        }
+        histogram->hasRawCounts = TRUE;
+
+        score = nbCalcChisq(data, histogram, method);
+    }
+
+    free(data);
+    free(histogram);
+
+    return score;
+}
+
+static int checkScore(const char* methodName, const char* file, double actual, double expected)
+{
+    if (isnan(expected))
+    {
+        if (!isnan(actual))
+        {
+            mw_printf("%s: expected nan for '%s', got %.15f\n", methodName, file, actual);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!(fabs(actual - expected) <= 1.0e-12 * fmax(1.0, fabs(expected))))
+    {
+        mw_printf("%s: expected %.15f for '%s', got %.15f\n", methodName, expected, file, actual);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Run a batch and read back the table it prints */
+static int runBatch(const char* models,
+                    NBodyLikelihoodMethod method,
+                    int* nFail,
+                    char names[][256],
+                    double* scores,
+                    unsigned int maxRows,
+                    unsigned int* nRows)
+{
+    FILE* f;
+    char line[512];
+    char methodLine[128];
+    int failed = 0;
+
+    f = tmpfile();
+    if (!f)
+    {
+        mwPerror("Creating temporary file");
+        return 1;
+    }
+
+    *nFail = nbMatchHistogramBatch(f, DATA_HIST, models, method);
+    rewind(f);
+
+    sprintf(methodLine, "# method = %s\n", showNBodyLikelihoodMethod(method));
+
+    *nRows = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        char* end;
+
+        if (line[0] == '#')
+        {
+            if (!strncmp(line, "# method = ", 11) && strcmp(line, methodLine))
+            {
+                mw_printf("Wrong method in table: %s", line);
+                failed = 1;
+            }
+            continue;
+        }
+
+        if (*nRows == maxRows)
+        {
+            mw_printf("Too many rows in table: %s", line);
+            failed = 1;
+            break;
+        }
+
+        scores[*nRows] = strtod(line, &end);
+        if (end == line || sscanf(end, " %255s", names[*nRows]) != 1)
+        {
+            mw_printf("Malformed table row: %s", line);
+            failed = 1;
+            break;
+        }
+
+        ++*nRows;
+    }
+
+    fclose(f);
+    return failed;
+}
+
+static int testMethodNames(void)
+{
+    unsigned int i;
+    int failed = 0;
+    static const char* badNames[] = { "emd", "", "InvalidMethod", "Original ", "Chisq" };
+
+    for (i = 0; i < N_METHODS; ++i)
+    {
+        NBodyLikelihoodMethod m = nbLikelihoodMethodFromName(methodNames[i].name);
+
+        if (m != methodNames[i].method)
+        {
+            mw_printf("Method name '%s' gave %d, expected %d\n", methodNames[i].name, m, methodNames[i].method);
+            failed = 1;
+        }
+
+        if (strcmp(showNBodyLikelihoodMethod(methodNames[i].method), methodNames[i].name))
+        {
+            mw_printf("Method %d is shown as '%s', expected '%s'\n",
+                      methodNames[i].method,
+                      showNBodyLikelihoodMethod(methodNames[i].method),
+                      methodNames[i].name);
+            failed = 1;
+        }
+    }
+
+    for (i = 0; i < sizeof(badNames) / sizeof(badNames[0]); ++i)
+    {
+        if (nbLikelihoodMethodFromName(badNames[i]) != NBODY_INVALID_METHOD)
+        {
+            mw_printf("Method name '%s' should be invalid\n", badNames[i]);
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
+
+/* Score the manifest with every method. The malformed, short and
+ * missing models are listed as nan in the order given */
+static int testManifest(void)
+{
+    static const char* expectedNames[] = { SAME_HIST, OTHER_HIST, MALFORMED_HIST, SHORT_HIST, MISSING_HIST };
+    char names[8][256];
+    double scores[8];
+    unsigned int i, j, nRows;
+    int nFail;
+    int failed = 0;
+
+    for (i = 0; i < N_METHODS; ++i)
+    {
+        const char* methodName = methodNames[i].name;
+        NBodyLikelihoodMethod method = nbLikelihoodMethodFromName(methodName);
+
+        if (runBatch(MANIFEST, method, &nFail, names, scores, 8, &nRows))
+        {
+            failed = 1;
+            continue;
+        }
+
+        if (nFail != 3)
+        {
+            mw_printf("%s: batch reported %d failures, expected 3\n", methodName, nFail);
+            failed = 1;
+        }
+
+        if (nRows != 5)
+        {
+            mw_printf("%s: batch printed %u rows, expected 5\n", methodName, nRows);
+            failed = 1;
+            continue;
+        }
+
+        for (j = 0; j < nRows; ++j)
+        {
+            if (strcmp(names[j], expectedNames[j]))
+            {
+                mw_printf("%s: row %u is '%s', expected '%s'\n", methodName, j, names[j], expectedNames[j]);
+                failed = 1;
+            }
+        }
+
+        failed |= checkScore(methodName, SAME_HIST, scores[0], expectedScore(SAME_HIST, dataCounts, method));
+        failed |= checkScore(methodName, OTHER_HIST, scores[1], expectedScore(OTHER_HIST, otherCounts, method));
+        failed |= checkScore(methodName, MALFORMED_HIST, scores[2], NAN);
+        failed |= checkScore(methodName, SHORT_HIST, scores[3], NAN);
+        failed |= checkScore(methodName, MISSING_HIST, scores[4], NAN);
+
+        if (method == NBODY_EMD && !(fabs(scores[0]) < ZERO_THRESHOLD))
+        {
+            mw_printf("EMD of a histogram against itself is %.15f\n", scores[0]);
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
+
+/* A directory is scored in sorted order, without hidden files or
+ * subdirectories */
+static int testDirectory(void)
+{
+    char names[8][256];
+    double scores[8];
+    unsigned int nRows;
+    int nFail;
+    int failed = 0;
+
+    if (runBatch(MODEL_DIR, NBODY_EMD, &nFail, names, scores, 8, &nRows))
+        return 1;
+
+    if (nFail != 0 || nRows != 2)
+    {
+        mw_printf("Directory batch gave %u rows with %d failures, expected 2 with none\n", nRows, nFail);
+        return 1;
+    }
+
+    if (strcmp(names[0], SAME_HIST) || strcmp(names[1], OTHER_HIST))
+    {
+        mw_printf("Directory batch rows are '%s', '%s'\n", names[0], names[1]);
+        failed = 1;
+    }
+
+    failed |= checkScore("EMD", OTHER_HIST, scores[1], expectedScore(OTHER_HIST, otherCounts, NBODY_EMD));
+
+    return failed;
+}
+
+static int testBatchErrors(void)
+{
+    FILE* f;
+    int failed = 0;
+
+    f = tmpfile();
+    if (!f)
+    {
+        mwPerror("Creating temporary file");
+        return 1;
+    }
+
+    if (nbMatchHistogramBatch(f, DATA_HIST, EMPTY_MANIFEST, NBODY_EMD) != -1)
+    {
+        mw_printf("Batch of an empty manifest should fail\n");
+        failed = 1;
+    }
+
+    if (nbMatchHistogramBatch(f, DATA_HIST, MISSING_HIST, NBODY_EMD) != -1)
+    {
+        mw_printf("Batch of a missing manifest should fail\n");
+        failed = 1;
+    }
+
+    if (nbMatchHistogramBatch(f, MALFORMED_HIST, MANIFEST, NBODY_EMD) != -1)
+    {
+        mw_printf("Batch against a malformed data histogram should fail\n");
+        failed = 1;
+    }
+
+    fclose(f);
+
+    return failed;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    if (setupFiles())
+    {
+        mw_printf("Failed to write test histograms\n");
+        return 1;
+    }
+
+    failed |= testMethodNames();
+    failed |= testManifest();
+    failed |= testDirectory();
+    failed |= testBatchErrors();
+
+    if (!failed)
+    {
+        printf("Batch histogram matching tests passed\n");
+    }
+
+    return failed;
+}
+
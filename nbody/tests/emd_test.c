@@ -98,6 +98,32 @@ static float randomSelf(WeightPos* RESTRICT arr1, WeightPos* RESTRICT arr2, unsi
     return 0.0f;
 }
 
+static double calcEMD1D(const WeightPos* arr1, const WeightPos* arr2, unsigned int n)
+{
+    unsigned int i;
+    double emd;
+    WeightPosD* d1;
+    WeightPosD* d2;
+
+    d1 = mwCalloc(n, sizeof(WeightPosD));
+    d2 = mwCalloc(n, sizeof(WeightPosD));
+
+    for (i = 0; i < n; ++i)
+    {
+        d1[i].weight = arr1[i].weight;
+        d1[i].pos = arr1[i].pos;
+        d2[i].weight = arr2[i].weight;
+        d2[i].pos = arr2[i].pos;
+    }
+
+    emd = emdCalc1D(d1, d2, n, n);
+
+    free(d1);
+    free(d2);
+
+    return emd;
+}
+
 static int testDistributionEMD(const char* distName, EMDTestDistribFunc distribf, unsigned int n)
 {
     unsigned int i;
@@ -105,6 +131,7 @@ static int testDistributionEMD(const char* distName, EMDTestDistribFunc distribf
     WeightPos* arr2;
     float expected;
     float actual;
+    double actual1D;
     int differs;
 
     arr1 = mwCalloc(n, sizeof(WeightPos));
@@ -117,26 +144,99 @@ static int testDistributionEMD(const char* distName, EMDTestDistribFunc distribf
 
     expected = distribf(arr1, arr2, n);
     actual = emdCalc((const float*) arr1, (const float*) arr2, n, n, NULL);
+    actual1D = calcEMD1D(arr1, arr2, n);
 
     free(arr1);
     free(arr2);
 
-    differs = (fabsf(expected - actual) >= ZERO_THRESHOLD);
+    differs = (fabsf(expected - actual) >= ZERO_THRESHOLD)
+           || (fabs(expected - actual1D) >= ZERO_THRESHOLD);
 
     if (differs)
     {
         mw_printf("EMD different for test distribution '%s' with %u bins:\n"
-                  "  Expected %f, Actual %f, |Diff| = %f\n",
+                  "  Expected %f, Actual %f, 1D %f, |Diff| = %f\n",
                   distName,
                   n,
                   expected,
                   actual,
+                  actual1D,
                   fabsf(actual - expected)
             );
     }
     else
     {
-        printf("EMD test '%s'[%u] = %f, %f\n", distName, n, expected, actual);
+        printf("EMD test '%s'[%u] = %f, %f, %f\n", distName, n, expected, actual, actual1D);
+    }
+
+    return differs;
+}
+
+/* Compare the 1D path against the general solver for two independent
+ * random distributions with some empty bins, where the answer isn't
+ * known in closed form */
+static int testRandomPairEMD(unsigned int n)
+{
+    unsigned int i;
+    WeightPos* arr1;
+    WeightPos* arr2;
+    float total1 = 0.0f;
+    float total2 = 0.0f;
+    float general;
+    double actual1D;
+    int differs;
+
+    arr1 = mwCalloc(n, sizeof(WeightPos));
+    arr2 = mwCalloc(n, sizeof(WeightPos));
+
+    for (i = 0; i < n; ++i)
+    {
+        arr2[i].pos = arr1[i].pos = (float) i;
+
+        if (dsfmt_genrand_open_open(&_prng) > 0.2)
+        {
+            arr1[i].weight = (float) dsfmt_genrand_open_open(&_prng);
+            arr2[i].weight = (float) dsfmt_genrand_open_open(&_prng);
+        }
+
+        total1 += arr1[i].weight;
+        total2 += arr2[i].weight;
+    }
+
+    if (total1 <= 0.0f || total2 <= 0.0f)
+    {
+        arr1[0].weight = arr2[0].weight = 1.0f;
+        total1 = total2 = 1.0f;
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        arr1[i].weight /= total1;
+        arr2[i].weight /= total2;
+    }
+
+    general = emdCalc((const float*) arr1, (const float*) arr2, n, n, NULL);
+    actual1D = calcEMD1D(arr1, arr2, n);
+
+    free(arr1);
+    free(arr2);
+
+    /* The general solver works in single precision */
+    differs = (fabs(general - actual1D) >= 1.0e-4 * (1.0 + n));
+
+    if (differs)
+    {
+        mw_printf("1D EMD differs from general solver with %u bins:\n"
+                  "  General %f, 1D %f, |Diff| = %f\n",
+                  n,
+                  general,
+                  actual1D,
+                  fabs(general - actual1D)
+            );
+    }
+    else
+    {
+        printf("EMD test 'randomPair'[%u] = %f, %f\n", n, general, actual1D);
     }
 
     return differs;
@@ -177,6 +277,13 @@ int main(int argc, const char* argv[])
     fails += testDistributionEMD("allInDifferentBins", allInDifferentBins, 34);
     fails += testDistributionEMD("allInDifferentBins", allInDifferentBins, 50);
 
+    fails += testRandomPairEMD(1);
+    fails += testRandomPairEMD(7);
+    fails += testRandomPairEMD(20);
+    fails += testRandomPairEMD(33);
+    fails += testRandomPairEMD(50);
+    fails += testRandomPairEMD(100);
+
     if (fails != 0)
     {
         mw_printf("%d EMD test distributions failed\n", fails);
@@ -0,0 +1,42 @@
+
+nbody = 4096
+
+dwarfMass = 16
+dwarfRadius = 0.2
+reverseTime = 4.0
+evolveTime = 3.945
+
+
+function makeHistogram()
+   return HistogramParams.create()
+end
+
+function makePotential()
+   return PotentialProgram.create{
+      acceleration = "ax = -M * x; ay = -M * y; az = -M * ",
+      parameters   = { M = 1.0 }
+   }
+end
+
+function makeContext()
+   return NBodyCtx.create{
+      timestep   = calculateTimestep(dwarfMass, dwarfRadius),
+      timeEvolve = evolveTime,
+      eps2       = calculateEps2(nbody, dwarfRadius),
+      criterion  = "sw93",
+      useQuad    = true,
+      theta      = 1.0
+   }
+end
+
+function makeBodies(ctx, potential)
+   return predefinedModels.plummer{
+      nbody       = nbody,
+      prng        = DSFMT.create(argSeed),
+      position    = Vector.create(0, 0, 0),
+      velocity    = Vector.create(0, 0, 0),
+      mass        = dwarfMass,
+      scaleRadius = dwarfRadius
+   }
+end
+
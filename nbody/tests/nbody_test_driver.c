@@ -433,6 +433,51 @@ static int installHashFunctions(lua_State* luaSt)
 }
 #endif
 
+/* Table of the self gravity on each body in the state found with
+ * ctx, so different ways of finding the forces can be compared. The
+ * external potential is left out. */
+static int luaSelfGravity(lua_State* luaSt)
+{
+    int i;
+    NBodyStatus rc;
+    NBodyCtx ctx;
+    NBodyState* st;
+    const NBodyBodyArrays* arrays;
+
+    st = checkNBodyState(luaSt, 1);
+    ctx = *checkNBodyCtx(luaSt, 2);
+    ctx.potentialType = EXTERNAL_POTENTIAL_NONE;
+
+    rc = nbGravMap(&ctx, st);
+    if (nbStatusIsFatal(rc))
+        return luaL_error(luaSt, "Error finding accelerations: %s", showNBodyStatus(rc));
+
+    arrays = st->bodyArrays;
+    lua_createtable(luaSt, st->nbody, 0);
+    for (i = 0; i < st->nbody; ++i)
+    {
+        mwvector a;
+
+        SET_VECTOR(a, arrays->acc[0][i], arrays->acc[1][i], arrays->acc[2][i]);
+        pushVector(luaSt, a);
+        lua_rawseti(luaSt, -2, i + 1);
+    }
+
+    return 1;
+}
+
+static void registerNBodyStateTestMethods(lua_State* luaSt)
+{
+    static const luaL_reg testMethodsNBodyState[] =
+        {
+            { "selfGravity", luaSelfGravity },
+            { NULL, NULL }
+        };
+
+    luaL_register(luaSt, NBODYSTATE_TYPE, testMethodsNBodyState);
+    lua_pop(luaSt, 1);
+}
+
 /* Create a context with everything unset, useful for testing but
  * undesirable for actual work. */
 static int createTestNBodyCtx(lua_State* luaSt)
@@ -465,6 +510,7 @@ static int runNBodyTest(const char* file, const char** args, unsigned int nArgs)
      * to not include useless / and or less safe versions of
      * functions. */
     registerNBodyState(luaSt);
+    registerNBodyStateTestMethods(luaSt);
 
   #if USE_SSL_TESTS
     installHashFunctions(luaSt);
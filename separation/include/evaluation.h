@@ -42,6 +42,14 @@ int evaluate(SeparationResults* results,
              int ignoreCheckpoint,
              const char* separation_outfile);
 
+int evaluateBatch(const AstronomyParameters* ap,
+                  const BackgroundParameters* bgp,
+                  const Streams* streams,
+                  const IntegralArea* ias,
+                  const char* starPointsFile,
+                  const CLRequest* clr,
+                  const char* batchFile);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2008-2010 Travis Desell, Nathan Cole
+ *  Copyright (c) 2008-2010 Boleslaw Szymanski, Heidi Newberg
+ *  Copyright (c) 2008-2010 Carlos Varela, Malik Magdon-Ismail
+ *  Copyright (c) 2008-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GEOMETRY_CACHE_H_
+#define _GEOMETRY_CACHE_H_
+
+#include "separation_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GEOMETRY_CACHE_MAGIC "MWSEPGEO"
+#define GEOMETRY_CACHE_VERSION 1
+
+/* Identifies the integral a cache belongs to. This is also the header
+ * of the cache file, which is followed by the RConsts, the r points,
+ * the qw_r3_N weights and then one slab of mu_steps LBTrigs for each
+ * nu step, with each section starting on a 64 byte boundary. */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t realSize;
+    int32_t wedge;
+    int32_t convolve;
+    uint32_t r_steps;
+    uint32_t mu_steps;
+    uint32_t nu_steps;
+    uint32_t reserved;
+    double area[9];     /* r, nu and mu min, max and step sizes */
+    double sun_r0;
+    double coeff;
+} GeometryCacheHeader;
+
+/* Everything in an integral which depends only on the wedge, the
+ * integral area and the convolution, and not on the fit parameters.
+ * The r tables are complete once the cache is found; the trig for a
+ * nu slab is filled the first time the slab is integrated. */
+typedef struct GeometryCache
+{
+    GeometryCacheHeader* hdr;
+    RConsts* rc;                /* [r_steps] */
+    real* rPoints;              /* [r_steps * convolve] */
+    real* qw_r3_N;              /* [r_steps * convolve] */
+    LBTrig* lbts;               /* [nu_steps * mu_steps] */
+    unsigned char* slabReady;   /* [nu_steps], NULL if read from a file */
+    unsigned int nSlabsReady;
+
+    void* base;
+    size_t size;
+    int mapped;
+    int saved;                  /* Read from or written to a file */
+
+    struct GeometryCache* next;
+} GeometryCache;
+
+/* The trig for one nu slab. If fill is set the slab isn't ready yet
+ * and each row should be stored as it is calculated. */
+typedef struct
+{
+    LBTrig* lbts;
+    int fill;
+} GeometrySlab;
+
+#define EMPTY_GEOMETRY_SLAB { NULL, FALSE }
+
+/* Enable keeping the geometry between evaluations, and if dir is set
+ * also saving and loading it from files in that directory */
+void separationSetGeometryCache(int enable, const char* dir);
+
+/* Returns NULL if caching is disabled */
+GeometryCache* getGeometryCache(const AstronomyParameters* ap, const IntegralArea* ia, const StreamGauss sg);
+
+GeometrySlab geometryCacheSlab(GeometryCache* gc, unsigned int nu_step);
+
+/* complete should be false if the slab was only partially filled
+ * (i.e. when resuming from a checkpoint in the middle of it) */
+void geometryCacheSlabDone(GeometryCache* gc, unsigned int nu_step, int complete);
+
+/* Save the cache if it is now complete and a directory is set */
+int geometryCacheIntegralDone(GeometryCache* gc);
+
+void freeGeometryCaches(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _GEOMETRY_CACHE_H_ */
+
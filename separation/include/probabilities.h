@@ -35,7 +35,13 @@ extern "C" {
 
 /* probabilities will be rebuilt for each SSE level */
 #if MW_IS_X86
-  #if defined(__AVX__)
+  #if defined(__AVX512F__)
+    #define INIT_PROBABILITIES initProbabilities_AVX512
+    #define INIT_PROBABILITY_ROWS initProbabilityRows_AVX512
+  #elif defined(__AVX2__) && defined(__FMA__)
+    #define INIT_PROBABILITIES initProbabilities_AVX2
+    #define INIT_PROBABILITY_ROWS initProbabilityRows_AVX2
+  #elif defined(__AVX__)
     #define INIT_PROBABILITIES initProbabilities_AVX
   #elif defined(__SSE4_1__)
     #define INIT_PROBABILITIES initProbabilities_SSE41
@@ -52,6 +58,10 @@ extern "C" {
 
 
 #if MW_IS_X86
+ProbabilityFunc initProbabilities_AVX512(void);
+ProbabilityFunc initProbabilities_AVX2(void);
+ProbabilityRowFunc initProbabilityRows_AVX512(int* width);
+ProbabilityRowFunc initProbabilityRows_AVX2(int* width);
 ProbabilityFunc initProbabilities_AVX(void);
 ProbabilityFunc initProbabilities_SSE41(void);
 ProbabilityFunc initProbabilities_SSE3(void);
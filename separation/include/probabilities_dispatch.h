@@ -45,8 +45,28 @@ typedef real (*ProbabilityFunc)(const AstronomyParameters* ap,
 
 typedef ProbabilityFunc (*ProbInitFunc)();
 
+/* Sums for width consecutive r_steps of an integral point at once,
+ * one in each vector lane. The points are interleaved so the width
+ * r_steps of each convolve point are together. sc is the stream to
+ * sum, or NULL for the background. The sums aren't multiplied by
+ * reff_xr_rp3. */
+typedef void (*ProbabilityRowFunc)(const AstronomyParameters* ap,
+                                   const StreamConstants* sc,
+                                   const real* RESTRICT rPoints,
+                                   const real* RESTRICT qw_r3_N,
+                                   LBTrig lbt,
+                                   real* RESTRICT sums);
+
+typedef ProbabilityRowFunc (*ProbRowInitFunc)(int* width);
+
+#define PROBABILITY_ROW_MAX_WIDTH 8
+
 extern ProbabilityFunc probabilityFunc;
 
+/* NULL if the selected path only works on one r_step at a time */
+extern ProbabilityRowFunc probabilityRowFunc;
+extern int probabilityRowWidth;
+
 
 int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest* clr);
 
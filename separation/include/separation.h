@@ -44,6 +44,7 @@ extern "C" {
 #include "io_util.h"
 #include "coordinates.h"
 #include "integrals.h"
+#include "geometry_cache.h"
 #include "likelihood.h"
 #include "separation_utils.h"
 
@@ -59,6 +60,9 @@ typedef struct
     char* star_points_file;
     char* ap_file;  /* astronomy parameters */
     char* separation_outfile;
+    char* batch_parameters_file;
+    char* binary_star_points_file;
+    char* geometryCacheDir;
     char* preferredPlatformVendor;
     const char** forwardedArgs;
     real* numArgs;   /* Temporary */
@@ -77,6 +81,9 @@ typedef struct
     double waitFactor;  /* When using high CPU CL workarounds, factor for initial wait */
     int pollingMode;
     int disableGPUCheckpointing;
+    int nThreads;
+    int geometryCache;
+    double integralTolerance;
 
     MWPriority processPriority;
 
@@ -90,6 +97,8 @@ typedef struct
     int forceSSE3;
     int forceSSE41;
     int forceAVX;
+    int forceAVX2;
+    int forceAVX512;
 
     int verbose;
 } SeparationFlags;
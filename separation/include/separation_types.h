@@ -65,9 +65,12 @@ typedef struct
 {
     unsigned int number_stars;
     mwvector* stars;
+
+    void* mapping;      /* Non-NULL if stars points into a mapped binary file */
+    size_t mappingSize;
 } StarPoints;
 
-#define EMPTY_STAR_POINTS { 0, NULL }
+#define EMPTY_STAR_POINTS { 0, NULL, NULL, 0 }
 
 
 /* Convenience structure for passing mess of LBTrig to CAL kernel in 2 parts */
@@ -27,7 +27,26 @@
 #include <stdio.h>
 #include "separation_types.h"
 
+#define STAR_POINTS_BINARY_MAGIC "MWSTARPT"
+#define STAR_POINTS_BINARY_VERSION 1
+
+/* Header of the binary star points format. It is followed by
+ * numberStars points of starSize bytes, each stored as native endian
+ * doubles x, y, z and an unused padding value so that the points
+ * can be mapped directly as mwvectors. The header size keeps the
+ * points aligned when the file is mapped. */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t realSize;
+    uint64_t numberStars;
+    uint32_t starSize;
+    uint32_t reserved;
+} StarPointsBinaryHeader;
+
 int readStarPoints(StarPoints* sp, const char* file);
+int writeStarPointsBinary(const StarPoints* sp, const char* file);
 void freeStarPoints(StarPoints* sp);
 
 #endif /* _STAR_POINTS_H_ */
@@ -37,6 +37,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
 
 
 static void getFinalIntegrals(SeparationResults* results,
@@ -269,3 +270,302 @@ error:
     return rc;
 }
 
+
+
+#if SEPARATION_OPENCL
+/* The CL kernels have these compiled in, so they need to be rebuilt
+ * if any of them change between parameter sets */
+static int clCompiledConstantsDiffer(const AstronomyParameters* a, const AstronomyParameters* b)
+{
+    return a->fast_h_prob != b->fast_h_prob
+        || a->aux_bg_profile != b->aux_bg_profile
+        || a->number_streams != b->number_streams
+        || a->convolve != b->convolve
+        || a->r0 != b->r0
+        || a->sun_r0 != b->sun_r0
+        || a->q_inv_sqr != b->q_inv_sqr
+        || a->bg_a != b->bg_a
+        || a->bg_b != b->bg_b
+        || a->bg_c != b->bg_c
+        || a->alpha != b->alpha
+        || a->alpha_delta3 != b->alpha_delta3;
+}
+#endif /* SEPARATION_OPENCL */
+
+#define BATCH_LINE_MAX 4096
+
+/* Read the next set of fit parameters. Blank lines and lines starting
+ * with '#' are skipped; numbers may be separated with whitespace or
+ * commas. Returns 1 on a parameter set, 0 at end of input and -1 on error */
+static int readBatchParameters(FILE* f, real* params, unsigned int maxParams, unsigned int* nParamsOut, unsigned int* lineNum)
+{
+    char buf[BATCH_LINE_MAX];
+    char* p;
+    char* end;
+    unsigned int n;
+
+    while (fgets(buf, sizeof(buf), f))
+    {
+        ++*lineNum;
+
+        p = buf;
+        while (isspace(*p))
+            ++p;
+
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        n = 0;
+        while (*p != '\0')
+        {
+            if (isspace(*p) || *p == ',')
+            {
+                ++p;
+                continue;
+            }
+
+            if (n >= maxParams)
+            {
+                mw_printf("Too many parameters on batch line %u\n", *lineNum);
+                return -1;
+            }
+
+            params[n] = (real) strtod(p, &end);
+            if (end == p)
+            {
+                mw_printf("Error parsing batch parameters on line %u at '%s'\n", *lineNum, p);
+                return -1;
+            }
+
+            ++n;
+            p = end;
+        }
+
+        *nParamsOut = n;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void printBatchResult(FILE* f, unsigned int index, const SeparationResults* results, int nStream)
+{
+    int i;
+
+    fprintf(f, "%u %.15f %.15f", index, results->likelihood, results->backgroundIntegral);
+    for (i = 0; i < nStream; ++i)
+        fprintf(f, " %.15f", results->streamIntegrals[i]);
+
+    fprintf(f, " %.15f", results->backgroundLikelihood);
+    for (i = 0; i < nStream; ++i)
+        fprintf(f, " %.15f", results->streamLikelihoods[i]);
+
+    fprintf(f, "\n");
+    fflush(f);
+}
+
+static void resetSeparationResults(SeparationResults* results, int nStream)
+{
+    int i;
+
+    results->likelihood = NAN;
+    results->backgroundIntegral = NAN;
+    results->backgroundLikelihood = NAN;
+    for (i = 0; i < nStream; ++i)
+    {
+        results->streamIntegrals[i] = NAN;
+        results->streamLikelihoods[i] = NAN;
+    }
+}
+
+static int evaluateBatchItem(SeparationResults* results,
+                             const AstronomyParameters* apBase,
+                             const BackgroundParameters* bgpBase,
+                             const Streams* streamsBase,
+                             const IntegralArea* ias,
+                             const StarPoints* sp,
+                             const StreamGauss sg,
+                             const CLRequest* clr,
+                             CLInfo* ci,
+                             int* clReady,
+                             AstronomyParameters* clAP,
+                             const real* params,
+                             unsigned int nParams)
+{
+    int rc;
+    AstronomyParameters ap = *apBase;
+    BackgroundParameters bgp = *bgpBase;
+    Streams streams = *streamsBase;
+    StreamConstants* sc = NULL;
+    EvaluationState* es = NULL;
+
+    streams.parameters = (StreamParameters*) mwMalloc(streamsBase->number_streams * sizeof(StreamParameters));
+    memcpy(streams.parameters, streamsBase->parameters, streamsBase->number_streams * sizeof(StreamParameters));
+
+    rc = setParameters(&ap, &bgp, &streams, params, nParams);
+    if (rc)
+        goto batch_item_exit;
+
+    rc = setAstronomyParameters(&ap, &bgp);
+    if (rc)
+        goto batch_item_exit;
+
+    setExpStreamWeights(&ap, &streams);
+    sc = getStreamConstants(&ap, &streams);
+
+    rc = probabilityFunctionDispatch(&ap, clr);
+    if (rc)
+        goto batch_item_exit;
+
+  #if SEPARATION_OPENCL
+    if (!clr->forceNoOpenCL && (!*clReady || clCompiledConstantsDiffer(clAP, &ap)))
+    {
+        if (*clReady)
+        {
+            releaseSeparationKernel();
+            mwDestroyCLInfo(ci);
+            memset(ci, 0, sizeof(*ci));
+            *clReady = FALSE;
+        }
+
+        rc = setupSeparationCL(ci, &ap, ias, clr);
+        if (rc)
+            goto batch_item_exit;
+
+        *clReady = TRUE;
+        *clAP = ap;
+    }
+  #else
+    (void) clReady, (void) clAP;
+  #endif /* SEPARATION_OPENCL */
+
+    es = newEvaluationState(&ap);
+    rc = calculateIntegrals(&ap, ias, sc, sg, es, clr, ci);
+    if (rc)
+        goto batch_item_exit;
+
+    getFinalIntegrals(results, es, ap.number_streams, ap.number_integrals);
+
+    rc = likelihood(results, &ap, sp, sc, &streams, sg, FALSE, NULL);
+    rc |= checkSeparationResults(results, ap.number_streams);
+
+batch_item_exit:
+    if (es)
+        freeEvaluationState(es);
+    mwFreeA(sc);
+    freeStreams(&streams);
+
+    return rc;
+}
+
+/* Evaluate every set of fit parameters read from batchFile ("-" for
+ * stdin) with the same star points, integral areas and CL setup,
+ * printing one result line per set to stdout. The base parameters
+ * are those read from the parameters file, and each set is applied
+ * on top of them in the same way as the command line fit parameters.
+ *
+ * Checkpoints are not resumed from in batch mode. */
+int evaluateBatch(const AstronomyParameters* ap,
+                  const BackgroundParameters* bgp,
+                  const Streams* streams,
+                  const IntegralArea* ias,
+                  const char* starPointsFile,
+                  const CLRequest* clr,
+                  const char* batchFile)
+{
+    int rc = 0;
+    int itemRC, readRC;
+    FILE* f;
+    StreamGauss sg;
+    StarPoints sp = EMPTY_STAR_POINTS;
+    SeparationResults* results;
+    CLInfo ci;
+    int clReady = FALSE;
+    AstronomyParameters clAP;
+    real* params;
+    unsigned int nParams = 0;
+    unsigned int lineNum = 0;
+    unsigned int index = 0;
+    const unsigned int maxParams = BATCH_LINE_MAX / 2;
+    double t1, t2;
+
+    memset(&ci, 0, sizeof(ci));
+    memset(&clAP, 0, sizeof(clAP));
+
+    if (!strcmp(batchFile, "-"))
+    {
+        f = stdin;
+    }
+    else
+    {
+        f = mwOpenResolved(batchFile, "r");
+        if (!f)
+        {
+            mwPerror("Opening batch parameters file '%s'", batchFile);
+            return 1;
+        }
+    }
+
+    if (resolveCheckpoint())
+    {
+        if (f != stdin)
+            fclose(f);
+        return 1;
+    }
+
+    rc = readStarPoints(&sp, starPointsFile);
+    if (rc)
+    {
+        if (f != stdin)
+            fclose(f);
+        freeStarPoints(&sp);
+        return rc;
+    }
+
+    sg = getStreamGauss(ap->convolve);
+    results = newSeparationResults(ap->number_streams);
+    params = (real*) mwMalloc(maxParams * sizeof(real));
+
+    while ((readRC = readBatchParameters(f, params, maxParams, &nParams, &lineNum)) > 0)
+    {
+        t1 = mwGetTime();
+        resetSeparationResults(results, ap->number_streams);
+
+        itemRC = evaluateBatchItem(results, ap, bgp, streams, ias, &sp, sg, clr,
+                                   &ci, &clReady, &clAP, params, nParams);
+        if (itemRC)
+        {
+            mw_printf("Failed to evaluate batch parameters %u (line %u)\n", index, lineNum);
+            rc |= itemRC;
+        }
+
+        t2 = mwGetTime();
+        mw_printf("Batch item %u time = %f s\n", index, t2 - t1);
+
+        printBatchResult(stdout, index, results, ap->number_streams);
+        ++index;
+    }
+
+    if (readRC < 0)
+        rc = 1;
+
+    mw_printf("Evaluated %u parameter sets\n", index);
+
+  #if SEPARATION_OPENCL
+    if (clReady)
+    {
+        releaseSeparationKernel();
+        mwDestroyCLInfo(&ci);
+    }
+  #endif
+
+    free(params);
+    freeSeparationResults(results);
+    freeStreamGauss(sg);
+    freeStarPoints(&sp);
+
+    if (f != stdin)
+        fclose(f);
+
+    return rc;
+}
@@ -0,0 +1,394 @@
+/*
+ *  Copyright (c) 2008-2010 Travis Desell, Nathan Cole
+ *  Copyright (c) 2008-2010 Boleslaw Szymanski, Heidi Newberg
+ *  Copyright (c) 2008-2010 Carlos Varela, Malik Magdon-Ismail
+ *  Copyright (c) 2008-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "geometry_cache.h"
+#include "r_points.h"
+#include "milkyway_util.h"
+
+#if HAVE_SYS_MMAN_H
+  #include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_MMAN_H && !defined(_WIN32)
+  #define GEOMETRY_CACHE_USE_MMAP 1
+#else
+  #define GEOMETRY_CACHE_USE_MMAP 0
+#endif
+
+#define GEOMETRY_CACHE_PATH_MAX 4096
+
+typedef struct
+{
+    size_t rc;
+    size_t rPoints;
+    size_t qw_r3_N;
+    size_t lbts;
+    size_t total;
+} GeometryCacheLayout;
+
+static int geometryCacheEnabled = FALSE;
+static char* geometryCacheDir = NULL;
+static GeometryCache* geometryCaches = NULL;
+
+
+void separationSetGeometryCache(int enable, const char* dir)
+{
+    free(geometryCacheDir);
+    geometryCacheDir = dir ? strdup(dir) : NULL;
+    geometryCacheEnabled = enable || dir;
+}
+
+static size_t alignSection(size_t offset)
+{
+    return (offset + 63) & ~(size_t) 63;
+}
+
+static void geometryCacheLayout(GeometryCacheLayout* l, const GeometryCacheHeader* hdr)
+{
+    size_t nRPoints = (size_t) hdr->r_steps * hdr->convolve;
+
+    l->rc = alignSection(sizeof(GeometryCacheHeader));
+    l->rPoints = alignSection(l->rc + hdr->r_steps * sizeof(RConsts));
+    l->qw_r3_N = alignSection(l->rPoints + nRPoints * sizeof(real));
+    l->lbts = alignSection(l->qw_r3_N + nRPoints * sizeof(real));
+    l->total = l->lbts + (size_t) hdr->nu_steps * hdr->mu_steps * sizeof(LBTrig);
+}
+
+static void setGeometryCacheHeader(GeometryCacheHeader* hdr, const AstronomyParameters* ap, const IntegralArea* ia)
+{
+    /* Cleared so that the padding compares and hashes consistently */
+    memset(hdr, 0, sizeof(*hdr));
+
+    memcpy(hdr->magic, GEOMETRY_CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version = GEOMETRY_CACHE_VERSION;
+    hdr->realSize = (uint32_t) sizeof(real);
+    hdr->wedge = (int32_t) ap->wedge;
+    hdr->convolve = (int32_t) ap->convolve;
+    hdr->r_steps = ia->r_steps;
+    hdr->mu_steps = ia->mu_steps;
+    hdr->nu_steps = ia->nu_steps;
+
+    hdr->area[0] = (double) ia->r_min;
+    hdr->area[1] = (double) ia->r_max;
+    hdr->area[2] = (double) ia->r_step_size;
+    hdr->area[3] = (double) ia->nu_min;
+    hdr->area[4] = (double) ia->nu_max;
+    hdr->area[5] = (double) ia->nu_step_size;
+    hdr->area[6] = (double) ia->mu_min;
+    hdr->area[7] = (double) ia->mu_max;
+    hdr->area[8] = (double) ia->mu_step_size;
+
+    hdr->sun_r0 = (double) ap->sun_r0;
+    hdr->coeff = (double) ap->coeff;
+}
+
+/* FNV-1a of the header for the file name */
+static uint64_t hashGeometryCacheHeader(const GeometryCacheHeader* hdr)
+{
+    size_t i;
+    uint64_t h = 14695981039346656037ULL;
+    const unsigned char* p = (const unsigned char*) hdr;
+
+    for (i = 0; i < sizeof(*hdr); ++i)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static int geometryCachePath(char* buf, size_t size, const GeometryCacheHeader* hdr)
+{
+    int n;
+
+    n = snprintf(buf, size, "%s/separation_geometry_%016llx.bin",
+                 geometryCacheDir,
+                 (unsigned long long) hashGeometryCacheHeader(hdr));
+    if (n < 0 || (size_t) n >= size)
+    {
+        mw_printf("Geometry cache path too long\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static void setGeometryCachePointers(GeometryCache* gc, const GeometryCacheLayout* l)
+{
+    char* base = (char*) gc->base;
+
+    gc->hdr = (GeometryCacheHeader*) base;
+    gc->rc = (RConsts*) (base + l->rc);
+    gc->rPoints = (real*) (base + l->rPoints);
+    gc->qw_r3_N = (real*) (base + l->qw_r3_N);
+    gc->lbts = (LBTrig*) (base + l->lbts);
+    gc->size = l->total;
+}
+
+static GeometryCache* newGeometryCache(const GeometryCacheHeader* key,
+                                       const AstronomyParameters* ap,
+                                       const IntegralArea* ia,
+                                       const StreamGauss sg)
+{
+    unsigned int i, idx;
+    int j;
+    GeometryCache* gc;
+    GeometryCacheLayout l;
+    RPoints* rPts;
+    RConsts* rc;
+
+    geometryCacheLayout(&l, key);
+
+    gc = (GeometryCache*) mwCalloc(1, sizeof(GeometryCache));
+    gc->base = mwCallocA(1, l.total);
+    setGeometryCachePointers(gc, &l);
+    *gc->hdr = *key;
+
+    rPts = precalculateRPts(ap, ia, sg, &rc, FALSE);
+    memcpy(gc->rc, rc, ia->r_steps * sizeof(RConsts));
+
+    for (i = 0; i < ia->r_steps; ++i)
+    {
+        for (j = 0; j < ap->convolve; ++j)
+        {
+            idx = i * ap->convolve + j;
+            gc->rPoints[idx] = rPts[idx].r_point;
+            gc->qw_r3_N[idx] = rPts[idx].qw_r3_N;
+        }
+    }
+
+    mwFreeA(rPts);
+    mwFreeA(rc);
+
+    gc->slabReady = (unsigned char*) mwCalloc(ia->nu_steps, sizeof(unsigned char));
+
+    return gc;
+}
+
+/* Returns NULL if the file doesn't exist or is for a different integral */
+static GeometryCache* readGeometryCacheFile(const char* path, const GeometryCacheHeader* key)
+{
+    FILE* f;
+    long fileSize;
+    GeometryCache* gc;
+    GeometryCacheHeader hdr;
+    GeometryCacheLayout l;
+
+    f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    geometryCacheLayout(&l, key);
+
+    if (   fread(&hdr, sizeof(hdr), 1, f) != 1
+        || memcmp(&hdr, key, sizeof(hdr))
+        || fseek(f, 0, SEEK_END)
+        || (fileSize = ftell(f)) < 0
+        || (size_t) fileSize != l.total)
+    {
+        mw_printf("Ignoring geometry cache '%s' which does not match the integral\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    gc = (GeometryCache*) mwCalloc(1, sizeof(GeometryCache));
+
+  #if GEOMETRY_CACHE_USE_MMAP
+    gc->base = mmap(NULL, l.total, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (gc->base == MAP_FAILED)
+    {
+        mwPerror("Failed to map geometry cache '%s'", path);
+        gc->base = NULL;
+    }
+    else
+    {
+        gc->mapped = TRUE;
+    }
+  #endif
+
+    if (!gc->base)
+    {
+        gc->base = mwMallocA(l.total);
+        if (fseek(f, 0, SEEK_SET) || fread(gc->base, l.total, 1, f) != 1)
+        {
+            mwPerror("Failed to read geometry cache '%s'", path);
+            mwFreeA(gc->base);
+            free(gc);
+            fclose(f);
+            return NULL;
+        }
+    }
+
+    fclose(f);
+
+    setGeometryCachePointers(gc, &l);
+    gc->nSlabsReady = gc->hdr->nu_steps;
+    gc->saved = TRUE;
+
+    return gc;
+}
+
+static int writeGeometryCacheFile(const GeometryCache* gc, const char* path)
+{
+    FILE* f;
+    char tmpPath[GEOMETRY_CACHE_PATH_MAX + 8];
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+    f = fopen(tmpPath, "wb");
+    if (!f)
+    {
+        mwPerror("Opening geometry cache '%s'", tmpPath);
+        return 1;
+    }
+
+    if (fwrite(gc->base, gc->size, 1, f) != 1)
+    {
+        mwPerror("Failed to write geometry cache '%s'", tmpPath);
+        fclose(f);
+        mw_remove(tmpPath);
+        return 1;
+    }
+
+    if (fclose(f))
+    {
+        mwPerror("Failed to close geometry cache '%s'", tmpPath);
+        mw_remove(tmpPath);
+        return 1;
+    }
+
+    if (mw_rename(tmpPath, path))
+    {
+        mwPerror("Failed to rename geometry cache '%s' to '%s'", tmpPath, path);
+        mw_remove(tmpPath);
+        return 1;
+    }
+
+    return 0;
+}
+
+GeometryCache* getGeometryCache(const AstronomyParameters* ap, const IntegralArea* ia, const StreamGauss sg)
+{
+    GeometryCache* gc;
+    GeometryCacheHeader key;
+    char path[GEOMETRY_CACHE_PATH_MAX];
+
+    if (!geometryCacheEnabled)
+        return NULL;
+
+    setGeometryCacheHeader(&key, ap, ia);
+
+    for (gc = geometryCaches; gc; gc = gc->next)
+    {
+        if (!memcmp(gc->hdr, &key, sizeof(key)))
+            return gc;
+    }
+
+    if (geometryCacheDir && !geometryCachePath(path, sizeof(path), &key))
+    {
+        gc = readGeometryCacheFile(path, &key);
+        if (gc)
+            mw_printf("Using geometry cache '%s'\n", path);
+    }
+
+    if (!gc)
+        gc = newGeometryCache(&key, ap, ia, sg);
+
+    gc->next = geometryCaches;
+    geometryCaches = gc;
+
+    return gc;
+}
+
+GeometrySlab geometryCacheSlab(GeometryCache* gc, unsigned int nu_step)
+{
+    GeometrySlab slab;
+
+    slab.lbts = &gc->lbts[(size_t) nu_step * gc->hdr->mu_steps];
+    slab.fill = gc->slabReady && !gc->slabReady[nu_step];
+
+    return slab;
+}
+
+void geometryCacheSlabDone(GeometryCache* gc, unsigned int nu_step, int complete)
+{
+    if (complete && gc->slabReady && !gc->slabReady[nu_step])
+    {
+        gc->slabReady[nu_step] = TRUE;
+        ++gc->nSlabsReady;
+    }
+}
+
+int geometryCacheIntegralDone(GeometryCache* gc)
+{
+    char path[GEOMETRY_CACHE_PATH_MAX];
+
+    if (!geometryCacheDir || gc->saved || gc->nSlabsReady != gc->hdr->nu_steps)
+        return 0;
+
+    /* Only try once, whether or not it works */
+    gc->saved = TRUE;
+
+    if (geometryCachePath(path, sizeof(path), gc->hdr) || writeGeometryCacheFile(gc, path))
+    {
+        mw_printf("Failed to save geometry cache\n");
+        return 1;
+    }
+
+    mw_printf("Saved geometry cache '%s'\n", path);
+    return 0;
+}
+
+void freeGeometryCaches(void)
+{
+    GeometryCache* gc;
+    GeometryCache* next;
+
+    for (gc = geometryCaches; gc; gc = next)
+    {
+        next = gc->next;
+
+      #if GEOMETRY_CACHE_USE_MMAP
+        if (gc->mapped)
+        {
+            if (munmap(gc->base, gc->size))
+                mwPerror("Failed to unmap geometry cache");
+        }
+        else
+      #endif
+        {
+            mwFreeA(gc->base);
+        }
+
+        free(gc->slabReady);
+        free(gc);
+    }
+
+    geometryCaches = NULL;
+
+    free(geometryCacheDir);
+    geometryCacheDir = NULL;
+    geometryCacheEnabled = FALSE;
+}
+
@@ -29,9 +29,14 @@
 #include "calculated_constants.h"
 #include "evaluation.h"
 #include "probabilities_dispatch.h"
+#include "geometry_cache.h"
 
 #include <time.h>
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif /* _OPENMP */
+
 /* Marshaling into split r_points and qw_r3_N which helps with vectorization */
 static RConsts* initRPoints(const AstronomyParameters* ap,
                             const IntegralArea* ia,
@@ -60,6 +65,60 @@ static RConsts* initRPoints(const AstronomyParameters* ap,
     return rc;
 }
 
+/* Row function used by the current integral, or NULL to do one r_step
+ * at a time */
+static ProbabilityRowFunc rowFunc = NULL;
+
+/* The row functions pad the last block of r_steps, and the per point
+ * functions the last vector of convolve points, so use whichever
+ * leaves fewer lanes idle */
+static ProbabilityRowFunc selectRowFunc(const AstronomyParameters* ap, const IntegralArea* ia)
+{
+    const unsigned int width = (unsigned int) probabilityRowWidth;
+    unsigned int rowIdle, pointIdle;
+
+    if (!probabilityRowFunc)
+        return NULL;
+
+    rowIdle = (width - ia->r_steps % width) % width * ap->convolve;
+    pointIdle = (width - ap->convolve % width) % width * ia->r_steps;
+
+    return rowIdle <= pointIdle ? probabilityRowFunc : NULL;
+}
+
+/* Copy r points for the row function, with the width r_steps of each
+ * convolve point together. Blocks start at the same place as the
+ * r_steps do in the plain layout. The r_steps past the end of the last
+ * block are filled with pad. */
+static real* interleaveRPoints(const AstronomyParameters* ap,
+                               const IntegralArea* ia,
+                               const real* RESTRICT points,
+                               real pad)
+{
+    unsigned int i, block;
+    int j, k;
+    const int width = probabilityRowWidth;
+    const unsigned int nBlocks = (ia->r_steps + width - 1) / width;
+    real* rows;
+
+    rows = (real*) mwMallocA(sizeof(real) * nBlocks * width * ap->convolve);
+
+    for (block = 0; block < nBlocks; ++block)
+    {
+        for (j = 0; j < ap->convolve; ++j)
+        {
+            for (k = 0; k < width; ++k)
+            {
+                i = block * width + k;
+                rows[(block * ap->convolve + j) * width + k] =
+                    (i < ia->r_steps) ? points[i * ap->convolve + j] : pad;
+            }
+        }
+    }
+
+    return rows;
+}
+
 
 #ifdef MILKYWAY_IPHONE_APP
 double _milkywaySeparationGlobalProgress = 0.0;
@@ -119,16 +178,68 @@ static inline void doBoincCheckpoint(EvaluationState* es,
 #endif /* BOINC_APPLICATION */
 
 HOT
-static inline void sumProbs(EvaluationState* es)
+static inline void sumProbs(Kahan* bgSum,
+                            Kahan* streamSums,
+                            real bgTmp,
+                            const real* streamTmps,
+                            int nStreams)
 {
     int i;
 
-    KAHAN_ADD(es->bgSum, es->bgTmp);
-    for (i = 0; i < es->numberStreams; ++i)
-        KAHAN_ADD(es->streamSums[i], es->streamTmps[i]);
+    KAHAN_ADD(*bgSum, bgTmp);
+    for (i = 0; i < nStreams; ++i)
+        KAHAN_ADD(streamSums[i], streamTmps[i]);
 }
 
 
+/* With a row function the r points are interleaved, and a block of
+ * r_steps is done at once. Each sum still adds its r_steps in order. */
+HOT
+static inline void r_sum_rows(const AstronomyParameters* ap,
+                              const StreamConstants* sc,
+                              const real* RESTRICT rPoints,
+                              const real* RESTRICT qw_r3_N,
+                              LBTrig lbt,
+                              real id,
+                              const RConsts* rc,
+                              unsigned int r_steps,
+                              Kahan* bgSum,
+                              Kahan* streamSums)
+{
+    unsigned int r_step, i, n;
+    int j;
+    const unsigned int width = (unsigned int) probabilityRowWidth;
+    real reff_xr_rp3[PROBABILITY_ROW_MAX_WIDTH];
+    real sums[PROBABILITY_ROW_MAX_WIDTH];
+
+    for (r_step = 0; r_step < r_steps; r_step += width)
+    {
+        const real* RESTRICT blockR = &rPoints[r_step * ap->convolve];
+        const real* RESTRICT blockQW = &qw_r3_N[r_step * ap->convolve];
+
+        n = MIN(width, r_steps - r_step);
+        for (i = 0; i < n; ++i)
+        {
+            reff_xr_rp3[i] = id * rc[r_step + i].irv_reff_xr_rp3;
+        }
+
+        rowFunc(ap, NULL, blockR, blockQW, lbt, sums);
+        for (i = 0; i < n; ++i)
+        {
+            KAHAN_ADD(*bgSum, sums[i] * reff_xr_rp3[i]);
+        }
+
+        for (j = 0; j < ap->number_streams; ++j)
+        {
+            rowFunc(ap, &sc[j], blockR, blockQW, lbt, sums);
+            for (i = 0; i < n; ++i)
+            {
+                KAHAN_ADD(streamSums[j], sums[i] * reff_xr_rp3[i]);
+            }
+        }
+    }
+}
+
 HOT
 static inline void r_sum(const AstronomyParameters* ap,
                          const StreamConstants* sc,
@@ -137,26 +248,35 @@ static inline void r_sum(const AstronomyParameters* ap,
                          const real* RESTRICT qw_r3_N,
                          LBTrig lbt,
                          real id,
-                         EvaluationState* es,
                          const RConsts* rc,
-                         unsigned int r_steps)
+                         unsigned int r_steps,
+                         Kahan* bgSum,
+                         Kahan* streamSums,
+                         real* RESTRICT streamTmps)
 {
     unsigned int r_step;
     real reff_xr_rp3;
+    real bgTmp;
+
+    if (rowFunc)
+    {
+        r_sum_rows(ap, sc, rPoints, qw_r3_N, lbt, id, rc, r_steps, bgSum, streamSums);
+        return;
+    }
 
     for (r_step = 0; r_step < r_steps; ++r_step)
     {
         reff_xr_rp3 = id * rc[r_step].irv_reff_xr_rp3;
-        es->bgTmp = probabilityFunc(ap,
-                                    sc,
-                                    sg_dx,
-                                    &rPoints[r_step * ap->convolve],
-                                    &qw_r3_N[r_step * ap->convolve],
-                                    lbt,
-                                    rc[r_step].gPrime,
-                                    reff_xr_rp3,
-                                    es->streamTmps);
-        sumProbs(es);
+        bgTmp = probabilityFunc(ap,
+                                sc,
+                                sg_dx,
+                                &rPoints[r_step * ap->convolve],
+                                &qw_r3_N[r_step * ap->convolve],
+                                lbt,
+                                rc[r_step].gPrime,
+                                reff_xr_rp3,
+                                streamTmps);
+        sumProbs(bgSum, streamSums, bgTmp, streamTmps, ap->number_streams);
     }
 }
 
@@ -175,6 +295,160 @@ inline LBTrig lb_trig(LB lb)
     return lbt;
 }
 
+static inline real muPoint(const IntegralArea* ia, unsigned int mu_step)
+{
+    return ia->mu_min + (((real) mu_step + 0.5) * ia->mu_step_size);
+}
+
+/* Trig of the integral point, from the geometry cache if it has it */
+static inline LBTrig pointTrig(const AstronomyParameters* ap,
+                               const IntegralArea* ia,
+                               GeometrySlab slab,
+                               real nu,
+                               unsigned int mu_step)
+{
+    LB lb;
+    LBTrig lbt;
+
+    if (slab.lbts && !slab.fill)
+        return slab.lbts[mu_step];
+
+    lb = gc2lb(ap->wedge, muPoint(ia, mu_step), nu); /* integral point */
+    lbt = lb_trig(lb);
+
+    if (slab.fill)
+        slab.lbts[mu_step] = lbt;
+
+    return lbt;
+}
+
+#if SEPARATION_OPENMP
+
+/* Per mu row sums for one nu step. Each row is summed independently
+ * with its own Kahan accumulators by whichever thread gets it, and
+ * then the rows are reduced in mu order. The result therefore does
+ * not depend on the number of threads or on the scheduling. */
+typedef struct
+{
+    Kahan* bgSums;        /* [mu_steps] */
+    Kahan* streamSums;    /* [mu_steps * number_streams] */
+    real* streamTmps;     /* [nThreads * number_streams] */
+    int nThreads;
+} MuRowSums;
+
+static void newMuRowSums(MuRowSums* rs, const AstronomyParameters* ap, const IntegralArea* ia)
+{
+    rs->nThreads = omp_get_max_threads();
+    rs->bgSums = (Kahan*) mwCallocA(ia->mu_steps, sizeof(Kahan));
+    rs->streamSums = (Kahan*) mwCallocA(ia->mu_steps * ap->number_streams, sizeof(Kahan));
+    rs->streamTmps = (real*) mwCallocA(rs->nThreads * ap->number_streams, sizeof(real));
+}
+
+static void freeMuRowSums(MuRowSums* rs)
+{
+    mwFreeA(rs->bgSums);
+    mwFreeA(rs->streamSums);
+    mwFreeA(rs->streamTmps);
+}
+
+static void reduceMuRowSums(EvaluationState* es, const MuRowSums* rs, unsigned int muStart, unsigned int mu_steps)
+{
+    unsigned int i;
+    int j;
+    const Kahan* rowStreamSums;
+
+    for (i = muStart; i < mu_steps; ++i)
+    {
+        KAHAN_REDUCTION(es->bgSum, rs->bgSums[i]);
+
+        rowStreamSums = &rs->streamSums[i * es->numberStreams];
+        for (j = 0; j < es->numberStreams; ++j)
+        {
+            KAHAN_REDUCTION(es->streamSums[j], rowStreamSums[j]);
+        }
+    }
+}
+
+HOT
+static void mu_sum(const AstronomyParameters* ap,
+                   const IntegralArea* ia,
+                   const StreamConstants* sc,
+                   const RConsts* rc,
+                   const real* RESTRICT sg_dx,
+                   const real* RESTRICT rPoints,
+                   const real* RESTRICT qw_r3_N,
+                   const NuId nuid,
+                   GeometrySlab slab,
+                   MuRowSums* rs,
+                   EvaluationState* es)
+{
+    int mu_step;
+    const int muStart = (int) es->mu_step;
+    const int mu_steps = (int) ia->mu_steps;
+    const int nStreams = ap->number_streams;
+
+    /* Checkpoints are only taken on row boundaries, so resuming is
+     * independent of how the previous row was split up */
+    doBoincCheckpoint(es, ia, ap->total_calc_probs);
+
+    memset(rs->bgSums, 0, ia->mu_steps * sizeof(Kahan));
+    memset(rs->streamSums, 0, ia->mu_steps * nStreams * sizeof(Kahan));
+
+  #pragma omp parallel for private(mu_step) schedule(dynamic, 1)
+    for (mu_step = muStart; mu_step < mu_steps; ++mu_step)
+    {
+        LBTrig lbt;
+        real* streamTmps = &rs->streamTmps[omp_get_thread_num() * nStreams];
+
+        lbt = pointTrig(ap, ia, slab, nuid.nu, (unsigned int) mu_step);
+
+        r_sum(ap, sc, sg_dx, rPoints, qw_r3_N, lbt, nuid.id, rc, ia->r_steps,
+              &rs->bgSums[mu_step], &rs->streamSums[mu_step * nStreams], streamTmps);
+    }
+
+    reduceMuRowSums(es, rs, muStart, ia->mu_steps);
+    es->mu_step = 0;
+}
+
+static void nuSum(const AstronomyParameters* ap,
+                  const IntegralArea* ia,
+                  const StreamConstants* sc,
+                  const RConsts* rc,
+                  const real* RESTRICT sg_dx,
+                  const real* RESTRICT rPoints,
+                  const real* RESTRICT qw_r3_N,
+                  GeometryCache* gc,
+                  EvaluationState* es)
+{
+    NuId nuid;
+    GeometrySlab slab = EMPTY_GEOMETRY_SLAB;
+    int complete;
+    MuRowSums rs;
+
+    newMuRowSums(&rs, ap, ia);
+
+    for ( ; es->nu_step < ia->nu_steps; es->nu_step++)
+    {
+        nuid = calcNuStep(ia, es->nu_step);
+
+        /* Rows before a resumed mu step are never visited */
+        complete = (es->mu_step == 0);
+        if (gc)
+            slab = geometryCacheSlab(gc, es->nu_step);
+
+        mu_sum(ap, ia, sc, rc, sg_dx, rPoints, qw_r3_N, nuid, slab, &rs, es);
+
+        if (gc)
+            geometryCacheSlabDone(gc, es->nu_step, complete);
+    }
+
+    es->nu_step = 0;
+
+    freeMuRowSums(&rs);
+}
+
+#else /* !SEPARATION_OPENMP */
+
 HOT
 static inline void mu_sum(const AstronomyParameters* ap,
                           const IntegralArea* ia,
@@ -184,25 +458,19 @@ static inline void mu_sum(const AstronomyParameters* ap,
                           const real* RESTRICT rPoints,
                           const real* RESTRICT qw_r3_N,
                           const NuId nuid,
+                          GeometrySlab slab,
                           EvaluationState* es)
 {
-    real mu;
-    LB lb;
     LBTrig lbt;
 
-    const real mu_step_size = ia->mu_step_size;
-    const real mu_min = ia->mu_min;
-
     for (; es->mu_step < ia->mu_steps; es->mu_step++)
     {
         doBoincCheckpoint(es, ia, ap->total_calc_probs);
 
-        mu = mu_min + (((real) es->mu_step + 0.5) * mu_step_size);
+        lbt = pointTrig(ap, ia, slab, nuid.nu, es->mu_step);
 
-        lb = gc2lb(ap->wedge, mu, nuid.nu); /* integral point */
-        lbt = lb_trig(lb);
-
-        r_sum(ap, sc, sg_dx, rPoints, qw_r3_N, lbt, nuid.id, es, rc, ia->r_steps);
+        r_sum(ap, sc, sg_dx, rPoints, qw_r3_N, lbt, nuid.id, rc, ia->r_steps,
+              &es->bgSum, es->streamSums, es->streamTmps);
     }
 
     es->mu_step = 0;
@@ -215,20 +483,380 @@ static void nuSum(const AstronomyParameters* ap,
                   const real* RESTRICT sg_dx,
                   const real* RESTRICT rPoints,
                   const real* RESTRICT qw_r3_N,
+                  GeometryCache* gc,
                   EvaluationState* es)
 {
     NuId nuid;
+    GeometrySlab slab = EMPTY_GEOMETRY_SLAB;
+    int complete;
 
     for ( ; es->nu_step < ia->nu_steps; es->nu_step++)
     {
         nuid = calcNuStep(ia, es->nu_step);
 
-        mu_sum(ap, ia, sc, rc, sg_dx, rPoints, qw_r3_N, nuid, es);
+        /* Rows before a resumed mu step are never visited */
+        complete = (es->mu_step == 0);
+        if (gc)
+            slab = geometryCacheSlab(gc, es->nu_step);
+
+        mu_sum(ap, ia, sc, rc, sg_dx, rPoints, qw_r3_N, nuid, slab, es);
+
+        if (gc)
+            geometryCacheSlabDone(gc, es->nu_step, complete);
     }
 
     es->nu_step = 0;
 }
 
+#endif /* SEPARATION_OPENMP */
+
+/* Adaptive integration.
+ *
+ * The nu x mu grid is split into tiles of ADAPTIVE_TILE x ADAPTIVE_TILE
+ * cells. A block of cells is estimated by the midpoint rule, with one
+ * r column at its center weighted by the volume of the whole block,
+ * and again with the 2 x 2 blocks it splits into. If the two agree to
+ * within the block's share of the tolerance the finer estimate is
+ * used, otherwise each of the smaller blocks is tried the same way. A
+ * single cell is the same column as on the full grid, so the most it
+ * can do is the full grid, but smooth regions take a few columns for
+ * a tile instead of one for each cell.
+ *
+ * Checkpoints are taken between rows of tiles. Each tile is summed
+ * separately and the tiles are added in order, so the result doesn't
+ * depend on the number of threads.
+ */
+#define ADAPTIVE_TILE 16
+#define ADAPTIVE_MAX_DEPTH 4   /* log2(ADAPTIVE_TILE) */
+
+typedef struct
+{
+    unsigned int nu0, mu0;
+    unsigned int nNu, nMu;
+} CellBlock;
+
+typedef struct
+{
+    const AstronomyParameters* ap;
+    const IntegralArea* ia;
+    const StreamConstants* sc;
+    const RConsts* rc;
+    const real* sg_dx;
+    const real* rPoints;
+    const real* qw_r3_N;
+    int nTerms;             /* The background and then each stream */
+    real* cellTolerance;    /* [nTerms] Allowed error per cell */
+} AdaptiveIntegral;
+
+/* Per thread */
+typedef struct
+{
+    Kahan* columnSums;      /* [nTerms] */
+    real* streamTmps;       /* [number_streams] */
+    real* est;              /* [(ADAPTIVE_MAX_DEPTH + 1) * 4 * nTerms] */
+    real* err;              /* [nTerms] Estimated error of what was added */
+    uint64_t nColumns;
+} AdaptiveScratch;
+
+static inline int adaptiveThread(void)
+{
+  #if SEPARATION_OPENMP
+    return omp_get_thread_num();
+  #else
+    return 0;
+  #endif
+}
+
+/* Matches the nu and mu steps for a single cell */
+static void blockEstimate(const AdaptiveIntegral* ai, AdaptiveScratch* s, CellBlock b, real* est)
+{
+    int i;
+    real nuLow, nu, mu, id;
+    LB lb;
+    const IntegralArea* ia = ai->ia;
+
+    nuLow = ia->nu_min + (b.nu0 * ia->nu_step_size);
+    nu = nuLow + 0.5 * (b.nNu * ia->nu_step_size);
+    mu = ia->mu_min + (((real) b.mu0 + 0.5 * b.nMu) * ia->mu_step_size);
+
+    id = mw_cos(d2r(90.0 - nuLow - b.nNu * ia->nu_step_size)) - mw_cos(d2r(90.0 - nuLow));
+    id *= b.nMu;
+
+    lb = gc2lb(ai->ap->wedge, mu, nu);
+
+    memset(s->columnSums, 0, ai->nTerms * sizeof(Kahan));
+    r_sum(ai->ap, ai->sc, ai->sg_dx, ai->rPoints, ai->qw_r3_N, lb_trig(lb), id, ai->rc, ia->r_steps,
+          &s->columnSums[0], &s->columnSums[1], s->streamTmps);
+
+    for (i = 0; i < ai->nTerms; ++i)
+        est[i] = s->columnSums[i].sum;
+
+    s->nColumns++;
+}
+
+static int splitBlock(CellBlock b, CellBlock* sub)
+{
+    unsigned int i, j;
+    int n = 0;
+    const unsigned int nuParts = (b.nNu > 1) ? 2 : 1;
+    const unsigned int muParts = (b.nMu > 1) ? 2 : 1;
+
+    for (i = 0; i < nuParts; ++i)
+    {
+        for (j = 0; j < muParts; ++j)
+        {
+            sub[n].nu0 = b.nu0 + i * (b.nNu / 2);
+            sub[n].nNu = (nuParts == 1) ? b.nNu : (i == 0 ? b.nNu / 2 : b.nNu - b.nNu / 2);
+            sub[n].mu0 = b.mu0 + j * (b.nMu / 2);
+            sub[n].nMu = (muParts == 1) ? b.nMu : (j == 0 ? b.nMu / 2 : b.nMu - b.nMu / 2);
+            ++n;
+        }
+    }
+
+    return n;
+}
+
+/* Add the integral over the block, for which est is the single column estimate */
+static void refineBlock(const AdaptiveIntegral* ai,
+                        AdaptiveScratch* s,
+                        CellBlock b,
+                        const real* est,
+                        int depth,
+                        Kahan* sums)
+{
+    int i, k, n;
+    int accept = TRUE;
+    real fine, diff, allowed;
+    CellBlock sub[4];
+    const int nTerms = ai->nTerms;
+    real* subEst = &s->est[depth * 4 * nTerms];
+
+    if (b.nNu == 1 && b.nMu == 1)
+    {
+        for (k = 0; k < nTerms; ++k)
+            KAHAN_ADD(sums[k], est[k]);
+        return;
+    }
+
+    n = splitBlock(b, sub);
+    for (i = 0; i < n; ++i)
+        blockEstimate(ai, s, sub[i], &subEst[i * nTerms]);
+
+    for (k = 0; k < nTerms && accept; ++k)
+    {
+        fine = 0.0;
+        for (i = 0; i < n; ++i)
+            fine += subEst[i * nTerms + k];
+
+        allowed = ai->cellTolerance[k] * ((real) b.nNu * b.nMu);
+        accept = (mw_fabs(fine - est[k]) <= allowed);
+    }
+
+    if (!accept)
+    {
+        for (i = 0; i < n; ++i)
+            refineBlock(ai, s, sub[i], &subEst[i * nTerms], depth + 1, sums);
+        return;
+    }
+
+    /* The midpoint rule's error falls by about 4 each time the blocks
+     * are halved, so the finer estimate is off by about a third of the
+     * difference. */
+    for (k = 0; k < nTerms; ++k)
+    {
+        fine = 0.0;
+        for (i = 0; i < n; ++i)
+        {
+            fine += subEst[i * nTerms + k];
+            KAHAN_ADD(sums[k], subEst[i * nTerms + k]);
+        }
+
+        diff = mw_fabs(fine - est[k]);
+        s->err[k] += diff / 3.0;
+    }
+}
+
+static CellBlock tileBlock(const IntegralArea* ia, unsigned int nu0, unsigned int nuEnd, unsigned int tileMu)
+{
+    CellBlock b;
+
+    b.nu0 = nu0;
+    b.nNu = nuEnd - nu0;
+    b.mu0 = tileMu * ADAPTIVE_TILE;
+    b.nMu = MIN(ADAPTIVE_TILE, ia->mu_steps - b.mu0);
+
+    return b;
+}
+
+static void printAdaptiveStats(const AstronomyParameters* ap,
+                               const IntegralArea* ia,
+                               const AdaptiveScratch* scratch,
+                               int nThreads,
+                               const real* total)
+{
+    int i, k;
+    uint64_t nColumns = 0;
+    real err;
+
+    for (i = 0; i < nThreads; ++i)
+        nColumns += scratch[i].nColumns;
+
+    mw_printf("Adaptive integral: %llu columns of %llu\n",
+              (unsigned long long) nColumns,
+              (unsigned long long) ia->nu_steps * ia->mu_steps);
+
+    for (k = 0; k < ap->number_streams + 1; ++k)
+    {
+        err = 0.0;
+        for (i = 0; i < nThreads; ++i)
+            err += scratch[i].err[k];
+
+        if (k == 0)
+            mw_printf("  background estimated relative error: %g\n", err / mw_fabs(total[k]));
+        else
+            mw_printf("  stream %d estimated relative error: %g\n", k - 1, err / mw_fabs(total[k]));
+    }
+}
+
+static int integrateAdaptive(const AstronomyParameters* ap,
+                             const IntegralArea* ia,
+                             const StreamConstants* sc,
+                             const RConsts* rc,
+                             const real* RESTRICT sg_dx,
+                             const real* RESTRICT rPoints,
+                             const real* RESTRICT qw_r3_N,
+                             real tolerance,
+                             EvaluationState* es)
+{
+    int i, k, t;
+    int nThreads = 1;
+    int nTiles;
+    unsigned int nuEnd, tileNu;
+    const unsigned int nTileNu = (ia->nu_steps + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE;
+    const int nTileMu = (int) ((ia->mu_steps + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE);
+    const int nTerms = ap->number_streams + 1;
+    real* tileEst;
+    real* total;
+    Kahan* tileSums;
+    AdaptiveIntegral ai;
+    AdaptiveScratch* scratch;
+
+    if (es->mu_step != 0)
+    {
+        mw_printf("Adaptive integration can't resume from the middle of a nu step\n");
+        return 1;
+    }
+
+  #if SEPARATION_OPENMP
+    nThreads = omp_get_max_threads();
+  #endif
+
+    ai.ap = ap;
+    ai.ia = ia;
+    ai.sc = sc;
+    ai.rc = rc;
+    ai.sg_dx = sg_dx;
+    ai.rPoints = rPoints;
+    ai.qw_r3_N = qw_r3_N;
+    ai.nTerms = nTerms;
+    ai.cellTolerance = (real*) mwCallocA(nTerms, sizeof(real));
+
+    scratch = (AdaptiveScratch*) mwCallocA(nThreads, sizeof(AdaptiveScratch));
+    for (i = 0; i < nThreads; ++i)
+    {
+        scratch[i].columnSums = (Kahan*) mwCallocA(nTerms, sizeof(Kahan));
+        scratch[i].streamTmps = (real*) mwCallocA(nTerms, sizeof(real));
+        scratch[i].est = (real*) mwCallocA((ADAPTIVE_MAX_DEPTH + 1) * 4 * nTerms, sizeof(real));
+        scratch[i].err = (real*) mwCallocA(nTerms, sizeof(real));
+    }
+
+    nTiles = (int) nTileNu * nTileMu;
+    tileEst = (real*) mwMallocA(nTiles * nTerms * sizeof(real));
+    tileSums = (Kahan*) mwMallocA(nTileMu * nTerms * sizeof(Kahan));
+    total = (real*) mwCallocA(nTerms, sizeof(real));
+
+    /* One column for each whole tile, which gives the integrals the
+     * tolerance is relative to */
+  #if SEPARATION_OPENMP
+  #pragma omp parallel for private(t) schedule(dynamic, 16)
+  #endif
+    for (t = 0; t < nTiles; ++t)
+    {
+        unsigned int nu0 = (t / nTileMu) * ADAPTIVE_TILE;
+        CellBlock b = tileBlock(ia, nu0, MIN(nu0 + ADAPTIVE_TILE, ia->nu_steps), t % nTileMu);
+        blockEstimate(&ai, &scratch[adaptiveThread()], b, &tileEst[t * nTerms]);
+    }
+
+    for (t = 0; t < nTiles; ++t)
+    {
+        for (k = 0; k < nTerms; ++k)
+            total[k] += tileEst[t * nTerms + k];
+    }
+
+    for (k = 0; k < nTerms; ++k)
+    {
+        /* Insignificant streams are zeroed afterwards anyway */
+        if (k > 0 && !sc[k - 1].large_sigma)
+            ai.cellTolerance[k] = REAL_MAX;
+        else
+            ai.cellTolerance[k] = tolerance * mw_fabs(total[k]) / ((real) ia->nu_steps * ia->mu_steps);
+    }
+
+    for ( ; es->nu_step < ia->nu_steps; es->nu_step = nuEnd)
+    {
+        doBoincCheckpoint(es, ia, ap->total_calc_probs);
+
+        tileNu = es->nu_step / ADAPTIVE_TILE;
+        nuEnd = MIN((tileNu + 1) * ADAPTIVE_TILE, ia->nu_steps);
+        memset(tileSums, 0, nTileMu * nTerms * sizeof(Kahan));
+
+      #if SEPARATION_OPENMP
+      #pragma omp parallel for private(t) schedule(dynamic, 1)
+      #endif
+        for (t = 0; t < nTileMu; ++t)
+        {
+            AdaptiveScratch* s = &scratch[adaptiveThread()];
+            CellBlock b = tileBlock(ia, es->nu_step, nuEnd, t);
+            real* est = &tileEst[(tileNu * nTileMu + t) * nTerms];
+
+            /* A checkpoint not taken on a tile boundary leaves part of a tile */
+            if (es->nu_step % ADAPTIVE_TILE != 0)
+            {
+                est = &s->est[ADAPTIVE_MAX_DEPTH * 4 * nTerms];
+                blockEstimate(&ai, s, b, est);
+            }
+
+            refineBlock(&ai, s, b, est, 0, &tileSums[t * nTerms]);
+        }
+
+        for (t = 0; t < nTileMu; ++t)
+        {
+            KAHAN_REDUCTION(es->bgSum, tileSums[t * nTerms]);
+            for (k = 1; k < nTerms; ++k)
+                KAHAN_REDUCTION(es->streamSums[k - 1], tileSums[t * nTerms + k]);
+        }
+    }
+
+    es->nu_step = 0;
+
+    printAdaptiveStats(ap, ia, scratch, nThreads, total);
+
+    for (i = 0; i < nThreads; ++i)
+    {
+        mwFreeA(scratch[i].columnSums);
+        mwFreeA(scratch[i].streamTmps);
+        mwFreeA(scratch[i].est);
+        mwFreeA(scratch[i].err);
+    }
+    mwFreeA(scratch);
+    mwFreeA(tileEst);
+    mwFreeA(tileSums);
+    mwFreeA(total);
+    mwFreeA(ai.cellTolerance);
+
+    return 0;
+}
+
 void separationIntegralGetSums(EvaluationState* es)
 {
     int i;
@@ -252,8 +880,12 @@ int integrate(const AstronomyParameters* ap,
     RConsts* rc;
     real* RESTRICT rPoints;
     real* RESTRICT qw_r3_N;
+    real* rRows = NULL;
+    real* qwRows = NULL;
+    GeometryCache* gc;
+    int rv = 0;
 
-    (void) clr, (void) _ci;
+    (void) _ci;
 
     if (ap->q == 0.0)
     {
@@ -264,21 +896,64 @@ int integrate(const AstronomyParameters* ap,
         return 1;
     }
 
-    rPoints = mwMallocA(sizeof(real) * ia->r_steps * ap->convolve);
-    qw_r3_N = mwMallocA(sizeof(real) * ia->r_steps * ap->convolve);
-    rc = initRPoints(ap, ia, sg, rPoints, qw_r3_N);
+    gc = getGeometryCache(ap, ia, sg);
+    if (gc)
+    {
+        rc = gc->rc;
+        rPoints = gc->rPoints;
+        qw_r3_N = gc->qw_r3_N;
+    }
+    else
+    {
+        rPoints = mwMallocA(sizeof(real) * ia->r_steps * ap->convolve);
+        qw_r3_N = mwMallocA(sizeof(real) * ia->r_steps * ap->convolve);
+        rc = initRPoints(ap, ia, sg, rPoints, qw_r3_N);
+    }
+
+    rowFunc = selectRowFunc(ap, ia);
+    if (rowFunc)
+    {
+        /* The padding r_steps have no weight, and r = 1 keeps them finite */
+        rRows = interleaveRPoints(ap, ia, rPoints, 1.0);
+        qwRows = interleaveRPoints(ap, ia, qw_r3_N, 0.0);
+    }
+
+    if (clr->integralTolerance > 0.0)
+    {
+        rv = integrateAdaptive(ap, ia, sc, rc, sg.dx,
+                               rRows ? rRows : rPoints,
+                               qwRows ? qwRows : qw_r3_N,
+                               clr->integralTolerance, es);
+    }
+    else
+    {
+        nuSum(ap, ia, sc, rc, sg.dx,
+              rRows ? rRows : rPoints,
+              qwRows ? qwRows : qw_r3_N,
+              gc, es);
+    }
+
+    mwFreeA(rRows);
+    mwFreeA(qwRows);
+    rowFunc = NULL;
 
-    nuSum(ap, ia, sc, rc, sg.dx, rPoints, qw_r3_N, es);
     separationIntegralGetSums(es);
 
-    mwFreeA(rc);
-    mwFreeA(rPoints);
-    mwFreeA(qw_r3_N);
+    if (gc)
+    {
+        geometryCacheIntegralDone(gc);
+    }
+    else
+    {
+        mwFreeA(rc);
+        mwFreeA(rPoints);
+        mwFreeA(qw_r3_N);
+    }
 
   #ifdef MILKYWAY_IPHONE_APP
     _milkywaySeparationGlobalProgress = 1.0;
   #endif
 
-    return 0;
+    return rv;
 }
 
@@ -34,6 +34,10 @@
 #include "separation_utils.h"
 #include "evaluation_state.h"
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif /* _OPENMP */
+
 /* CHECKME: What is this? */
 static real probability_log(real bg, real sum_exp_weights)
 {
@@ -152,40 +156,43 @@ static real likelihood_probability(const AstronomyParameters* ap,
                                    real gPrime,
                                    real reff_xr_rp3,
                                    const SeparationResults* results,
-                                   EvaluationState* es,
+
+                                   Kahan* bgSum,
+                                   Kahan* streamSums,
+                                   real* RESTRICT streamTmps,
 
                                    real* RESTRICT bgProb) /* Out argument for thing needed by separation */
 {
     int i;
-    real starProb, streamOnly;
+    real bgTmp, starProb, streamOnly;
 
     /* if q is 0, there is no probability */
     if (ap->q == 0.0)
     {
-        es->bgTmp = -1.0;
+        bgTmp = -1.0;
     }
     else
     {
-        es->bgTmp = probabilityFunc(ap, sc, sg_dx, r_points, qw_r3_N, lbt, gPrime, reff_xr_rp3, es->streamTmps);
+        bgTmp = probabilityFunc(ap, sc, sg_dx, r_points, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamTmps);
     }
 
     if (bgProb)
-        *bgProb = es->bgTmp;
+        *bgProb = bgTmp;
 
-    es->bgTmp = (es->bgTmp / results->backgroundIntegral) * ap->exp_background_weight;
+    bgTmp = (bgTmp / results->backgroundIntegral) * ap->exp_background_weight;
 
-    starProb = es->bgTmp; /* bg only */
+    starProb = bgTmp; /* bg only */
     for (i = 0; i < ap->number_streams; ++i)
     {
-        streamOnly = es->streamTmps[i] / results->streamIntegrals[i] * streams->parameters[i].epsilonExp;
+        streamOnly = streamTmps[i] / results->streamIntegrals[i] * streams->parameters[i].epsilonExp;
         starProb += streamOnly;
         streamOnly = probability_log(streamOnly, streams->sumExpWeights);
-        KAHAN_ADD(es->streamSums[i], streamOnly);
+        KAHAN_ADD(streamSums[i], streamOnly);
     }
     starProb /= streams->sumExpWeights;
 
-    es->bgTmp = probability_log(es->bgTmp, streams->sumExpWeights);
-    KAHAN_ADD(es->bgSum, es->bgTmp);
+    bgTmp = probability_log(bgTmp, streams->sumExpWeights);
+    KAHAN_ADD(*bgSum, bgTmp);
 
     return starProb;
 }
@@ -266,6 +273,85 @@ static void printSeparationStats(const StreamStats* ss,
         printf("%d stars separated into stream\n", ss[i].q);
 }
 
+/* Stars are summed in fixed size blocks, each with its own set of
+ * Kahan sums. The blocks may be evaluated by any thread in any order,
+ * but they are always reduced in star order, so the result only
+ * depends on the block size. */
+#define LIKELIHOOD_BLOCK_SIZE 1024
+
+typedef struct
+{
+    Kahan prob;
+    Kahan bgOnly;
+    Kahan* streamOnly;    /* [number_streams] */
+} LikelihoodBlockSums;
+
+/* Per thread scratch space */
+typedef struct
+{
+    real* r_points;
+    real* qw_r3_N;
+    real* streamTmps;
+} LikelihoodScratch;
+
+static void likelihood_block(const AstronomyParameters* ap,
+                             const StarPoints* sp,
+                             const StreamConstants* sc,
+                             const Streams* streams,
+                             const StreamGauss sg,
+                             const SeparationResults* results,
+                             LikelihoodScratch* scratch,
+                             LikelihoodBlockSums* sums,
+                             real* RESTRICT starBgProbs,      /* Per star outputs kept for separation. May be NULL */
+                             real* RESTRICT starStreamProbs,
+                             unsigned int first,
+                             unsigned int last)
+{
+    unsigned int i;
+    int j;
+    mwvector point;
+    real star_prob;
+    real bgProb;
+    real gPrime;
+    real reff_xr_rp3;
+    LB lb;
+    LBTrig lbt;
+
+    for (i = first; i < last; ++i)
+    {
+        point = sp->stars[i];
+        gPrime = calcG(Z(point));
+        setSplitRPoints(ap, sg, ap->convolve, gPrime, scratch->r_points, scratch->qw_r3_N);
+        reff_xr_rp3 = calcReffXrRp3(Z(point), gPrime);
+
+        LB_L(lb) = L(point);
+        LB_B(lb) = B(point);
+
+        lbt = lb_trig(lb);
+
+        star_prob = likelihood_probability(ap, sc, streams, sg.dx, scratch->r_points, scratch->qw_r3_N,
+                                           lbt, gPrime, reff_xr_rp3, results,
+                                           &sums->bgOnly, sums->streamOnly, scratch->streamTmps, &bgProb);
+
+        if (mw_cmpnzero_muleps(star_prob, SEPARATION_EPS))
+        {
+            star_prob = mw_log10(star_prob);
+            KAHAN_ADD(sums->prob, star_prob);
+        }
+        else
+        {
+            sums->prob.sum -= 238.0;
+        }
+
+        if (starBgProbs)
+        {
+            starBgProbs[i] = bgProb;
+            for (j = 0; j < ap->number_streams; ++j)
+                starStreamProbs[i * ap->number_streams + j] = scratch->streamTmps[j];
+        }
+    }
+}
+
 static int likelihood_sum(SeparationResults* results,
                           const AstronomyParameters* ap,
                           const StarPoints* sp,
@@ -273,75 +359,113 @@ static int likelihood_sum(SeparationResults* results,
                           const Streams* streams,
                           const StreamGauss sg,
 
-                          EvaluationState* es,
-
-                          real* RESTRICT r_points,
-                          real* RESTRICT qw_r3_N,
-
-
                           const int do_separation,
                           StreamStats* ss,
                           FILE* f)
 {
     Kahan prob = ZERO_KAHAN;
+    Kahan bgOnly = ZERO_KAHAN;
+    Kahan* streamOnly;
 
-    unsigned int current_star_point;
-    mwvector point;
-    real star_prob;
-    LB lb;
-    LBTrig lbt;
-    real reff_xr_rp3;
-    RConsts rc = { 0.0, 0.0 };
+    int i, j;
+    int nBlocks;
+    const int nStreams = ap->number_streams;
+    LikelihoodBlockSums* blockSums;
+    Kahan* blockStreamSums;
+    real* starBgProbs = NULL;
+    real* starStreamProbs = NULL;
 
-    real bgProb = 0.0;
+    unsigned int current_star_point;
     real epsilon_b = 0.0;
     mwmatrix cmatrix;
-    unsigned int num_zero = 0;
     unsigned int badJacobians = 0;  /* CHECKME: Seems like this never changes */
 
     if (do_separation)
     {
         setSeparationConstants(ap, results, cmatrix);
         epsilon_b = get_stream_bg_weight_consts(ss, streams);
+
+        /* The separation itself draws random numbers so it has to be
+         * done serially in star order after the probabilities are found */
+        starBgProbs = (real*) mwMallocA(sp->number_stars * sizeof(real));
+        starStreamProbs = (real*) mwMallocA(sp->number_stars * nStreams * sizeof(real));
     }
 
-    for (current_star_point = 0; current_star_point < sp->number_stars; ++current_star_point)
-    {
-        point = sp->stars[current_star_point];
-        rc.gPrime = calcG(Z(point));
-        setSplitRPoints(ap, sg, ap->convolve, rc.gPrime, r_points, qw_r3_N);
-        reff_xr_rp3 = calcReffXrRp3(Z(point), rc.gPrime);
+    nBlocks = (int) ((sp->number_stars + LIKELIHOOD_BLOCK_SIZE - 1) / LIKELIHOOD_BLOCK_SIZE);
+    blockSums = (LikelihoodBlockSums*) mwCallocA(nBlocks, sizeof(LikelihoodBlockSums));
+    blockStreamSums = (Kahan*) mwCallocA(nBlocks * nStreams, sizeof(Kahan));
+    streamOnly = (Kahan*) mwCallocA(nStreams, sizeof(Kahan));
 
-        LB_L(lb) = L(point);
-        LB_B(lb) = B(point);
+    for (i = 0; i < nBlocks; ++i)
+    {
+        blockSums[i].streamOnly = &blockStreamSums[i * nStreams];
+    }
 
-        lbt = lb_trig(lb);
+  #ifdef _OPENMP
+    #pragma omp parallel private(i)
+  #endif
+    {
+        LikelihoodScratch scratch;
+        unsigned int first, last;
 
-        star_prob = likelihood_probability(ap, sc, streams, sg.dx, r_points, qw_r3_N, lbt, rc.gPrime,
-                                           reff_xr_rp3, results, es, &bgProb);
+        scratch.r_points = (real*) mwMallocA(sizeof(real) * ap->convolve);
+        scratch.qw_r3_N = (real*) mwMallocA(sizeof(real) * ap->convolve);
+        scratch.streamTmps = (real*) mwCallocA(nStreams > 0 ? nStreams : 1, sizeof(real));
 
-        if (mw_cmpnzero_muleps(star_prob, SEPARATION_EPS))
+      #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 1)
+      #endif
+        for (i = 0; i < nBlocks; ++i)
         {
-            star_prob = mw_log10(star_prob);
-            KAHAN_ADD(prob, star_prob);
+            first = (unsigned int) i * LIKELIHOOD_BLOCK_SIZE;
+            last = first + LIKELIHOOD_BLOCK_SIZE;
+            if (last > sp->number_stars)
+                last = sp->number_stars;
+
+            likelihood_block(ap, sp, sc, streams, sg, results, &scratch, &blockSums[i],
+                             starBgProbs, starStreamProbs, first, last);
         }
-        else
+
+        mwFreeA(scratch.r_points);
+        mwFreeA(scratch.qw_r3_N);
+        mwFreeA(scratch.streamTmps);
+    }
+
+    for (i = 0; i < nBlocks; ++i)
+    {
+        KAHAN_REDUCTION(prob, blockSums[i].prob);
+        KAHAN_REDUCTION(bgOnly, blockSums[i].bgOnly);
+        for (j = 0; j < nStreams; ++j)
         {
-            ++num_zero;
-            prob.sum -= 238.0;
+            KAHAN_REDUCTION(streamOnly[j], blockSums[i].streamOnly[j]);
         }
+    }
 
-        if (do_separation)
-            separation(f, ap, results, cmatrix, ss, es->streamTmps, bgProb, epsilon_b, point);
+    if (do_separation)
+    {
+        for (current_star_point = 0; current_star_point < sp->number_stars; ++current_star_point)
+        {
+            separation(f, ap, results, cmatrix, ss,
+                       &starStreamProbs[current_star_point * nStreams],
+                       starBgProbs[current_star_point],
+                       epsilon_b,
+                       sp->stars[current_star_point]);
+        }
     }
 
-    calculateLikelihoods(results, &prob, &es->bgSum, es->streamSums,
+    calculateLikelihoods(results, &prob, &bgOnly, streamOnly,
                          sp->number_stars, streams->number_streams, badJacobians);
 
 
     if (do_separation)
         printSeparationStats(ss, sp->number_stars, ap->number_streams);
 
+    mwFreeA(blockSums);
+    mwFreeA(blockStreamSums);
+    mwFreeA(streamOnly);
+    mwFreeA(starBgProbs);
+    mwFreeA(starStreamProbs);
+
     return 0;
 }
 
@@ -359,9 +483,6 @@ int likelihood(SeparationResults* results,
                const int do_separation,
                const char* separation_outfile)
 {
-    real* r_points;
-    real* qw_r3_N;
-    EvaluationState* es;
     StreamStats* ss = NULL;
     FILE* f = NULL;
 
@@ -382,29 +503,17 @@ int likelihood(SeparationResults* results,
         ss = newStreamStats(streams->number_streams);
     }
 
-    /* New state for this sum */
-    es = newEvaluationState(ap);
-
-    r_points = (real*) mwMallocA(sizeof(real) * ap->convolve);
-    qw_r3_N = (real*) mwMallocA(sizeof(real) * ap->convolve);
-
     t1 = mwGetTime();
     rc = likelihood_sum(results,
                         ap, sp, sc, streams,
                         sg,
-                        es,
-                        r_points,
-                        qw_r3_N,
                         do_separation,
                         ss,
                         f);
     t2 = mwGetTime();
     mw_printf("Likelihood time = %f s\n", t2 - t1);
 
-    mwFreeA(r_points);
-    mwFreeA(qw_r3_N);
     mwFreeA(ss);
-    freeEvaluationState(es);
 
     if (f && fclose(f))
         mwPerror("Closing separation output file '%s'", separation_outfile);
@@ -59,42 +59,146 @@
 #include "probabilities.h"
 
 
-static inline mwvector lbr2xyz_2(const AstronomyParameters* ap, real rPoint, LBTrig lbt)
+/* The convolution points are handled in fixed size blocks. Each
+ * coordinate of the points in a block has its own array, so the terms
+ * for one stream can be found for the whole block in loops the
+ * compiler can vectorize. The unused end of the last block has zero
+ * weights. */
+#define PROB_BLOCK 16
+
+typedef struct
 {
-    mwvector xyz;
-
-    xyz.x = mw_mad(rPoint, lbt.lCosBCos, ap->m_sun_r0);
-    xyz.y = rPoint * lbt.lSinBCos;
-    xyz.z = rPoint * lbt.bSin;
-
-    return xyz;
-}
-
-static inline real streamIncrement(const StreamConstants* sc, mwvector xyz)
+    real x[PROB_BLOCK];
+    real y[PROB_BLOCK];
+    real z[PROB_BLOCK];
+    real qw_r3_N[PROB_BLOCK];
+} ConvolveBlock;
+
+#if DOUBLEPREC && !ENABLE_CRLIBM
+
+/* The same factorized polynomial as gmx_mm_exp_pd, written without
+ * intrinsics or library calls so the loop using it vectorizes. Only
+ * for -2^31 < x <= 0, which the stream terms always are. x is rounded
+ * to an integer power of 2 with the 1.5 * 2^52 trick, and the powers
+ * below the smallest normal double are flushed to zero. The exponent
+ * is kept to 32 bits and compared as an integer, since there are no
+ * 64 bit integer compares in SSE2 and a floating point compare isn't
+ * if-converted while math may trap. */
+static inline real blockExp(real x)
 {
-    real xyz_norm, dotted;
-    mwvector xyzs;
+    const real argscale = 1.442695040888963387;
+    const real roundMagic = 6755399441055744.0;
+
+    const real CA0 = 7.0372789822689374920e-9;
+    const real CB0 = 89.491964762085371;
+    const real CB1 = -9.7373870675164587;
+    const real CC0 = 51.247261867992408;
+    const real CC1 = -0.184020268133945;
+    const real CD0 = 36.82070153762337;
+    const real CD1 = 5.416849282638991;
+    const real CE0 = 30.34003452248759;
+    const real CE1 = 8.726173289493301;
+    const real CF0 = 27.73526969472330;
+    const real CF1 = 10.284755658866532;
+
+    real z, rounded, fexppart;
+    real factB, factC, factD, factE, factF;
+    uint64_t bits;
+    int32_t n;
+
+    z = x * argscale;
+    rounded = z + roundMagic;
+    z -= rounded - roundMagic;
+
+    memcpy(&bits, &rounded, sizeof(bits));
+    n = (int32_t) (bits & 0xffffffff);
+    n = (n < -1022) ? -1023 : n;
+    bits = (uint64_t) (uint32_t) (n + 1023) << 52;
+    memcpy(&fexppart, &bits, sizeof(fexppart));
+
+    factB = (z + CB1) * z + CB0;
+    factC = (z + CC1) * z + CC0;
+    factD = (z + CD1) * z + CD0;
+    factE = (z + CE1) * z + CE0;
+    factF = (z + CF1) * z + CF0;
+
+    return CA0 * fexppart * factF * (factB * factC) * (factD * factE);
+}
 
-    xyzs = mw_subv(xyz, sc->c);
-    dotted = mw_dotv(sc->a, xyzs);
-    mw_incsubv_s(xyzs, sc->a, dotted);
+#else
 
-    xyz_norm = mw_sqrv(xyzs);
+/* crlibm builds need the correctly rounded exp for consistent results */
+#define blockExp mw_exp
 
-    return mw_exp(-xyz_norm * sc->sigma_sq2_inv);
-}
+#endif /* DOUBLEPREC && !ENABLE_CRLIBM */
 
 HOT
 static inline void streamSums(real* st_probs,
                               const StreamConstants* sc,
-                              const mwvector xyz,
-                              const real qw_r3_N,
+                              const ConvolveBlock* RESTRICT cb,
                               const unsigned int nstreams)
 {
-    unsigned int i;
+    unsigned int i, j;
+    real xs, ys, zs, dotted;
+    real tmp[PROB_BLOCK];
+
+    for (j = 0; j < nstreams; ++j)
+    {
+        const real ax = X(sc[j].a);
+        const real ay = Y(sc[j].a);
+        const real az = Z(sc[j].a);
+        const real cx = X(sc[j].c);
+        const real cy = Y(sc[j].c);
+        const real cz = Z(sc[j].c);
+        const real negSigma = -sc[j].sigma_sq2_inv;
+
+        for (i = 0; i < PROB_BLOCK; ++i)
+        {
+            xs = cb->x[i] - cx;
+            ys = cb->y[i] - cy;
+            zs = cb->z[i] - cz;
+
+            dotted = ax * xs + ay * ys + az * zs;
+            xs -= ax * dotted;
+            ys -= ay * dotted;
+            zs -= az * dotted;
+
+            tmp[i] = (xs * xs + ys * ys + zs * zs) * negSigma;
+        }
+
+        for (i = 0; i < PROB_BLOCK; ++i)
+            tmp[i] = cb->qw_r3_N[i] * blockExp(tmp[i]);
 
-    for (i = 0; i < nstreams; ++i)
-        st_probs[i] += qw_r3_N * streamIncrement(&sc[i], xyz);
+        /* Added in point order, as if one point was done at a time */
+        for (i = 0; i < PROB_BLOCK; ++i)
+            st_probs[j] += tmp[i];
+    }
+}
+
+/* Fill the block with the points first to first + n */
+static inline void setConvolveBlock(ConvolveBlock* cb,
+                                    const AstronomyParameters* ap,
+                                    const real* RESTRICT r_point,
+                                    const real* RESTRICT qw_r3_N,
+                                    LBTrig lbt,
+                                    int first,
+                                    int n)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+    {
+        cb->x[i] = mw_mad(r_point[first + i], lbt.lCosBCos, ap->m_sun_r0);
+        cb->y[i] = r_point[first + i] * lbt.lSinBCos;
+        cb->z[i] = r_point[first + i] * lbt.bSin;
+        cb->qw_r3_N[i] = qw_r3_N[first + i];
+    }
+
+    for (; i < PROB_BLOCK; ++i)
+    {
+        cb->x[i] = cb->y[i] = cb->z[i] = 0.0;
+        cb->qw_r3_N[i] = 0.0;
+    }
 }
 
 HOT
@@ -112,15 +216,15 @@ static inline real h_prob_slow(const AstronomyParameters* ap, real qw_r3_N, real
 }
 
 HOT
-static inline real rg_calc(const AstronomyParameters* ap, const mwvector xyz)
+static inline real rg_calc(const AstronomyParameters* ap, real x, real y, real z)
 {
     /* sqrt(x^2 + y^2 + q_inv_sqr * z^2) */
 
     real tmp;
 
-    tmp = sqr(X(xyz));
-    tmp = mw_mad(Y(xyz), Y(xyz), tmp);               /* x^2 + y^2 */
-    tmp = mw_mad(ap->q_inv_sqr, sqr(Z(xyz)), tmp);   /* (q_invsqr * z^2) + (x^2 + y^2) */
+    tmp = sqr(x);
+    tmp = mw_mad(y, y, tmp);                  /* x^2 + y^2 */
+    tmp = mw_mad(ap->q_inv_sqr, sqr(z), tmp); /* (q_invsqr * z^2) + (x^2 + y^2) */
 
     return mw_sqrt(tmp);
 }
@@ -151,30 +255,35 @@ real probabilities_fast_hprob(const AstronomyParameters* ap,
                               real reff_xr_rp3,
                               real* RESTRICT streamTmps)
 {
-    int i;
+    int i, j, n;
     real h_prob, g, rg;
-    mwvector xyz;
+    ConvolveBlock cb;
     real bg_prob = 0.0;
     int convolve = ap->convolve;
     int aux_bg_profile = ap->aux_bg_profile;
 
     zero_st_probs(streamTmps, ap->number_streams);
-    for (i = 0; i < convolve; ++i)
+    for (i = 0; i < convolve; i += PROB_BLOCK)
     {
-        xyz = lbr2xyz_2(ap, r_point[i], lbt);
-        rg = rg_calc(ap, xyz);
+        n = MIN(PROB_BLOCK, convolve - i);
+        setConvolveBlock(&cb, ap, r_point, qw_r3_N, lbt, i, n);
 
-        h_prob = h_prob_fast(ap, qw_r3_N[i], rg);
-
-        /* Add a quadratic term in g to the the Hernquist profile */
-        if (aux_bg_profile)
+        for (j = 0; j < n; ++j)
         {
-            g = gPrime + sg_dx[i];
-            h_prob += aux_prob(ap, qw_r3_N[i], g);
+            rg = rg_calc(ap, cb.x[j], cb.y[j], cb.z[j]);
+            h_prob = h_prob_fast(ap, cb.qw_r3_N[j], rg);
+
+            /* Add a quadratic term in g to the the Hernquist profile */
+            if (aux_bg_profile)
+            {
+                g = gPrime + sg_dx[i + j];
+                h_prob += aux_prob(ap, cb.qw_r3_N[j], g);
+            }
+
+            bg_prob += h_prob;
         }
 
-        bg_prob += h_prob;
-        streamSums(streamTmps, sc, xyz, qw_r3_N[i], ap->number_streams);
+        streamSums(streamTmps, sc, &cb, ap->number_streams);
     }
 
     bg_prob *= reff_xr_rp3;
@@ -195,29 +304,33 @@ real probabilities_slow_hprob(const AstronomyParameters* ap,
                               real reff_xr_rp3,
                               real* RESTRICT streamTmps)
 {
-    int i;
+    int i, j, n;
     real rg, g;
-    mwvector xyz;
+    ConvolveBlock cb;
     real bg_prob = 0.0;
     int convolve = ap->convolve;
     int aux_bg_profile = ap->aux_bg_profile;
 
     zero_st_probs(streamTmps, ap->number_streams);
 
-    for (i = 0; i < convolve; ++i)
+    for (i = 0; i < convolve; i += PROB_BLOCK)
     {
-        xyz = lbr2xyz_2(ap, r_point[i], lbt);
-
-        rg = rg_calc(ap, xyz);
+        n = MIN(PROB_BLOCK, convolve - i);
+        setConvolveBlock(&cb, ap, r_point, qw_r3_N, lbt, i, n);
 
-        bg_prob += h_prob_slow(ap, qw_r3_N[i], rg);
-        if (aux_bg_profile)
+        for (j = 0; j < n; ++j)
         {
-            g = gPrime + sg_dx[i];
-            bg_prob += aux_prob(ap, qw_r3_N[i], g);
+            rg = rg_calc(ap, cb.x[j], cb.y[j], cb.z[j]);
+
+            bg_prob += h_prob_slow(ap, cb.qw_r3_N[j], rg);
+            if (aux_bg_profile)
+            {
+                g = gPrime + sg_dx[i + j];
+                bg_prob += aux_prob(ap, cb.qw_r3_N[j], g);
+            }
         }
 
-        streamSums(streamTmps, sc, xyz, qw_r3_N[i], ap->number_streams);
+        streamSums(streamTmps, sc, &cb, ap->number_streams);
     }
 
     bg_prob *= reff_xr_rp3;
@@ -0,0 +1,410 @@
+/*
+ *  Copyright (c) 2008-2010 Travis Desell, Nathan Cole
+ *  Copyright (c) 2008-2010 Boleslaw Szymanski, Heidi Newberg
+ *  Copyright (c) 2008-2010 Carlos Varela, Malik Magdon-Ismail
+ *  Copyright (c) 2008-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *  Copyright (c) 1991-2000 University of Groningen, The Netherlands
+ *  Copyright (c) 2001-2009 The GROMACS Development Team
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *  This file incorporates work covered by the following copyright and
+ *  permission notice:
+ *
+ *    Fast exp(x) computation (with SSE2 optimizations).
+ *
+ *  Copyright (c) 2010, Naoaki Okazaki
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the names of the authors nor the names of its contributors
+ *        may be used to endorse or promote products derived from this
+ *        software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ *  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* This is built twice, once with AVX2 and FMA and once with AVX-512F.
+ *
+ * The integral uses the row functions, where a vector holds the same
+ * convolution point of consecutive r_steps. The likelihood has a
+ * single r_step per star, so there a vector holds consecutive
+ * convolution points. The last, partial vector is loaded with a mask,
+ * which gives its unused lanes a zero weight, so convolve doesn't need
+ * to be a multiple of the width. */
+
+#if !defined(__AVX2__) || !defined(__FMA__)
+  #error AVX2 and FMA not defined
+#endif
+
+#include "milkyway_util.h"
+#include "probabilities.h"
+#include "probabilities_intrin.h"
+
+
+#ifdef __AVX512F__
+
+#define VW 8
+
+typedef __m512d vd;
+typedef __m512i vi;
+typedef __mmask8 vmask;
+
+#define v_set1     _mm512_set1_pd
+#define v_zero     _mm512_setzero_pd
+#define v_add      _mm512_add_pd
+#define v_sub      _mm512_sub_pd
+#define v_mul      _mm512_mul_pd
+#define v_div      _mm512_div_pd
+#define v_fma      _mm512_fmadd_pd
+#define v_fms      _mm512_fmsub_pd
+#define v_fnma     _mm512_fnmadd_pd
+#define v_sqrt     _mm512_sqrt_pd
+#define v_loadu    _mm512_loadu_pd
+#define v_storeu   _mm512_storeu_pd
+#define v_hsum     _mm512_reduce_add_pd
+
+static inline vmask v_tail_mask(int n)
+{
+    return (vmask) ((1u << n) - 1);
+}
+
+static inline vd v_load_tail(const double* p, vmask m)
+{
+    return _mm512_maskz_loadu_pd(m, p);
+}
+
+/* 2^intpart with the lanes below arglimit flushed to zero */
+static inline vd v_exp2_int(vd x, vd z, vd* intpart)
+{
+    const vd arglimit = v_set1(-1022.0 / 1.442695040888963387);
+    const vi expbase = _mm512_set1_epi64(1023);
+    vi iexppart;
+
+    *intpart = _mm512_roundscale_pd(z, _MM_FROUND_TO_NEAREST_INT);
+    iexppart = _mm512_cvtepi32_epi64(_mm512_cvtpd_epi32(*intpart));
+    iexppart = _mm512_slli_epi64(_mm512_add_epi64(iexppart, expbase), 52);
+
+    return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(x, arglimit, _CMP_GT_OQ), _mm512_castsi512_pd(iexppart));
+}
+
+#else
+
+#define VW 4
+
+typedef __m256d vd;
+typedef __m256i vi;
+typedef __m256i vmask;
+
+#define v_set1     _mm256_set1_pd
+#define v_zero     _mm256_setzero_pd
+#define v_add      _mm256_add_pd
+#define v_sub      _mm256_sub_pd
+#define v_mul      _mm256_mul_pd
+#define v_div      _mm256_div_pd
+#define v_fma      _mm256_fmadd_pd
+#define v_fms      _mm256_fmsub_pd
+#define v_fnma     _mm256_fnmadd_pd
+#define v_sqrt     _mm256_sqrt_pd
+#define v_loadu    _mm256_loadu_pd
+#define v_storeu   _mm256_storeu_pd
+
+static inline vmask v_tail_mask(int n)
+{
+    return _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), _mm256_set_epi64x(3, 2, 1, 0));
+}
+
+static inline vd v_load_tail(const double* p, vmask m)
+{
+    return _mm256_maskload_pd(p, m);
+}
+
+static inline double v_hsum(vd x)
+{
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+
+    s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+    return _mm_cvtsd_f64(s);
+}
+
+static inline vd v_exp2_int(vd x, vd z, vd* intpart)
+{
+    const vd arglimit = v_set1(-1022.0 / 1.442695040888963387);
+    const vi expbase = _mm256_set1_epi64x(1023);
+    vi iexppart;
+
+    *intpart = _mm256_round_pd(z, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    iexppart = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(*intpart));
+    iexppart = _mm256_slli_epi64(_mm256_add_epi64(iexppart, expbase), 52);
+
+    return _mm256_and_pd(_mm256_cmp_pd(x, arglimit, _CMP_GT_OQ), _mm256_castsi256_pd(iexppart));
+}
+
+#endif /* __AVX512F__ */
+
+
+/* The same factorized polynomial as gmx_mm_exp_pd, with each factor
+ * (C0 + C1*z + z^2) as a single FMA */
+static inline vd fma_exp_pd(vd x)
+{
+    const vd argscale = v_set1(1.442695040888963387);
+
+    const vd CA0 = v_set1(7.0372789822689374920e-9);
+    const vd CB0 = v_set1(89.491964762085371);
+    const vd CB1 = v_set1(-9.7373870675164587);
+    const vd CC0 = v_set1(51.247261867992408);
+    const vd CC1 = v_set1(-0.184020268133945);
+    const vd CD0 = v_set1(36.82070153762337);
+    const vd CD1 = v_set1(5.416849282638991);
+    const vd CE0 = v_set1(30.34003452248759);
+    const vd CE1 = v_set1(8.726173289493301);
+    const vd CF0 = v_set1(27.73526969472330);
+    const vd CF1 = v_set1(10.284755658866532);
+
+    vd z, intpart, fexppart;
+    vd factB, factC, factD, factE, factF;
+
+    z = v_mul(x, argscale);
+    fexppart = v_exp2_int(x, z, &intpart);
+    z = v_sub(z, intpart);
+
+    factB = v_fma(v_add(z, CB1), z, CB0);
+    factC = v_fma(v_add(z, CC1), z, CC0);
+    factD = v_fma(v_add(z, CD1), z, CD0);
+    factE = v_fma(v_add(z, CE1), z, CE0);
+    factF = v_fma(v_add(z, CF1), z, CF0);
+
+    z = v_mul(v_mul(CA0, fexppart), factF);
+    factB = v_mul(factB, factC);
+    factD = v_mul(factD, factE);
+
+    return v_mul(z, v_mul(factB, factD));
+}
+
+static inline void loadConvolvePoints(const real* RESTRICT r_point,
+                                      const real* RESTRICT qw_r3_N,
+                                      int i,
+                                      int nFull,
+                                      vmask tail,
+                                      vd* RI,
+                                      vd* QI)
+{
+    if (i < nFull)
+    {
+        *RI = v_loadu(&r_point[i]);
+        *QI = v_loadu(&qw_r3_N[i]);
+    }
+    else
+    {
+        *RI = v_load_tail(&r_point[i], tail);
+        *QI = v_load_tail(&qw_r3_N[i], tail);
+    }
+}
+
+static real probabilities_fma(const AstronomyParameters* ap,
+                              const StreamConstants* sc,
+                              const real* RESTRICT sg_dx,
+                              const real* RESTRICT r_point,
+                              const real* RESTRICT qw_r3_N,
+                              LBTrig lbt,
+                              real gPrime,
+                              real reff_xr_rp3,
+                              real* RESTRICT streamTmps)
+{
+    int i, j;
+    const int convolve = ap->convolve;
+    const int nStreams = ap->number_streams;
+    const int nFull = convolve - convolve % VW;
+    const vmask tail = v_tail_mask(convolve - nFull);
+
+    const vd COSBL    = v_set1(lbt.lCosBCos);
+    const vd SINB     = v_set1(lbt.bSin);
+    const vd SINCOSBL = v_set1(lbt.lSinBCos);
+    const vd SUNR0    = v_set1(ap->sun_r0);
+    const vd R0       = v_set1(ap->r0);
+    const vd QV_RECIP = v_set1(ap->q_inv);
+
+    vd RI, QI, x, y, z, rg, rs, bg, st, dotted;
+
+    (void) gPrime, (void) sg_dx;
+
+    bg = v_zero();
+    for (i = 0; i < convolve; i += VW)
+    {
+        loadConvolvePoints(r_point, qw_r3_N, i, nFull, tail, &RI, &QI);
+
+        x = v_fms(RI, COSBL, SUNR0);
+        y = v_mul(RI, SINCOSBL);
+        z = v_mul(v_mul(RI, SINB), QV_RECIP);
+
+        rg = v_sqrt(v_fma(x, x, v_fma(y, y, v_mul(z, z))));
+        rs = v_add(rg, R0);
+
+        bg = v_add(bg, v_div(QI, v_mul(rg, v_mul(rs, v_mul(rs, rs)))));
+    }
+
+    for (j = 0; j < nStreams; ++j)
+    {
+        const vd AX = v_set1(X(sc[j].a));
+        const vd AY = v_set1(Y(sc[j].a));
+        const vd AZ = v_set1(Z(sc[j].a));
+        const vd CX = v_set1(X(sc[j].c));
+        const vd CY = v_set1(Y(sc[j].c));
+        const vd CZ = v_set1(Z(sc[j].c));
+        const vd NEG_SIGMA = v_set1(-sc[j].sigma_sq2_inv);
+
+        /* The points are cheaper to recalculate than to store */
+        st = v_zero();
+        for (i = 0; i < convolve; i += VW)
+        {
+            loadConvolvePoints(r_point, qw_r3_N, i, nFull, tail, &RI, &QI);
+
+            x = v_sub(v_fms(RI, COSBL, SUNR0), CX);
+            y = v_fms(RI, SINCOSBL, CY);
+            z = v_fms(RI, SINB, CZ);
+
+            dotted = v_fma(AX, x, v_fma(AY, y, v_mul(AZ, z)));
+            x = v_fnma(dotted, AX, x);
+            y = v_fnma(dotted, AY, y);
+            z = v_fnma(dotted, AZ, z);
+
+            st = v_fma(QI, fma_exp_pd(v_mul(v_fma(x, x, v_fma(y, y, v_mul(z, z))), NEG_SIGMA)), st);
+        }
+
+        streamTmps[j] = v_hsum(st) * reff_xr_rp3;
+    }
+
+    return v_hsum(bg) * reff_xr_rp3;
+}
+
+static inline vd rowBackgroundTerm(vd RI, vd QI, vd COSBL, vd SINB, vd SINCOSBL, vd SUNR0, vd R0, vd QV_RECIP)
+{
+    vd x, y, z, rg, rs;
+
+    x = v_fms(RI, COSBL, SUNR0);
+    y = v_mul(RI, SINCOSBL);
+    z = v_mul(v_mul(RI, SINB), QV_RECIP);
+
+    rg = v_sqrt(v_fma(x, x, v_fma(y, y, v_mul(z, z))));
+    rs = v_add(rg, R0);
+
+    return v_div(QI, v_mul(rg, v_mul(rs, v_mul(rs, rs))));
+}
+
+static inline vd rowStreamTerm(vd RI, vd QI, vd COSBL, vd SINB, vd SINCOSBL, vd SUNR0,
+                               vd AX, vd AY, vd AZ, vd CX, vd CY, vd CZ, vd NEG_SIGMA)
+{
+    vd x, y, z, dotted;
+
+    x = v_sub(v_fms(RI, COSBL, SUNR0), CX);
+    y = v_fms(RI, SINCOSBL, CY);
+    z = v_fms(RI, SINB, CZ);
+
+    dotted = v_fma(AX, x, v_fma(AY, y, v_mul(AZ, z)));
+    x = v_fnma(dotted, AX, x);
+    y = v_fnma(dotted, AY, y);
+    z = v_fnma(dotted, AZ, z);
+
+    return v_mul(QI, fma_exp_pd(v_mul(v_fma(x, x, v_fma(y, y, v_mul(z, z))), NEG_SIGMA)));
+}
+
+/* A vector holds VW r_steps, so there is no partial vector or
+ * horizontal sum. convolve is always even, so two points are done per
+ * iteration to keep two sums going. */
+static void probabilityRow_fma(const AstronomyParameters* ap,
+                               const StreamConstants* sc,
+                               const real* RESTRICT rPoints,
+                               const real* RESTRICT qw_r3_N,
+                               LBTrig lbt,
+                               real* RESTRICT sums)
+{
+    int i;
+    const int convolve = ap->convolve;
+
+    const vd COSBL    = v_set1(lbt.lCosBCos);
+    const vd SINB     = v_set1(lbt.bSin);
+    const vd SINCOSBL = v_set1(lbt.lSinBCos);
+    const vd SUNR0    = v_set1(ap->sun_r0);
+
+    vd sum0 = v_zero();
+    vd sum1 = v_zero();
+
+    if (!sc)
+    {
+        const vd R0       = v_set1(ap->r0);
+        const vd QV_RECIP = v_set1(ap->q_inv);
+
+        for (i = 0; i < convolve; i += 2)
+        {
+            sum0 = v_add(sum0, rowBackgroundTerm(v_loadu(&rPoints[i * VW]), v_loadu(&qw_r3_N[i * VW]),
+                                                 COSBL, SINB, SINCOSBL, SUNR0, R0, QV_RECIP));
+            sum1 = v_add(sum1, rowBackgroundTerm(v_loadu(&rPoints[(i + 1) * VW]), v_loadu(&qw_r3_N[(i + 1) * VW]),
+                                                 COSBL, SINB, SINCOSBL, SUNR0, R0, QV_RECIP));
+        }
+    }
+    else
+    {
+        const vd AX = v_set1(X(sc->a));
+        const vd AY = v_set1(Y(sc->a));
+        const vd AZ = v_set1(Z(sc->a));
+        const vd CX = v_set1(X(sc->c));
+        const vd CY = v_set1(Y(sc->c));
+        const vd CZ = v_set1(Z(sc->c));
+        const vd NEG_SIGMA = v_set1(-sc->sigma_sq2_inv);
+
+        for (i = 0; i < convolve; i += 2)
+        {
+            sum0 = v_add(sum0, rowStreamTerm(v_loadu(&rPoints[i * VW]), v_loadu(&qw_r3_N[i * VW]),
+                                             COSBL, SINB, SINCOSBL, SUNR0,
+                                             AX, AY, AZ, CX, CY, CZ, NEG_SIGMA));
+            sum1 = v_add(sum1, rowStreamTerm(v_loadu(&rPoints[(i + 1) * VW]), v_loadu(&qw_r3_N[(i + 1) * VW]),
+                                             COSBL, SINB, SINCOSBL, SUNR0,
+                                             AX, AY, AZ, CX, CY, CZ, NEG_SIGMA));
+        }
+    }
+
+    v_storeu(sums, v_add(sum0, sum1));
+}
+
+ProbabilityFunc INIT_PROBABILITIES(void)
+{
+    return probabilities_fma;
+}
+
+ProbabilityRowFunc INIT_PROBABILITY_ROWS(int* width)
+{
+    *width = VW;
+    return probabilityRow_fma;
+}
+
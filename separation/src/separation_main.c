@@ -29,6 +29,10 @@
 #include "io_util.h"
 #include <popt.h>
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif /* _OPENMP */
+
 
 #define DEFAULT_ASTRONOMY_PARAMETERS "astronomy_parameters.txt"
 #define DEFAULT_STAR_POINTS "stars.txt"
@@ -145,6 +149,9 @@ static void freeSeparationFlags(SeparationFlags* sf)
     free(sf->star_points_file);
     free(sf->ap_file);
     free(sf->separation_outfile);
+    free(sf->batch_parameters_file);
+    free(sf->binary_star_points_file);
+    free(sf->geometryCacheDir);
     free(sf->forwardedArgs);
     free(sf->numArgs);
     free(sf->preferredPlatformVendor);
@@ -165,6 +172,8 @@ static void setCLReqFlags(CLRequest* clr, const SeparationFlags* sf)
     clr->forceSSE3 = sf->forceSSE3;
     clr->forceSSE41 = sf->forceSSE41;
     clr->forceAVX = sf->forceAVX;
+    clr->forceAVX2 = sf->forceAVX2;
+    clr->forceAVX512 = sf->forceAVX512;
     clr->verbose = sf->verbose;
     clr->nonResponsive = sf->nonResponsive;
     clr->enableCheckpointing = !sf->disableGPUCheckpointing;
@@ -180,6 +189,11 @@ static void setCLReqFlags(CLRequest* clr, const SeparationFlags* sf)
     clr->forceNoILKernel = sf->forceNoILKernel;
     clr->forceNoOpenCL = sf->forceNoOpenCL;
 
+    /* Only the CPU integration is adaptive */
+    clr->integralTolerance = sf->integralTolerance;
+    if (clr->integralTolerance > 0.0)
+        clr->forceNoOpenCL = TRUE;
+
     clr->enableProfiling = FALSE;
 }
 
@@ -344,6 +358,36 @@ static int parseParameters(int argc, const char** argv, SeparationFlags* sfOut)
                 0, "Output file for separation (enables separation)", NULL
             },
 
+            {
+                "batch-parameters", '\0',
+                POPT_ARG_STRING, &sf.batch_parameters_file,
+                0, "Evaluate each line of fit parameters in file ('-' for stdin), printing one result line per set", NULL
+            },
+
+            {
+                "geometry-cache", '\0',
+                POPT_ARG_NONE, &sf.geometryCache,
+                0, "Keep the parameter independent integral geometry between evaluations", NULL
+            },
+
+            {
+                "geometry-cache-dir", '\0',
+                POPT_ARG_STRING, &sf.geometryCacheDir,
+                0, "Save and load the integral geometry in this directory (implies --geometry-cache)", NULL
+            },
+
+            {
+                "integral-tolerance", '\0',
+                POPT_ARG_DOUBLE, &sf.integralTolerance,
+                0, "Integrate adaptively to this relative error instead of over every cell of the grid (CPU only)", NULL
+            },
+
+            {
+                "convert-star-points", '\0',
+                POPT_ARG_STRING, &sf.binary_star_points_file,
+                0, "Write the star points file in the binary format to the given file and exit", NULL
+            },
+
             {
                 "seed", 'e',
                 POPT_ARG_INT, &sf.separationSeed,
@@ -410,6 +454,12 @@ static int parseParameters(int argc, const char** argv, SeparationFlags* sfOut)
                 0, "Disable checkpointing with GPUs" , NULL
             },
 
+            {
+                "nthreads", 'n',
+                POPT_ARG_INT, &sf.nThreads,
+                0, "BOINC argument for number of threads. No effect if built without OpenMP", NULL
+            },
+
             {
                 "platform", 'l',
                 POPT_ARG_INT, &sf.usePlatform,
@@ -476,6 +526,18 @@ static int parseParameters(int argc, const char** argv, SeparationFlags* sfOut)
                 0, "Force to use AVX path", NULL
             },
 
+            {
+                "force-avx2", '\0',
+                POPT_ARG_NONE, &sf.forceAVX2,
+                0, "Force to use AVX2 and FMA path", NULL
+            },
+
+            {
+                "force-avx512", '\0',
+                POPT_ARG_NONE, &sf.forceAVX512,
+                0, "Force to use AVX-512 path", NULL
+            },
+
             {
                 "p", 'p',
                 POPT_ARG_NONE, &serverParams,
@@ -592,6 +654,24 @@ static IntegralArea* prepareParameters(const SeparationFlags* sf,
     return ias;
 }
 
+static int convertStarPoints(const SeparationFlags* sf)
+{
+    int rc;
+    StarPoints sp = EMPTY_STAR_POINTS;
+
+    rc = readStarPoints(&sp, sf->star_points_file);
+    if (!rc)
+    {
+        rc = writeStarPointsBinary(&sp, sf->binary_star_points_file);
+        if (!rc)
+            mw_printf("Wrote %u star points to '%s'\n", sp.number_stars, sf->binary_star_points_file);
+    }
+
+    freeStarPoints(&sp);
+
+    return rc;
+}
+
 static int worker(const SeparationFlags* sf)
 {
     AstronomyParameters ap;
@@ -611,6 +691,17 @@ static int worker(const SeparationFlags* sf)
     if (!ias)
         return 1;
 
+    if (sf->batch_parameters_file)
+    {
+        rc = evaluateBatch(&ap, &bgp, &streams, ias, sf->star_points_file, &clr, sf->batch_parameters_file);
+        if (rc)
+            mw_printf("Failed to evaluate batch parameters\n");
+
+        mwFreeA(ias);
+        freeStreams(&streams);
+        return rc;
+    }
+
     rc = setAstronomyParameters(&ap, &bgp);
     if (rc)
     {
@@ -646,11 +737,47 @@ static int worker(const SeparationFlags* sf)
     return rc;
 }
 
+static int separationSetNumThreads(int numThreads)
+{
+  #ifdef _OPENMP
+    int nProc = omp_get_num_procs();
+    int nBoinc = mwGetBoincNumCPU();
+
+    if (nProc <= 0)
+    {
+        mw_printf("Number of processors %d is crazy\n", nProc);
+        return 1;
+    }
+
+    /* If command line argument not given, and BOINC gives us a value use that */
+    if (numThreads <= 0 && nBoinc > 0)
+    {
+        numThreads = nBoinc;
+    }
+
+    if (numThreads != 0)
+    {
+        omp_set_num_threads(numThreads);
+        mw_printf("Using OpenMP %d max threads on a system with %d processors\n",
+                  omp_get_max_threads(),
+                  nProc);
+    }
+  #else
+    (void) numThreads;
+  #endif /* _OPENMP */
+
+    return 0;
+}
+
 static int separationInit(int debugBOINC)
 {
     int rc;
     MWInitType initType = MW_PLAIN;
 
+  #ifdef _OPENMP
+    initType |= MW_MULTITHREAD;
+  #endif
+
   #if DISABLE_DENORMALS
     mwDisableDenormalsSSE();
   #endif
@@ -728,8 +855,25 @@ int main(int argc, const char* argv[])
         mwSetProcessPriority(sf.processPriority);
     }
 
+    if (separationSetNumThreads(sf.nThreads))
+    {
+        freeSeparationFlags(&sf);
+        mw_finish(EXIT_FAILURE);
+    }
+
+    if (sf.binary_star_points_file)
+    {
+        rc = convertStarPoints(&sf);
+        freeSeparationFlags(&sf);
+        mw_finish(rc);
+        return rc;
+    }
+
+    separationSetGeometryCache(sf.geometryCache, sf.geometryCacheDir);
+
     rc = worker(&sf);
 
+    freeGeometryCaches();
     freeSeparationFlags(&sf);
 
     if (!sf.ignoreCheckpoint && sf.cleanupCheckpoint && rc == 0)
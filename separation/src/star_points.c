@@ -24,6 +24,29 @@
 #include "star_points.h"
 #include "milkyway_util.h"
 
+#if HAVE_SYS_MMAN_H
+  #include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_TYPES_H
+  #include <sys/types.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+  #include <sys/stat.h>
+#endif
+
+#include <limits.h>
+
+#if HAVE_SYS_MMAN_H && !defined(_WIN32)
+  #define STAR_POINTS_USE_MMAP 1
+#else
+  #define STAR_POINTS_USE_MMAP 0
+#endif
+
+static const size_t starPointsBinaryStarSize = 4 * sizeof(double);
+
+
 static int freadStarPoints(FILE* data_file, StarPoints* sp)
 {
     double x, y, z;
@@ -50,26 +73,243 @@ static int freadStarPoints(FILE* data_file, StarPoints* sp)
     return 0;
 }
 
+static int isStarPointsBinaryHeader(const StarPointsBinaryHeader* hdr)
+{
+    return !memcmp(hdr->magic, STAR_POINTS_BINARY_MAGIC, sizeof(hdr->magic));
+}
+
+static int starPointsFileSize(FILE* f, uint64_t* sizeOut)
+{
+#if HAVE_SYS_STAT_H && !defined(_WIN32)
+    struct stat st;
+
+    if (fstat(fileno(f), &st))
+    {
+        mwPerror("Failed to stat star points file");
+        return 1;
+    }
+
+    *sizeOut = (uint64_t) st.st_size;
+#else
+    long pos = ftell(f);
+    long end;
+
+    if (fseek(f, 0, SEEK_END) || (end = ftell(f)) < 0 || fseek(f, pos, SEEK_SET))
+    {
+        mwPerror("Failed to find size of star points file");
+        return 1;
+    }
+
+    *sizeOut = (uint64_t) end;
+#endif
+
+    return 0;
+}
+
+static int verifyStarPointsBinaryHeader(const StarPointsBinaryHeader* hdr, uint64_t fileSize)
+{
+    uint64_t expectedSize;
+
+    if (hdr->version != STAR_POINTS_BINARY_VERSION)
+    {
+        mw_printf("Unsupported binary star points version %u (expected %u)\n",
+                  hdr->version, STAR_POINTS_BINARY_VERSION);
+        return 1;
+    }
+
+    if (hdr->realSize != sizeof(double) || hdr->starSize != starPointsBinaryStarSize)
+    {
+        mw_printf("Binary star points file has unexpected sizes (real = %u, star = %u)\n",
+                  hdr->realSize, hdr->starSize);
+        return 1;
+    }
+
+    if (hdr->numberStars > UINT_MAX)
+    {
+        mw_printf("Too many stars in binary star points file (%llu)\n",
+                  (unsigned long long) hdr->numberStars);
+        return 1;
+    }
+
+    expectedSize = sizeof(StarPointsBinaryHeader) + hdr->numberStars * hdr->starSize;
+    if (fileSize != expectedSize)
+    {
+        mw_printf("Binary star points file size %llu does not match expected size %llu\n",
+                  (unsigned long long) fileSize,
+                  (unsigned long long) expectedSize);
+        return 1;
+    }
+
+    return 0;
+}
+
+#if STAR_POINTS_USE_MMAP && DOUBLEPREC
+
+/* The stored points have the same layout as mwvector, so the file
+ * can be used directly. The mapping is private so nothing can be
+ * written back to the file. */
+static int mapStarPointsBinary(FILE* f, StarPoints* sp, size_t fileSize)
+{
+    void* p;
+
+    p = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+    if (p == MAP_FAILED)
+    {
+        mwPerror("Failed to map binary star points file");
+        return 1;
+    }
+
+    sp->mapping = p;
+    sp->mappingSize = fileSize;
+    sp->stars = (mwvector*) ((char*) p + sizeof(StarPointsBinaryHeader));
+
+    return 0;
+}
+
+#endif /* STAR_POINTS_USE_MMAP && DOUBLEPREC */
+
+static int freadStarPointsBinaryData(FILE* f, StarPoints* sp)
+{
+    unsigned int i;
+    double pt[4];
+
+    sp->stars = (mwvector*) mwMallocA(sizeof(mwvector) * sp->number_stars);
+    for (i = 0; i < sp->number_stars; ++i)
+    {
+        if (fread(pt, sizeof(pt), 1, f) != 1)
+        {
+            mwPerror("Failed to read binary star points item %u", i);
+            return 1;
+        }
+
+        SET_VECTOR(sp->stars[i], (real) pt[0], (real) pt[1], (real) pt[2]);
+        W(sp->stars[i]) = 0.0;
+    }
+
+    return 0;
+}
+
+static int freadStarPointsBinary(FILE* f, const StarPointsBinaryHeader* hdr, StarPoints* sp)
+{
+    uint64_t fileSize;
+
+    if (starPointsFileSize(f, &fileSize) || verifyStarPointsBinaryHeader(hdr, fileSize))
+        return 1;
+
+    sp->number_stars = (unsigned int) hdr->numberStars;
+
+  #if STAR_POINTS_USE_MMAP && DOUBLEPREC
+    if (sizeof(mwvector) == starPointsBinaryStarSize && fileSize <= (uint64_t) SIZE_MAX)
+    {
+        if (!mapStarPointsBinary(f, sp, (size_t) fileSize))
+            return 0;
+
+        mw_printf("Falling back to reading binary star points file\n");
+    }
+  #endif
+
+    return freadStarPointsBinaryData(f, sp);
+}
+
+/* Read star points from either the text or the binary format, which
+ * is detected from the magic at the start of the file */
 int readStarPoints(StarPoints* sp, const char* filename)
 {
     int rc;
     FILE* f;
+    StarPointsBinaryHeader hdr;
 
-    f = mwOpenResolved(filename, "r");
+    f = mwOpenResolved(filename, "rb");
     if (!f)
     {
         mwPerror("Opening star points file '%s'", filename);
         return 1;
     }
 
-    rc = freadStarPoints(f, sp);
+    memset(&hdr, 0, sizeof(hdr));
+    if (fread(&hdr, sizeof(hdr), 1, f) == 1 && isStarPointsBinaryHeader(&hdr))
+    {
+        rc = freadStarPointsBinary(f, &hdr, sp);
+    }
+    else
+    {
+        rewind(f);
+        rc = freadStarPoints(f, sp);
+    }
+
     fclose(f);
 
     return rc;
 }
 
+int writeStarPointsBinary(const StarPoints* sp, const char* filename)
+{
+    FILE* f;
+    unsigned int i;
+    double pt[4];
+    StarPointsBinaryHeader hdr;
+
+    f = mwOpenResolved(filename, "wb");
+    if (!f)
+    {
+        mwPerror("Opening binary star points file '%s'", filename);
+        return 1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, STAR_POINTS_BINARY_MAGIC, sizeof(hdr.magic));
+    hdr.version = STAR_POINTS_BINARY_VERSION;
+    hdr.realSize = (uint32_t) sizeof(double);
+    hdr.numberStars = (uint64_t) sp->number_stars;
+    hdr.starSize = (uint32_t) starPointsBinaryStarSize;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+    {
+        mwPerror("Failed to write binary star points header");
+        fclose(f);
+        return 1;
+    }
+
+    for (i = 0; i < sp->number_stars; ++i)
+    {
+        pt[0] = (double) X(sp->stars[i]);
+        pt[1] = (double) Y(sp->stars[i]);
+        pt[2] = (double) Z(sp->stars[i]);
+        pt[3] = 0.0;
+
+        if (fwrite(pt, sizeof(pt), 1, f) != 1)
+        {
+            mwPerror("Failed to write binary star points item %u", i);
+            fclose(f);
+            return 1;
+        }
+    }
+
+    if (fclose(f))
+    {
+        mwPerror("Failed to close binary star points file '%s'", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
 void freeStarPoints(StarPoints* sp)
 {
+  #if STAR_POINTS_USE_MMAP
+    if (sp->mapping)
+    {
+        if (munmap(sp->mapping, sp->mappingSize))
+            mwPerror("Failed to unmap star points file");
+
+        sp->mapping = NULL;
+        sp->mappingSize = 0;
+        sp->stars = NULL;
+        return;
+    }
+  #endif
+
     mwFreeA(sp->stars);
+    sp->stars = NULL;
 }
 
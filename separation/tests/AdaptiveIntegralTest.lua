@@ -0,0 +1,68 @@
+--
+-- Copyright (C) 2011 Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- The adaptive integral should agree with the full grid to within the
+-- requested tolerance on a smooth case, using fewer columns to do it.
+
+argv = {...}
+
+binName = argv[1]
+testDir = argv[2]
+
+assert(binName, "Binary name not set")
+assert(testDir, "Test directory not set")
+
+local tolerance = 1.0e-3
+
+local function readProcess(bin, ...)
+   local cmd = table.concat({ bin, table.concat({...}, " "), "2>&1" }, " ")
+   local f = assert(io.popen(cmd, "r"))
+   local s = assert(f:read('*a'))
+   f:close()
+   return s
+end
+
+local function runIntegral(...)
+   local output = readProcess(binName,
+                              "-i",
+                              "-a", testDir .. "/astronomy_parameters-82-small.txt",
+                              "-s", testDir .. "/stars-82-small.txt",
+                              ...)
+   local bg = output:match("<background_integral>%s*(%S+)%s*</background_integral>")
+   local stream = output:match("<stream_integral>%s*(%S+)%s*</stream_integral>")
+   local used, total = output:match("Adaptive integral: (%d+) columns of (%d+)")
+
+   assert(bg and stream, "Integrals missing from output:\n" .. output)
+   return tonumber(bg), tonumber(stream), tonumber(used), tonumber(total)
+end
+
+local function relativeDifference(a, b)
+   return math.abs(a - b) / math.abs(b)
+end
+
+local bg, stream = runIntegral()
+local adaptiveBg, adaptiveStream, used, total = runIntegral("--integral-tolerance", tolerance)
+
+assert(used and total, "Adaptive integration wasn't used")
+assert(used < total, string.format("Adaptive integral used %d columns of %d", used, total))
+
+assert(relativeDifference(adaptiveBg, bg) < tolerance,
+       string.format("Adaptive background integral %.15g differs from %.15g", adaptiveBg, bg))
+assert(relativeDifference(adaptiveStream, stream) < tolerance,
+       string.format("Adaptive stream integral %.15g differs from %.15g", adaptiveStream, stream))
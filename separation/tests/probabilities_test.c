@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2011 Matthew Arsenault
+ * Copyright (c) 2011 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compare each of the intrinsic probability functions this CPU can
+ * run against the plain fast_hprob one at random integral points,
+ * and fast_hprob against slow_hprob for the alpha = delta = 1 case
+ * where they should be the same. The row functions, which do several
+ * r_steps at once, are compared against fast_hprob for each r_step. */
+
+#include "separation.h"
+#include "probabilities.h"
+#include "probabilities_dispatch.h"
+#include "dSFMT.h"
+
+#define N_TEST_STREAMS 3
+#define N_TEST_POINTS 500
+
+/* Relative to the size of the reference. The stream terms can be
+ * arbitrarily small far from the stream, so there is also a floor
+ * relative to the largest stream term seen at the point. */
+#define PROB_TOLERANCE 1.0e-12
+
+typedef struct
+{
+    const char* name;
+    int* force;
+} TestPath;
+
+static dsfmt_t _prng;
+
+
+static void setTestParameters(AstronomyParameters* ap, StreamConstants* sc, int convolve)
+{
+    int i;
+    BackgroundParameters bgp = EMPTY_BACKGROUND_PARAMETERS;
+
+    memset(ap, 0, sizeof(*ap));
+    ap->convolve = convolve;
+    ap->number_streams = N_TEST_STREAMS;
+    ap->wedge = 82;
+
+    bgp.q = mwXrandom(&_prng, 0.4, 1.0);
+    bgp.r0 = mwXrandom(&_prng, 2.0, 20.0);
+
+    if (setAstronomyParameters(ap, &bgp))
+        mw_panic("Failed to set test astronomy parameters\n");
+
+    for (i = 0; i < N_TEST_STREAMS; ++i)
+    {
+        sc[i].a = mwRandomUnitVector(&_prng);
+        sc[i].c = mwRandomVector(&_prng, mwXrandom(&_prng, 1.0, 40.0));
+        sc[i].sigma_sq2_inv = 1.0 / (2.0 * sqr(mwXrandom(&_prng, 0.5, 8.0)));
+        sc[i].large_sigma = TRUE;
+    }
+}
+
+static LBTrig randomLBTrig(void)
+{
+    LB lb;
+
+    LB_L(lb) = mwXrandom(&_prng, 0.0, 360.0);
+    LB_B(lb) = mwXrandom(&_prng, -90.0, 90.0);
+
+    return lb_trig(lb);
+}
+
+static int closeEnough(real a, real ref, real scale)
+{
+    return mw_fabs(a - ref) <= PROB_TOLERANCE * mw_fmax(mw_fabs(ref), scale);
+}
+
+/* Returns the number of points which differ */
+static int compareProbabilityFunc(const char* name,
+                                  ProbabilityFunc f,
+                                  ProbabilityFunc ref,
+                                  const AstronomyParameters* ap,
+                                  const StreamConstants* sc,
+                                  const StreamGauss sg)
+{
+    int i, j, fails = 0;
+    real gPrime, reff_xr_rp3, bg, bgRef, scale;
+    LBTrig lbt;
+    MW_ALIGN_V(64) real rPoints[MAX_CONVOLVE];
+    MW_ALIGN_V(64) real qw_r3_N[MAX_CONVOLVE];
+    real st[N_TEST_STREAMS], stRef[N_TEST_STREAMS];
+
+    for (i = 0; i < N_TEST_POINTS; ++i)
+    {
+        gPrime = mwXrandom(&_prng, 16.0, 23.5);
+        reff_xr_rp3 = mwXrandom(&_prng, 0.1, 10.0);
+        lbt = randomLBTrig();
+        setSplitRPoints(ap, sg, ap->convolve, gPrime, rPoints, qw_r3_N);
+
+        bg = f(ap, sc, sg.dx, rPoints, qw_r3_N, lbt, gPrime, reff_xr_rp3, st);
+        bgRef = ref(ap, sc, sg.dx, rPoints, qw_r3_N, lbt, gPrime, reff_xr_rp3, stRef);
+
+        if (!closeEnough(bg, bgRef, 0.0))
+        {
+            mw_printf("%s: background probability differs at point %d (convolve %d): %.17g vs. %.17g\n",
+                      name, i, ap->convolve, bg, bgRef);
+            ++fails;
+        }
+
+        scale = 0.0;
+        for (j = 0; j < N_TEST_STREAMS; ++j)
+            scale = mw_fmax(scale, mw_fabs(stRef[j]));
+
+        for (j = 0; j < N_TEST_STREAMS; ++j)
+        {
+            if (!closeEnough(st[j], stRef[j], scale))
+            {
+                mw_printf("%s: stream %d probability differs at point %d (convolve %d): %.17g vs. %.17g\n",
+                          name, j, i, ap->convolve, st[j], stRef[j]);
+                ++fails;
+            }
+        }
+    }
+
+    return fails;
+}
+
+/* Returns the number of points which differ */
+static int compareProbabilityRowFunc(const char* name,
+                                     ProbabilityRowFunc f,
+                                     int width,
+                                     const AstronomyParameters* ap,
+                                     const StreamConstants* sc,
+                                     const StreamGauss sg)
+{
+    int i, j, k, l, fails = 0;
+    real gPrime, scale;
+    LBTrig lbt;
+    MW_ALIGN_V(64) real rPoints[PROBABILITY_ROW_MAX_WIDTH][MAX_CONVOLVE];
+    MW_ALIGN_V(64) real qw_r3_N[PROBABILITY_ROW_MAX_WIDTH][MAX_CONVOLVE];
+    MW_ALIGN_V(64) real rRow[PROBABILITY_ROW_MAX_WIDTH * MAX_CONVOLVE];
+    MW_ALIGN_V(64) real qwRow[PROBABILITY_ROW_MAX_WIDTH * MAX_CONVOLVE];
+    real bg[PROBABILITY_ROW_MAX_WIDTH], bgRef[PROBABILITY_ROW_MAX_WIDTH];
+    real st[N_TEST_STREAMS][PROBABILITY_ROW_MAX_WIDTH];
+    real stRef[PROBABILITY_ROW_MAX_WIDTH][N_TEST_STREAMS];
+
+    for (i = 0; i < N_TEST_POINTS / width; ++i)
+    {
+        lbt = randomLBTrig();
+
+        for (l = 0; l < width; ++l)
+        {
+            gPrime = mwXrandom(&_prng, 16.0, 23.5);
+            setSplitRPoints(ap, sg, ap->convolve, gPrime, rPoints[l], qw_r3_N[l]);
+
+            for (k = 0; k < ap->convolve; ++k)
+            {
+                rRow[k * width + l] = rPoints[l][k];
+                qwRow[k * width + l] = qw_r3_N[l][k];
+            }
+
+            bgRef[l] = probabilities_fast_hprob(ap, sc, sg.dx, rPoints[l], qw_r3_N[l], lbt, gPrime, 1.0, stRef[l]);
+        }
+
+        f(ap, NULL, rRow, qwRow, lbt, bg);
+        for (j = 0; j < N_TEST_STREAMS; ++j)
+            f(ap, &sc[j], rRow, qwRow, lbt, st[j]);
+
+        for (l = 0; l < width; ++l)
+        {
+            if (!closeEnough(bg[l], bgRef[l], 0.0))
+            {
+                mw_printf("%s rows: background probability differs at point %d, lane %d (convolve %d): %.17g vs. %.17g\n",
+                          name, i, l, ap->convolve, bg[l], bgRef[l]);
+                ++fails;
+            }
+
+            scale = 0.0;
+            for (j = 0; j < N_TEST_STREAMS; ++j)
+                scale = mw_fmax(scale, mw_fabs(stRef[l][j]));
+
+            for (j = 0; j < N_TEST_STREAMS; ++j)
+            {
+                if (!closeEnough(st[j][l], stRef[l][j], scale))
+                {
+                    mw_printf("%s rows: stream %d probability differs at point %d, lane %d (convolve %d): %.17g vs. %.17g\n",
+                              name, j, i, l, ap->convolve, st[j][l], stRef[l][j]);
+                    ++fails;
+                }
+            }
+        }
+    }
+
+    return fails;
+}
+
+static int testConvolve(int convolve)
+{
+    unsigned int i;
+    int fails = 0;
+    AstronomyParameters ap;
+    MW_ALIGN_V(64) StreamConstants sc[N_TEST_STREAMS];
+    StreamGauss sg;
+    CLRequest clr;
+    TestPath paths[] =
+        {
+            { "SSE2",    &clr.forceSSE2   },
+            { "SSE3",    &clr.forceSSE3   },
+            { "SSE4.1",  &clr.forceSSE41  },
+            { "AVX",     &clr.forceAVX    },
+            { "AVX2",    &clr.forceAVX2   },
+            { "AVX-512", &clr.forceAVX512 }
+        };
+
+    setTestParameters(&ap, sc, convolve);
+    sg = getStreamGauss(convolve);
+
+    fails += compareProbabilityFunc("slow_hprob", probabilities_slow_hprob, probabilities_fast_hprob, &ap, sc, sg);
+
+    for (i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i)
+    {
+        memset(&clr, 0, sizeof(clr));
+        *paths[i].force = TRUE;
+
+        /* Skips the paths this CPU or build doesn't have */
+        if (probabilityFunctionDispatch(&ap, &clr) || probabilityFunc == probabilities_fast_hprob)
+            continue;
+
+        fails += compareProbabilityFunc(paths[i].name, probabilityFunc, probabilities_fast_hprob, &ap, sc, sg);
+
+        if (probabilityRowFunc)
+        {
+            fails += compareProbabilityRowFunc(paths[i].name, probabilityRowFunc, probabilityRowWidth, &ap, sc, sg);
+        }
+    }
+
+    freeStreamGauss(sg);
+
+    return fails;
+}
+
+int main(int argc, const char* argv[])
+{
+    unsigned int i;
+    int fails = 0;
+    static const int convolves[] = { 2, 30, 64, 120, 126, 140, 256 };
+
+    (void) argc, (void) argv;
+
+    dsfmt_init_gen_rand(&_prng, 1234);
+
+    for (i = 0; i < sizeof(convolves) / sizeof(convolves[0]); ++i)
+    {
+        fails += testConvolve(convolves[i]);
+    }
+
+    if (fails != 0)
+    {
+        mw_printf("%d probability comparisons failed\n", fails);
+    }
+
+    return fails != 0;
+}
+